@@ -22,6 +22,7 @@ void setup(){
     myM3LS.bindButton(9, M3LS::InvertZ);
     myM3LS.bindButton(10, M3LS::InvertS);
     myM3LS.bindButton(11, M3LS::CenterAxes);
+    myM3LS.bindButton(12, M3LS::Stop);
 
     // You can also set initial conditions directly
     myM3LS.setRefreshRate(40);
@@ -0,0 +1,22 @@
+#include "M3LS.h"
+#include "M3LSServer.h"
+
+// Select which pins will be used for the X, Y, and Z axis
+int xpin = A3; int ypin = A2; int zpin = A0;
+
+// Initialize the library with your three selected pins
+M3LS myM3LS(xpin, ypin, zpin);
+
+// Accept commands from a host over the native USB port
+M3LSServer myServer(myM3LS, SerialUSB);
+
+void setup(){
+    // Run the library's setup routine
+    myM3LS.begin();
+    SerialUSB.begin(115200);
+}
+
+void loop(){
+    // Answer host frames and play back uploaded trajectories
+    myServer.poll();
+}
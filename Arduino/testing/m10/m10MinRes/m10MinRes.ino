@@ -6,6 +6,11 @@ int step = 127;
 
 M3LS myM3LS(xpin, ypin, zpin);
 
+// Wait for the tested axes to arrive within 1 count, for at most 3 seconds
+void settle(M3LS::Axes axis){
+    myM3LS.waitForSettle(M3LS::axisMask(axis), 1, 3000);
+}
+
 void setup(){
     // Initialize M3LS
     myM3LS.begin();
@@ -21,18 +26,18 @@ void loop(){
         while (step < 137){
             step++;
             myM3LS.updatePosition(step, step, step, axisList[axisNum]);
-            delay(1000);
+            settle(axisList[axisNum]);
         }
         
         // Step backwards ten times
         while (step > 127){
             step--;
             myM3LS.updatePosition(step, step, step, axisList[axisNum]);
-            delay(1000);
+            settle(axisList[axisNum]);
         }
 
         // Recenter axis
         myM3LS.updatePosition(127, 127, 127, axisList[axisNum]);
-        delay(3000);
+        settle(axisList[axisNum]);
     }
 }
@@ -5,6 +5,11 @@ M3LS::Axes axisList[3] = {M3LS::X, M3LS::Y, M3LS::XY};
 
 M3LS myM3LS(xpin, ypin, zpin);
 
+// Wait for the tested axes to arrive within 5 counts, for at most 3 seconds
+void settle(M3LS::Axes axis){
+    myM3LS.waitForSettle(M3LS::axisMask(axis), 5, 3000);
+}
+
 void setup(){
     // Initialize M3LS
     myM3LS.begin();
@@ -17,12 +22,12 @@ void loop(){
         // Iterate over three trials
         for (int trial = 0; trial < 3; trial++){
             myM3LS.updatePosition(0, 0, 0, axisList[axisNum]);
-            delay(3000);
+            settle(axisList[axisNum]);
             myM3LS.updatePosition(255, 255, 255, axisList[axisNum]);
-            delay(3000);
+            settle(axisList[axisNum]);
         }
         // Recenter axis
         myM3LS.updatePosition(127, 127, 127, axisList[axisNum]);
-        delay(3000);
+        settle(axisList[axisNum]);
     }
 }
@@ -0,0 +1,458 @@
+/*
+M3LSClient.cc - Linux host client for the M3LS binary serial protocol
+Copyright info?
+*/
+
+#include "M3LSClient.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+// Consecutive timeouts without progress before a request is given up
+#define M3LS_CLIENT_RETRIES 5
+
+// Wait before sending a window the device refused for lack of space again, in
+// milliseconds. It doubles with each refusal in a row, up to the timeout.
+#define M3LS_CLIENT_FULL_BACKOFF_MS 2
+
+// Monotonic time in milliseconds
+static long long nowMillis(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Maps a numeric baud rate onto its termios constant
+static speed_t baudConstant(int baud){
+    switch(baud){
+        case 9600   :   return B9600;
+        case 19200  :   return B19200;
+        case 38400  :   return B38400;
+        case 57600  :   return B57600;
+        case 230400 :   return B230400;
+        case 460800 :   return B460800;
+        case 921600 :   return B921600;
+        default     :   return B115200;
+    }
+}
+
+M3LSClient::M3LSClient(){
+    fd = -1;
+    ownsFd = false;
+    window = M3LS_PROTOCOL_WINDOW;
+    timeout = 200;
+    nextSeq = 0;
+    retransmits = 0;
+    timeouts = 0;
+    lastProgress = 0;
+    failed = false;
+    rewound = false;
+    fullBackoff = 0;
+    resendAt = 0;
+    telemetryStarted = false;
+    telemetrySeq = 0;
+    telemetryDropped = 0;
+    telemetryLostFrames = 0;
+}
+
+M3LSClient::~M3LSClient(){
+    close();
+}
+
+// ---------------------------------------------------------------------------
+// Connection
+// Opens a serial device in raw mode
+bool M3LSClient::open(const char *device, int baud){
+    close();
+    int descriptor = ::open(device, O_RDWR | O_NOCTTY);
+    if (descriptor < 0){ return false; }
+
+    struct termios tio;
+    if (tcgetattr(descriptor, &tio) == 0){
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, baudConstant(baud));
+        cfsetospeed(&tio, baudConstant(baud));
+        tcsetattr(descriptor, TCSANOW, &tio);
+    }
+    attach(descriptor);
+    ownsFd = true;
+    return true;
+}
+
+// Uses an already open descriptor, such as the master end of a pty
+void M3LSClient::attach(int descriptor){
+    close();
+    fd = descriptor;
+    ownsFd = false;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    decoder.reset();
+    inFlight.clear();
+    failed = false;
+    rewound = false;
+    fullBackoff = 0;
+    resendAt = 0;
+    timeouts = 0;
+}
+
+void M3LSClient::close(){
+    if (fd >= 0 && ownsFd){ ::close(fd); }
+    fd = -1;
+    ownsFd = false;
+    inFlight.clear();
+}
+
+// Sets the number of frames allowed in flight, at most the device's window
+void M3LSClient::setWindow(int frames){
+    window = frames < 1 ? 1 : frames;
+    if (window > M3LS_PROTOCOL_WINDOW){ window = M3LS_PROTOCOL_WINDOW; }
+}
+
+// Sets how long to wait for a reply before sending frames again
+void M3LSClient::setTimeout(int milliseconds){
+    timeout = milliseconds;
+}
+
+// ---------------------------------------------------------------------------
+// Asynchronous interface
+// Sends a request once the window has room; `done` runs when it is answered
+bool M3LSClient::submit(uint8_t type, const uint8_t *payload, int length,
+    Callback done){
+    if (fd < 0 || length > M3LS_MAX_PAYLOAD){ return false; }
+    while ((int)inFlight.size() >= window){
+        if (!pump(timeout)){ return false; }
+    }
+
+    Request request;
+    request.seq = nextSeq++;
+    request.type = type;
+    request.payload.assign(payload, payload + length);
+    request.done = done;
+    if (inFlight.empty()){ lastProgress = nowMillis(); }
+    inFlight.push_back(request);
+    return transmit(inFlight.back());
+}
+
+// Processes replies for up to `milliseconds`, returns false on failure
+bool M3LSClient::pump(int milliseconds){
+    if (failed || fd < 0){ return false; }
+
+    // Wake up in time to resend a refused window
+    if (resendAt){
+        long long wait = resendAt - nowMillis();
+        if (wait < milliseconds){ milliseconds = wait < 0 ? 0 : wait; }
+    }
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, milliseconds) > 0){
+        uint8_t buf[512];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0){
+            for (ssize_t i = 0; i < n; i++){
+                if (decoder.push(buf[i])){
+                    handleReply(decoder.getFrame());
+                }
+            }
+        }
+    }
+
+    // The device had no room for the oldest request: try again once the
+    // backoff is over
+    if (resendAt && nowMillis() >= resendAt){
+        resendAt = 0;
+        rewound = false;
+        lastProgress = nowMillis();
+        if (!retransmitAll()){ return false; }
+    }
+
+    // Nothing heard back in time: go back to the oldest request
+    if (!inFlight.empty() && nowMillis() - lastProgress > timeout){
+        if (timeouts++ >= M3LS_CLIENT_RETRIES){
+            failed = true;
+            return false;
+        }
+        lastProgress = nowMillis();
+        if (!retransmitAll()){ return false; }
+    }
+    return !failed;
+}
+
+// Waits until every request has been answered
+bool M3LSClient::flush(){
+    while (!inFlight.empty()){
+        if (!pump(timeout)){ return false; }
+    }
+    return true;
+}
+
+int M3LSClient::getInFlight(){
+    return inFlight.size();
+}
+
+unsigned long M3LSClient::getRetransmitCount(){
+    return retransmits;
+}
+
+// ---------------------------------------------------------------------------
+// Blocking conveniences
+// Restarts the device's sequence window at this client's sequence number
+bool M3LSClient::sync(){
+    bool ok = false;
+    submit(M3LSProtocol::Sync, NULL, 0,
+        [&ok](uint8_t status, const M3LSFrame&){
+            ok = status == M3LSProtocol::statusOk;
+        });
+    return flush() && ok;
+}
+
+bool M3LSClient::getStatus(M3LSStatus *status){
+    bool ok = false;
+    submit(M3LSProtocol::GetStatus, NULL, 0,
+        [&ok, status](uint8_t, const M3LSFrame& reply){
+            ok = parseStatus(reply, status);
+        });
+    return flush() && ok;
+}
+
+bool M3LSClient::setMode(uint8_t mode){
+    bool ok = false;
+    submit(M3LSProtocol::SetMode, &mode, 1,
+        [&ok](uint8_t status, const M3LSFrame&){
+            ok = status != M3LSProtocol::statusBadRequest;
+        });
+    return flush() && ok;
+}
+
+bool M3LSClient::move(int32_t x, int32_t y, int32_t z){
+    uint8_t payload[4 * M3LS_PROTOCOL_AXES];
+    M3LSProtocol::putI32(x, payload);
+    M3LSProtocol::putI32(y, payload + 4);
+    M3LSProtocol::putI32(z, payload + 8);
+    return submit(M3LSProtocol::Move, payload, sizeof(payload), Callback()) &&
+        flush();
+}
+
+bool M3LSClient::start(uint16_t interval){
+    uint8_t payload[2];
+    M3LSProtocol::putU16(interval, payload);
+    return submit(M3LSProtocol::Start, payload, 2, Callback()) && flush();
+}
+
+bool M3LSClient::stop(){
+    return submit(M3LSProtocol::Stop, NULL, 0, Callback()) && flush();
+}
+
+// Keeps the window full of waypoint batches, sized to the space the device
+// last reported so that batches are rarely refused
+bool M3LSClient::uploadTrajectory(const int32_t (*points)[M3LS_PROTOCOL_AXES],
+    int count){
+    int sent = 0;
+    int room = 0;
+    int unacked = 0;
+    bool known = false;
+    Callback track = [&](uint8_t status, const M3LSFrame& reply){
+        if (reply.length >= 4){
+            room = M3LSProtocol::getU16(reply.payload + 2);
+            known = true;
+        }
+        (void)status;
+    };
+
+    // Learn how much space the device has before the first batch
+    if (!submit(M3LSProtocol::GetStatus, NULL, 0, track) || !flush()){
+        return false;
+    }
+
+    while (sent < count){
+        int credit = known ? room - unacked : 0;
+        if (credit <= 0){
+            if (!pump(1)){ return false; }
+            if (inFlight.empty()){
+                // Let playback free some space, then ask again
+                if (!submit(M3LSProtocol::GetStatus, NULL, 0, track) ||
+                    !flush()){
+                    return false;
+                }
+            }
+            continue;
+        }
+
+        uint8_t payload[M3LS_MAX_PAYLOAD];
+        int encoded;
+        int length = M3LSProtocol::encodeWaypoints(points + sent,
+            count - sent < credit ? count - sent : credit,
+            M3LS_PROTOCOL_AXES, payload, M3LS_MAX_PAYLOAD, &encoded);
+        unacked += encoded;
+        bool ok = submit(M3LSProtocol::Waypoints, payload, length,
+            [&, encoded](uint8_t status, const M3LSFrame& reply){
+                unacked -= encoded;
+                track(status, reply);
+            });
+        if (!ok){ return false; }
+        sent += encoded;
+    }
+    return flush();
+}
+
+// Requests status samples back to back and hands each one to `sample`
+bool M3LSClient::streamStatus(int count,
+    std::function<void(const M3LSStatus&)> sample){
+    for (int i = 0; i < count; i++){
+        bool ok = submit(M3LSProtocol::GetStatus, NULL, 0,
+            [sample](uint8_t, const M3LSFrame& reply){
+                M3LSStatus status;
+                if (parseStatus(reply, &status)){ sample(status); }
+            });
+        if (!ok){ return false; }
+    }
+    return flush();
+}
+
+// Starts or stops the device's telemetry stream. The handler is installed
+// before the request goes out, so no early sample is missed.
+bool M3LSClient::streamTelemetry(uint32_t interval, TelemetryHandler handler){
+    if (interval){
+        telemetry = handler;
+        telemetryStarted = false;
+    }
+    uint8_t payload[4];
+    M3LSProtocol::putI32((int32_t)interval, payload);
+    bool ok = false;
+    submit(M3LSProtocol::StreamTelemetry, payload, 4,
+        [&ok](uint8_t status, const M3LSFrame&){
+            ok = status == M3LSProtocol::statusOk;
+        });
+    ok = flush() && ok;
+    // Samples flushed by the device before it acknowledged a stop have been
+    // delivered by now
+    if (!interval){ telemetry = TelemetryHandler(); }
+    return ok;
+}
+
+// Returns the number of samples the device dropped because the link could not
+// keep up
+unsigned long M3LSClient::getTelemetryDropped(){
+    return telemetryDropped;
+}
+
+// Returns the number of telemetry frames lost or corrupted on the way
+unsigned long M3LSClient::getTelemetryLostFrames(){
+    return telemetryLostFrames;
+}
+
+// Unpacks the payload of a status reply
+bool M3LSClient::parseStatus(const M3LSFrame& frame, M3LSStatus *status){
+    if (frame.type != M3LSProtocol::Status ||
+        frame.length < 9 + 4 * M3LS_PROTOCOL_AXES){
+        return false;
+    }
+    status->freeWaypoints = M3LSProtocol::getU16(frame.payload + 2);
+    status->mode = frame.payload[4];
+    status->numAxes = frame.payload[5];
+    status->queued = M3LSProtocol::getU16(frame.payload + 6);
+    status->playing = frame.payload[8];
+    for (int axis = 0; axis < M3LS_PROTOCOL_AXES; axis++){
+        status->position[axis] = M3LSProtocol::getI32(frame.payload + 9 +
+            4 * axis);
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Private Functions
+// Writes one request to the device
+bool M3LSClient::transmit(const Request& request){
+    uint8_t frame[M3LS_MAX_FRAME];
+    int length = M3LSProtocol::encodeFrame(request.seq, request.type,
+        request.payload.empty() ? NULL : &request.payload[0],
+        request.payload.size(), frame);
+    int sent = 0;
+    while (sent < length){
+        ssize_t n = write(fd, frame + sent, length - sent);
+        if (n < 0 && errno != EAGAIN){ return false; }
+        if (n < 0){
+            struct pollfd pfd;
+            pfd.fd = fd;
+            pfd.events = POLLOUT;
+            poll(&pfd, 1, timeout);
+            continue;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+// Sends every request in flight again, oldest first
+bool M3LSClient::retransmitAll(){
+    retransmits++;
+    for (size_t i = 0; i < inFlight.size(); i++){
+        if (!transmit(inFlight[i])){ return false; }
+    }
+    return true;
+}
+
+// Matches a reply with the oldest request. The device executes frames in
+// order, so a refusal of the oldest frame, or a report that it never
+// arrived, sends the whole window again from there. A refusal for lack of
+// space waits out a backoff first, so the device has time to free some.
+void M3LSClient::handleReply(const M3LSFrame& frame){
+    if (frame.type == M3LSProtocol::Telemetry){
+        handleTelemetry(frame);
+        return;
+    }
+    if (inFlight.empty() || frame.length < 4){ return; }
+    Request& oldest = inFlight.front();
+    uint8_t status = frame.payload[0];
+
+    if (status == M3LSProtocol::statusFull && frame.seq == oldest.seq){
+        if (resendAt){ return; }
+        rewound = true;
+        fullBackoff = fullBackoff ? fullBackoff * 2 :
+            M3LS_CLIENT_FULL_BACKOFF_MS;
+        if (fullBackoff > timeout){ fullBackoff = timeout; }
+        resendAt = nowMillis() + fullBackoff;
+        lastProgress = nowMillis();
+        return;
+    }
+    if (status == M3LSProtocol::statusOutOfOrder){
+        // Every frame behind a lost one is refused; rewind only once
+        if (frame.payload[1] == oldest.seq && !rewound){
+            rewound = true;
+            retransmitAll();
+        }
+        return;
+    }
+    if (frame.seq != oldest.seq){ return; }
+
+    Callback done = oldest.done;
+    inFlight.pop_front();
+    lastProgress = nowMillis();
+    timeouts = 0;
+    rewound = false;
+    fullBackoff = 0;
+    if (done){ done(status, frame); }
+}
+
+// Decodes a telemetry frame and hands its samples to the handler, counting
+// the frames missing from the sequence since the last one
+void M3LSClient::handleTelemetry(const M3LSFrame& frame){
+    M3LSTelemetrySample samples[255];
+    uint32_t dropped;
+    int count = M3LSProtocol::decodeTelemetry(frame.payload, frame.length,
+        samples, 255, &dropped);
+    if (count < 0){ return; }
+
+    if (telemetryStarted){
+        telemetryLostFrames += (uint8_t)(frame.seq - telemetrySeq);
+    }
+    telemetryStarted = true;
+    telemetrySeq = frame.seq + 1;
+    telemetryDropped += dropped;
+    if (!telemetry){ return; }
+    for (int sample = 0; sample < count; sample++){
+        telemetry(samples[sample]);
+    }
+}
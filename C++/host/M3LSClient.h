@@ -0,0 +1,110 @@
+/*
+M3LSClient.h - Linux host client for the M3LS binary serial protocol
+Copyright info?
+*/
+
+#ifndef M3LSClient_h
+#define M3LSClient_h
+
+#include "M3LSProtocol.h"
+#include <deque>
+#include <functional>
+#include <stdint.h>
+#include <vector>
+
+// Device state reported by a status request
+struct M3LSStatus {
+    uint8_t mode;
+    uint8_t numAxes;
+    uint16_t queued;
+    uint16_t freeWaypoints;
+    bool playing;
+    int32_t position[M3LS_PROTOCOL_AXES];
+};
+
+// Talks to an M3LSServer over a serial device. Requests are pipelined: up to
+// the configured window of frames is in flight, and each completes through
+// its callback when the device acknowledges it. Lost, refused or out of
+// order frames are sent again from the oldest unacknowledged one, after a
+// backoff if the device refused it for lack of space.
+class M3LSClient {
+    public:
+        typedef std::function<void(uint8_t status, const M3LSFrame& reply)>
+            Callback;
+        typedef std::function<void(const M3LSTelemetrySample& sample)>
+            TelemetryHandler;
+
+        M3LSClient();
+        ~M3LSClient();
+
+        // Connection
+        bool open(const char *device, int baud);
+        void attach(int fd);
+        void close();
+        void setWindow(int frames);
+        void setTimeout(int milliseconds);
+
+        // Asynchronous interface
+        bool submit(uint8_t type, const uint8_t *payload, int length,
+            Callback done);
+        bool pump(int milliseconds);
+        bool flush();
+        int getInFlight();
+        unsigned long getRetransmitCount();
+
+        // Blocking conveniences built on the asynchronous interface
+        bool sync();
+        bool getStatus(M3LSStatus *status);
+        bool setMode(uint8_t mode);
+        bool move(int32_t x, int32_t y, int32_t z);
+        bool start(uint16_t interval);
+        bool stop();
+
+        // Streams a trajectory, keeping the window full of waypoint batches
+        bool uploadTrajectory(const int32_t (*points)[M3LS_PROTOCOL_AXES],
+            int count);
+        // Streams `count` status samples back to back
+        bool streamStatus(int count,
+            std::function<void(const M3LSStatus&)> sample);
+        // Has the device sample every `interval` us, 0 to stop. Samples reach
+        // `handler` as their frames arrive while the client is pumped.
+        bool streamTelemetry(uint32_t interval, TelemetryHandler handler);
+        unsigned long getTelemetryDropped();
+        unsigned long getTelemetryLostFrames();
+
+        static bool parseStatus(const M3LSFrame& frame, M3LSStatus *status);
+
+    private:
+        struct Request {
+            uint8_t seq;
+            uint8_t type;
+            std::vector<uint8_t> payload;
+            Callback done;
+        };
+        int fd;
+        bool ownsFd;
+        int window;
+        int timeout;
+        uint8_t nextSeq;
+        std::deque<Request> inFlight;
+        M3LSFrameDecoder decoder;
+        unsigned long retransmits;
+        int timeouts;
+        long long lastProgress;
+        bool failed;
+        bool rewound;
+        int fullBackoff;
+        long long resendAt;
+        TelemetryHandler telemetry;
+        bool telemetryStarted;
+        uint8_t telemetrySeq;
+        unsigned long telemetryDropped;
+        unsigned long telemetryLostFrames;
+
+        bool transmit(const Request& request);
+        bool retransmitAll();
+        void handleReply(const M3LSFrame& frame);
+        void handleTelemetry(const M3LSFrame& frame);
+};
+
+#endif
@@ -0,0 +1,161 @@
+/*
+m3lsctl.cc - Command line front end for the M3LS host client
+Copyright info?
+*/
+
+#include "M3LSClient.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+static const char *modeNames[] = {"hold", "open", "position", "velocity"};
+
+static void usage(){
+    fprintf(stderr,
+        "usage: m3lsctl [-d device] [-b baud] [-w window] command [args]\n"
+        "commands:\n"
+        "    status                   print mode, queue and positions\n"
+        "    mode hold|open|position|velocity\n"
+        "    move X Y Z               move to absolute encoder counts\n"
+        "    play FILE [INTERVAL]     upload \"X Y Z\" lines and play them\n"
+        "    stop                     stop playback and clear the queue\n"
+        "    watch [COUNT]            stream status samples\n"
+        "    record INTERVAL [COUNT]  stream telemetry sampled every INTERVAL"
+        " us\n");
+}
+
+static void printStatus(const M3LSStatus& status){
+    printf("%s %d %d %d queued=%d free=%d%s\n",
+        status.mode < 4 ? modeNames[status.mode] : "?",
+        status.position[0], status.position[1], status.position[2],
+        status.queued, status.freeWaypoints,
+        status.playing ? " playing" : "");
+}
+
+// Prints a telemetry sample as one tab separated line: time, mode, radius,
+// joystick X Y Z, buttons, then position, error and status of each axis
+static void printSample(const M3LSTelemetrySample& sample){
+    printf("%u\t%s\t%d\t%d\t%d\t%d\t%d", sample.time,
+        sample.mode < 4 ? modeNames[sample.mode] : "?", sample.radius,
+        sample.joystick[0], sample.joystick[1], sample.joystick[2],
+        sample.buttons);
+    for (int axis = 0; axis < M3LS_PROTOCOL_AXES; axis++){
+        printf("\t%d\t%d\t%d", sample.position[axis], sample.error[axis],
+            sample.status[axis]);
+    }
+    printf("\n");
+}
+
+// Reads whitespace separated X Y Z triples
+static bool readTrajectory(const char *path,
+    std::vector<int32_t>& coordinates){
+    FILE *file = fopen(path, "r");
+    if (!file){ return false; }
+    long x, y, z;
+    while (fscanf(file, "%ld %ld %ld", &x, &y, &z) == 3){
+        coordinates.push_back(x);
+        coordinates.push_back(y);
+        coordinates.push_back(z);
+    }
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char **argv){
+    const char *device = "/dev/ttyACM0";
+    int baud = 115200;
+    int window = M3LS_PROTOCOL_WINDOW;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:b:w:")) != -1){
+        switch(opt){
+            case 'd' :  device = optarg;
+                        break;
+            case 'b' :  baud = atoi(optarg);
+                        break;
+            case 'w' :  window = atoi(optarg);
+                        break;
+            default  :  usage();
+                        return 2;
+        }
+    }
+    if (optind >= argc){
+        usage();
+        return 2;
+    }
+    const char *command = argv[optind];
+    int nargs = argc - optind - 1;
+    char **args = argv + optind + 1;
+
+    M3LSClient client;
+    client.setWindow(window);
+    if (!client.open(device, baud)){
+        perror(device);
+        return 1;
+    }
+    if (!client.sync()){
+        fprintf(stderr, "%s: no answer from the device\n", device);
+        return 1;
+    }
+
+    bool ok = false;
+    M3LSStatus status;
+    if (!strcmp(command, "status")){
+        ok = client.getStatus(&status);
+        if (ok){ printStatus(status); }
+    } else if (!strcmp(command, "mode") && nargs == 1){
+        for (uint8_t mode = 0; mode < 4; mode++){
+            if (!strcmp(args[0], modeNames[mode])){
+                ok = client.setMode(mode);
+            }
+        }
+    } else if (!strcmp(command, "move") && nargs == 3){
+        ok = client.move(atol(args[0]), atol(args[1]), atol(args[2]));
+    } else if (!strcmp(command, "play") && nargs >= 1){
+        std::vector<int32_t> coordinates;
+        if (!readTrajectory(args[0], coordinates)){
+            perror(args[0]);
+            return 1;
+        }
+        ok = client.start(nargs > 1 ? atoi(args[1]) : 20) &&
+            client.uploadTrajectory(
+                (const int32_t (*)[M3LS_PROTOCOL_AXES])&coordinates[0],
+                coordinates.size() / M3LS_PROTOCOL_AXES);
+    } else if (!strcmp(command, "stop")){
+        ok = client.stop();
+    } else if (!strcmp(command, "watch")){
+        ok = client.streamStatus(nargs > 0 ? atoi(args[0]) : 1000,
+            printStatus);
+    } else if (!strcmp(command, "record") && nargs >= 1){
+        long remaining = nargs > 1 ? atol(args[1]) : 1000;
+        ok = client.streamTelemetry(atol(args[0]),
+            [&remaining](const M3LSTelemetrySample& sample){
+                if (remaining > 0){ printSample(sample); }
+                remaining--;
+            });
+        // Give up after about a second without a sample
+        int idle = 0;
+        while (ok && remaining > 0 && idle < 10){
+            long before = remaining;
+            ok = client.pump(100);
+            idle = remaining == before ? idle + 1 : 0;
+        }
+        ok = client.streamTelemetry(0, M3LSClient::TelemetryHandler()) &&
+            ok && remaining <= 0;
+        if (client.getTelemetryDropped() || client.getTelemetryLostFrames()){
+            fprintf(stderr, "%lu samples dropped, %lu frames lost\n",
+                client.getTelemetryDropped(),
+                client.getTelemetryLostFrames());
+        }
+    } else {
+        usage();
+        return 2;
+    }
+
+    if (!ok){
+        fprintf(stderr, "%s: %s failed\n", device, command);
+        return 1;
+    }
+    return 0;
+}
@@ -77,24 +77,87 @@ inline long map(long x, long in_min, long in_max, long out_min, long out_max)
 } // extern "C"
 #endif
 
-#include <gmock/gmock.h>
-
 #define UNUSED(expr) do { (void)(expr); } while (0)
 #define F(x) (x)
 
+#ifdef ARDUINO_FAKE
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Pins the fake keeps state for
+#define ARDUINO_FAKE_PINS 64
+
+// Stand-in for the board without gmock: every call just updates plain state
+// and counters that a test reads directly, so it costs a few instructions.
+// delay() and delayMicroseconds() advance the clock.
+class ArduinoFake {
+  public:
+    ArduinoFake();
+    void reset();
+
+    unsigned long getMillis() { return currentMillis; }
+    unsigned long getMicros() { return currentMillis * 1000 + currentMicros; }
+    void setMillisRaw(unsigned long milliseconds) {
+      currentMillis = milliseconds;
+    }
+    void addMillisRaw(unsigned long milliseconds) {
+      currentMillis += milliseconds;
+    }
+    void addMicrosRaw(unsigned long microseconds) {
+      currentMicros += microseconds;
+    }
+
+    // Last mode and level written to each pin, and the value analogRead()
+    // returns for it
+    uint8_t mode[ARDUINO_FAKE_PINS];
+    uint8_t level[ARDUINO_FAKE_PINS];
+    int analogValue[ARDUINO_FAKE_PINS];
+
+    // Calls made since the last reset()
+    unsigned long pinModes;
+    unsigned long digitalWrites;
+    unsigned long digitalReads;
+    unsigned long analogReads;
+    unsigned long delays;
+    unsigned long millisReads;
+
+  private:
+    unsigned long currentMillis;
+    unsigned long currentMicros;
+};
+ArduinoFake* arduinoFakeInstance();
+void releaseArduinoFake();
+
+#else
+#include <gmock/gmock.h>
+
 class ArduinoMock {
   private:
     unsigned long  currentMillis;
+    unsigned long  currentMicros;
 
   public:
     ArduinoMock();
 
+    // The clock may be read and advanced from several threads at once, as
+    // the simulation harness does
     unsigned long getMillis() {
-      return currentMillis;
+      return __atomic_load_n(&currentMillis, __ATOMIC_RELAXED);
+    };
+
+    // micros() follows the millis() clock, plus any delayMicroseconds()
+    unsigned long getMicros() {
+      return getMillis() * 1000 +
+        __atomic_load_n(&currentMicros, __ATOMIC_RELAXED);
+    };
+
+    void addMicrosRaw (unsigned long microseconds) {
+      __atomic_fetch_add(&currentMicros, microseconds, __ATOMIC_RELAXED);
     };
 
     void setMillisRaw (unsigned long milliseconds) {
-      currentMillis = milliseconds;
+      __atomic_store_n(&currentMillis, milliseconds, __ATOMIC_RELAXED);
     };
     void setMillisSecs(unsigned long seconds) {
       setMillisRaw(seconds *      1000);
@@ -107,7 +170,7 @@ class ArduinoMock {
     };
 
     void addMillisRaw (unsigned long milliseconds) {
-      currentMillis += milliseconds;
+      __atomic_fetch_add(&currentMillis, milliseconds, __ATOMIC_RELAXED);
     };
     void addMillisSecs(unsigned long seconds) {
       addMillisRaw(seconds *      1000);
@@ -129,5 +192,8 @@ class ArduinoMock {
 };
 ArduinoMock* arduinoMockInstance();
 void releaseArduinoMock();
+#endif
+
+#include "Serial.h"
 
 #endif // ARDUINO_H
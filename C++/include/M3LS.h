@@ -9,93 +9,357 @@ Copyright info?
 
 #include "Arduino.h"
 #include "SPI.h"
+#include "M3LSTransport.h"
+#include "M3LSStorage.h"
+#include "M3LSTravel.h"
+#include "M3LSEstimator.h"
+#include "M3LSTransform.h"
+#include "M3LSSensitivity.h"
+#include "M3LSEnvelope.h"
+#include "M3LSCommandQueue.h"
+#include "M3LSProfile.h"
+#include "M3LSPolicies.h"
 
-#ifndef MOCK
-    #include "hidjoystickrptparser.h"
-    #include <usbhid.h>
-    #include <hiduniversal.h>
-    #include <usbhub.h>
-#endif
+// Axis count of a manipulator that learns its number of axes from the
+// constructor it is built with, which is how M3LS behaves
+#define M3LS_DYNAMIC_AXES 0
+
+// Bounds of the interval waitForSettle() polls the stages at, in milliseconds.
+// Polling starts fast for short moves and backs off while stages travel.
+#define M3LS_SETTLE_POLL_MIN_MS 1
+#define M3LS_SETTLE_POLL_MAX_MS 32
+
+// Longest begin() waits for the stages to finish calibrating, and the interval
+// they are polled at while they do, in milliseconds
+#define M3LS_CALIBRATION_TIMEOUT_MS 2000
+#define M3LS_CALIBRATION_POLL_MS 5
+
+// Closed loop speed settings (<40>): the control interval the speed and
+// acceleration are expressed in, in units of 3.2us (100 ms), the speed of
+// ordinary moves in counts/s, and the acceleration of velocity mode in
+// counts/s^2
+#define M3LS_SPEED_INTERVAL 31250
+#define M3LS_POSITION_SPEED 10000
+#define M3LS_VELOCITY_ACCEL 20000
+
+// Return home: default height in encoder counts Z must rise before X and Y
+// may move, and the position error every axis must settle within for the move
+// to complete. Z is sent half the clearance plus M3LS_HOME_LIFT_MARGIN higher,
+// so that its estimate is certain to have cleared while it is still moving.
+#define M3LS_HOME_CLEARANCE 10
+#define M3LS_HOME_LIFT_MARGIN 10
+#define M3LS_HOME_TOLERANCE 5
+
+// Longest a queued sequence waits for a stage to clear a height or settle
+// before it is abandoned and every stage halted, in ms. A move across the
+// whole travel at M3LS_POSITION_SPEED takes 1.2 s.
+#define M3LS_WAIT_TIMEOUT_MS 3000
+
+// Interval between the background status reads that correct the position
+// estimates, in milliseconds
+#define M3LS_ESTIMATE_SAMPLE_MS 100
+
+// Status reads that must all come back intact for a timing level to pass the
+// probe, and how many levels slower than the fastest passing one a stage is
+// then run at
+#define M3LS_TIMING_PROBES 8
+#define M3LS_TIMING_MARGIN 1
 
-class M3LS{
+// Times a frame whose reply is missing, malformed or answers another command
+// is sent again, and the wait before the first resend in microseconds, which
+// doubles with each one after it
+#define M3LS_LINK_RETRIES 2
+#define M3LS_LINK_BACKOFF_US 100
+
+// Errors on the SPI link to one stage since begin() or resetLinkErrors()
+struct M3LSLinkErrors {
+    unsigned long noReply;      // no complete reply fit in the buffer
+    unsigned long malformed;    // a garbled frame, or one cut short
+    unsigned long stale;        // a well formed reply to another command
+    unsigned long retries;      // frames sent again to recover
+    unsigned long failures;     // frames given up on after every retry
+};
+
+template <class Manipulator> class BasicM3LSServer;
+
+// Declarations shared by every axis count, so that M3LS::hold and
+// BasicM3LS<2>::hold are the same value of the same type
+class M3LSBase{
     public:
         // Enums
         enum Axes {X, Y, Z, XY, XZ, YZ, XYZ};
         enum ControlMode {hold, open, position, velocity};
-        enum Commands {ActiveMovement, SetHome, ReturnHome, CenterAxes, 
-            ToggleHold, ToggleVelocity, ZUp, ZDown, 
-            InvertX, InvertY, InvertZ, InvertS};
+        enum Commands {ActiveMovement, SetHome, ReturnHome, CenterAxes,
+            ToggleHold, ToggleVelocity, ZUp, ZDown,
+            InvertX, InvertY, InvertZ, InvertS, Stop};
+        // Bit mask of the stages moved by an axis selection (X = 1, Y = 2, Z = 4)
+        static constexpr int axisMask(Axes axis){
+            return axis == X ? 1 : axis == Y ? 2 : axis == Z ? 4 :
+                axis == XY ? 3 : axis == XZ ? 5 : axis == YZ ? 6 : 7;
+        }
+};
+
+// Number of axes: a compile time constant, or a field for M3LS_DYNAMIC_AXES
+template <int NAxes>
+class M3LSAxisCount{
+    public:
+        int getNumAxes() const { return NAxes; }
+    protected:
+        void setNumAxes(int) {}
+};
+
+template <>
+class M3LSAxisCount<M3LS_DYNAMIC_AXES>{
+    public:
+        int getNumAxes() const { return numAxes; }
+    protected:
+        void setNumAxes(int newNumAxes) { numAxes = newNumAxes; }
+        int numAxes;
+};
+
+// Calls f(0) to f(N - 1) with the loop unrolled at compile time
+template <int N>
+struct M3LSUnroll{
+    template <class F> static void run(F& f){
+        M3LSUnroll<N - 1>::run(f);
+        f(N - 1);
+    }
+};
+
+template <>
+struct M3LSUnroll<0>{
+    template <class F> static void run(F&){}
+};
+
+// Config bundles the policies a manipulator is built with; see
+// M3LSDefaultConfig. Configurations other than the default are instantiated
+// by including M3LSImpl.h.
+template <int NAxes, class Config = M3LSDefaultConfig>
+class BasicM3LS : public M3LSBase, public M3LSAxisCount<NAxes>{
+    static_assert(NAxes >= M3LS_DYNAMIC_AXES && NAxes <= 3,
+        "an M3-LS manipulator has one to three axes");
+    public:
+        // Policies
+        typedef typename Config::Transport Transport;
+        typedef typename Config::Input Input;
+        typedef typename Config::Clock Clock;
+        typedef typename Config::Logger Logger;
+        // Number of axes storage is reserved for, and the mask of all of them
+        static const int maxAxes = NAxes == M3LS_DYNAMIC_AXES ? 3 : NAxes;
+        static const int allAxes = (1 << maxAxes) - 1;
         // Constructors
-        M3LS(int X_SS);
-        M3LS(int X_SS, int Y_SS);
-        M3LS(int X_SS, int Y_SS, int Z_SS);
+        template <int N = NAxes>
+        BasicM3LS(int X_SS)
+        {
+            static_assert(N == M3LS_DYNAMIC_AXES || N == 1,
+                "one chip select given for a manipulator without one axis");
+            // Initialize a one axis system
+            this->setNumAxes(1);
+            storage = NULL;
+            timingProbe = false;
+            homeClearance = M3LS_HOME_CLEARANCE;
+            linkRetries = M3LS_LINK_RETRIES;
+            memset(buttonMap, 0, sizeof(buttonMap));
+            pins[0] = X_SS;
+        }
+        template <int N = NAxes>
+        BasicM3LS(int X_SS, int Y_SS)
+        {
+            static_assert(N == M3LS_DYNAMIC_AXES || N == 2,
+                "two chip selects given for a manipulator without two axes");
+            // Initialize a two axis system
+            this->setNumAxes(2);
+            storage = NULL;
+            timingProbe = false;
+            homeClearance = M3LS_HOME_CLEARANCE;
+            linkRetries = M3LS_LINK_RETRIES;
+            memset(buttonMap, 0, sizeof(buttonMap));
+            pins[0] = X_SS;
+            pins[1] = Y_SS;
+        }
+        template <int N = NAxes>
+        BasicM3LS(int X_SS, int Y_SS, int Z_SS)
+        {
+            static_assert(N == M3LS_DYNAMIC_AXES || N == 3,
+                "three chip selects given for a manipulator without three axes");
+            // Initialize a three axis system
+            this->setNumAxes(3);
+            storage = NULL;
+            timingProbe = false;
+            homeClearance = M3LS_HOME_CLEARANCE;
+            linkRetries = M3LS_LINK_RETRIES;
+            memset(buttonMap, 0, sizeof(buttonMap));
+            pins[0] = X_SS;
+            pins[1] = Y_SS;
+            pins[2] = Z_SS;
+        }
         // Initializiation and High Level Functions
+        void setStorage(M3LSStorage *newStorage);
+        void setTimingProbe(bool enable);
         void begin();
+        bool negotiateTiming();
+        bool calibrate(unsigned long timeout);
+        bool saveSettings();
+        int getSweepFrequency(int axis);
         void run();
         void bindButton(int buttonNumber, Commands comm);
         void setRefreshRate(int newRate);
         void setControlMode(ControlMode newMode);
         void setHome();
         void returnHome();
+        void setHomeClearance(int counts);
+        bool isHoming();
         void invertXAxis(bool newStatus);
         void invertYAxis(bool newStatus);
         void invertZAxis(bool newStatus);
         void invertSAxis(bool newStatus);
+        bool setSensitivityCurve(const M3LSCurvePoint *points, int count);
+        bool setZones(int numZones);
         void centerAxes();
         void updatePosition(int inp0, int inp1, int inp2);
         void updatePosition(int inp0, int inp1, int inp2, bool isActive);
         void updatePosition(int inp0, int inp1, int inp2, Axes axis);
         void updatePosition(int inp0, int inp1, int inp2, Axes axis, bool isActive);
+        // Axis selection checked against the axis count at compile time
+        template <Axes axis>
+        void updatePosition(int inp0, int inp1, int inp2, bool isActive = false){
+            static_assert((axisMask(axis) & ~allAxes) == 0,
+                "axis selection includes an axis this manipulator does not have");
+            updatePosition(inp0, inp1, inp2, axis, isActive);
+        }
+        void moveAxes(int axes, const int *targets);
+        // Soft limits every target is clamped to
+        bool setSoftLimits(int axis, int low, int high);
+        bool setKeepOut(const int *low, const int *high, int exitAxis,
+            bool exitHigh);
+        void clearKeepOut();
+        M3LSEnvelope& getEnvelope();
+        // Steering in a frame at an angle to the stages
+        void setTransform(const float *matrix, const int *offset);
+        void clearTransform();
+        void moveInFrame(const int *frameTargets);
+        void moveAlongNeedle(int counts);
+        void halt();
+        unsigned long getStopLatency();
+        const M3LSLinkErrors& getLinkErrors(int axis);
+        void resetLinkErrors();
+        bool serviceCommands();
+        bool flushCommands(unsigned long timeout);
+        int getQueuedCommands();
+        bool isSettled(int axes, int tolerance);
+        bool waitForSettle(int axes, int tolerance, unsigned long timeout);
         void getCurrentPosition();
+        void estimateCurrentPosition();
+        int getEstimatedPosition(int axis);
+        int getEstimateError(int axis);
+        void refreshEstimates();
+        Transport& getTransport();
+        Input& getInput();
+        M3LSSensitivity& getSensitivity();
     private:
+        // The serial protocol dispatcher reports the mode and positions
+        template <class Manipulator> friend class BasicM3LSServer;
         // Variables
-        int numAxes;
-        int pins[3];
+        int pins[maxAxes];
         int radius;
-        int center[3];
+        M3LSSensitivity sensitivity;
+        int center[maxAxes];
         int refreshRate;
         ControlMode currentControlMode;
         int currentZPosition;
-        int currentPosition[3];
-        int homePosition[3];
+        int currentPosition[maxAxes];
+        int homePosition[maxAxes];
+        int sweepFrequency[maxAxes];
+        int driveSpeed[maxAxes];
+        int moveSpeed[maxAxes];
+        int homeClearance;
+        bool homing;
+        bool waiting;
+        unsigned long waitStarted;
+        M3LSEstimator estimators[maxAxes];
+        // Status bits and position error of each stage's last status read,
+        // -1 and 0 if it went unanswered
+        int lastStatus[maxAxes];
+        int lastError[maxAxes];
+        M3LSTransform transform;
+        int needle;
+        M3LSEnvelope envelope;
+        unsigned long lastSample;
+        M3LSStorage *storage;
+        bool timingProbe;
+        uint32_t bootCount;
+        uint32_t calibrationBoot;
         bool invertX;
         bool invertY;
         bool invertZ;
         bool invertS;
         Commands buttonMap[20];
         char sendChars[50];
-        char recvChars[100];
-#ifndef MOCK
-        // USB Shield
-        USB Usb;
-        USBHub Hub;
-        HIDUniversal Hid;
-        JoystickEvents JoyEvents;
-        JoystickReportParser Joy;
-#endif
+        char recvChars[M3LS_REPLY_SIZE];
+        Transport transport;
+        Input input;
+        M3LSCommandQueue commands;
+        unsigned long haltRequested;
+        unsigned long stopLatency;
+        M3LSLinkErrors linkErrors[maxAxes];
+        int linkRetries;
         // Timing
         unsigned long lastMillis;
         unsigned long curMillis;
         int lastButtons;
         int curButtons;
         // Functions
-        void calibrate();
-        void calibrateForward();
-        void calibrateReverse();
-        void initUSBShield();
+        template <class F> void forEachAxis(F f){
+            if (NAxes == M3LS_DYNAMIC_AXES){
+                for (int axis = 0; axis < this->getNumAxes(); axis++){ f(axis); }
+            } else {
+                M3LSUnroll<NAxes>::run(f);
+            }
+        }
+        int readSweepFrequency(int pin);
+        bool sweep(char direction, unsigned long timeout,
+            unsigned long *elapsed);
+        bool loadSettings();
+        bool probeTiming(int pin);
+        void readInput();
         void setBounds(int amount);
-        void moveToTargetPosition(int target0);
-        void moveToTargetPosition(int target0, Axes axis);
-        void moveToTargetPosition(int target0, int target1);
-        void moveToTargetPosition(int target0, int target1, Axes axis);
-        void moveToTargetPosition(int target0, int target1, int target2);
-        void moveToTargetPosition(int target0, int target1, int target2, Axes axis);
-        int scaleToZones(int numZones, int input);
-        void setTargetPosition(int target);
-        void advanceMotor(int inp, int axisNum);
+        int scaleToZones(int input);
+        void queueMove(int axes, const int *targets);
+        void queueCommand(const M3LSCommand& command);
+        void queueStep(M3LSCommand::Type type, int axes, const int *values);
+        bool isReady(const M3LSCommand& command);
+        bool isClear(int axes, const int32_t *thresholds);
+        bool isArrived(int axes);
+        void executeCommand(const M3LSCommand& command);
+        void cancelCommands();
+        void restoreSpeeds(int axes);
+        void sendMove(int axes, const int *targets);
+        int limitPoint(int axes, int *point);
+        void sendHalt(int axes);
+        void sendSpeeds(int axes, const int *speeds);
+        void setTargetPosition(int target, char *frame);
+        void setSpeed(int countsPerSecond, int acceleration, char *frame);
+        void driveAxis(int inp, int axisNum);
+        void followInFrame(int inp0, int inp1, int inp2);
         int getAxisPosition(int pin);
+        int readStatus(int pin, int *position, int *error);
         void recenter(int newx, int newy, int newz);
+        void recenter(const int *newCenter);
         int sendSPICommand(int pin, int length);
+        int sendBatch(const M3LSCommandFrame *frames, int count);
+        bool checkReply(int pin, int received);
+        void countReplyError(int pin, const char *send, int received);
+        void backOff(int pin, int attempt);
+        int getAxisOfPin(int pin);
 };
 
+// Instantiated in M3LS.cc for every axis count in the default configuration
+extern template class BasicM3LS<M3LS_DYNAMIC_AXES>;
+extern template class BasicM3LS<1>;
+extern template class BasicM3LS<2>;
+extern template class BasicM3LS<3>;
+
+// The original class: one to three axes chosen by the constructor
+typedef BasicM3LS<M3LS_DYNAMIC_AXES> M3LS;
+
 #endif
@@ -0,0 +1,119 @@
+/*
+M3LSBus.h - Arbiter that lets several M3LS instances share one SPI bus, with
+            their command frames merged into shared batches
+Copyright info?
+*/
+
+#ifndef M3LSBus_h
+#define M3LSBus_h
+
+#include "Arduino.h"
+#include "M3LSTransport.h"
+#include "M3LSPolicies.h"
+
+// Manipulators that can share a bus, and the command frames each can have
+// waiting for the next batch
+#define M3LS_BUS_CLIENTS 4
+#define M3LS_BUS_QUEUE 12
+
+// Resends of a posted frame without a good reply before it is dropped and
+// counted as failed
+#define M3LS_BUS_RETRIES 3
+
+// Bus time and frames charged to one client since the counters were reset
+struct M3LSBusUsage {
+    unsigned long frames;
+    unsigned long failed;
+    unsigned long busyMicros;
+};
+
+/*
+Owns the one transport backend on the bus and hands it out to registered
+clients. Frames whose replies nobody reads (moves, speed changes) are posted:
+they wait in the client's queue, and flush() sends the queues of every client
+as a single batch, ordered either round robin from a rotating first client
+(fair) or by client priority, highest first. A transfer that needs its reply
+flushes the queues first, so frames to a stage always reach it in the order
+they were sent. A stop frame (<03>) is never held: it goes out at once and
+drops frames still waiting for its stage.
+
+A merged batch resends a frame without a good reply up to M3LS_BUS_RETRIES
+times, then drops it, counts it as failed against the client that posted it
+and carries on with the rest, so one stage's desync never costs another
+client its frames. A stop batch instead reports how many of its frames were
+answered, so the manipulator retries it and counts its link errors itself.
+
+Merged batches are charged to clients by frame, each frame costing an equal
+share of the batch's time; direct transfers are charged exactly.
+*/
+class M3LSBus {
+    public:
+        enum Policy {fair, priority};
+        M3LSBus();
+        void begin();
+        int attach(int clientPriority);
+        void setPolicy(Policy newPolicy);
+        // Frame-level contract, on behalf of a client
+        int transfer(int client, int pin, const char *send, int length,
+            char *recv, int recvSize);
+        int post(int client, const M3LSCommandFrame *frames, int count,
+            char *recv = NULL, int recvSize = 0);
+        void flush();
+        int getPending();
+        // Utilization
+        const M3LSBusUsage& getUsage(int client);
+        int getUtilization(int client);
+        void resetUsage();
+        M3LSTransport& getBackend();
+    private:
+        struct Client {
+            int priority;
+            M3LSCommandFrame queue[M3LS_BUS_QUEUE];
+            int count;
+            M3LSBusUsage usage;
+        };
+        M3LSTransport backend;
+        bool started;
+        Policy policy;
+        Client clients[M3LS_BUS_CLIENTS];
+        int numClients;
+        int nextClient;
+        unsigned long usageStart;
+        M3LSCommandFrame batch[M3LS_BUS_CLIENTS * M3LS_BUS_QUEUE];
+        int owners[M3LS_BUS_CLIENTS * M3LS_BUS_QUEUE];
+        char recvChars[M3LS_REPLY_SIZE];
+        int schedule();
+        int stop(int client, const M3LSCommandFrame *frames, int count,
+            char *recv, int recvSize);
+        void send(int count);
+        bool isClient(int client);
+};
+
+// Transport policy of a manipulator on a shared bus. Attach it to the bus
+// before begin(), and call the bus's flush() once per loop() after every
+// manipulator's run() so their moves go out together.
+class M3LSBusTransport {
+    public:
+        M3LSBusTransport();
+        void attach(M3LSBus& newBus, int clientPriority = 0);
+        int getClient();
+        M3LSBus& getBus();
+        // Frame-level contract of M3LSTransport.h
+        void begin();
+        int transfer(int pin, const char *send, int length, char *recv,
+            int recvSize);
+        int transferBatch(const M3LSCommandFrame *frames, int count,
+            char *recv, int recvSize);
+        void setTimingLevel(int pin, int level);
+        int getTimingLevel(int pin);
+    private:
+        M3LSBus *bus;
+        int client;
+};
+
+// The default configuration with its stages on a shared bus
+struct M3LSSharedConfig : M3LSDefaultConfig {
+    typedef M3LSBusTransport Transport;
+};
+
+#endif
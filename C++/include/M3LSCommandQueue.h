@@ -0,0 +1,58 @@
+/*
+M3LSCommandQueue.h - Prioritized queue of the commands an M3LS sends its
+                     stages, so that a stop can overtake queued motion
+Copyright info?
+*/
+
+#ifndef M3LSCommandQueue_h
+#define M3LSCommandQueue_h
+
+#include <stdint.h>
+
+// Number of commands each priority level holds, enough for a planned return
+// home with room to spare
+#define M3LS_QUEUE_CAPACITY 16
+
+// Number of axes a queued command carries targets for
+#define M3LS_QUEUE_AXES 3
+
+// One step of a command sequence. A step is executed as a single transport
+// transaction, so the queue can be cut between any two steps. Wait steps send
+// nothing; the queue stays at them until their condition holds.
+struct M3LSCommand {
+    enum Type {Move, Halt, SetMode, SetSpeed, WaitClear, WaitSettle, Complete};
+    uint8_t type;
+    // Bit mask of the stages addressed (X = 1, Y = 2, Z = 4)
+    uint8_t axes;
+    // Move: target of each addressed axis. SetSpeed: speed of each addressed
+    // axis, in encoder counts per second. WaitClear: position each addressed
+    // axis must be past, on the side of its target. SetMode: the mode, in
+    // targets[0].
+    int32_t targets[M3LS_QUEUE_AXES];
+};
+
+/*
+Two fixed size rings, one per priority. pop() always drains the urgent ring
+first, and clear() drops every command of a priority at once, which is how a
+stop discards the rest of a sequence.
+*/
+class M3LSCommandQueue {
+    public:
+        enum Priority {urgent, normal};
+        M3LSCommandQueue();
+        bool push(const M3LSCommand& command, Priority priority);
+        bool peek(M3LSCommand *command);
+        bool pop(M3LSCommand *command);
+        void clear(Priority priority);
+        int size(Priority priority);
+        bool isEmpty();
+    private:
+        struct Ring {
+            M3LSCommand commands[M3LS_QUEUE_CAPACITY];
+            int head;
+            int count;
+        };
+        Ring rings[2];
+};
+
+#endif
@@ -0,0 +1,74 @@
+/*
+M3LSEnvelope.h - Soft limits every target is clamped to before it is sent to
+                 a stage, with an optional region the needle must keep out of
+Copyright info?
+*/
+
+#ifndef M3LSEnvelope_h
+#define M3LSEnvelope_h
+
+#include <stdint.h>
+
+// Axes an envelope covers
+#define M3LS_ENVELOPE_AXES 3
+
+/*
+A box of per-axis limits, the whole travel of the stages until narrowed, and
+optionally a keep-out box inside it, such as the dish below a floor height on
+Z. A target inside the keep-out box is moved out of it along its exit axis,
+to just past the face on the exit side, so with Z as the exit axis the needle
+is lifted over the dish rather than stopped short of it.
+
+clamp() and clampPoint() run on every frame that carries a target, so both
+are written without branches: the comparisons compile to conditional moves
+(IT blocks on the Cortex-M3) and the hit counters are bumped by the result of
+a comparison rather than inside an if.
+*/
+class M3LSEnvelope {
+    public:
+        M3LSEnvelope();
+        void reset();
+        bool setLimits(int axis, int newLow, int newHigh);
+        bool setKeepOut(const int *newLow, const int *newHigh,
+            int newExitAxis, bool exitHigh);
+        void clearKeepOut();
+        bool hasKeepOut(){ return keepOut != 0; }
+        int getLow(int axis){ return low[axis]; }
+        int getHigh(int axis){ return high[axis]; }
+        int getExitAxis(){ return exitAxis; }
+        // Clamps one coordinate into the limits of its axis
+        int clamp(int axis, int value){
+            int limited = value < low[axis] ? low[axis] : value;
+            limited = limited > high[axis] ? high[axis] : limited;
+            hits[axis] += limited != value;
+            return limited;
+        }
+        // Clamps the first numAxes coordinates of a point into the limits,
+        // then out of the keep-out region
+        void clampPoint(int *point, int numAxes){
+            int inside = keepOut;
+            for (int axis = 0; axis < numAxes; axis++){
+                point[axis] = clamp(axis, point[axis]);
+                inside &= (point[axis] >= keepLow[axis]) &
+                    (point[axis] <= keepHigh[axis]);
+            }
+            point[exitAxis] = inside ? exitFace : point[exitAxis];
+            keepOutHits += inside;
+        }
+        // Limit hits since the last resetHits()
+        unsigned long getHits(int axis){ return hits[axis]; }
+        unsigned long getKeepOutHits(){ return keepOutHits; }
+        void resetHits();
+    private:
+        int low[M3LS_ENVELOPE_AXES];
+        int high[M3LS_ENVELOPE_AXES];
+        int keepOut;
+        int keepLow[M3LS_ENVELOPE_AXES];
+        int keepHigh[M3LS_ENVELOPE_AXES];
+        int exitAxis;
+        int exitFace;
+        unsigned long hits[M3LS_ENVELOPE_AXES];
+        unsigned long keepOutHits;
+};
+
+#endif
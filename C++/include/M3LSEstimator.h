@@ -0,0 +1,50 @@
+/*
+M3LSEstimator.h - Dead reckoning of a stage's position from the commands the
+                  library has sent it, corrected by occasional status reads
+Copyright info?
+*/
+
+#ifndef M3LSEstimator_h
+#define M3LSEstimator_h
+
+// Uncertainty of a position that was just read, or of a stage that has come to
+// rest on its target under closed loop control, in encoder counts
+#define M3LS_ESTIMATE_BASE_ERROR 2
+
+// Time allowed past the predicted arrival for the stage to settle, in ms
+#define M3LS_ESTIMATE_SETTLE_MS 50
+
+// The motion model ignores acceleration, so a moving stage may be this many
+// percent of its predicted travel away from the estimate
+#define M3LS_ESTIMATE_SPEED_ERROR 25
+
+/*
+Motion model: after being sent to a target, a stage travels there in a
+straight line at the speed it was programmed with, then holds it. Times are
+millis() values passed in by the caller, so the model itself never reads a
+clock.
+*/
+class M3LSEstimator {
+    public:
+        M3LSEstimator();
+        // A position known from a status read
+        void sample(int position, unsigned long now);
+        // A move toward `target` at `speed` encoder counts per second
+        void command(int target, int speed, unsigned long now);
+        // A halt that left the stage holding at `position`
+        void stop(int position, unsigned long now);
+        // Predictions
+        int estimate(unsigned long now);
+        int errorBound(unsigned long now);
+        bool isMoving(unsigned long now);
+        int getTarget();
+    private:
+        int origin;
+        int target;
+        int speed;
+        int originError;
+        unsigned long start;
+        int travelled(unsigned long now);
+};
+
+#endif
@@ -0,0 +1,1649 @@
+/*
+M3LSImpl.h - Member definitions of BasicM3LS. M3LS.cc instantiates them for
+             the default configuration; include this header instead of
+             M3LS.h to build a manipulator with other policies.
+Copyright info?
+*/
+
+#ifndef M3LSImpl_h
+#define M3LSImpl_h
+
+#include "M3LS.h"
+#include <ctype.h>
+
+// Initialization and public high level functions
+// Keeps calibration and settings in the given storage; call before begin()
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::setStorage(M3LSStorage *newStorage){
+    storage = newStorage;
+}
+
+// Makes begin() probe each stage for the fastest SPI timing it answers
+// reliably at; call before begin()
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::setTimingProbe(bool enable){
+    timingProbe = enable;
+}
+
+// Initializes internal parameters and calibrates the motors and USB shield
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::begin(){
+    // Initialize all pins as unselected outputs
+    forEachAxis([this](int axis){
+        pinMode(pins[axis], OUTPUT);
+        digitalWrite(pins[axis], HIGH);
+    });
+
+    // Set the default internal bounds, radius, refresh rate, etc.
+    lastMillis = 0;
+    radius = 5500;
+    recenter(6000, 6000, 6000);
+    needle = 0;
+    refreshRate = 1000/50;
+    currentZPosition = 125;
+    invertX = false;
+    invertY = false;
+    invertZ = false;
+    invertS = false;
+
+    resetLinkErrors();
+    Logger::begin();
+
+#ifdef M3LS_PROFILE
+    M3LSProfiler::begin();
+#endif
+
+    // Initialize the input device
+    input.begin();
+
+    // Initialize SPI
+    delay(50);
+    SPI.begin();
+    transport.begin();
+    if (timingProbe && !negotiateTiming()){
+        Logger::println("Timing probe failed, running at the slowest level");
+    }
+
+    // Calibrate the stages, unless a recent calibration was stored
+    forEachAxis([this](int axis){
+        sweepFrequency[axis] = 0;
+        driveSpeed[axis] = 0;
+        moveSpeed[axis] = M3LS_POSITION_SPEED;
+        lastStatus[axis] = -1;
+        lastError[axis] = 0;
+    });
+    homing = false;
+    waiting = false;
+    lastSample = 0;
+    haltRequested = 0;
+    stopLatency = 0;
+    memcpy(homePosition, center, sizeof(homePosition));
+    if (!loadSettings() && !calibrate(M3LS_CALIBRATION_TIMEOUT_MS)){
+        Logger::println("Calibration timed out");
+    }
+    saveSettings();
+
+    // Ensure the system is in position mode
+    currentControlMode = position;
+    setControlMode(open);
+    setControlMode(position);
+
+    // Start the position estimates from where the stages are
+    getCurrentPosition();
+}
+
+// The main event loop
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::run(){
+    // Send the next step of any queued command sequence
+    {
+        M3LS_PROFILE_SCOPE(Commands);
+        serviceCommands();
+    }
+
+    // Ensure that at least INTERVAL ms have passed since the last update
+    curMillis = Clock::millis();
+    if(curMillis - lastMillis < (unsigned long)refreshRate){ return; }
+    lastMillis = curMillis;
+    M3LS_PROFILE_SCOPE(Run);
+
+    // Follow the input device, if the configuration has one
+    if (Input::present){ readInput(); }
+
+    // Correct the position estimates in the background
+    M3LS_PROFILE_SCOPE(Estimates);
+    refreshEstimates();
+}
+
+// Maps the buttons and axes of the input device onto commands and moves
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::readInput(){
+    // Get input from the device
+    {
+        M3LS_PROFILE_SCOPE(UsbTask);
+        input.task();
+    }
+    M3LS_PROFILE_BEGIN(Buttons);
+    curButtons = input.getButtons();
+
+    // Default the Z axis to dead zone
+    currentZPosition = 125;
+
+    // Default hold position movement to its active state
+    bool isActive = false;
+
+    // Handle buttons that can be held down:
+    if(curButtons){
+        // Calculate which button was pressed
+        int status = curButtons;
+        int button = 1;
+        while (status >>=1) { ++button; }
+
+        // Retrieve the associated command
+        Commands comm = buttonMap[button];
+
+        // Handle requested command
+        switch(comm){
+             // These will run the Z axis one zone up or down
+            case ZUp:               currentZPosition = 127 +
+                                        255 / (sensitivity.getZones() - 1);
+                                    break;
+            case ZDown:             currentZPosition = 127 -
+                                        255 / (sensitivity.getZones() - 1);
+                                    break;
+            // Handles the "hold trigger to move" functionality
+            case ActiveMovement:    isActive = true;
+                                    break;
+            default:                break;
+        }
+    }
+
+    // Handle any buttons that have changed
+    if(curButtons && lastButtons == 0){
+        // Calculate which button was pressed
+        int status = curButtons;
+        int button = 1;
+        while (status >>=1) { ++button; }
+
+        // Retrieve the associated command
+        Commands comm = buttonMap[button];
+
+        // Handle requested command
+        switch(comm){
+            case SetHome:           setHome();
+                                    break;
+            case ReturnHome:        returnHome();
+                                    break;
+            case CenterAxes:        {
+                                        int targets[3] = {6000, 6000, 6000};
+                                        recenter(targets);
+                                        moveAxes(axisMask(XY), targets);
+                                    }
+                                    break;
+            case ToggleHold:        if (currentControlMode == hold){
+                                        setControlMode(position);
+                                    } else if (currentControlMode == position){
+                                        // Holding also cuts short any
+                                        // queued sequence
+                                        cancelCommands();
+                                        setControlMode(hold);
+                                    }
+                                    break;
+            case ToggleVelocity:    if (currentControlMode == velocity){
+                                        setControlMode(position);
+                                    } else {
+                                        setControlMode(velocity);
+                                    }
+                                    break;
+            case InvertX:           invertXAxis(!invertX);
+                                    break;
+            case InvertY:           invertYAxis(!invertY);
+                                    break;
+            case InvertZ:           invertZAxis(!invertZ);
+                                    break;
+            case InvertS:           invertSAxis(!invertS);
+                                    break;
+            case Stop:              halt();
+                                    break;
+            default:                break;
+        }
+    }
+    M3LS_PROFILE_END(Buttons);
+
+    // Update the position and bounds based upon the joystick inputs, unless
+    // a queued sequence still owns the stages
+    if (commands.isEmpty()){
+        M3LS_PROFILE_SCOPE(Position);
+        updatePosition(input.getX() + invertX * (255 - 2 * input.getX()),
+            input.getY() + invertY * (255 - 2 * input.getY()),
+            currentZPosition + invertZ * (255 - 2 * currentZPosition), XY,
+            isActive);
+    }
+    {
+        M3LS_PROFILE_SCOPE(Bounds);
+        setBounds(input.getZ() + invertS * (255 - 2 * input.getZ()));
+    }
+
+    // Save the current button status
+    lastButtons = curButtons;
+}
+
+// Binds a given button to a specified command
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::bindButton(int buttonNumber, Commands comm){
+    buttonMap[buttonNumber] = comm;
+}
+
+// Sets the current refresh rate to the new value
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::setRefreshRate(int newRate){
+    refreshRate = 1000 / newRate;
+}
+
+// Sets the current control mode to the new mode
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::setControlMode(ControlMode newMode){
+    /*
+    Send to controller:
+        <20 X>\r
+        7 bytes
+        X = 0: Open loop mode
+        X = 1: Closed loop mode
+        X = R: Report current mode
+    Receive from controller:
+        <20 X IIII>\r
+        12 bytes
+        IIII is the closed loop control interval, units are 3.2us
+        Ignored for our purposes
+    */
+
+    // Stop any axis still being driven by velocity control
+    if (newMode != currentControlMode){
+        forEachAxis([this](int axis){ driveAxis(0, axis); });
+    }
+
+    if (newMode == open && currentControlMode != open){
+        memcpy(sendChars, "<20 0>\r", 7);
+        forEachAxis([this](int axis){ sendSPICommand(pins[axis], 7); });
+    } else if(newMode != open && currentControlMode == open){
+        memcpy(sendChars, "<20 1>\r", 7);
+        forEachAxis([this](int axis){ sendSPICommand(pins[axis], 7); });
+    } else if(newMode == position && currentControlMode != position){
+        // This is where re-centering has to occur.
+        // Re-center bounds around the current position
+        estimateCurrentPosition();
+        recenter(currentPosition);
+    }
+    currentControlMode = newMode;
+}
+
+// Store the current position as the home position
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::setHome(){
+    getCurrentPosition();
+    memcpy(homePosition, currentPosition, sizeof(homePosition));
+    Logger::print("Setting home to");
+    forEachAxis([this](int axis){
+        Logger::print(" ");
+        Logger::print(homePosition[axis]);
+    });
+    Logger::println();
+    saveSettings();
+}
+
+// Return to the stored home position. The move is planned as a queued
+// sequence that run() works through, so it completes in the background and a
+// stop or hold can cut it short:
+//   1. Z rises past the clearance height
+//   2. X and Y start as soon as Z is certain to have cleared it, on speeds
+//      scaled so that both arrive together along a straight line
+//   3. Once X and Y have settled, Z descends to its home position
+//   4. Once every axis has settled, the previous mode is restored
+// isHoming() returns false when the sequence is complete. A return is
+// refused if the envelope keeps Z from reaching the clearance height.
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::returnHome(){
+    bool hasZ = this->getNumAxes() > 2;
+    int lift = invertZ ? -1 : 1;
+    if (hasZ){
+        // The lift must end far enough past the clearance height for the
+        // estimate to be certain it has cleared
+        estimateCurrentPosition();
+        int reach = currentPosition[2] + lift * (homeClearance +
+            M3LS_ESTIMATE_BASE_ERROR);
+        if (lift > 0 ? reach >= envelope.getHigh(2) :
+            reach <= envelope.getLow(2)){
+            Logger::println("Return home refused: Z cannot clear");
+            return;
+        }
+    }
+
+    // Store current mode and switch to position mode
+    ControlMode previousMode = currentControlMode;
+    setControlMode(position);
+    Logger::println("Returning home");
+    forEachAxis([this](int axis){
+        Logger::print(homePosition[axis]);
+        Logger::print(" ");
+    });
+    Logger::println();
+    estimateCurrentPosition();
+    homing = true;
+
+    // Raise Z axis
+    int values[3];
+    if (hasZ){
+        values[2] = currentPosition[2] + lift * (homeClearance * 3 / 2 +
+            M3LS_HOME_LIFT_MARGIN);
+        queueStep(M3LSCommand::Move, axisMask(Z), values);
+        values[2] = currentPosition[2] + lift * homeClearance;
+        queueStep(M3LSCommand::WaitClear, axisMask(Z), values);
+    }
+
+    // Move X and Y to home position, the longer move at the speed of
+    // ordinary moves and the shorter one slowed to match
+    int planar = this->getNumAxes() < 2 ? this->getNumAxes() : 2;
+    int distance[2] = {0, 0};
+    int longest = 1;
+    for (int axis = 0; axis < planar; axis++){
+        distance[axis] = abs(homePosition[axis] - currentPosition[axis]);
+        if (distance[axis] > longest){ longest = distance[axis]; }
+    }
+    for (int axis = 0; axis < 2; axis++){
+        values[axis] = (int)((long)M3LS_POSITION_SPEED * distance[axis] /
+            longest);
+    }
+    queueStep(M3LSCommand::SetSpeed, axisMask(XY), values);
+    queueStep(M3LSCommand::Move, axisMask(XY), homePosition);
+    recenter(homePosition);
+    queueStep(M3LSCommand::WaitSettle, axisMask(XY), values);
+    values[0] = values[1] = M3LS_POSITION_SPEED;
+    queueStep(M3LSCommand::SetSpeed, axisMask(XY), values);
+
+    // Lower Z to home position
+    if (hasZ){
+        queueStep(M3LSCommand::Move, axisMask(Z), homePosition);
+        queueStep(M3LSCommand::WaitSettle, axisMask(Z), values);
+    }
+
+    // Restore previous mode
+    values[0] = previousMode;
+    queueStep(M3LSCommand::SetMode, 0, values);
+    queueStep(M3LSCommand::Complete, 0, values);
+
+    // Send the first step now
+    serviceCommands();
+}
+
+// Sets how far Z rises before X and Y move when returning home, in encoder
+// counts
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::setHomeClearance(int counts){
+    homeClearance = counts;
+}
+
+// Returns true until every axis has settled at the end of a return home
+template <int NAxes, class Config>
+bool BasicM3LS<NAxes, Config>::isHoming(){
+    return homing;
+}
+
+// Sets the inversion status of the X axis
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::invertXAxis(bool newStatus){
+    invertX = newStatus;
+}
+
+// Sets the inversion status of the Y axis
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::invertYAxis(bool newStatus){
+    invertY = newStatus;
+}
+
+// Sets the inversion status of the Z axis
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::invertZAxis(bool newStatus){
+    invertZ = newStatus;
+}
+
+// Sets the inversion status of the sensitivity axis
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::invertSAxis(bool newStatus){
+    invertS = newStatus;
+}
+
+// Replaces the curve from the sensitivity axis to the bounds radius; see
+// M3LSSensitivity. Returns false, keeping the old curve, if it is invalid.
+template <int NAxes, class Config>
+bool BasicM3LS<NAxes, Config>::setSensitivityCurve(
+    const M3LSCurvePoint *points, int count){
+    return sensitivity.setCurve(points, count);
+}
+
+// Sets how many zones velocity control divides each axis into, an odd number
+// from 3 to M3LS_ZONES_MAX. Returns false, keeping the old zones, otherwise.
+template <int NAxes, class Config>
+bool BasicM3LS<NAxes, Config>::setZones(int numZones){
+    return sensitivity.setZones(numZones);
+}
+
+// Default method for updating the needle's position
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::updatePosition(int inp0, int inp1, int inp2){
+    updatePosition(inp0, inp1, inp2, XYZ, false);
+}
+
+// Default method for updating the needle's position with a trigger parameter
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::updatePosition(int inp0, int inp1, int inp2, bool isActive){
+    updatePosition(inp0, inp1, inp2, XYZ, isActive);
+}
+
+// Default method for updating the needle's position with an axis parameter
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::updatePosition(int inp0, int inp1, int inp2, Axes axis){
+    updatePosition(inp0, inp1, inp2, axis, false);
+}
+
+// Update the needle's position based upon current mode and joystick inputs
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::updatePosition(int inp0, int inp1, int inp2, Axes axis, bool isActive){
+    // Handle inputs based on the current control mode
+    switch(currentControlMode)
+    {
+        case hold     : // Only execute a move command if the button is held
+                        if (!isActive){
+                            forEachAxis([this](int axis){
+                                driveAxis(0, axis);
+                            });
+                            estimateCurrentPosition();
+                            recenter(currentPosition);
+                            break;
+                        }
+                        // fall through
+        case position : // Steer in the configured frame, if there is one
+                        if (!transform.isIdentity()){
+                            followInFrame(inp0, inp1, inp2);
+                            break;
+                        }
+
+                        // Map the inputs based on the current bounds
+                        // Joystick reports 0-255
+                        Logger::print("X: ");
+                        Logger::print(inp0);
+                        Logger::print(" ");
+                        inp0 = map(inp0, 0, 255, 
+                            center[0] - radius, center[0] + radius);
+                        Logger::println(inp0);
+                        Logger::print("Y: ");
+                        Logger::print(inp1);
+                        Logger::print(" ");
+                        inp1 = map(inp1, 0, 255, 
+                            center[1] - radius, center[1] + radius);
+                        Logger::println(inp1);
+                        {
+                            // Z follows the joystick in velocity mode below
+                            int targets[3] = {inp0, inp1, 0};
+                            moveAxes(axisMask(axis) & axisMask(XY), targets);
+                        }
+
+                        // Treat the Z axis as if it is in velocity mode
+                        if (this->getNumAxes() > 2){
+                            inp2 = scaleToZones(inp2);
+                            driveAxis(inp2, 2);
+                        }
+                        break;
+
+        case velocity : // Set the speed and direction based on displacement,
+                        // divided between the configured zones
+                        // This should result in zone 0 being a "dead zone."
+                        {
+                            int inputs[3] = {inp0, inp1, inp2};
+
+                            // Loop through each available axis
+                            forEachAxis([&](int axis){
+                                int inp = scaleToZones(inputs[axis]);
+                                driveAxis(inp, axis);
+                            });
+                        }
+                        break;
+        default       : break;
+    }
+}
+
+// Gets and stores the current position of each stage
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::getCurrentPosition(){
+    unsigned long now = Clock::millis();
+    forEachAxis([&](int axis){
+        // A stage that cannot be read keeps its estimate
+        int error;
+        if (readStatus(pins[axis], &currentPosition[axis], &error) >= 0){
+            estimators[axis].sample(currentPosition[axis], now);
+        }
+    });
+}
+
+// Stores the estimated position of each stage without reading any of them
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::estimateCurrentPosition(){
+    unsigned long now = Clock::millis();
+    forEachAxis([&](int axis){
+        currentPosition[axis] = estimators[axis].estimate(now);
+    });
+}
+
+// Returns the position an axis is predicted to be at from the commands it
+// was sent since its last status read
+template <int NAxes, class Config>
+int BasicM3LS<NAxes, Config>::getEstimatedPosition(int axis){
+    if (axis < 0 || axis >= this->getNumAxes()){ return 0; }
+    return estimators[axis].estimate(Clock::millis());
+}
+
+// Returns how many encoder counts an axis may be from its estimate
+template <int NAxes, class Config>
+int BasicM3LS<NAxes, Config>::getEstimateError(int axis){
+    if (axis < 0 || axis >= this->getNumAxes()){ return 0; }
+    return estimators[axis].errorBound(Clock::millis());
+}
+
+// Reads the status of the axis with the least certain estimate, at most once
+// every M3LS_ESTIMATE_SAMPLE_MS and only while some estimate is uncertain
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::refreshEstimates(){
+    unsigned long now = Clock::millis();
+    if (now - lastSample < M3LS_ESTIMATE_SAMPLE_MS){ return; }
+    int worst = -1;
+    int worstError = M3LS_ESTIMATE_BASE_ERROR;
+    forEachAxis([&](int axis){
+        int error = estimators[axis].errorBound(now);
+        if (error > worstError){
+            worst = axis;
+            worstError = error;
+        }
+    });
+    if (worst < 0){ return; }
+    lastSample = now;
+    int position;
+    int error;
+    if (readStatus(pins[worst], &position, &error) >= 0){
+        estimators[worst].sample(position, now);
+    }
+}
+
+// Returns true if every selected axis has stopped within `tolerance` encoder
+// counts of its target. Reads each stage's status once and never waits.
+template <int NAxes, class Config>
+bool BasicM3LS<NAxes, Config>::isSettled(int axes, int tolerance){
+    bool settled = true;
+    forEachAxis([&](int axis){
+        if (!(axes & (1 << axis))){ return; }
+        int position;
+        int error;
+        int status = readStatus(pins[axis], &position, &error);
+        if (status < 0){
+            settled = false;
+            return;
+        }
+        currentPosition[axis] = position;
+        estimators[axis].sample(position, Clock::millis());
+        if ((status & M3LS_STATUS_RUNNING) || abs(error) > tolerance){
+            settled = false;
+        }
+    });
+    return settled;
+}
+
+// Waits until the selected axes have settled, or `timeout` milliseconds have
+// passed. Returns false on timeout.
+template <int NAxes, class Config>
+bool BasicM3LS<NAxes, Config>::waitForSettle(int axes, int tolerance,
+    unsigned long timeout){
+    unsigned long start = Clock::millis();
+    unsigned long interval = M3LS_SETTLE_POLL_MIN_MS;
+    while (!isSettled(axes, tolerance)){
+        unsigned long elapsed = Clock::millis() - start;
+        if (elapsed >= timeout){ return false; }
+        // Back off while the stages are still on their way
+        delay(interval < timeout - elapsed ? interval : timeout - elapsed);
+        if (interval < M3LS_SETTLE_POLL_MAX_MS){ interval *= 2; }
+    }
+    return true;
+}
+
+// Calibrates every stage with a forward then a reverse frequency sweep.
+// Returns false if the stages did not finish within `timeout` milliseconds.
+template <int NAxes, class Config>
+bool BasicM3LS<NAxes, Config>::calibrate(unsigned long timeout){
+    unsigned long elapsed = 0;
+    if (!sweep('5', timeout, &elapsed) || !sweep('4', timeout, &elapsed)){
+        return false;
+    }
+    calibrationBoot = bootCount;
+    return true;
+}
+
+// Counts this boot and writes the calibration, home position, bindings and
+// sensitivity to the storage given to setStorage(). Sections keep their old
+// stamp when their contents have not changed, and the record is not written
+// unless a setting did, or the storage has no boot counter of its own.
+template <int NAxes, class Config>
+bool BasicM3LS<NAxes, Config>::saveSettings(){
+    if (storage == NULL){ return false; }
+    bool counted = storage->writeBoots(bootCount);
+    M3LSRecord old;
+    if (!storage->read(&old, sizeof(old)) ||
+        !M3LSStorage::checkHeader(old, this->getNumAxes())){
+        memset(&old, 0, sizeof(old));
+    }
+
+    M3LSRecord record;
+    memset(&record, 0, sizeof(record));
+    record.numAxes = this->getNumAxes();
+    record.boots = bootCount;
+    forEachAxis([&](int axis){
+        record.sweepFrequency[axis] = sweepFrequency[axis];
+        record.homePosition[axis] = homePosition[axis];
+    });
+    for (int button = 0; button < 20; button++){
+        record.buttonMap[button] = buttonMap[button];
+    }
+    M3LSCurvePoint curve[M3LS_CURVE_POINTS];
+    record.curvePoints = sensitivity.getCurve(curve);
+    for (int point = 0; point < record.curvePoints; point++){
+        record.curveInput[point] = curve[point].input;
+        record.curveRadius[point] = curve[point].radius;
+    }
+    record.zones = sensitivity.getZones();
+    record.inverted[0] = invertX;
+    record.inverted[1] = invertY;
+    record.inverted[2] = invertZ;
+    record.inverted[3] = invertS;
+    M3LSStorage::sealHeader(&record);
+
+    // Seal each section with the boot it last changed in
+    M3LSStorage::seal(&record.calibration, record.sweepFrequency,
+        sizeof(record.sweepFrequency), calibrationBoot);
+    M3LSStorage::seal(&record.home, record.homePosition,
+        sizeof(record.homePosition), bootCount);
+    M3LSStorage::seal(&record.bindings, record.buttonMap,
+        sizeof(record.buttonMap), bootCount);
+    M3LSStorage::seal(&record.sensitivity, record.curveRadius,
+        M3LS_SENSITIVITY_SIZE, bootCount);
+    if (memcmp(old.homePosition, record.homePosition,
+        sizeof(record.homePosition)) == 0){
+        record.home = old.home;
+    }
+    if (memcmp(old.buttonMap, record.buttonMap,
+        sizeof(record.buttonMap)) == 0){
+        record.bindings = old.bindings;
+    }
+    if (memcmp(old.curveRadius, record.curveRadius,
+        M3LS_SENSITIVITY_SIZE) == 0){
+        record.sensitivity = old.sensitivity;
+    }
+
+    // A new boot count alone is not worth rewriting the record for, once the
+    // boot counter has it
+    M3LSRecord unchanged = record;
+    if (counted){ unchanged.boots = old.boots; }
+    M3LSStorage::sealHeader(&unchanged);
+    if (memcmp(&old, &unchanged, sizeof(unchanged)) == 0){ return true; }
+    return storage->write(&record, sizeof(record));
+}
+
+// Restores whatever stored settings are intact and counts this boot. Returns
+// true if the stored calibration was recent enough to skip recalibrating.
+template <int NAxes, class Config>
+bool BasicM3LS<NAxes, Config>::loadSettings(){
+    bootCount = 1;
+    calibrationBoot = 0;
+    if (storage == NULL){ return false; }
+    uint32_t counted;
+    if (storage->readBoots(&counted)){ bootCount = counted + 1; }
+    M3LSRecord record;
+    if (!storage->read(&record, sizeof(record)) ||
+        !M3LSStorage::checkHeader(record, this->getNumAxes())){
+        return false;
+    }
+    if (record.boots + 1 > bootCount){ bootCount = record.boots + 1; }
+
+    if (M3LSStorage::check(record.home, record.homePosition,
+        sizeof(record.homePosition))){
+        forEachAxis([&](int axis){
+            homePosition[axis] = record.homePosition[axis];
+        });
+        recenter(homePosition);
+    }
+    if (M3LSStorage::check(record.bindings, record.buttonMap,
+        sizeof(record.buttonMap))){
+        for (int button = 0; button < 20; button++){
+            buttonMap[button] = (Commands)record.buttonMap[button];
+        }
+    }
+    if (M3LSStorage::check(record.sensitivity, record.curveRadius,
+        M3LS_SENSITIVITY_SIZE)){
+        M3LSCurvePoint curve[M3LS_CURVE_POINTS];
+        int points = record.curvePoints < M3LS_CURVE_POINTS ?
+            record.curvePoints : M3LS_CURVE_POINTS;
+        for (int point = 0; point < points; point++){
+            curve[point].input = record.curveInput[point];
+            curve[point].radius = record.curveRadius[point];
+        }
+        sensitivity.setCurve(curve, points);
+        sensitivity.setZones(record.zones);
+        invertX = record.inverted[0];
+        invertY = record.inverted[1];
+        invertZ = record.inverted[2];
+        invertS = record.inverted[3];
+    }
+
+    // Reuse the calibration only while it is recent
+    if (!M3LSStorage::check(record.calibration, record.sweepFrequency,
+        sizeof(record.sweepFrequency)) ||
+        bootCount - record.calibration.stamp > M3LS_WARM_START_BOOTS){
+        return false;
+    }
+
+    // The stages only keep a calibration while they are powered, so it is
+    // reused only if every stage still drives at the stored frequency
+    bool kept = true;
+    forEachAxis([&](int axis){
+        kept = kept && record.sweepFrequency[axis] != 0 &&
+            readSweepFrequency(pins[axis]) == record.sweepFrequency[axis];
+    });
+    if (!kept){ return false; }
+    calibrationBoot = record.calibration.stamp;
+    forEachAxis([&](int axis){
+        sweepFrequency[axis] = record.sweepFrequency[axis];
+    });
+    return true;
+}
+
+// Returns the resonant frequency the last calibration found for an axis
+template <int NAxes, class Config>
+int BasicM3LS<NAxes, Config>::getSweepFrequency(int axis){
+    return axis >= 0 && axis < this->getNumAxes() ? sweepFrequency[axis] : 0;
+}
+
+// Returns the SPI transport backend the library sends its frames through
+template <int NAxes, class Config>
+typename BasicM3LS<NAxes, Config>::Transport&
+BasicM3LS<NAxes, Config>::getTransport(){
+    return transport;
+}
+
+// Returns the input device the control loop follows
+template <int NAxes, class Config>
+typename BasicM3LS<NAxes, Config>::Input&
+BasicM3LS<NAxes, Config>::getInput(){
+    return input;
+}
+
+// Returns the sensitivity curve and velocity zones the control loop follows
+template <int NAxes, class Config>
+M3LSSensitivity& BasicM3LS<NAxes, Config>::getSensitivity(){
+    return sensitivity;
+}
+
+// ---------------------------------------------------------------------------
+// Private Functions
+// Runs one frequency sweep on every stage at once, then polls until all of
+// them have finished. `elapsed` accumulates the time spent waiting.
+template <int NAxes, class Config>
+bool BasicM3LS<NAxes, Config>::sweep(char direction, unsigned long timeout,
+    unsigned long *elapsed){
+    /*
+    Send to controller:
+        <87 D>\r
+        7 bytes
+        D = 4: Reverse frequency sweep
+        D = 5: Forward frequency sweep
+    Receive from controller:
+        <87 D XX FFFF>\r
+        15 bytes
+        F... : Resonant frequency found by the sweep
+    Sending <87>\r alone reports the result of the last sweep.
+    */
+
+    // Start the sweep on every stage before waiting on any of them
+    M3LSCommandFrame frames[maxAxes];
+    int count = 0;
+    forEachAxis([&](int axis){
+        frames[count].pin = pins[axis];
+        frames[count].length = 7;
+        memcpy(frames[count].data, "<87 5>\r", 7);
+        frames[count].data[4] = direction;
+        count++;
+    });
+    if (sendBatch(frames, count) < count){
+        return false;
+    }
+
+    // Wait until no stage reports its motor running
+    while (true){
+        bool running = false;
+        forEachAxis([&](int axis){
+            int position;
+            int error;
+            int status = readStatus(pins[axis], &position, &error);
+            running |= status < 0 || (status & M3LS_STATUS_RUNNING);
+        });
+        if (!running){ break; }
+        if (*elapsed >= timeout){ return false; }
+        delay(M3LS_CALIBRATION_POLL_MS);
+        *elapsed += M3LS_CALIBRATION_POLL_MS;
+    }
+
+    // Read back the frequency each stage settled on
+    forEachAxis([this](int axis){
+        int frequency = readSweepFrequency(pins[axis]);
+        if (frequency != 0){ sweepFrequency[axis] = frequency; }
+    });
+    return true;
+}
+
+// Returns the resonant frequency the stage on `pin` found in its last sweep,
+// or 0 if it has none or could not be read
+template <int NAxes, class Config>
+int BasicM3LS<NAxes, Config>::readSweepFrequency(int pin){
+    memcpy(sendChars, "<87>\r", 5);
+    if (sendSPICommand(pin, 5) < 0 || memcmp(recvChars, "<87 ", 4) != 0){
+        return 0;
+    }
+    return (int)strtoul(recvChars + 9, NULL, 16);
+}
+
+// Adjust the internal bounds along the sensitivity curve
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::setBounds(int amount){
+    radius = sensitivity.getRadius(amount);
+}
+
+// Move every selected axis to its target. Bit n of `axes` selects axis n
+// (see axisMask) and targets[n] is its target; axes this manipulator does not
+// have are ignored. All frames are encoded before any is sent, so the
+// transport can put them on the wire back to back.
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::moveAxes(int axes, const int *targets){
+    // Keep the order of a queued sequence that is still being sent
+    if (!commands.isEmpty()){
+        queueMove(axes, targets);
+        return;
+    }
+    sendMove(axes, targets);
+}
+
+// Limits an axis to [low, high] encoder counts. Returns false, keeping the
+// old limits, unless both lie within the travel in that order.
+template <int NAxes, class Config>
+bool BasicM3LS<NAxes, Config>::setSoftLimits(int axis, int low, int high){
+    if (axis >= this->getNumAxes()){ return false; }
+    return envelope.setLimits(axis, low, high);
+}
+
+// Keeps every target out of the box from low to high, inclusive, by moving
+// it along exitAxis to just past high, or just past low if exitHigh is
+// false. For the dish, that is the footprint of the dish in X and Y below
+// the floor height on Z, left upward along Z.
+template <int NAxes, class Config>
+bool BasicM3LS<NAxes, Config>::setKeepOut(const int *low, const int *high,
+    int exitAxis, bool exitHigh){
+    if (exitAxis >= this->getNumAxes()){ return false; }
+    return envelope.setKeepOut(low, high, exitAxis, exitHigh);
+}
+
+// Drops the keep-out region
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::clearKeepOut(){
+    envelope.clearKeepOut();
+}
+
+// Returns the soft limits, with their hit counters
+template <int NAxes, class Config>
+M3LSEnvelope& BasicM3LS<NAxes, Config>::getEnvelope(){
+    return envelope;
+}
+
+// Sets the frame the joystick steers in and moveInFrame() targets are given
+// in: stage = matrix * frame + offset, with the matrix row major. Its third
+// column is the needle axis. The matrix is converted to fixed point here, so
+// following the joystick never does floating point.
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::setTransform(const float *matrix,
+    const int *offset){
+    transform.configure(matrix, offset);
+    needle = 0;
+}
+
+// Steers along the stage axes again
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::clearTransform(){
+    transform.reset();
+    needle = 0;
+}
+
+// Moves every stage to a point given in the frame of setTransform(), which
+// takes three coordinates whatever the number of axes
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::moveInFrame(const int *frameTargets){
+    int targets[3];
+    transform.apply(frameTargets, targets);
+    moveAxes(allAxes, targets);
+}
+
+// Advances the needle `counts` along its axis, negative to withdraw it, from
+// wherever the stages were last sent
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::moveAlongNeedle(int counts){
+    int along[3] = {0, 0, counts};
+    int targets[3];
+    transform.rotate(along, targets);
+    forEachAxis([&](int axis){
+        targets[axis] += estimators[axis].getTarget();
+    });
+    moveAxes(allAxes, targets);
+}
+
+// Stops every stage where it is and drops any queued motion, then leaves the
+// manipulator in hold mode. The stop overtakes everything queued, so it is
+// on the wire as soon as the transaction in progress, if any, is done.
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::halt(){
+    haltRequested = micros();
+    commands.clear(M3LSCommandQueue::normal);
+    homing = false;
+    waiting = false;
+    M3LSCommand stop;
+    stop.type = M3LSCommand::Halt;
+    stop.axes = allAxes;
+    commands.push(stop, M3LSCommandQueue::urgent);
+    serviceCommands();
+}
+
+// Returns the longest time between a halt() and the stop reaching every
+// stage, in microseconds
+template <int NAxes, class Config>
+unsigned long BasicM3LS<NAxes, Config>::getStopLatency(){
+    return stopLatency;
+}
+
+// Returns the errors on the SPI link to an axis's stage, all zero for an
+// axis the manipulator does not have
+template <int NAxes, class Config>
+const M3LSLinkErrors& BasicM3LS<NAxes, Config>::getLinkErrors(int axis){
+    static const M3LSLinkErrors none = {0, 0, 0, 0, 0};
+    if (axis < 0 || axis >= this->getNumAxes()){ return none; }
+    return linkErrors[axis];
+}
+
+// Zeroes the link error counters of every axis
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::resetLinkErrors(){
+    memset(linkErrors, 0, sizeof(linkErrors));
+}
+
+// Sends the next queued command, urgent ones first. Returns false if there
+// was nothing to send, or the next command is a wait that is not over. A
+// wait that lasts M3LS_WAIT_TIMEOUT_MS abandons the sequence and halts.
+template <int NAxes, class Config>
+bool BasicM3LS<NAxes, Config>::serviceCommands(){
+    M3LSCommand command;
+    if (!commands.peek(&command)){ return false; }
+    if (!isReady(command)){
+        unsigned long now = Clock::millis();
+        if (!waiting){
+            waiting = true;
+            waitStarted = now;
+        } else if (now - waitStarted >= M3LS_WAIT_TIMEOUT_MS){
+            Logger::println("Wait timed out, halting");
+            waiting = false;
+            halt();
+            return true;
+        }
+        return false;
+    }
+    waiting = false;
+    commands.pop(&command);
+    executeCommand(command);
+    return true;
+}
+
+// Sends every queued command, waiting out any wait steps. Returns false if
+// commands are still queued after `timeout` ms.
+template <int NAxes, class Config>
+bool BasicM3LS<NAxes, Config>::flushCommands(unsigned long timeout){
+    unsigned long start = Clock::millis();
+    while (!commands.isEmpty()){
+        if (serviceCommands()){ continue; }
+        if (Clock::millis() - start >= timeout){ return false; }
+        delay(M3LS_SETTLE_POLL_MIN_MS);
+    }
+    return true;
+}
+
+// Returns the number of commands waiting to be sent
+template <int NAxes, class Config>
+int BasicM3LS<NAxes, Config>::getQueuedCommands(){
+    return commands.size(M3LSCommandQueue::urgent) +
+        commands.size(M3LSCommandQueue::normal);
+}
+
+// Queues a move behind the commands already waiting
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::queueMove(int axes, const int *targets){
+    queueStep(M3LSCommand::Move, axes, targets);
+}
+
+// Queues a step of a sequence; `values` holds one value per addressed axis,
+// or the mode of a SetMode step
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::queueStep(M3LSCommand::Type type, int axes,
+    const int *values){
+    M3LSCommand command;
+    command.type = type;
+    command.axes = axes;
+    for (int axis = 0; axis < M3LS_QUEUE_AXES; axis++){
+        bool used = axis < maxAxes && ((axes & (1 << axis)) ||
+            (type == M3LSCommand::SetMode && axis == 0));
+        command.targets[axis] = used ? values[axis] : 0;
+    }
+    queueCommand(command);
+}
+// Queues a command at normal priority, sending the oldest ones to make room
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::queueCommand(const M3LSCommand& command){
+    while (!commands.push(command, M3LSCommandQueue::normal)){
+        serviceCommands();
+    }
+}
+
+// Returns true once the condition of a wait step holds; other steps are
+// always ready
+template <int NAxes, class Config>
+bool BasicM3LS<NAxes, Config>::isReady(const M3LSCommand& command){
+    switch(command.type){
+        case M3LSCommand::WaitClear     :   return isClear(command.axes,
+                                                command.targets);
+        case M3LSCommand::WaitSettle    :   return isArrived(command.axes) &&
+                                                isSettled(command.axes,
+                                                    M3LS_HOME_TOLERANCE);
+        default                         :   return true;
+    }
+}
+
+// Returns true if every selected axis is certain to be past its threshold on
+// the side of its target. This is judged from the position estimates and
+// their error bounds, so it sends nothing.
+template <int NAxes, class Config>
+bool BasicM3LS<NAxes, Config>::isClear(int axes, const int32_t *thresholds){
+    unsigned long now = Clock::millis();
+    bool clear = true;
+    forEachAxis([&](int axis){
+        if (!(axes & (1 << axis))){ return; }
+        M3LSEstimator& estimator = estimators[axis];
+        int low = estimator.estimate(now) - estimator.errorBound(now);
+        int high = estimator.estimate(now) + estimator.errorBound(now);
+        if (estimator.getTarget() > thresholds[axis] ?
+            low < thresholds[axis] : high > thresholds[axis]){
+            clear = false;
+        }
+    });
+    return clear;
+}
+
+// Returns true if the estimates of every selected axis say it should have
+// come to rest, so a settle check is only read from the stages when it can
+// pass
+template <int NAxes, class Config>
+bool BasicM3LS<NAxes, Config>::isArrived(int axes){
+    unsigned long now = Clock::millis();
+    bool arrived = true;
+    forEachAxis([&](int axis){
+        if ((axes & (1 << axis)) && estimators[axis].isMoving(now)){
+            arrived = false;
+        }
+    });
+    return arrived;
+}
+
+// Carries out one queued command as a single transaction
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::executeCommand(const M3LSCommand& command){
+    int targets[M3LS_QUEUE_AXES];
+    switch(command.type){
+        case M3LSCommand::Move      :   for (int axis = 0;
+                                            axis < M3LS_QUEUE_AXES; axis++){
+                                            targets[axis] =
+                                                command.targets[axis];
+                                        }
+                                        sendMove(command.axes, targets);
+                                        break;
+        case M3LSCommand::Halt      :   sendHalt(command.axes);
+                                        break;
+        case M3LSCommand::SetMode   :   setControlMode(
+                                            (ControlMode)command.targets[0]);
+                                        break;
+        case M3LSCommand::SetSpeed  :   for (int axis = 0;
+                                            axis < M3LS_QUEUE_AXES; axis++){
+                                            targets[axis] =
+                                                command.targets[axis];
+                                        }
+                                        sendSpeeds(command.axes, targets);
+                                        break;
+        case M3LSCommand::Complete  :   homing = false;
+                                        break;
+        default                     :   break;
+    }
+}
+
+// Sets the closed loop speed of the selected axes in a single batch. The
+// acceleration scales with the speed, so axes given proportional speeds keep
+// pace while ramping too.
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::sendSpeeds(int axes, const int *speeds){
+    M3LSCommandFrame frames[maxAxes];
+    int count = 0;
+    forEachAxis([&](int axis){
+        if (axes & (1 << axis)){
+            moveSpeed[axis] = speeds[axis];
+            frames[count].pin = pins[axis];
+            frames[count].length = 29;
+            setSpeed(speeds[axis], (int)((long)M3LS_VELOCITY_ACCEL *
+                speeds[axis] / M3LS_POSITION_SPEED), frames[count].data);
+            count++;
+        }
+    });
+    if (count == 0){ return; }
+    sendBatch(frames, count);
+}
+
+// Drops the rest of any queued sequence and puts back the speed of ordinary
+// moves on axes it had changed
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::cancelCommands(){
+    commands.clear(M3LSCommandQueue::normal);
+    homing = false;
+    restoreSpeeds(allAxes);
+}
+
+// Restores the speed of ordinary moves on the selected axes that were being
+// driven or were moving at a planned speed
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::restoreSpeeds(int axes){
+    M3LSCommandFrame frames[maxAxes];
+    int count = 0;
+    forEachAxis([&](int axis){
+        if ((axes & (1 << axis)) && (driveSpeed[axis] != 0 ||
+            moveSpeed[axis] != M3LS_POSITION_SPEED)){
+            driveSpeed[axis] = 0;
+            moveSpeed[axis] = M3LS_POSITION_SPEED;
+            frames[count].pin = pins[axis];
+            frames[count].length = 29;
+            setSpeed(M3LS_POSITION_SPEED, M3LS_VELOCITY_ACCEL,
+                frames[count].data);
+            count++;
+        }
+    });
+    if (count > 0){
+        sendBatch(frames, count);
+    }
+}
+
+// Sends the selected axes to their targets in a single batch. Targets are
+// clamped to the soft limits first, which bounds around a center near the
+// end of travel reach, and a move into the keep-out region also moves its
+// exit axis clear.
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::sendMove(int axes, const int *targets){
+    M3LSCommandFrame frames[maxAxes];
+    int count = 0;
+    unsigned long now = Clock::millis();
+    int point[maxAxes];
+    forEachAxis([&](int axis){ point[axis] = targets[axis]; });
+    axes = limitPoint(axes, point);
+    forEachAxis([&](int axis){
+        if (axes & (1 << axis)){
+            frames[count].pin = pins[axis];
+            frames[count].length = 14;
+            setTargetPosition(point[axis], frames[count].data);
+            estimators[axis].command(point[axis], moveSpeed[axis], now);
+            count++;
+        }
+    });
+    if (count == 0){ return; }
+    sendBatch(frames, count);
+}
+
+// Clamps the selected axes of a point to the envelope, taking the other axes
+// to stay at their last targets, and returns the axes that must move: the
+// selected ones, plus any other the clamp moved
+template <int NAxes, class Config>
+int BasicM3LS<NAxes, Config>::limitPoint(int axes, int *point){
+    forEachAxis([&](int axis){
+        if (!(axes & (1 << axis))){ point[axis] = estimators[axis].getTarget(); }
+    });
+    envelope.clampPoint(point, this->getNumAxes());
+    forEachAxis([&](int axis){
+        axes |= (point[axis] != estimators[axis].getTarget()) << axis;
+    });
+    return axes;
+}
+
+// Stops the selected stages in a single batch, then restores the speed of
+// ordinary moves on any that were being driven or moving at a planned speed
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::sendHalt(int axes){
+    /*
+    Send to controller:
+        <03>\r
+        5 bytes
+    Receive from controller:
+        <03>\r
+        5 bytes
+    */
+    M3LSCommandFrame frames[maxAxes];
+    int count = 0;
+    forEachAxis([&](int axis){
+        if (axes & (1 << axis)){
+            frames[count].pin = pins[axis];
+            frames[count].length = 5;
+            memcpy(frames[count].data, "<03>\r", 5);
+            count++;
+        }
+    });
+    sendBatch(frames, count);
+    unsigned long latency = micros() - haltRequested;
+    if (latency > stopLatency){ stopLatency = latency; }
+
+    restoreSpeeds(axes);
+    currentControlMode = hold;
+
+    // The stages stopped wherever they were, so read where that is and forget
+    // the targets they were heading for
+    getCurrentPosition();
+    unsigned long now = Clock::millis();
+    forEachAxis([&](int axis){
+        if (axes & (1 << axis)){
+            estimators[axis].stop(currentPosition[axis], now);
+        }
+    });
+}
+
+// Map a joystick input to a smaller zone number, scaled by the bounds
+template <int NAxes, class Config>
+int BasicM3LS<NAxes, Config>::scaleToZones(int input){
+    return sensitivity.getZone(input) *
+        (radius / (sensitivity.getZones() * 10) + 1);
+}
+
+// Position mode in a transformed frame: joystick X and Y sweep the bounds of
+// the frame's XY plane around the center, and the Z buttons advance or
+// withdraw the needle along the frame's third axis by one zone step per tick.
+// All the stages move together, as each frame axis generally involves all of
+// them.
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::followInFrame(int inp0, int inp1, int inp2){
+    needle += scaleToZones(inp2);
+    needle = needle < -M3LS_TRAVEL_MAX ? -M3LS_TRAVEL_MAX :
+        needle > M3LS_TRAVEL_MAX ? M3LS_TRAVEL_MAX : needle;
+    int displacement[3] = {(int)map(inp0, 0, 255, -radius, radius),
+        (int)map(inp1, 0, 255, -radius, radius), needle};
+    int targets[3];
+    transform.rotate(displacement, targets);
+    forEachAxis([&](int axis){ targets[axis] += center[axis]; });
+    moveAxes(allAxes, targets);
+}
+
+// Build the frame that sets the target position to move to
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::setTargetPosition(int target, char *frame){
+    /*
+    Send to controller:
+        <08>\r
+        4 bytes
+    Receive from controller:
+        <08>\r
+        4 bytes
+        Ignored for our purposes
+    */
+
+    // Build command for the caller to send
+    memcpy(frame, "<08 ", 4);
+    sprintf(frame + 4, "%08X", target);
+    memcpy(frame + 12, ">\r", 2);
+}
+
+// Build the frame that sets the closed loop speed and acceleration
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::setSpeed(int countsPerSecond, int acceleration,
+    char *frame){
+    /*
+    Send to controller:
+        <40 SSSSSS CCCCCC AAAA IIII>\r
+        29 bytes
+        S... : Speed, encoder counts per interval
+        C... : Cutoff speed, 0 to keep the default
+        A... : Acceleration, encoder counts per interval per interval
+        I... : Interval, units are 3.2us
+    Receive from controller:
+        <40>\r
+        5 bytes
+        Ignored for our purposes
+    */
+
+    // Express the speed and acceleration per interval of 1/10 s
+    int speed = countsPerSecond / 10 > 0 ? countsPerSecond / 10 : 1;
+    sprintf(frame, "<40 %06X %06X %04X %04X>\r", speed, 0,
+        acceleration / 100, M3LS_SPEED_INTERVAL);
+}
+
+// Drive an axis toward the end of its travel at a speed given by its zone.
+// The stage's own speed control does the work, so nothing is sent until the
+// zone changes. Returning to the dead zone stops the axis where it is and
+// restores the speed of ordinary moves.
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::driveAxis(int inp, int axisNum){
+    int previous = driveSpeed[axisNum];
+    if (inp == previous){ return; }
+    driveSpeed[axisNum] = inp;
+
+    M3LSCommandFrame frames[2];
+    int count = 0;
+    if (inp == 0){
+        // Stop the stage wherever it is. Reading the position and sending it
+        // back as the target lands past it, as the stage keeps moving while
+        // the read and the move go out.
+        memcpy(frames[count].data, "<03>\r", 5);
+        frames[count++].length = 5;
+        setSpeed(M3LS_POSITION_SPEED, M3LS_VELOCITY_ACCEL, frames[count].data);
+        frames[count++].length = 29;
+        moveSpeed[axisNum] = M3LS_POSITION_SPEED;
+    } else {
+        // The zone's step per update, spread evenly over the update period
+        setSpeed(abs(inp) * 1000 / refreshRate, M3LS_VELOCITY_ACCEL,
+            frames[count].data);
+        frames[count++].length = 29;
+        // Head for the edge of the envelope, moving any other axis the
+        // keep-out region needs clear before the drive gets there
+        int point[maxAxes];
+        point[axisNum] = inp > 0 ? M3LS_TRAVEL_MAX : M3LS_TRAVEL_MIN;
+        int others = limitPoint(1 << axisNum, point) & ~(1 << axisNum);
+        if (others){ sendMove(others, point); }
+        int end = point[axisNum];
+        if (previous == 0 || (inp > 0) != (previous > 0)){
+            setTargetPosition(end, frames[count].data);
+            frames[count++].length = 14;
+        }
+        estimators[axisNum].command(end, abs(inp) * 1000 / refreshRate,
+            Clock::millis());
+    }
+    for (int frame = 0; frame < count; frame++){
+        frames[frame].pin = pins[axisNum];
+    }
+    sendBatch(frames, count);
+
+    // The stage holds where it stopped, so read where that is
+    if (inp == 0){
+        int position;
+        int error;
+        if (readStatus(pins[axisNum], &position, &error) < 0){
+            position = estimators[axisNum].estimate(Clock::millis());
+        }
+        estimators[axisNum].stop(position, Clock::millis());
+    }
+}
+
+// Steps each stage from the original timing toward the fastest level with
+// status reads, which change nothing on the stage, then runs it
+// M3LS_TIMING_MARGIN levels slower than the fastest level that passed, or at
+// the slowest level if that is past the end of the table. A stage that fails
+// even the slowest level is left there, logged and counted as a link failure.
+// Returns false if any stage failed. The transport still falls back on its
+// own if errors appear later.
+template <int NAxes, class Config>
+bool BasicM3LS<NAxes, Config>::negotiateTiming(){
+    // A level passes only if its frames get through the first time
+    int retries = linkRetries;
+    linkRetries = 0;
+    bool passed = true;
+    forEachAxis([this, &passed](int axis){
+        int fastest = -1;
+        for (int level = M3LS_TIMING_SLOWEST; level >= 0; level--){
+            transport.setTimingLevel(pins[axis], level);
+            if (!probeTiming(pins[axis])){ break; }
+            fastest = level;
+        }
+
+        // The probe fails on purpose at the levels that are too fast
+        memset(&linkErrors[axis], 0, sizeof(M3LSLinkErrors));
+        if (fastest < 0){
+            transport.setTimingLevel(pins[axis], M3LS_TIMING_SLOWEST);
+            linkErrors[axis].failures++;
+            passed = false;
+            Logger::print("Timing probe failed on pin ");
+            Logger::println(pins[axis]);
+            return;
+        }
+        int level = fastest + M3LS_TIMING_MARGIN;
+        transport.setTimingLevel(pins[axis],
+            level < M3LS_TIMING_SLOWEST ? level : M3LS_TIMING_SLOWEST);
+        Logger::print("Timing level of pin ");
+        Logger::print(pins[axis]);
+        Logger::print(": ");
+        Logger::println(transport.getTimingLevel(pins[axis]));
+    });
+    linkRetries = retries;
+    return passed;
+}
+
+// Returns true if M3LS_TIMING_PROBES status reads of a stage all come back as
+// well formed <10> replies, which readStatus() checks, that agree on its
+// position
+template <int NAxes, class Config>
+bool BasicM3LS<NAxes, Config>::probeTiming(int pin){
+    int first = 0;
+    for (int probe = 0; probe < M3LS_TIMING_PROBES; probe++){
+        int position;
+        int error;
+        if (readStatus(pin, &position, &error) < 0){ return false; }
+        if (probe == 0){ first = position; }
+        if (abs(position - first) > M3LS_ESTIMATE_BASE_ERROR){ return false; }
+    }
+    return true;
+}
+
+// Get the current position of a single stage
+template <int NAxes, class Config>
+int BasicM3LS<NAxes, Config>::getAxisPosition(int pin){
+    int position;
+    int error;
+    readStatus(pin, &position, &error);
+    return position;
+}
+
+// Read the status bits, position and position error of a single stage.
+// Returns the status bits, or -1 if no valid reply came back, in which case
+// the position is the stage's estimate rather than anything from the reply.
+template <int NAxes, class Config>
+int BasicM3LS<NAxes, Config>::readStatus(int pin, int *position, int *error){
+    /*
+    Send to controller:
+        <10>\r
+        5 bytes
+    Receive from controller:
+        <10 SSSSSS PPPPPPPP EEEEEEEE>\r
+        30 bytes
+        S... : Motor status, see datasheet
+        P... : Absolute position in encoder counts
+        E... : Position error in encoder counts
+    */
+
+    // Build command and send it to SPI
+    memcpy(sendChars, "<10>\r", 5);
+    int axis = getAxisOfPin(pin);
+    if (sendSPICommand(pin, 5) < 0){
+        *position = axis < 0 ? 0 : estimators[axis].estimate(Clock::millis());
+        *error = 0;
+        if (axis >= 0){
+            lastStatus[axis] = -1;
+            lastError[axis] = 0;
+        }
+        return -1;
+    }
+
+    // Extract the fixed width hex fields of the reply
+    char field[9];
+    memcpy(field, recvChars + 11, 8);
+    field[8] = 0;
+    *position = (int)strtoul(field, NULL, 16);
+    memcpy(field, recvChars + 20, 8);
+    *error = (int)strtoul(field, NULL, 16);
+    memcpy(field, recvChars + 4, 6);
+    field[6] = 0;
+    int status = (int)strtoul(field, NULL, 16);
+    if (axis >= 0){
+        lastStatus[axis] = status;
+        lastError[axis] = *error;
+    }
+    return status;
+}
+
+// Set the specified coordinates as the new center
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::recenter(int newx, int newy, int newz){
+    int newCenter[3] = {newx, newy, newz};
+    recenter(newCenter);
+}
+
+// Set the stored coordinates of every available axis as the new center
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::recenter(const int *newCenter){
+    forEachAxis([&](int axis){ center[axis] = newCenter[axis]; });
+    needle = 0;
+}
+
+// Sends a command over the SPI bus and writes the response to the buffer.
+// Returns 0 once the buffer holds a valid reply to the command, or -1 if none
+// came back after M3LS_LINK_RETRIES resends. Every transfer selects the
+// stage afresh, which drops any partial frame on its side, and the answer to
+// a resend overtakes a stale reply to an earlier command, so resending is
+// the whole resync: a recovered error costs one extra transaction.
+template <int NAxes, class Config>
+int BasicM3LS<NAxes, Config>::sendSPICommand(int pin, int length){
+    M3LS_PROFILE_SCOPE(Spi);
+    for (int attempt = 0; ; attempt++){
+        // Clear the buffer and hand the frame to the transport backend
+        memset(recvChars, 0, M3LS_REPLY_SIZE);
+        int received = transport.transfer(pin, sendChars, length, recvChars,
+            M3LS_REPLY_SIZE);
+        // Logger::print("Received from M3-LS:");
+        // Logger::println(recvChars);
+        if (checkReply(pin, received)){ return 0; }
+        if (attempt == linkRetries){ break; }
+        backOff(pin, attempt);
+    }
+    int axis = getAxisOfPin(pin);
+    if (axis >= 0){ linkErrors[axis].failures++; }
+    return -1;
+}
+
+// Sends a batch of frames, leaving the last reply in the buffer. The
+// transport stops at the first frame without a good reply, which is counted
+// against its stage, and the batch is resent from there. Each frame gets
+// M3LS_LINK_RETRIES resends of its own; one that still fails is skipped so
+// the rest of the batch, a halt to the other stages say, is still sent.
+// Returns the number of frames answered.
+template <int NAxes, class Config>
+int BasicM3LS<NAxes, Config>::sendBatch(const M3LSCommandFrame *frames, int count){
+    M3LS_PROFILE_SCOPE(Spi);
+    int next = 0;
+    int answered = 0;
+    int attempt = 0;
+    while (next < count){
+        memset(recvChars, 0, M3LS_REPLY_SIZE);
+        int sent = transport.transferBatch(frames + next, count - next,
+            recvChars, M3LS_REPLY_SIZE);
+        next += sent;
+        answered += sent;
+        if (next == count){ break; }
+
+        // The frame that failed is a new one unless nothing went through
+        if (sent > 0){ attempt = 0; }
+        int pin = frames[next].pin;
+        char *end = (char *)memchr(recvChars, '\r', M3LS_REPLY_SIZE);
+        int received = recvChars[0] == '<' && end ? end - recvChars + 1 : -1;
+        countReplyError(pin, frames[next].data, received);
+        if (attempt == linkRetries){
+            int axis = getAxisOfPin(pin);
+            if (axis >= 0){ linkErrors[axis].failures++; }
+            next++;
+            attempt = 0;
+            continue;
+        }
+        backOff(pin, attempt++);
+    }
+    return answered;
+}
+
+// Returns true if the buffer holds a reply echoing the opcode of the command
+// in sendChars; a status reply must also have well formed fields, as its
+// position is used as is. Anything else is counted against the stage.
+template <int NAxes, class Config>
+bool BasicM3LS<NAxes, Config>::checkReply(int pin, int received){
+    bool valid = M3LSTimingTable::echoes(sendChars, recvChars, received);
+    if (valid && memcmp(sendChars, "<10>", 4) == 0){
+        // <10 SSSSSS PPPPPPPP EEEEEEEE>\r
+        valid = received == 30 && recvChars[3] == ' ' &&
+            recvChars[28] == '>';
+        for (int i = 4; valid && i < 28; i++){
+            bool separator = i == 10 || i == 19;
+            valid = separator ? recvChars[i] == ' ' : isxdigit(recvChars[i]);
+        }
+    }
+    if (valid){ return true; }
+    countReplyError(pin, sendChars, received);
+    return false;
+}
+
+// Counts the bad reply in the buffer to the command in `send` against the
+// stage on `pin`: missing, a well formed answer to another command, or
+// garbled
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::countReplyError(int pin, const char *send,
+    int received){
+    int axis = getAxisOfPin(pin);
+    if (axis < 0){ return; }
+    if (received < 0){
+        linkErrors[axis].noReply++;
+    } else if (received >= 4 && recvChars[0] == '<' &&
+        recvChars[received - 1] == '\r' && isdigit(recvChars[1]) &&
+        isdigit(recvChars[2]) && (recvChars[1] != send[1] ||
+        recvChars[2] != send[2])){
+        linkErrors[axis].stale++;
+    } else {
+        linkErrors[axis].malformed++;
+    }
+}
+
+// Counts a resend to the stage on `pin` and waits before it, twice as long
+// for each earlier resend of the same frame
+template <int NAxes, class Config>
+void BasicM3LS<NAxes, Config>::backOff(int pin, int attempt){
+    int axis = getAxisOfPin(pin);
+    if (axis >= 0){ linkErrors[axis].retries++; }
+    delayMicroseconds(M3LS_LINK_BACKOFF_US << attempt);
+}
+
+// Returns the axis whose stage is on `pin`, or -1 if there is none
+template <int NAxes, class Config>
+int BasicM3LS<NAxes, Config>::getAxisOfPin(int pin){
+    int found = -1;
+    forEachAxis([&](int axis){
+        if (pins[axis] == pin){ found = axis; }
+    });
+    return found;
+}
+
+#endif
@@ -0,0 +1,146 @@
+/*
+M3LSPolicies.h - Policies that BasicM3LS is configured with: where its
+                 transport, input device, clock and log output come from
+Copyright info?
+*/
+
+#ifndef M3LSPolicies_h
+#define M3LSPolicies_h
+
+#include "Arduino.h"
+#include "M3LSTransport.h"
+
+#ifndef MOCK
+    #include "hidjoystickrptparser.h"
+    #include <usbhid.h>
+    #include <hiduniversal.h>
+    #include <usbhub.h>
+#endif
+
+// Uncomment to have the default configuration log to Serial
+// #define DEBUG
+
+// Clock read by the control loop, settle waits, position estimates and
+// telemetry
+struct M3LSArduinoClock {
+    static unsigned long millis(){ return ::millis(); }
+    static unsigned long micros(){ return ::micros(); }
+};
+
+// Logger that discards everything, so log statements cost nothing
+struct M3LSNullLogger {
+    static void begin(){}
+    template <class T> static void print(const T&){}
+    static void println(){}
+    template <class T> static void println(const T&){}
+};
+
+// Logger that writes to Serial at 115200 baud
+struct M3LSSerialLogger {
+    static void begin(){ Serial.begin(115200); }
+    template <class T> static void print(const T& value){ Serial.print(value); }
+    static void println(){ Serial.println(); }
+    template <class T> static void println(const T& value){
+        Serial.println(value);
+    }
+};
+
+/*
+Input devices. An input policy reports the joystick axes (0-255, centered at
+127) and a bit vector of buttons, refreshed by task() once per refresh tick.
+When `present` is false run() leaves out the joystick handling entirely.
+*/
+
+// No input device; the stages are driven only through the API
+struct M3LSNoInput {
+    static constexpr bool present = false;
+    void begin(){}
+    void task(){}
+    int getButtons(){ return 0; }
+    int getX(){ return 127; }
+    int getY(){ return 127; }
+    int getZ(){ return 127; }
+};
+
+// Input set by the caller, e.g. a test driving run() on the host
+class M3LSScriptedInput {
+    public:
+        static constexpr bool present = true;
+        M3LSScriptedInput() : x(127), y(127), z(127), buttons(0) {}
+        void begin(){}
+        void task(){}
+        void set(int newX, int newY, int newZ){ x = newX; y = newY; z = newZ; }
+        void setButtons(int newButtons){ buttons = newButtons; }
+        int getButtons(){ return buttons; }
+        int getX(){ return x; }
+        int getY(){ return y; }
+        int getZ(){ return z; }
+    private:
+        int x;
+        int y;
+        int z;
+        int buttons;
+};
+
+#ifndef MOCK
+// Joystick on a USB host shield
+class M3LSUsbJoystick {
+    public:
+        static constexpr bool present = true;
+        M3LSUsbJoystick() : Usb(), Hub(&Usb), Hid(&Usb), Joy(&JoyEvents) {
+            current.x = current.y = current.z = 127;
+            current.buttons = 0;
+            pressed = 0;
+        }
+        void begin(){
+            Usb.Init();
+            Hid.SetReportParser(0, &Joy);
+        }
+        // Takes every report published since the last tick. The axes follow
+        // the newest, and a button counts as held if any report had it down,
+        // so a press shorter than a tick is still seen.
+        void task(){
+            Usb.Task();
+            pressed = 0;
+            M3LSJoystickSnapshot report;
+            while (Joy.getReports().pop(&report)){
+                current = report;
+                pressed |= report.buttons;
+            }
+        }
+        int getButtons(){ return current.buttons | pressed; }
+        int getX(){ return current.x; }
+        int getY(){ return current.y; }
+        int getZ(){ return current.z; }
+    private:
+        M3LSJoystickSnapshot current;
+        uint16_t pressed;
+        // USB Shield
+        USB Usb;
+        USBHub Hub;
+        HIDUniversal Hid;
+        JoystickEvents JoyEvents;
+        JoystickReportParser Joy;
+};
+#endif
+
+// The configuration M3LS is built with: the transport chosen in
+// M3LSTransport.h, the USB joystick on hardware and none on the host, and log
+// output only with DEBUG. To change one policy, derive from this and
+// redeclare that typedef.
+struct M3LSDefaultConfig {
+    typedef M3LSTransport Transport;
+#ifdef MOCK
+    typedef M3LSNoInput Input;
+#else
+    typedef M3LSUsbJoystick Input;
+#endif
+    typedef M3LSArduinoClock Clock;
+#ifdef DEBUG
+    typedef M3LSSerialLogger Logger;
+#else
+    typedef M3LSNullLogger Logger;
+#endif
+};
+
+#endif
@@ -0,0 +1,77 @@
+/*
+M3LSProfile.h - Optional timing of each phase of BasicM3LS::run() and of every
+                SPI transaction, kept in a fixed table that can be printed
+Copyright info?
+*/
+
+#ifndef M3LSProfile_h
+#define M3LSProfile_h
+
+#include "Arduino.h"
+#include <stdint.h>
+
+// Uncomment to time the phases of run(). The host build turns this on with
+// cmake -Dprofile=ON. Without it the timers compile to nothing.
+// #define M3LS_PROFILE
+
+// Running totals for one phase, in clock ticks
+struct M3LSProfileEntry {
+    uint32_t count;
+    uint64_t total;
+    uint32_t max;
+};
+
+/*
+Clock and table behind the timers. On the Due the clock is the Cortex-M3 DWT
+cycle counter, one tick per MCK cycle; elsewhere, including the host where it
+follows the mock's virtual clock, it is micros(). Phases nest: Run covers a
+whole refresh tick including the phases inside it, and every SPI transaction
+is also counted in the phase that issued it.
+*/
+class M3LSProfiler {
+    public:
+        enum Phase {Run, UsbTask, Buttons, Position, Bounds, Commands,
+            Estimates, Spi, NumPhases};
+        static void begin();
+        static uint32_t now();
+        static uint32_t ticksPerMicrosecond();
+        static void record(Phase phase, uint32_t ticks);
+        static const M3LSProfileEntry& get(Phase phase);
+        static void reset();
+        static void dump(Stream& out);
+    private:
+        static M3LSProfileEntry entries[NumPhases];
+        static const char *const names[NumPhases];
+};
+
+// Times the rest of the enclosing scope
+class M3LSProfileScope {
+    public:
+        M3LSProfileScope(M3LSProfiler::Phase phase)
+            : phase(phase), start(M3LSProfiler::now()) {}
+        ~M3LSProfileScope(){
+            M3LSProfiler::record(phase, M3LSProfiler::now() - start);
+        }
+    private:
+        M3LSProfiler::Phase phase;
+        uint32_t start;
+};
+
+#ifdef M3LS_PROFILE
+    #define M3LS_PROFILE_CONCAT2(a, b) a##b
+    #define M3LS_PROFILE_CONCAT(a, b) M3LS_PROFILE_CONCAT2(a, b)
+    // Times the rest of the enclosing scope
+    #define M3LS_PROFILE_SCOPE(phase) M3LSProfileScope \
+        M3LS_PROFILE_CONCAT(profileScope, __LINE__)(M3LSProfiler::phase)
+    // Time a stretch of code that cannot be put in its own scope
+    #define M3LS_PROFILE_BEGIN(phase) \
+        uint32_t profileStart##phase = M3LSProfiler::now()
+    #define M3LS_PROFILE_END(phase) M3LSProfiler::record(M3LSProfiler::phase, \
+        M3LSProfiler::now() - profileStart##phase)
+#else
+    #define M3LS_PROFILE_SCOPE(phase)
+    #define M3LS_PROFILE_BEGIN(phase)
+    #define M3LS_PROFILE_END(phase)
+#endif
+
+#endif
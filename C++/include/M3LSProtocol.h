@@ -0,0 +1,150 @@
+/*
+M3LSProtocol.h - Framed binary protocol for driving the M3LS library from a
+                 host over a serial port. This file has no Arduino
+                 dependencies so the firmware and the host client share it.
+Copyright info?
+*/
+
+#ifndef M3LSProtocol_h
+#define M3LSProtocol_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+Frame layout:
+    A5 LEN SEQ TYPE PAYLOAD[LEN] CRCL CRCH
+    A5      Start of frame
+    LEN     Payload length, 0 to M3LS_MAX_PAYLOAD
+    SEQ     Sequence number, echoed by the device in its reply
+    TYPE    Message type, see below
+    CRC     CRC-16/CCITT over LEN, SEQ, TYPE and PAYLOAD, little endian
+
+Flow control:
+    The host may have up to M3LS_PROTOCOL_WINDOW frames in flight. The device
+    executes frames strictly in sequence order and replies to each one. A
+    frame ahead of the expected sequence number is answered with
+    statusOutOfOrder and the host goes back to the expected frame; a frame
+    behind it is a retransmission and is answered with statusDuplicate
+    without being executed again. A sync frame is accepted with any sequence
+    number and restarts the window after it.
+
+Telemetry:
+    Once the host sends StreamTelemetry, the device samples its stages at the
+    given interval and sends the samples in Telemetry frames of their own,
+    outside the window. Their SEQ counts telemetry frames, so the host can
+    tell how many were lost.
+*/
+
+#define M3LS_FRAME_START        0xA5
+#define M3LS_MAX_PAYLOAD        250
+#define M3LS_FRAME_OVERHEAD     6
+#define M3LS_MAX_FRAME          (M3LS_MAX_PAYLOAD + M3LS_FRAME_OVERHEAD)
+#define M3LS_PROTOCOL_WINDOW    8
+#define M3LS_PROTOCOL_AXES      3
+
+// Worst case encoded size of one varint
+#define M3LS_MAX_VARINT         5
+
+// Number of values in one telemetry sample
+#define M3LS_TELEMETRY_FIELDS   (7 + 3 * M3LS_PROTOCOL_AXES)
+
+// One telemetry sample: the state of the manipulator and every stage's reply
+// to a status read (<10>)
+struct M3LSTelemetrySample {
+    uint32_t time;                          // micros() at the sample
+    uint8_t mode;                           // control mode
+    int32_t radius;                         // bounds the joystick maps onto
+    uint8_t joystick[3];                    // X, Y and Z, 0-255
+    uint16_t buttons;                       // bit vector of buttons held
+    int32_t position[M3LS_PROTOCOL_AXES];   // encoder counts
+    int32_t error[M3LS_PROTOCOL_AXES];      // position error, encoder counts
+    int32_t status[M3LS_PROTOCOL_AXES];     // status bits, -1 if no answer
+};
+
+class M3LSProtocol {
+    public:
+        // Host to device messages
+        enum Requests {
+            Sync        = 0x01,  // no payload
+            SetMode     = 0x02,  // mode
+            GetStatus   = 0x03,  // no payload
+            Waypoints   = 0x04,  // count, count * axes zigzag varint deltas
+            Start       = 0x05,  // interval ms (u16)
+            Stop        = 0x06,  // no payload
+            Move        = 0x07,  // axes * target (i32)
+            StreamTelemetry = 0x08   // interval us (u32), 0 to stop
+        };
+        // Device to host messages
+        enum Replies {
+            Ack         = 0x80,  // status, expected seq, free waypoints (u16)
+            Status      = 0x81,  // Ack payload, mode, axes, queued (u16),
+                                 // playing, axes * position (i32)
+            Telemetry   = 0x82   // count, samples dropped (varint),
+                                 // count * fields zigzag varint deltas
+        };
+        enum StatusCodes {statusOk, statusDuplicate, statusOutOfOrder,
+            statusFull, statusBadRequest};
+
+        // Checksums and framing
+        static uint16_t crc16(const uint8_t *data, size_t length,
+            uint16_t crc = 0xFFFF);
+        static int encodeFrame(uint8_t seq, uint8_t type,
+            const uint8_t *payload, int length, uint8_t *out);
+
+        // Integer packing
+        static int putVarint(int32_t value, uint8_t *out);
+        static int getVarint(const uint8_t *in, int length, int32_t *value);
+        static void putU16(uint16_t value, uint8_t *out);
+        static uint16_t getU16(const uint8_t *in);
+        static void putI32(int32_t value, uint8_t *out);
+        static int32_t getI32(const uint8_t *in);
+
+        // Waypoint batches: the first point is a delta from zero so every
+        // frame decodes on its own, later points are deltas from the previous
+        static int encodeWaypoints(const int32_t (*points)[M3LS_PROTOCOL_AXES],
+            int count, int axes, uint8_t *out, int capacity, int *encoded);
+        static int decodeWaypoints(const uint8_t *in, int length, int axes,
+            int32_t (*points)[M3LS_PROTOCOL_AXES], int capacity);
+
+        // Telemetry batches, delta encoded field by field like waypoints.
+        // `dropped` counts samples the device discarded before this batch.
+        static int encodeTelemetry(const M3LSTelemetrySample *samples,
+            int count, uint32_t dropped, uint8_t *out, int capacity,
+            int *encoded);
+        static int decodeTelemetry(const uint8_t *in, int length,
+            M3LSTelemetrySample *samples, int capacity, uint32_t *dropped);
+        static void packTelemetry(const M3LSTelemetrySample& sample,
+            uint32_t *fields);
+        static void unpackTelemetry(const uint32_t *fields,
+            M3LSTelemetrySample *sample);
+};
+
+// A complete frame as delivered by the decoder
+struct M3LSFrame {
+    uint8_t seq;
+    uint8_t type;
+    uint8_t length;
+    uint8_t payload[M3LS_MAX_PAYLOAD];
+};
+
+// Reassembles frames from a byte stream, one byte at a time. Bytes that do
+// not form a valid frame are skipped until the next start byte.
+class M3LSFrameDecoder {
+    public:
+        M3LSFrameDecoder();
+        bool push(uint8_t byte);
+        const M3LSFrame& getFrame();
+        unsigned long getErrorCount();
+        void reset();
+    private:
+        enum State {waitStart, waitLength, waitSeq, waitType, waitPayload,
+            waitCrcLow, waitCrcHigh};
+        State state;
+        M3LSFrame frame;
+        uint8_t received;
+        uint16_t crc;
+        unsigned long errors;
+};
+
+#endif
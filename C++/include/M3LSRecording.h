@@ -0,0 +1,134 @@
+/*
+M3LSRecording.h - Records the joystick input of a session so that it can be
+                  exported and replayed through run() later
+Copyright info?
+*/
+
+#ifndef M3LSRecording_h
+#define M3LSRecording_h
+
+#include "Arduino.h"
+#include "M3LSPolicies.h"
+#include <stdint.h>
+
+// Bytes a recording holds. A tick in which the joystick moved takes about
+// five bytes and a tick in which nothing changed takes none.
+#define M3LS_RECORDING_SIZE 8192
+
+// Identifies an exported recording
+#define M3LS_RECORDING_MAGIC 0x4352334DUL
+
+// Input reported to one refresh tick, and when it was read in milliseconds
+// from the start of the recording
+struct M3LSInputState {
+    uint32_t time;
+    uint8_t x;
+    uint8_t y;
+    uint8_t z;
+    uint16_t buttons;
+};
+
+/*
+Buffer of input states. Only states that differ from the one before are
+appended, each as zigzag varint deltas of its time and inputs from the
+previous state, so a recording stays small while the operator holds still.
+Exported recordings carry a header and a checksum:
+    magic (u32), length (u32), data[length], CRC-16/CCITT of data (u16)
+all little endian.
+*/
+class M3LSRecording {
+    public:
+        M3LSRecording();
+        void clear();
+        bool append(const M3LSInputState& state);
+        void rewind();
+        bool next(M3LSInputState *state);
+        int getSize();
+        const uint8_t *getData();
+        bool isFull();
+        // Import and export
+        bool load(const uint8_t *exported, int size);
+        void write(Stream& out);
+#if defined(MOCK)
+        bool saveFile(const char *path);
+        bool loadFile(const char *path);
+#endif
+    private:
+        uint8_t data[M3LS_RECORDING_SIZE];
+        int size;
+        bool full;
+        // Last state appended, and where next() has read up to
+        uint32_t lastFields[5];
+        int readOffset;
+        uint32_t readFields[5];
+        void seal(uint8_t *header, uint8_t *trailer);
+};
+
+// Input policy that passes another one through and appends every change to
+// a recording. Timestamps come from Clock and start at record().
+template <class Input, class Clock = M3LSArduinoClock>
+class M3LSRecordingInput : public Input {
+    public:
+        M3LSRecordingInput() : recording(NULL), start(0) {}
+        // Starts appending to `newRecording`, or stops for NULL
+        void record(M3LSRecording *newRecording){
+            recording = newRecording;
+            start = Clock::millis();
+        }
+        void task(){
+            Input::task();
+            if (recording == NULL){ return; }
+            M3LSInputState state;
+            state.time = Clock::millis() - start;
+            state.x = this->getX();
+            state.y = this->getY();
+            state.z = this->getZ();
+            state.buttons = this->getButtons();
+            recording->append(state);
+        }
+    private:
+        M3LSRecording *recording;
+        unsigned long start;
+};
+
+// Input policy that plays a recording back. Each tick sees the last state
+// recorded at or before the time since play(), so the session runs at the
+// speed it was recorded at and, given the same clock, identically each time.
+template <class Clock = M3LSArduinoClock>
+class M3LSReplayInput {
+    public:
+        static constexpr bool present = true;
+        M3LSReplayInput() : recording(NULL), start(0), pending(false) {
+            current.x = current.y = current.z = 127;
+            current.buttons = 0;
+        }
+        void begin(){}
+        // Starts playing `newRecording` from its beginning
+        void play(M3LSRecording *newRecording){
+            recording = newRecording;
+            recording->rewind();
+            pending = recording->next(&upcoming);
+            start = Clock::millis();
+        }
+        // Returns true until every recorded state has been played
+        bool isPlaying(){ return pending; }
+        void task(){
+            unsigned long elapsed = Clock::millis() - start;
+            while (pending && upcoming.time <= elapsed){
+                current = upcoming;
+                pending = recording->next(&upcoming);
+            }
+        }
+        int getButtons(){ return current.buttons; }
+        int getX(){ return current.x; }
+        int getY(){ return current.y; }
+        int getZ(){ return current.z; }
+    private:
+        M3LSRecording *recording;
+        unsigned long start;
+        bool pending;
+        M3LSInputState current;
+        M3LSInputState upcoming;
+};
+
+#endif
@@ -0,0 +1,61 @@
+/*
+M3LSSensitivity.h - Sensitivity curve from the joystick's throttle to the
+                    bounds the joystick sweeps, and the zones of its axes
+                    in velocity mode, both kept as lookup tables
+Copyright info?
+*/
+
+#ifndef M3LSSensitivity_h
+#define M3LSSensitivity_h
+
+#include <stdint.h>
+
+// Control points a curve can have
+#define M3LS_CURVE_POINTS 8
+
+// Velocity zones by default, and the most there can be
+#define M3LS_ZONES 7
+#define M3LS_ZONES_MAX 15
+
+// A control point: the bounds radius, in encoder counts, at a throttle input
+struct M3LSCurvePoint {
+    uint8_t input;
+    uint16_t radius;
+};
+
+/*
+The curve is a list of control points from input 0 to input 255, joined by
+straight segments, with the radius never falling as the input rises. It is
+compiled into a 256-entry table when it is set, as is the zone of every axis
+input, so the control loop only ever indexes the tables.
+
+The default curve is the one the library always had: fine control up to
+half throttle (10 to 500 counts), coarse above it (500 to 5500 counts).
+*/
+class M3LSSensitivity {
+    public:
+        M3LSSensitivity();
+        void reset();
+        bool setCurve(const M3LSCurvePoint *points, int count);
+        bool setZones(int newNumZones);
+        int getZones(){ return numZones; }
+        int getCurve(M3LSCurvePoint *points);
+        // Radius at a throttle input of 0-255
+        int getRadius(int input){ return radii[clamp(input)]; }
+        // Zone of an axis input of 0-255, 0 in the middle
+        int getZone(int input){ return zones[clamp(input)]; }
+        unsigned long getRebuilds(){ return rebuilds; }
+    private:
+        M3LSCurvePoint curve[M3LS_CURVE_POINTS];
+        int curvePoints;
+        uint16_t radii[256];
+        int8_t zones[256];
+        int numZones;
+        unsigned long rebuilds;
+        static int clamp(int input){
+            return input < 0 ? 0 : input > 255 ? 255 : input;
+        }
+        void buildZones();
+};
+
+#endif
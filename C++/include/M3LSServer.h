@@ -0,0 +1,82 @@
+/*
+M3LSServer.h - Dispatches frames of the M3LS binary protocol received on a
+               serial port onto an M3LS instance
+Copyright info?
+*/
+
+#ifndef M3LSServer_h
+#define M3LSServer_h
+
+#include "Arduino.h"
+#include "M3LS.h"
+#include "M3LSProtocol.h"
+
+// Number of waypoints the device can hold ahead of playback
+#define M3LS_WAYPOINT_CAPACITY 512
+
+// Number of telemetry samples held while they wait to be sent, and how many
+// are gathered before a frame goes out. When the port cannot keep up the
+// oldest samples are dropped.
+// Sampling never reads the stages, so it costs no SPI time inside poll().
+// Positions are the estimates; status and error are as of the last status
+// read the manipulator made, which run() refreshes every
+// M3LS_ESTIMATE_SAMPLE_MS while an estimate is uncertain.
+#define M3LS_TELEMETRY_CAPACITY 64
+#define M3LS_TELEMETRY_BATCH 8
+
+template <class Manipulator>
+class BasicM3LSServer{
+    public:
+        // Constructor
+        BasicM3LSServer(Manipulator& manipulator, Stream& serialPort);
+        // Event loop: reads and answers frames, samples telemetry, then plays
+        // back waypoints
+        void poll();
+        bool isPlaying();
+        int getQueuedWaypoints();
+        unsigned long getErrorCount();
+        void setTelemetryInterval(unsigned long microseconds);
+        unsigned long getTelemetryDropped();
+    private:
+        // Variables
+        Manipulator& m3;
+        Stream& port;
+        M3LSFrameDecoder decoder;
+        uint8_t expectedSeq;
+        int32_t waypoints[M3LS_WAYPOINT_CAPACITY][M3LS_PROTOCOL_AXES];
+        int waypointHead;
+        int waypointCount;
+        bool playing;
+        unsigned long interval;
+        unsigned long lastMillis;
+        uint8_t replyChars[M3LS_MAX_FRAME];
+        M3LSTelemetrySample telemetry[M3LS_TELEMETRY_CAPACITY];
+        int telemetryHead;
+        int telemetryCount;
+        uint32_t telemetryDropped;
+        unsigned long totalDropped;
+        unsigned long telemetryInterval;
+        unsigned long lastTelemetry;
+        uint8_t telemetrySeq;
+        // Functions
+        void dispatch(const M3LSFrame& frame);
+        uint8_t execute(const M3LSFrame& frame);
+        uint8_t queueWaypoints(const M3LSFrame& frame);
+        void moveTo(const int32_t *targets);
+        int buildAck(uint8_t status, uint8_t *payload);
+        void sendAck(uint8_t seq, uint8_t status);
+        void sendStatus(uint8_t seq, uint8_t status);
+        void sampleTelemetry(unsigned long now);
+        void sendTelemetry();
+};
+
+// Instantiated in M3LSServer.cc for every axis count
+extern template class BasicM3LSServer<BasicM3LS<M3LS_DYNAMIC_AXES> >;
+extern template class BasicM3LSServer<BasicM3LS<1> >;
+extern template class BasicM3LSServer<BasicM3LS<2> >;
+extern template class BasicM3LSServer<BasicM3LS<3> >;
+
+// Server for the original, constructor configured M3LS
+typedef BasicM3LSServer<M3LS> M3LSServer;
+
+#endif
@@ -0,0 +1,110 @@
+/*
+M3LSSnapshotRing.h - Lock-free ring that hands immutable snapshots from one
+                     producer, such as a USB callback, to one consumer
+Copyright info?
+*/
+
+#ifndef M3LSSnapshotRing_h
+#define M3LSSnapshotRing_h
+
+#include <stdint.h>
+
+// Joystick reports that can wait between two refresh ticks
+#define M3LS_JOYSTICK_REPORTS 16
+
+// One joystick report as the control loop sees it. Reports are numbered in
+// the order they were published, so a consumer can tell how many it skipped.
+struct M3LSJoystickSnapshot {
+    uint32_t sequence;
+    uint8_t x;
+    uint8_t y;
+    uint8_t z;
+    uint16_t buttons;
+};
+
+/*
+Single-producer/single-consumer ring of snapshots. The producer copies a
+whole snapshot into a free slot before publishing it, and the consumer copies
+it out before releasing the slot, so neither ever sees a snapshot the other
+is halfway through. Each index is written by one side only and published
+with release/acquire ordering, so no locks or interrupt masking are needed;
+on the Cortex-M3 a 32-bit load or store is a single instruction.
+
+When the ring is full push() refuses the snapshot and counts it as dropped:
+the producer never writes a slot the consumer may be reading. Capacity must
+be a power of two.
+*/
+template <class T, unsigned Capacity>
+class M3LSSnapshotRing {
+        static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+            "capacity must be a power of two");
+    public:
+        M3LSSnapshotRing() : head(0), tail(0), dropped(0) {}
+
+        // Producer: publishes a snapshot, returns false if the ring is full
+        bool push(const T& snapshot){
+            unsigned next = __atomic_load_n(&head, __ATOMIC_RELAXED);
+            if (next - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) == Capacity){
+                __atomic_store_n(&dropped,
+                    __atomic_load_n(&dropped, __ATOMIC_RELAXED) + 1,
+                    __ATOMIC_RELAXED);
+                return false;
+            }
+            slots[next & (Capacity - 1)] = snapshot;
+            __atomic_store_n(&head, next + 1, __ATOMIC_RELEASE);
+            return true;
+        }
+
+        // Consumer: takes the oldest snapshot, returns false if there is none
+        bool pop(T *snapshot){
+            unsigned first = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+            if (first == __atomic_load_n(&head, __ATOMIC_ACQUIRE)){
+                return false;
+            }
+            *snapshot = slots[first & (Capacity - 1)];
+            __atomic_store_n(&tail, first + 1, __ATOMIC_RELEASE);
+            return true;
+        }
+
+        // Consumer: takes the newest snapshot and discards the older ones,
+        // returns false if there is none
+        bool takeNewest(T *snapshot){
+            unsigned end = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+            if (end == __atomic_load_n(&tail, __ATOMIC_RELAXED)){
+                return false;
+            }
+            *snapshot = slots[(end - 1) & (Capacity - 1)];
+            __atomic_store_n(&tail, end, __ATOMIC_RELEASE);
+            return true;
+        }
+
+        // Consumer: takes up to `max` snapshots, oldest first, and returns
+        // how many it took
+        int drain(T *snapshots, int max){
+            int taken = 0;
+            while (taken < max && pop(snapshots + taken)){ taken++; }
+            return taken;
+        }
+
+        // Consumer: returns the number of snapshots waiting
+        unsigned getCount(){
+            return __atomic_load_n(&head, __ATOMIC_ACQUIRE) -
+                __atomic_load_n(&tail, __ATOMIC_RELAXED);
+        }
+
+        // Returns the number of snapshots refused because the ring was full
+        unsigned long getDropped(){
+            return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+        }
+    private:
+        T slots[Capacity];
+        // Free-running counts of snapshots published and taken
+        unsigned head;
+        unsigned tail;
+        unsigned long dropped;
+};
+
+typedef M3LSSnapshotRing<M3LSJoystickSnapshot, M3LS_JOYSTICK_REPORTS>
+    M3LSJoystickRing;
+
+#endif
@@ -0,0 +1,138 @@
+/*
+M3LSStorage.h - Non-volatile storage for the calibration and user settings of
+                an M3LS, so that begin() can skip recalibrating after a reset
+Copyright info?
+*/
+
+#ifndef M3LSStorage_h
+#define M3LSStorage_h
+
+#include "Arduino.h"
+#include <stdint.h>
+#include <stddef.h>
+#include "M3LSSensitivity.h"
+
+// Identifies a record written by this library, and its layout version
+#define M3LS_STORAGE_MAGIC 0x534C334DUL
+#define M3LS_STORAGE_VERSION 2
+
+// A stored calibration is reused for this many power cycles after the one it
+// was made in. The boards have no real time clock, so every timestamp in the
+// record is the boot count it was taken at. Every boot is counted in a boot
+// counter kept apart from the record, so boots that change no setting never
+// rewrite the record.
+#define M3LS_WARM_START_BOOTS 16
+
+// Slots the EEPROM boot counter rotates through, to spread its wear
+#define M3LS_BOOT_SLOTS 8
+
+// Stamp and checksum kept in front of each section of a record
+struct M3LSSection {
+    uint32_t stamp;
+    uint16_t checksum;
+    uint16_t valid;
+};
+
+// Everything that is persisted, laid out exactly as it is stored
+struct M3LSRecord {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t numAxes;
+    uint32_t boots;
+    uint16_t reserved;
+    uint16_t checksum;
+    // Calibration results
+    M3LSSection calibration;
+    int32_t sweepFrequency[3];
+    // Home position
+    M3LSSection home;
+    int32_t homePosition[3];
+    // Button bindings
+    M3LSSection bindings;
+    uint8_t buttonMap[20];
+    // Sensitivity: curve control points, velocity zones and axis inversion
+    // flags
+    M3LSSection sensitivity;
+    uint16_t curveRadius[M3LS_CURVE_POINTS];
+    uint8_t curveInput[M3LS_CURVE_POINTS];
+    uint8_t curvePoints;
+    uint8_t zones;
+    uint8_t inverted[4];
+};
+
+// Bytes of the sensitivity section, which runs from the curve to the flags
+#define M3LS_SENSITIVITY_SIZE (offsetof(M3LSRecord, inverted) + \
+    sizeof(((M3LSRecord *)0)->inverted) - offsetof(M3LSRecord, curveRadius))
+
+/*
+Byte storage a record is kept in. Backends only move bytes; the checksums,
+stamps and layout checks live in the static helpers below so every backend
+treats a torn or stale record the same way.
+*/
+class M3LSStorage {
+    public:
+        virtual ~M3LSStorage() {}
+        // Reads `size` bytes from the start of storage
+        virtual bool read(void *data, int size) = 0;
+        // Replaces the start of storage with `size` bytes
+        virtual bool write(const void *data, int size) = 0;
+        // Boot counter kept apart from the record, where counting a boot
+        // wears the storage far less than rewriting the record. A counter
+        // never written reads 0. Backends without one return false, and the
+        // count is then only kept in the record.
+        virtual bool readBoots(uint32_t *boots){ (void)boots; return false; }
+        virtual bool writeBoots(uint32_t boots){ (void)boots; return false; }
+
+        // Record helpers
+        static void seal(M3LSSection *section, const void *data, int size,
+            uint32_t stamp);
+        static bool check(const M3LSSection& section, const void *data,
+            int size);
+        static void sealHeader(M3LSRecord *record);
+        static bool checkHeader(const M3LSRecord& record, int numAxes);
+};
+
+#if defined(ARDUINO_ARCH_SAM) && !defined(MOCK)
+// Keeps the record in the last pages of the second flash bank of the SAM3X,
+// which a sketch upload erases. Writes go through the EFC's erase and write
+// page command, one page at a time. The boot counter has the page in front of
+// the record: a base count and a bitmap, one bit cleared per boot, so the
+// page is only erased once every bit is used.
+class DueFlashStorage : public M3LSStorage {
+    public:
+        bool read(void *data, int size);
+        bool write(const void *data, int size);
+        bool readBoots(uint32_t *boots);
+        bool writeBoots(uint32_t boots);
+};
+#endif
+
+#if defined(ARDUINO_ARCH_AVR) && !defined(MOCK)
+// Keeps the record at the start of the on-chip EEPROM. Unchanged bytes are
+// not rewritten. The boot counter follows the record, in M3LS_BOOT_SLOTS
+// slots that take turns.
+class EEPROMStorage : public M3LSStorage {
+    public:
+        bool read(void *data, int size);
+        bool write(const void *data, int size);
+        bool readBoots(uint32_t *boots);
+        bool writeBoots(uint32_t boots);
+};
+#endif
+
+#if defined(MOCK)
+// Keeps the record in a file, which stands in for flash in host tests. The
+// boot counter follows the record in the same file.
+class FileStorage : public M3LSStorage {
+    public:
+        FileStorage(const char *path);
+        bool read(void *data, int size);
+        bool write(const void *data, int size);
+        bool readBoots(uint32_t *boots);
+        bool writeBoots(uint32_t boots);
+    private:
+        const char *path;
+};
+#endif
+
+#endif
@@ -0,0 +1,38 @@
+/*
+M3LSTransform.h - Fixed point mapping from the frame the operator steers in,
+                  such as one aligned with an angled needle, to stage axes
+Copyright info?
+*/
+
+#ifndef M3LSTransform_h
+#define M3LSTransform_h
+
+#include <stdint.h>
+
+// Fraction bits of the fixed point matrix elements
+#define M3LS_TRANSFORM_SHIFT 16
+
+/*
+Affine map from frame coordinates p to stage coordinates s:
+    s = M p + offset
+M is configured once from floats and kept as Q15.16 integers, so mapping a
+point costs nine 32x32->64 bit multiply-accumulates (SMLAL on the Cortex-M3)
+and three shifts, with no floating point. The columns of M are the frame's
+axes expressed in stage counts; the third column is the needle axis.
+*/
+class M3LSTransform {
+    public:
+        M3LSTransform();
+        void reset();
+        void configure(const float *matrix, const int *newOffset);
+        bool isIdentity();
+        void apply(const int *frame, int *stage);
+        void rotate(const int *displacement, int *stage);
+        const int32_t *getMatrix();
+    private:
+        int32_t matrix[9];
+        int offset[3];
+        bool identity;
+};
+
+#endif
@@ -0,0 +1,215 @@
+/*
+M3LSTransport.h - SPI transport backends used by the M3LS library to move
+                  command frames to the M3-LS stages and read their replies
+Copyright info?
+*/
+
+#ifndef M3LSTransport_h
+#define M3LSTransport_h
+
+#include "Arduino.h"
+#include "SPI.h"
+
+// The transport is chosen at compile time so the hot path never goes through
+// a virtual call. Uncomment one of the lines below to override the default,
+// which is the blocking backend on hardware and the loopback backend on the
+// host (MOCK) build.
+// #define M3LS_TRANSPORT_BLOCKING
+// #define M3LS_TRANSPORT_DMA
+// #define M3LS_TRANSPORT_LOOPBACK
+
+// Size of the receive buffer every backend fills with a reply frame
+#define M3LS_REPLY_SIZE 100
+
+// Number of filler bytes polled for the start of a reply before giving up
+#define M3LS_REPLY_POLLS 100
+
+// Minimum delay between two bytes on the wire, in microseconds
+#define M3LS_BYTE_DELAY_US 60
+
+// Timing levels run from the fastest clock and gap the library will try, at
+// level 0, to the original 2 MHz and M3LS_BYTE_DELAY_US gap at the slowest
+// level, which every stage starts at
+#define M3LS_TIMING_LEVELS 6
+#define M3LS_TIMING_SLOWEST (M3LS_TIMING_LEVELS - 1)
+
+// Number of chip selects the timing of each backend is kept for
+#define M3LS_TIMING_SLOTS 8
+
+// A stage is moved one level slower after this many consecutive replies that
+// do not echo the command they answer
+#define M3LS_TIMING_FALLBACK_ERRORS 2
+
+// Motor status bit of a <10> reply that is set while the motor is running
+#define M3LS_STATUS_RUNNING 0x000004
+
+// Size of an encoded command frame, with room for sprintf's terminator
+#define M3LS_COMMAND_SIZE 32
+
+// A command frame addressed to one stage, encoded ahead of a batch transfer
+struct M3LSCommandFrame {
+    int pin;
+    int length;
+    char data[M3LS_COMMAND_SIZE];
+};
+
+// SPI clock and inter-byte gap a stage is driven with
+struct M3LSTiming {
+    uint32_t clock;
+    int byteDelay;
+};
+
+// Timing level of each chip select. Every backend keeps one and reports the
+// outcome of each frame to it, so a stage whose replies stop echoing their
+// commands falls back to slower timing without the library stepping in.
+class M3LSTimingTable {
+    public:
+        M3LSTimingTable();
+        const M3LSTiming& get(int pin);
+        int getLevel(int pin);
+        void setLevel(int pin, int level);
+        void record(int pin, const char *send, const char *recv,
+            int received);
+        static bool echoes(const char *send, const char *recv, int received);
+        static const M3LSTiming levels[M3LS_TIMING_LEVELS];
+    private:
+        int pins[M3LS_TIMING_SLOTS];
+        int level[M3LS_TIMING_SLOTS];
+        int errors[M3LS_TIMING_SLOTS];
+        int getSlot(int pin);
+};
+
+/*
+Frame-level contract shared by every backend:
+    transfer(pin, send, length, recv, recvSize)
+        Selects the stage on `pin`, clocks out the `length` byte command
+        frame in `send`, then clocks out filler bytes (0x01) until the stage
+        has answered with a complete reply frame "<...>\r". The reply is
+        stored at the start of `recv` and its length is returned, or -1 if
+        the reply did not fit in `recvSize` bytes. The frame is clocked at
+        the pin's timing level.
+    transferBatch(frames, count, recv, recvSize)
+        Sends `count` frames back to back, each to the stage on its own pin,
+        and leaves the reply to the last one in `recv`. Stops at the first
+        frame without a reply echoing its opcode, leaving what arrived of
+        that reply in `recv`. Returns the number of frames answered before
+        it, so `count` on success.
+    setTimingLevel(pin, level), getTimingLevel(pin)
+        Select and report the timing level of the stage on `pin`.
+*/
+
+// Clocks each byte from the CPU through the global SPI object. At the slowest
+// timing level this is the library's original behavior: 2 MHz, SPI mode 1
+// and 60us between bytes.
+class BlockingSPITransport {
+    public:
+        void begin();
+        int transfer(int pin, const char *send, int length, char *recv,
+            int recvSize);
+        int transferBatch(const M3LSCommandFrame *frames, int count,
+            char *recv, int recvSize);
+        void setTimingLevel(int pin, int level);
+        int getTimingLevel(int pin);
+    private:
+        M3LSTimingTable timing;
+        int exchange(int pin, const char *send, int length, char *recv,
+            int recvSize);
+};
+
+#if defined(M3LS_TRANSPORT_DMA)
+// Moves whole frames with the SAM3X DMA controller. The SPI peripheral inserts
+// the inter-byte gap itself (DLYBCT), and a DMAC interrupt advances the frame
+// from the command to the reply phase, so the CPU is free while a frame is on
+// the wire. The USB host shield shares the bus, so nothing else may use SPI
+// until isBusy() returns false.
+class DmaSPITransport {
+    public:
+        void begin();
+        int transfer(int pin, const char *send, int length, char *recv,
+            int recvSize);
+        int transferBatch(const M3LSCommandFrame *frames, int count,
+            char *recv, int recvSize);
+        // Asynchronous interface: start a frame or a batch, then poll for
+        // completion. A batch's frames must stay valid until it is done.
+        void start(int pin, const char *send, int length, char *recv,
+            int recvSize);
+        void startBatch(const M3LSCommandFrame *frames, int count,
+            char *recv, int recvSize);
+        bool isBusy();
+        int result();
+        void setTimingLevel(int pin, int level);
+        int getTimingLevel(int pin);
+};
+#endif
+
+#if defined(MOCK) || defined(M3LS_TRANSPORT_LOOPBACK)
+// Maximum number of stages a loopback transport can simulate
+#define M3LS_LOOPBACK_STAGES 8
+
+// Host-side stand-in for the stages. Each chip select gets a tiny model of an
+// M3-LS that answers the commands the library sends, so frames can be checked
+// without any hardware. Each frame takes the time it would on the wire, as
+// measured by micros(). Scripted replies take precedence over the model.
+// Moves complete instantly unless a stage is given a speed, in which case it
+// covers that many counts each time its status is read. Frequency sweeps
+// likewise finish at once unless given a length in status reads. A stage can
+// be given the fastest timing level its cabling carries; frames sent faster
+// than that get a reply whose opcode echo has a flipped bit.
+class LoopbackTransport {
+    public:
+        LoopbackTransport();
+        void begin();
+        int transfer(int pin, const char *send, int length, char *recv,
+            int recvSize);
+        int transferBatch(const M3LSCommandFrame *frames, int count,
+            char *recv, int recvSize);
+        // Test hooks
+        void setPosition(int pin, int position);
+        void setSpeed(int pin, int countsPerPoll);
+        void setSweepLength(int pin, int polls);
+        void setFrequency(int pin, int frequency);
+        void setTimingLimit(int pin, int level);
+        int getPosition(int pin);
+        int getTarget(int pin);
+        int getDriveSpeed(int pin);
+        bool isClosedLoop(int pin);
+        void queueReply(int pin, const char *reply);
+        unsigned long getFrameCount(int pin);
+        const char *getLastFrame(int pin);
+        void setTimingLevel(int pin, int level);
+        int getTimingLevel(int pin);
+    private:
+        struct Stage {
+            int pin;
+            int position;
+            int target;
+            int speed;
+            int driveSpeed;
+            int sweepLength;
+            int sweeping;
+            int frequency;
+            int timingLimit;
+            char sweepDirection;
+            bool closedLoop;
+            unsigned long frames;
+            char lastFrame[M3LS_REPLY_SIZE];
+            char scripted[M3LS_REPLY_SIZE];
+        };
+        Stage stages[M3LS_LOOPBACK_STAGES];
+        M3LSTimingTable timing;
+        Stage *getStage(int pin);
+        int respond(Stage *stage, const char *send, int length, char *reply);
+};
+#endif
+
+// Resolve the backend the library will use
+#if defined(M3LS_TRANSPORT_DMA)
+    typedef DmaSPITransport M3LSTransport;
+#elif defined(M3LS_TRANSPORT_LOOPBACK) || \
+      (defined(MOCK) && !defined(M3LS_TRANSPORT_BLOCKING))
+    typedef LoopbackTransport M3LSTransport;
+#else
+    typedef BlockingSPITransport M3LSTransport;
+#endif
+
+#endif
@@ -0,0 +1,14 @@
+/*
+M3LSTravel.h - Travel of an M3-LS stage, shared by the manipulator and the
+               pieces that check targets against it
+Copyright info?
+*/
+
+#ifndef M3LSTravel_h
+#define M3LSTravel_h
+
+// Encoder counts at either end of a stage's travel
+#define M3LS_TRAVEL_MIN 0
+#define M3LS_TRAVEL_MAX 12000
+
+#endif
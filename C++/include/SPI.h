@@ -3,8 +3,11 @@
 #ifndef __SPI_h__
 #define __SPI_h__
 
-#include <gmock/gmock.h>
 #include <stdint.h>
+#include <stddef.h>
+#ifndef ARDUINO_FAKE
+#include <gmock/gmock.h>
+#endif
 
 class SPISettings {
     uint32_t _a;
@@ -12,7 +15,7 @@ class SPISettings {
     uint8_t _c;
   public:
     SPISettings(uint32_t a, uint8_t b, uint8_t c): _a(a), _b(b), _c(c) {}
-    SPISettings();
+    SPISettings(): _a(0), _b(0), _c(0) {}
     bool operator==(const SPISettings& rhs)const {
       return _a == rhs._a && _b == rhs._b && _c == rhs._c;
     }
@@ -38,6 +41,45 @@ class SPI_ {
 
 extern SPI_ SPI;
 
+#ifdef ARDUINO_FAKE
+// Bytes of scripted responses the fake holds
+#define SPI_FAKE_SCRIPT 4096
+
+// Stand-in for the SPI peripheral without gmock. transfer() answers with the
+// scripted bytes in order, then with the responder if one is set, and with
+// the idle byte otherwise. Every call is counted.
+class SPIFake {
+  public:
+    typedef uint8_t (*Responder)(uint8_t sent, void *context);
+    SPIFake();
+    void reset();
+    bool queueResponse(const uint8_t *bytes, size_t length);
+    size_t getScripted();
+    void setResponder(Responder newResponder, void *newContext);
+    void setIdleByte(uint8_t newIdle);
+    uint8_t exchange(uint8_t sent);
+
+    // Calls and bytes since the last reset(), and the settings of the last
+    // transaction
+    unsigned long begins;
+    unsigned long transactions;
+    unsigned long openTransactions;
+    unsigned long bytes;
+    SPISettings settings;
+
+  private:
+    uint8_t script[SPI_FAKE_SCRIPT];
+    size_t scriptHead;
+    size_t scriptLength;
+    Responder responder;
+    void *context;
+    uint8_t idle;
+};
+
+SPIFake* SPIFakeInstance();
+void releaseSPIFake();
+
+#else
 class SPIMock {
   public:
     MOCK_METHOD0(begin, void());
@@ -58,5 +100,6 @@ class SPIMock {
 
 SPIMock* SPIMockInstance();
 void releaseSPIMock();
+#endif
 
 #endif
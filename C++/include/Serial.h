@@ -0,0 +1,56 @@
+// Header for Serial Mock
+
+#ifndef __Serial_h__
+#define __Serial_h__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Subset of the Arduino Stream/Print interface the library relies on
+class Stream {
+  public:
+    virtual ~Stream() {}
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() = 0;
+    virtual size_t write(uint8_t) = 0;
+    virtual size_t write(const uint8_t *, size_t);
+    size_t print(const char *);
+    size_t print(char);
+    size_t print(int);
+    size_t print(unsigned int);
+    size_t print(long);
+    size_t print(unsigned long);
+    size_t println(void);
+    size_t println(const char *);
+    size_t println(char);
+    size_t println(int);
+    size_t println(unsigned int);
+    size_t println(long);
+    size_t println(unsigned long);
+};
+
+// Serial port backed by a file descriptor, typically one end of a pty. While
+// no descriptor is attached, reads find nothing and writes are discarded.
+class Serial_ : public Stream {
+    int fd;
+    int peeked;
+  public:
+    Serial_();
+    void begin(unsigned long);
+    void end();
+    int available();
+    int read();
+    int peek();
+    void flush();
+    size_t write(uint8_t);
+    size_t write(const uint8_t *, size_t);
+    operator bool() { return true; }
+    // Host only: connect the port to a descriptor, -1 to disconnect
+    void attach(int);
+};
+
+extern Serial_ Serial;
+
+#endif
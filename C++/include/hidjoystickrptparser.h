@@ -2,6 +2,7 @@
 #define __HIDJOYSTICKRPTPARSER_H__
 
 #include <usbhid.h>
+#include "M3LSSnapshotRing.h"
 
 struct GamePadEventData {
         uint8_t X, Y, Z1, Z2, Rz, A, B;
@@ -23,6 +24,10 @@ class JoystickReportParser : public HIDReportParser {
         uint16_t oldButtons;
         JoystickType jtype;
 
+        // Reports handed to the control loop, and the number of the next one
+        M3LSJoystickRing reports;
+        uint32_t sequence;
+
 public:
         JoystickReportParser(JoystickEvents *evt);
 
@@ -33,6 +38,10 @@ public:
         uint8_t getZ();
 
         uint16_t getButtons();
+
+        // Snapshots of every changed report, safe to read from the control
+        // loop while the USB callback publishes more
+        M3LSJoystickRing& getReports();
 };
 
 #endif // __HIDJOYSTICKRPTPARSER_H__
@@ -0,0 +1,229 @@
+/*
+M3LSSimulation.cc - Runs many independent M3LS instances against loopback
+                    stages in parallel, checking invariants as they go
+Copyright info?
+*/
+
+#include "M3LSSimulation.h"
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+using ::testing::_;
+using ::testing::AnyNumber;
+
+// Virtual time of the pair running on this thread, in milliseconds
+static thread_local unsigned long simMillis = 0;
+
+unsigned long M3LSSimClock::millis(){
+    return simMillis;
+}
+
+unsigned long M3LSSimClock::micros(){
+    return simMillis * 1000;
+}
+
+void M3LSSimClock::reset(){
+    simMillis = 0;
+}
+
+void M3LSSimClock::advance(unsigned long milliseconds){
+    simMillis += milliseconds;
+}
+
+// ---------------------------------------------------------------------------
+// Input
+M3LSSimInput::M3LSSimInput(){
+    replaying = false;
+    state = 1;
+    x = y = z = 127;
+    buttons = 0;
+}
+
+// Starts a new random walk; a seed of 0 is replaced as xorshift would stall
+void M3LSSimInput::seed(uint32_t newSeed){
+    state = newSeed != 0 ? newSeed : 1;
+}
+
+// Replays a recording instead of walking at random
+void M3LSSimInput::play(M3LSRecording *recording){
+    replay.play(recording);
+    replaying = true;
+}
+
+// Moves every axis a few counts and, once in about 64 ticks, presses one of
+// the first six buttons for a tick
+void M3LSSimInput::task(){
+    if (replaying){
+        replay.task();
+        return;
+    }
+    x = walk(x);
+    y = walk(y);
+    z = walk(z);
+    buttons = random() % 64 == 0 ? 1 << (random() % 6) : 0;
+}
+
+// ---------------------------------------------------------------------------
+// Private Functions
+// Returns the next number of a xorshift32 sequence
+uint32_t M3LSSimInput::random(){
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// Moves an axis up to 8 counts either way, staying within 0-255
+int M3LSSimInput::walk(int value){
+    value += (int)(random() % 17) - 8;
+    return value < 0 ? 0 : value > 255 ? 255 : value;
+}
+
+// ---------------------------------------------------------------------------
+// Harness
+M3LSSimulation::M3LSSimulation(const M3LSSimOptions& newOptions){
+    options = newOptions;
+    results.resize(options.pairs);
+}
+
+// Allows the hardware calls begin() makes on the mock, any number of times
+// and from any thread
+void M3LSSimulation::expectHardware(){
+    ArduinoMock* arduinoMock = arduinoMockInstance();
+    SPIMock* spiMock = SPIMockInstance();
+    EXPECT_CALL(*arduinoMock, millis()).Times(AnyNumber());
+    EXPECT_CALL(*arduinoMock, delay(_)).Times(AnyNumber());
+    EXPECT_CALL(*arduinoMock, pinMode(_, _)).Times(AnyNumber());
+    EXPECT_CALL(*arduinoMock, digitalWrite(_, _)).Times(AnyNumber());
+    EXPECT_CALL(*spiMock, begin()).Times(AnyNumber());
+}
+
+// Runs every pair on `threads` workers and reports the aggregate throughput
+M3LSSimReport M3LSSimulation::run(int threads){
+    if (threads < 1){ threads = 1; }
+
+    // Deal the pairs out round robin
+    std::vector<std::deque<int> > shares(threads);
+    std::vector<std::mutex> locks(threads);
+    for (int pair = 0; pair < options.pairs; pair++){
+        shares[pair % threads].push_back(pair);
+    }
+
+    // Each worker empties its own share, then steals from the others
+    auto worker = [&](int self){
+        for (;;){
+            int pair = -1;
+            for (int offset = 0; offset < threads && pair < 0; offset++){
+                int victim = (self + offset) % threads;
+                std::lock_guard<std::mutex> guard(locks[victim]);
+                if (shares[victim].empty()){ continue; }
+                if (offset == 0){
+                    pair = shares[victim].front();
+                    shares[victim].pop_front();
+                } else {
+                    pair = shares[victim].back();
+                    shares[victim].pop_back();
+                }
+            }
+            if (pair < 0){ return; }
+            runPair(pair);
+        }
+    };
+
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int self = 1; self < threads; self++){
+        workers.push_back(std::thread(worker, self));
+    }
+    worker(0);
+    for (size_t index = 0; index < workers.size(); index++){
+        workers[index].join();
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    M3LSSimReport report;
+    report.threads = threads;
+    report.ticks = 0;
+    report.violations = 0;
+    for (int pair = 0; pair < options.pairs; pair++){
+        report.ticks += results[pair].ticks;
+        report.violations += results[pair].outOfTravel +
+            results[pair].desyncs;
+    }
+    report.seconds = elapsed.count();
+    report.ticksPerSecond = report.seconds > 0 ?
+        report.ticks / report.seconds : 0;
+    return report;
+}
+
+// Returns the outcome of a pair from the last run()
+const M3LSSimPairResult& M3LSSimulation::getResult(int pair){
+    return results[pair];
+}
+
+// Drives one manipulator through its ticks, checking every checkInterval
+// ticks that its stages stayed within travel and that the positions it reads
+// over SPI are the ones the stages report
+void M3LSSimulation::runPair(int pair){
+    M3LSSimPairResult& result = results[pair];
+    memset(&result, 0, sizeof(result));
+    result.checksum = 2166136261u;
+    M3LSSimClock::reset();
+
+    int pins[] = {1, 2, 3};
+    M3LSSimManipulator *m3 = new M3LSSimManipulator(pins[0], pins[1],
+        pins[2]);
+    m3->bindButton(1, M3LS::ActiveMovement);
+    m3->bindButton(2, M3LS::ToggleHold);
+    m3->bindButton(3, M3LS::ToggleVelocity);
+    m3->bindButton(4, M3LS::CenterAxes);
+    m3->bindButton(5, M3LS::ReturnHome);
+    m3->bindButton(6, M3LS::Stop);
+    m3->getInput().seed(options.seed ^ (uint32_t)(pair + 1) * 2654435761u);
+    m3->begin();
+
+    // Replaying moves the read position of a recording, so each pair reads
+    // its own copy
+    M3LSRecording *recording = NULL;
+    if (options.recording != NULL){
+        recording = new M3LSRecording(*options.recording);
+        m3->getInput().play(recording);
+    }
+    LoopbackTransport& stages = m3->getTransport();
+
+    for (int tick = 0; tick < options.ticks; tick++){
+        M3LSSimClock::advance(M3LS_SIM_TICK_MS);
+        m3->run();
+        result.ticks++;
+        for (int axis = 0; axis < 3; axis++){
+            // FNV-1a over the targets
+            uint32_t target = (uint32_t)stages.getTarget(pins[axis]);
+            for (int byte = 0; byte < 4; byte++){
+                result.checksum ^= (target >> (8 * byte)) & 0xFF;
+                result.checksum *= 16777619u;
+            }
+        }
+        if (options.checkInterval <= 0 ||
+            (tick + 1) % options.checkInterval != 0){
+            continue;
+        }
+
+        result.checks++;
+        m3->getCurrentPosition();
+        for (int axis = 0; axis < 3; axis++){
+            int target = stages.getTarget(pins[axis]);
+            if (target < M3LS_TRAVEL_MIN || target > M3LS_TRAVEL_MAX){
+                result.outOfTravel++;
+            }
+            if (m3->getEstimatedPosition(axis) !=
+                stages.getPosition(pins[axis])){
+                result.desyncs++;
+            }
+        }
+    }
+    delete m3;
+    delete recording;
+}
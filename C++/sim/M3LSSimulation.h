@@ -0,0 +1,119 @@
+/*
+M3LSSimulation.h - Runs many independent M3LS instances against loopback
+                   stages in parallel, checking invariants as they go
+Copyright info?
+*/
+
+#ifndef M3LSSimulation_h
+#define M3LSSimulation_h
+
+#include "M3LSImpl.h"
+#include "M3LSRecording.h"
+#include <stdint.h>
+#include <vector>
+
+// Milliseconds of virtual time between two refresh ticks of a pair
+#define M3LS_SIM_TICK_MS 20
+
+// Clock policy of a simulated manipulator. Each host thread has its own
+// virtual clock, which a pair resets when it starts and advances by a tick
+// at a time, so a pair runs identically whichever thread it lands on.
+struct M3LSSimClock {
+    static unsigned long millis();
+    static unsigned long micros();
+    static void reset();
+    static void advance(unsigned long milliseconds);
+};
+
+/*
+Input policy of a simulated manipulator: either a replayed recording or a
+seeded random walk of the joystick, with a bound button pressed now and then.
+*/
+class M3LSSimInput {
+    public:
+        static constexpr bool present = true;
+        M3LSSimInput();
+        void begin(){}
+        void seed(uint32_t newSeed);
+        void play(M3LSRecording *recording);
+        void task();
+        int getButtons(){ return replaying ? replay.getButtons() : buttons; }
+        int getX(){ return replaying ? replay.getX() : x; }
+        int getY(){ return replaying ? replay.getY() : y; }
+        int getZ(){ return replaying ? replay.getZ() : z; }
+    private:
+        M3LSReplayInput<M3LSSimClock> replay;
+        bool replaying;
+        uint32_t state;
+        int x;
+        int y;
+        int z;
+        int buttons;
+        uint32_t random();
+        int walk(int value);
+};
+
+// Loopback stages, the per-thread clock and the simulated joystick
+struct M3LSSimConfig : M3LSDefaultConfig {
+    typedef LoopbackTransport Transport;
+    typedef M3LSSimInput Input;
+    typedef M3LSSimClock Clock;
+    typedef M3LSNullLogger Logger;
+};
+
+typedef BasicM3LS<3, M3LSSimConfig> M3LSSimManipulator;
+
+// What to simulate. Every pair gets its own seed derived from `seed`; with a
+// recording every pair replays it instead of walking at random.
+struct M3LSSimOptions {
+    int pairs;
+    int ticks;
+    uint32_t seed;
+    // Ticks between two invariant checks
+    int checkInterval;
+    M3LSRecording *recording;
+};
+
+// Outcome of one pair. The checksum covers every stage target after every
+// tick, so two runs of a pair did the same thing if their checksums match.
+struct M3LSSimPairResult {
+    unsigned long ticks;
+    unsigned long checks;
+    // Stage targets outside the travel of the stage
+    unsigned long outOfTravel;
+    // Positions read over SPI that disagree with the stage
+    unsigned long desyncs;
+    uint32_t checksum;
+};
+
+// Outcome of a whole run
+struct M3LSSimReport {
+    int threads;
+    unsigned long ticks;
+    unsigned long violations;
+    double seconds;
+    double ticksPerSecond;
+};
+
+/*
+Runs every pair of a manipulator and its loopback stages to completion as one
+task of a work-stealing pool: each worker takes pairs from the front of its
+own share and, once that is empty, steals from the back of another's.
+
+Only begin() reaches the Arduino mock, through calls gmock serializes, and
+the loopback stages only advance its atomic micros() counter. Call
+expectHardware() to allow those calls from every thread before run().
+*/
+class M3LSSimulation {
+    public:
+        M3LSSimulation(const M3LSSimOptions& newOptions);
+        M3LSSimReport run(int threads);
+        const M3LSSimPairResult& getResult(int pair);
+        static void expectHardware();
+    private:
+        M3LSSimOptions options;
+        std::vector<M3LSSimPairResult> results;
+        void runPair(int pair);
+};
+
+#endif
@@ -0,0 +1,86 @@
+/*
+m3lssim.cc - Runs the simulation harness at increasing thread counts and
+             reports how its throughput scales
+Copyright info?
+*/
+
+#include "M3LSSimulation.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <unistd.h>
+
+static void usage(){
+    fprintf(stderr,
+        "usage: m3lssim [-p pairs] [-t ticks] [-j threads] [-s seed]"
+        " [-c interval] [-r recording]\n"
+        "    -p  manipulator and stage pairs to run (default 256)\n"
+        "    -t  refresh ticks per pair (default 2000)\n"
+        "    -j  most threads to scale up to (default: every core)\n"
+        "    -s  seed of the random joystick walks (default 1)\n"
+        "    -c  ticks between invariant checks (default 10)\n"
+        "    -r  replay an exported recording instead of walking\n");
+}
+
+int main(int argc, char **argv){
+    M3LSSimOptions options;
+    options.pairs = 256;
+    options.ticks = 2000;
+    options.seed = 1;
+    options.checkInterval = 10;
+    options.recording = NULL;
+    int maxThreads = std::thread::hardware_concurrency();
+    const char *recordingPath = NULL;
+
+    int option;
+    while ((option = getopt(argc, argv, "p:t:j:s:c:r:")) != -1){
+        switch(option){
+            case 'p'    :   options.pairs = atoi(optarg);
+                            break;
+            case 't'    :   options.ticks = atoi(optarg);
+                            break;
+            case 'j'    :   maxThreads = atoi(optarg);
+                            break;
+            case 's'    :   options.seed = strtoul(optarg, NULL, 0);
+                            break;
+            case 'c'    :   options.checkInterval = atoi(optarg);
+                            break;
+            case 'r'    :   recordingPath = optarg;
+                            break;
+            default     :   usage();
+                            return 2;
+        }
+    }
+    if (maxThreads < 1){ maxThreads = 1; }
+
+    static M3LSRecording recording;
+    if (recordingPath != NULL){
+        if (!recording.loadFile(recordingPath)){
+            fprintf(stderr, "m3lssim: cannot load %s\n", recordingPath);
+            return 1;
+        }
+        options.recording = &recording;
+    }
+
+    M3LSSimulation::expectHardware();
+    M3LSSimulation simulation(options);
+
+    // Double the threads each run, ending on the most asked for
+    printf("threads\tticks/s\tspeedup\tviolations\n");
+    double single = 0;
+    int failed = 0;
+    for (int threads = 1; ; threads *= 2){
+        if (threads > maxThreads){ threads = maxThreads; }
+        M3LSSimReport report = simulation.run(threads);
+        if (threads == 1){ single = report.ticksPerSecond; }
+        printf("%d\t%.0f\t%.2f\t%lu\n", report.threads, report.ticksPerSecond,
+            single > 0 ? report.ticksPerSecond / single : 0,
+            report.violations);
+        failed |= report.violations != 0;
+        if (threads == maxThreads){ break; }
+    }
+
+    releaseArduinoMock();
+    releaseSPIMock();
+    return failed;
+}
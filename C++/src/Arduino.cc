@@ -17,6 +17,7 @@ void releaseArduinoMock() {
 
 ArduinoMock::ArduinoMock() {
   currentMillis = 0;
+  currentMicros = 0;
 }
 
 void pinMode(uint8_t a, uint8_t b) {
@@ -54,14 +55,19 @@ unsigned long millis(void) {
 }
 
 unsigned long micros(void) {
-  return 0;
+  if (arduinoMock == NULL) {
+    return 0;
+  }
+  return arduinoMock->getMicros();
 }
 void delay(unsigned long a) {
   assert (arduinoMock != NULL);
   arduinoMock->delay(a);
 }
 void delayMicroseconds(unsigned int us) {
-  UNUSED(us);
+  if (arduinoMock != NULL) {
+    arduinoMock->addMicrosRaw(us);
+  }
 }
 
 unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeout) {
@@ -0,0 +1,122 @@
+#include "Arduino.h"
+
+static ArduinoFake* arduinoFake = NULL;
+ArduinoFake* arduinoFakeInstance() {
+  if(!arduinoFake) {
+    arduinoFake = new ArduinoFake();
+  }
+  return arduinoFake;
+}
+
+void releaseArduinoFake() {
+  if(arduinoFake) {
+    delete arduinoFake;
+    arduinoFake = NULL;
+  }
+}
+
+ArduinoFake::ArduinoFake() {
+  reset();
+}
+
+// Returns every pin, counter and the clock to power on
+void ArduinoFake::reset() {
+  memset(mode, 0, sizeof(mode));
+  memset(level, 0, sizeof(level));
+  memset(analogValue, 0, sizeof(analogValue));
+  pinModes = 0;
+  digitalWrites = 0;
+  digitalReads = 0;
+  analogReads = 0;
+  delays = 0;
+  millisReads = 0;
+  currentMillis = 0;
+  currentMicros = 0;
+}
+
+// Calls made before a test creates the fake find it created for them
+static ArduinoFake* fakeBoard() {
+  return arduinoFakeInstance();
+}
+
+void pinMode(uint8_t a, uint8_t b) {
+  ArduinoFake* board = fakeBoard();
+  board->pinModes++;
+  if (a < ARDUINO_FAKE_PINS) {
+    board->mode[a] = b;
+  }
+}
+void digitalWrite(uint8_t a, uint8_t b) {
+  ArduinoFake* board = fakeBoard();
+  board->digitalWrites++;
+  if (a < ARDUINO_FAKE_PINS) {
+    board->level[a] = b;
+  }
+}
+
+int digitalRead(uint8_t a) {
+  ArduinoFake* board = fakeBoard();
+  board->digitalReads++;
+  return a < ARDUINO_FAKE_PINS ? board->level[a] : LOW;
+}
+
+int analogRead(uint8_t a) {
+  ArduinoFake* board = fakeBoard();
+  board->analogReads++;
+  return a < ARDUINO_FAKE_PINS ? board->analogValue[a] : 0;
+}
+
+void analogReference(uint8_t mode) {
+  UNUSED(mode);
+}
+
+void analogWrite(uint8_t a, int b) {
+  UNUSED(a);
+  UNUSED(b);
+}
+
+unsigned long millis(void) {
+  ArduinoFake* board = fakeBoard();
+  board->millisReads++;
+  return board->getMillis();
+}
+
+unsigned long micros(void) {
+  return fakeBoard()->getMicros();
+}
+void delay(unsigned long a) {
+  ArduinoFake* board = fakeBoard();
+  board->delays++;
+  board->addMillisRaw(a);
+}
+void delayMicroseconds(unsigned int us) {
+  fakeBoard()->addMicrosRaw(us);
+}
+
+unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeout) {
+  UNUSED(pin);
+  UNUSED(state);
+  UNUSED(timeout);
+  return 0;
+}
+
+void shiftOut(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder,
+              uint8_t val) {
+  UNUSED(dataPin);
+  UNUSED(clockPin);
+  UNUSED(bitOrder);
+  UNUSED(val);
+}
+
+uint8_t shiftIn(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder) {
+  UNUSED(dataPin);
+  UNUSED(clockPin);
+  UNUSED(bitOrder);
+  return 0;
+}
+
+void attachInterrupt(uint8_t, void (*)(void), int mode) {
+  UNUSED(mode);
+}
+
+void detachInterrupt(uint8_t) {}
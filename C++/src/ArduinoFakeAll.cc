@@ -0,0 +1,4 @@
+#include "ArduinoFake.cc"
+#include "SPIFake.cc"
+#include "Serial.cc"
+#include "M3LSAll.cc"
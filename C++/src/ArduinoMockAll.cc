@@ -1,3 +1,4 @@
 #include "Arduino.cc"
 #include "SPI.cc"
-#include "M3LS.cc"
\ No newline at end of file
+#include "Serial.cc"
+#include "M3LSAll.cc"
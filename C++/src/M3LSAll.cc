@@ -0,0 +1,13 @@
+#include "M3LSTransport.cc"
+#include "M3LSStorage.cc"
+#include "M3LSEstimator.cc"
+#include "M3LSTransform.cc"
+#include "M3LSSensitivity.cc"
+#include "M3LSEnvelope.cc"
+#include "M3LSCommandQueue.cc"
+#include "M3LSProfile.cc"
+#include "M3LSRecording.cc"
+#include "M3LSBus.cc"
+#include "M3LS.cc"
+#include "M3LSProtocol.cc"
+#include "M3LSServer.cc"
@@ -0,0 +1,300 @@
+/*
+M3LSBus.cc - Arbiter that lets several M3LS instances share one SPI bus, with
+             their command frames merged into shared batches
+Copyright info?
+*/
+
+#include "M3LSBus.h"
+#include <string.h>
+
+// Returns true for a stop frame, which is never held back
+static bool isStop(const M3LSCommandFrame& frame){
+    return frame.length == 5 && memcmp(frame.data, "<03>\r", 5) == 0;
+}
+
+// Returns the microseconds since `start`
+static unsigned long elapsedSince(unsigned long start){
+    return micros() - start;
+}
+
+M3LSBus::M3LSBus(){
+    started = false;
+    policy = fair;
+    numClients = 0;
+    nextClient = 0;
+    usageStart = 0;
+}
+
+// Starts the backend once, however many clients call it
+void M3LSBus::begin(){
+    if (!started){
+        backend.begin();
+        started = true;
+        resetUsage();
+    }
+}
+
+// Registers a client and returns its number, or -1 if the bus is full.
+// Under the priority policy, higher numbers go first.
+int M3LSBus::attach(int clientPriority){
+    if (numClients == M3LS_BUS_CLIENTS){ return -1; }
+    Client& client = clients[numClients];
+    client.priority = clientPriority;
+    client.count = 0;
+    memset(&client.usage, 0, sizeof(client.usage));
+    return numClients++;
+}
+
+// Chooses how merged batches order the frames of different clients
+void M3LSBus::setPolicy(Policy newPolicy){
+    policy = newPolicy;
+}
+
+// Sends a frame whose reply the client needs, after everything posted
+int M3LSBus::transfer(int client, int pin, const char *send, int length,
+    char *recv, int recvSize){
+    if (!isClient(client)){ return -1; }
+    flush();
+    unsigned long start = micros();
+    int received = backend.transfer(pin, send, length, recv, recvSize);
+    M3LSBusUsage& usage = clients[client].usage;
+    usage.busyMicros += elapsedSince(start);
+    usage.frames++;
+    if (received < 0){ usage.failed++; }
+    return received;
+}
+
+// Queues frames for the next batch, flushing first if the client's queue
+// fills up. A batch holding a stop frame goes out at once instead. Returns
+// the number of frames queued, or answered before the first bad reply, which
+// is then left in `recv` if one was given.
+int M3LSBus::post(int client, const M3LSCommandFrame *frames, int count,
+    char *recv, int recvSize){
+    if (!isClient(client)){ return 0; }
+    for (int frame = 0; frame < count; frame++){
+        if (isStop(frames[frame])){
+            return stop(client, frames, count, recv, recvSize);
+        }
+    }
+    Client& owner = clients[client];
+    for (int frame = 0; frame < count; frame++){
+        if (owner.count == M3LS_BUS_QUEUE){ flush(); }
+        owner.queue[owner.count++] = frames[frame];
+    }
+    return count;
+}
+
+// Sends every queued frame of every client in one batch
+void M3LSBus::flush(){
+    int total = schedule();
+    if (total == 0){ return; }
+    send(total);
+}
+
+// Returns the number of frames waiting for the next batch
+int M3LSBus::getPending(){
+    int pending = 0;
+    for (int client = 0; client < numClients; client++){
+        pending += clients[client].count;
+    }
+    return pending;
+}
+
+// Returns the bus time and frames charged to a client
+const M3LSBusUsage& M3LSBus::getUsage(int client){
+    static const M3LSBusUsage none = {0, 0, 0};
+    if (!isClient(client)){ return none; }
+    return clients[client].usage;
+}
+
+// Returns the percentage of time since the counters were reset that the bus
+// spent on a client's frames
+int M3LSBus::getUtilization(int client){
+    if (!isClient(client)){ return 0; }
+    unsigned long window = elapsedSince(usageStart);
+    if (window == 0){ return 0; }
+    return (int)((unsigned long long)clients[client].usage.busyMicros * 100 /
+        window);
+}
+
+// Zeroes every client's counters and starts a new measuring window
+void M3LSBus::resetUsage(){
+    for (int client = 0; client < numClients; client++){
+        memset(&clients[client].usage, 0, sizeof(M3LSBusUsage));
+    }
+    usageStart = micros();
+}
+
+// Returns the transport every client's frames go through
+M3LSTransport& M3LSBus::getBackend(){
+    return backend;
+}
+
+// ---------------------------------------------------------------------------
+// Private Functions
+// Moves the queued frames into one batch in the order of the policy and
+// returns its length
+int M3LSBus::schedule(){
+    int order[M3LS_BUS_CLIENTS];
+    for (int rank = 0; rank < numClients; rank++){
+        order[rank] = (nextClient + rank) % numClients;
+    }
+    if (numClients > 0){ nextClient = (nextClient + 1) % numClients; }
+
+    int total = 0;
+    if (policy == priority){
+        // Highest priority first, ties in the order the clients attached
+        for (int rank = 0; rank < numClients; rank++){
+            order[rank] = rank;
+        }
+        for (int rank = 1; rank < numClients; rank++){
+            int client = order[rank];
+            int slot = rank;
+            while (slot > 0 &&
+                clients[order[slot - 1]].priority < clients[client].priority){
+                order[slot] = order[slot - 1];
+                slot--;
+            }
+            order[slot] = client;
+        }
+        for (int rank = 0; rank < numClients; rank++){
+            Client& client = clients[order[rank]];
+            for (int frame = 0; frame < client.count; frame++){
+                owners[total] = order[rank];
+                batch[total++] = client.queue[frame];
+            }
+        }
+    } else {
+        // One frame from each client in turn, starting from a different
+        // client each batch
+        for (int round = 0; round < M3LS_BUS_QUEUE; round++){
+            for (int rank = 0; rank < numClients; rank++){
+                Client& client = clients[order[rank]];
+                if (round < client.count){
+                    owners[total] = order[rank];
+                    batch[total++] = client.queue[round];
+                }
+            }
+        }
+    }
+    for (int client = 0; client < numClients; client++){
+        clients[client].count = 0;
+    }
+    return total;
+}
+
+// Sends a batch holding a stop ahead of everything queued, and drops the
+// client's waiting frames to the stages it stops. Returns the number of
+// frames answered, so the client resends the rest itself.
+int M3LSBus::stop(int client, const M3LSCommandFrame *frames, int count,
+    char *recv, int recvSize){
+    Client& owner = clients[client];
+    int kept = 0;
+    for (int queued = 0; queued < owner.count; queued++){
+        bool stopped = false;
+        for (int frame = 0; frame < count; frame++){
+            stopped |= isStop(frames[frame]) &&
+                frames[frame].pin == owner.queue[queued].pin;
+        }
+        if (!stopped){ owner.queue[kept++] = owner.queue[queued]; }
+    }
+    owner.count = kept;
+
+    unsigned long start = micros();
+    int answered = backend.transferBatch(frames, count, recvChars,
+        M3LS_REPLY_SIZE);
+    owner.usage.busyMicros += elapsedSince(start);
+    owner.usage.frames += answered < count ? answered + 1 : count;
+    if (answered < count){ owner.usage.failed++; }
+    if (recv != NULL){
+        memcpy(recv, recvChars, recvSize < M3LS_REPLY_SIZE ? recvSize :
+            M3LS_REPLY_SIZE);
+    }
+    return answered;
+}
+
+// Sends the first `count` frames of the merged batch. A frame without a good
+// reply is resent from where the batch stopped, up to M3LS_BUS_RETRIES
+// times, then dropped and charged as failed to its owner, and the frames
+// after it still go out. Each transmission costs its owner an equal share of
+// the time of the batch it went out in.
+void M3LSBus::send(int count){
+    int next = 0;
+    int attempt = 0;
+    while (next < count){
+        unsigned long start = micros();
+        int sent = backend.transferBatch(batch + next, count - next,
+            recvChars, M3LS_REPLY_SIZE);
+        int tried = sent < count - next ? sent + 1 : sent;
+        unsigned long share = elapsedSince(start) / tried;
+        for (int frame = next; frame < next + tried; frame++){
+            M3LSBusUsage& usage = clients[owners[frame]].usage;
+            usage.busyMicros += share;
+            usage.frames++;
+        }
+        next += sent;
+        if (next == count){ break; }
+
+        // The frame that failed is a new one unless nothing went through
+        if (sent > 0){ attempt = 0; }
+        if (attempt++ == M3LS_BUS_RETRIES){
+            clients[owners[next]].usage.failed++;
+            next++;
+            attempt = 0;
+        }
+    }
+}
+
+// Returns true for the number of a registered client
+bool M3LSBus::isClient(int client){
+    return client >= 0 && client < numClients;
+}
+
+// ---------------------------------------------------------------------------
+// Transport policy
+M3LSBusTransport::M3LSBusTransport(){
+    bus = NULL;
+    client = -1;
+}
+
+// Registers with a bus; under its priority policy higher priorities go first
+void M3LSBusTransport::attach(M3LSBus& newBus, int clientPriority){
+    bus = &newBus;
+    client = bus->attach(clientPriority);
+}
+
+// Returns this manipulator's number on the bus, -1 if it has none
+int M3LSBusTransport::getClient(){
+    return client;
+}
+
+M3LSBus& M3LSBusTransport::getBus(){
+    return *bus;
+}
+
+void M3LSBusTransport::begin(){
+    if (bus != NULL){ bus->begin(); }
+}
+
+int M3LSBusTransport::transfer(int pin, const char *send, int length,
+    char *recv, int recvSize){
+    if (client < 0){ return -1; }
+    return bus->transfer(client, pin, send, length, recv, recvSize);
+}
+
+// Posts the frames, so `recv` holds no reply afterwards unless the batch held
+// a stop, which is sent at once
+int M3LSBusTransport::transferBatch(const M3LSCommandFrame *frames, int count,
+    char *recv, int recvSize){
+    if (client < 0){ return 0; }
+    return bus->post(client, frames, count, recv, recvSize);
+}
+
+void M3LSBusTransport::setTimingLevel(int pin, int level){
+    if (bus != NULL){ bus->getBackend().setTimingLevel(pin, level); }
+}
+
+int M3LSBusTransport::getTimingLevel(int pin){
+    return bus != NULL ? bus->getBackend().getTimingLevel(pin) :
+        M3LS_TIMING_SLOWEST;
+}
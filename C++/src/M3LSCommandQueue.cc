@@ -0,0 +1,64 @@
+/*
+M3LSCommandQueue.cc - Prioritized queue of the commands an M3LS sends its
+                      stages, so that a stop can overtake queued motion
+Copyright info?
+*/
+
+#include "M3LSCommandQueue.h"
+
+M3LSCommandQueue::M3LSCommandQueue(){
+    clear(urgent);
+    clear(normal);
+}
+
+// Appends a command behind those of the same priority. Returns false if that
+// priority is full.
+bool M3LSCommandQueue::push(const M3LSCommand& command, Priority priority){
+    Ring& ring = rings[priority];
+    if (ring.count == M3LS_QUEUE_CAPACITY){ return false; }
+    ring.commands[(ring.head + ring.count) % M3LS_QUEUE_CAPACITY] = command;
+    ring.count++;
+    return true;
+}
+
+// Copies the oldest command of the highest priority waiting without removing
+// it. Returns false if the queue is empty.
+bool M3LSCommandQueue::peek(M3LSCommand *command){
+    for (int priority = urgent; priority <= normal; priority++){
+        Ring& ring = rings[priority];
+        if (ring.count == 0){ continue; }
+        *command = ring.commands[ring.head];
+        return true;
+    }
+    return false;
+}
+
+// Removes the oldest command of the highest priority waiting. Returns false
+// if the queue is empty.
+bool M3LSCommandQueue::pop(M3LSCommand *command){
+    for (int priority = urgent; priority <= normal; priority++){
+        Ring& ring = rings[priority];
+        if (ring.count == 0){ continue; }
+        *command = ring.commands[ring.head];
+        ring.head = (ring.head + 1) % M3LS_QUEUE_CAPACITY;
+        ring.count--;
+        return true;
+    }
+    return false;
+}
+
+// Drops every command of a priority
+void M3LSCommandQueue::clear(Priority priority){
+    rings[priority].head = 0;
+    rings[priority].count = 0;
+}
+
+// Returns the number of commands waiting at a priority
+int M3LSCommandQueue::size(Priority priority){
+    return rings[priority].count;
+}
+
+// Returns true if no command is waiting at any priority
+bool M3LSCommandQueue::isEmpty(){
+    return rings[urgent].count == 0 && rings[normal].count == 0;
+}
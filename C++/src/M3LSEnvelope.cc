@@ -0,0 +1,79 @@
+/*
+M3LSEnvelope.cc - Soft limits every target is clamped to before it is sent to
+                  a stage, with an optional region the needle must keep out of
+Copyright info?
+*/
+
+#include "M3LSEnvelope.h"
+#include "M3LSTravel.h"
+
+M3LSEnvelope::M3LSEnvelope(){
+    reset();
+}
+
+// Opens the limits to the whole travel, drops the keep-out region and zeroes
+// the hit counters
+void M3LSEnvelope::reset(){
+    for (int axis = 0; axis < M3LS_ENVELOPE_AXES; axis++){
+        low[axis] = M3LS_TRAVEL_MIN;
+        high[axis] = M3LS_TRAVEL_MAX;
+    }
+    clearKeepOut();
+    resetHits();
+}
+
+// Limits an axis to [newLow, newHigh]. Returns false, keeping the old
+// limits, unless both lie within the travel in that order.
+bool M3LSEnvelope::setLimits(int axis, int newLow, int newHigh){
+    if (axis < 0 || axis >= M3LS_ENVELOPE_AXES || newLow > newHigh ||
+        newLow < M3LS_TRAVEL_MIN || newHigh > M3LS_TRAVEL_MAX){
+        return false;
+    }
+    low[axis] = newLow;
+    high[axis] = newHigh;
+    return true;
+}
+
+// Keeps targets out of the box from newLow to newHigh, inclusive, by moving
+// them along newExitAxis to just above newHigh, or just below newLow if
+// exitHigh is false. Returns false, keeping the old region, if the box is
+// empty or its exit face lies outside the travel.
+bool M3LSEnvelope::setKeepOut(const int *newLow, const int *newHigh,
+    int newExitAxis, bool exitHigh){
+    if (newExitAxis < 0 || newExitAxis >= M3LS_ENVELOPE_AXES){
+        return false;
+    }
+    for (int axis = 0; axis < M3LS_ENVELOPE_AXES; axis++){
+        if (newLow[axis] > newHigh[axis]){ return false; }
+    }
+    int face = exitHigh ? newHigh[newExitAxis] + 1 : newLow[newExitAxis] - 1;
+    if (face < M3LS_TRAVEL_MIN || face > M3LS_TRAVEL_MAX){ return false; }
+
+    for (int axis = 0; axis < M3LS_ENVELOPE_AXES; axis++){
+        keepLow[axis] = newLow[axis];
+        keepHigh[axis] = newHigh[axis];
+    }
+    exitAxis = newExitAxis;
+    exitFace = face;
+    keepOut = 1;
+    return true;
+}
+
+// Lets targets anywhere within the limits
+void M3LSEnvelope::clearKeepOut(){
+    keepOut = 0;
+    exitAxis = 0;
+    exitFace = 0;
+    for (int axis = 0; axis < M3LS_ENVELOPE_AXES; axis++){
+        keepLow[axis] = 0;
+        keepHigh[axis] = -1;
+    }
+}
+
+// Zeroes the hit counters
+void M3LSEnvelope::resetHits(){
+    for (int axis = 0; axis < M3LS_ENVELOPE_AXES; axis++){
+        hits[axis] = 0;
+    }
+    keepOutHits = 0;
+}
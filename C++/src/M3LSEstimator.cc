@@ -0,0 +1,80 @@
+/*
+M3LSEstimator.cc - Dead reckoning of a stage's position from the commands the
+                   library has sent it, corrected by occasional status reads
+Copyright info?
+*/
+
+#include "M3LSEstimator.h"
+#include <stdlib.h>
+
+M3LSEstimator::M3LSEstimator(){
+    origin = 0;
+    target = 0;
+    speed = 0;
+    originError = 0;
+    start = 0;
+}
+
+// Restarts the prediction from a measured position, still heading for the
+// last target
+void M3LSEstimator::sample(int position, unsigned long now){
+    // A stage that was never commanded is holding wherever it is
+    if (speed <= 0){ target = position; }
+    origin = position;
+    originError = M3LS_ESTIMATE_BASE_ERROR;
+    start = now;
+}
+
+// Restarts the prediction from where the stage is believed to be now, which
+// carries the current uncertainty into the new move
+void M3LSEstimator::command(int newTarget, int newSpeed, unsigned long now){
+    int position = estimate(now);
+    originError = errorBound(now);
+    origin = position;
+    target = newTarget;
+    speed = newSpeed;
+    start = now;
+}
+
+// Drops the target of a cancelled move, so the stage is predicted to hold
+// where it stopped
+void M3LSEstimator::stop(int position, unsigned long now){
+    origin = position;
+    target = position;
+    originError = M3LS_ESTIMATE_BASE_ERROR;
+    start = now;
+}
+
+// Predicted position
+int M3LSEstimator::estimate(unsigned long now){
+    return target > origin ? origin + travelled(now) : origin - travelled(now);
+}
+
+// Largest distance the stage may be from the estimate
+int M3LSEstimator::errorBound(unsigned long now){
+    if (!isMoving(now)){ return M3LS_ESTIMATE_BASE_ERROR; }
+    return originError + travelled(now) * M3LS_ESTIMATE_SPEED_ERROR / 100;
+}
+
+// Returns true until the stage should have come to rest on its target
+bool M3LSEstimator::isMoving(unsigned long now){
+    if (origin == target){ return false; }
+    if (speed <= 0){ return true; }
+    unsigned long travelTime = (unsigned long)abs(target - origin) * 1000 /
+        speed;
+    return now - start < travelTime + M3LS_ESTIMATE_SETTLE_MS;
+}
+
+// Distance covered since the prediction started
+int M3LSEstimator::travelled(unsigned long now){
+    unsigned long distance = (unsigned long)abs(target - origin);
+    unsigned long elapsed = now - start;
+    if (speed <= 0){ return 0; }
+    if (elapsed >= distance * 1000 / speed){ return distance; }
+    return elapsed * speed / 1000;
+}
+
+// Target of the last move
+int M3LSEstimator::getTarget(){
+    return target;
+}
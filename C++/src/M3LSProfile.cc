@@ -0,0 +1,86 @@
+/*
+M3LSProfile.cc - Optional timing of each phase of BasicM3LS::run() and of
+                 every SPI transaction, kept in a fixed table that can be
+                 printed
+Copyright info?
+*/
+
+#include "M3LSProfile.h"
+
+M3LSProfileEntry M3LSProfiler::entries[M3LSProfiler::NumPhases];
+
+const char *const M3LSProfiler::names[M3LSProfiler::NumPhases] = {
+    "run", "usb", "buttons", "position", "bounds", "commands", "estimates",
+    "spi"
+};
+
+// Starts the clock and empties the table
+void M3LSProfiler::begin(){
+#if defined(ARDUINO_ARCH_SAM) && !defined(MOCK)
+    // The cycle counter only runs while trace is enabled
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+    reset();
+}
+
+// Returns the current clock reading, which wraps around
+uint32_t M3LSProfiler::now(){
+#if defined(ARDUINO_ARCH_SAM) && !defined(MOCK)
+    return DWT->CYCCNT;
+#else
+    return micros();
+#endif
+}
+
+// Returns the number of clock ticks in a microsecond
+uint32_t M3LSProfiler::ticksPerMicrosecond(){
+#if defined(ARDUINO_ARCH_SAM) && !defined(MOCK)
+    return VARIANT_MCK / 1000000;
+#else
+    return 1;
+#endif
+}
+
+// Adds one timing of a phase
+void M3LSProfiler::record(Phase phase, uint32_t ticks){
+    M3LSProfileEntry& entry = entries[phase];
+    entry.count++;
+    entry.total += ticks;
+    if (ticks > entry.max){ entry.max = ticks; }
+}
+
+// Returns the totals of a phase
+const M3LSProfileEntry& M3LSProfiler::get(Phase phase){
+    return entries[phase];
+}
+
+// Clears every total
+void M3LSProfiler::reset(){
+    for (int phase = 0; phase < NumPhases; phase++){
+        entries[phase].count = 0;
+        entries[phase].total = 0;
+        entries[phase].max = 0;
+    }
+}
+
+// Prints one tab separated line per phase that ran: its name, the number of
+// timings, and their total, mean and maximum in microseconds
+void M3LSProfiler::dump(Stream& out){
+    uint32_t scale = ticksPerMicrosecond();
+    out.println("phase\tcount\ttotal_us\tmean_us\tmax_us");
+    for (int phase = 0; phase < NumPhases; phase++){
+        const M3LSProfileEntry& entry = entries[phase];
+        if (entry.count == 0){ continue; }
+        out.print(names[phase]);
+        out.print('\t');
+        out.print((unsigned long)entry.count);
+        out.print('\t');
+        out.print((unsigned long)(entry.total / scale));
+        out.print('\t');
+        out.print((unsigned long)(entry.total / entry.count / scale));
+        out.print('\t');
+        out.println((unsigned long)(entry.max / scale));
+    }
+}
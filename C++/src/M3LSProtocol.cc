@@ -0,0 +1,280 @@
+/*
+M3LSProtocol.cc - Framed binary protocol for driving the M3LS library from a
+                  host over a serial port
+Copyright info?
+*/
+
+#include "M3LSProtocol.h"
+
+// CRC-16/CCITT (polynomial 0x1021), bitwise to stay small on the device
+uint16_t M3LSProtocol::crc16(const uint8_t *data, size_t length, uint16_t crc){
+    for (size_t i = 0; i < length; i++){
+        crc ^= (uint16_t)data[i] << 8;
+        for (int bit = 0; bit < 8; bit++){
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+// Builds a complete frame in `out` and returns its length
+int M3LSProtocol::encodeFrame(uint8_t seq, uint8_t type,
+    const uint8_t *payload, int length, uint8_t *out){
+    if (length < 0 || length > M3LS_MAX_PAYLOAD){ return -1; }
+
+    out[0] = M3LS_FRAME_START;
+    out[1] = length;
+    out[2] = seq;
+    out[3] = type;
+    for (int i = 0; i < length; i++){
+        out[4 + i] = payload[i];
+    }
+    uint16_t crc = crc16(out + 1, length + 3);
+    putU16(crc, out + 4 + length);
+    return length + M3LS_FRAME_OVERHEAD;
+}
+
+// Writes a zigzag encoded LEB128 varint and returns its length
+int M3LSProtocol::putVarint(int32_t value, uint8_t *out){
+    uint32_t zigzag = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+    int length = 0;
+    while (zigzag >= 0x80){
+        out[length++] = (uint8_t)(zigzag | 0x80);
+        zigzag >>= 7;
+    }
+    out[length++] = (uint8_t)zigzag;
+    return length;
+}
+
+// Reads a zigzag encoded varint, returns its length or -1 if truncated
+int M3LSProtocol::getVarint(const uint8_t *in, int length, int32_t *value){
+    uint32_t zigzag = 0;
+    for (int i = 0; i < length && i < M3LS_MAX_VARINT; i++){
+        zigzag |= (uint32_t)(in[i] & 0x7F) << (7 * i);
+        if (!(in[i] & 0x80)){
+            *value = (int32_t)((zigzag >> 1) ^ (~(zigzag & 1) + 1));
+            return i + 1;
+        }
+    }
+    return -1;
+}
+
+void M3LSProtocol::putU16(uint16_t value, uint8_t *out){
+    out[0] = value & 0xFF;
+    out[1] = value >> 8;
+}
+
+uint16_t M3LSProtocol::getU16(const uint8_t *in){
+    return (uint16_t)(in[0] | (in[1] << 8));
+}
+
+void M3LSProtocol::putI32(int32_t value, uint8_t *out){
+    uint32_t bits = (uint32_t)value;
+    for (int i = 0; i < 4; i++){
+        out[i] = (bits >> (8 * i)) & 0xFF;
+    }
+}
+
+int32_t M3LSProtocol::getI32(const uint8_t *in){
+    return (int32_t)((uint32_t)in[0] | ((uint32_t)in[1] << 8) |
+        ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24));
+}
+
+// Packs as many points as fit in `capacity` bytes, returns the payload length
+// and stores the number of points packed in `encoded`
+int M3LSProtocol::encodeWaypoints(const int32_t (*points)[M3LS_PROTOCOL_AXES],
+    int count, int axes, uint8_t *out, int capacity, int *encoded){
+    int length = 1;
+    int packed = 0;
+    int32_t previous[M3LS_PROTOCOL_AXES] = {0, 0, 0};
+
+    while (packed < count && packed < 255 &&
+        length + axes * M3LS_MAX_VARINT <= capacity){
+        for (int axis = 0; axis < axes; axis++){
+            length += putVarint(points[packed][axis] - previous[axis],
+                out + length);
+            previous[axis] = points[packed][axis];
+        }
+        packed++;
+    }
+    out[0] = packed;
+    *encoded = packed;
+    return length;
+}
+
+// Unpacks a waypoint payload, returns the number of points or -1 if malformed
+int M3LSProtocol::decodeWaypoints(const uint8_t *in, int length, int axes,
+    int32_t (*points)[M3LS_PROTOCOL_AXES], int capacity){
+    if (length < 1 || in[0] > capacity){ return -1; }
+
+    int count = in[0];
+    int offset = 1;
+    int32_t previous[M3LS_PROTOCOL_AXES] = {0, 0, 0};
+    for (int point = 0; point < count; point++){
+        for (int axis = 0; axis < axes; axis++){
+            int32_t delta;
+            int used = getVarint(in + offset, length - offset, &delta);
+            if (used < 0){ return -1; }
+            offset += used;
+            previous[axis] += delta;
+            points[point][axis] = previous[axis];
+        }
+    }
+    return offset == length ? count : -1;
+}
+
+// Packs as many samples as fit in `capacity` bytes, returns the payload
+// length and stores the number of samples packed in `encoded`. Deltas are
+// taken modulo 2^32 so the wrapping micros() clock needs no special case.
+int M3LSProtocol::encodeTelemetry(const M3LSTelemetrySample *samples,
+    int count, uint32_t dropped, uint8_t *out, int capacity, int *encoded){
+    int length = 1;
+    int packed = 0;
+    uint32_t previous[M3LS_TELEMETRY_FIELDS] = {0};
+    uint32_t fields[M3LS_TELEMETRY_FIELDS];
+
+    length += putVarint((int32_t)dropped, out + length);
+    while (packed < count && packed < 255 &&
+        length + M3LS_TELEMETRY_FIELDS * M3LS_MAX_VARINT <= capacity){
+        packTelemetry(samples[packed], fields);
+        for (int field = 0; field < M3LS_TELEMETRY_FIELDS; field++){
+            length += putVarint((int32_t)(fields[field] - previous[field]),
+                out + length);
+            previous[field] = fields[field];
+        }
+        packed++;
+    }
+    out[0] = packed;
+    *encoded = packed;
+    return length;
+}
+
+// Unpacks a telemetry payload, returns the number of samples or -1 if
+// malformed
+int M3LSProtocol::decodeTelemetry(const uint8_t *in, int length,
+    M3LSTelemetrySample *samples, int capacity, uint32_t *dropped){
+    if (length < 1 || in[0] > capacity){ return -1; }
+
+    int count = in[0];
+    int offset = 1;
+    int32_t value;
+    int used = getVarint(in + offset, length - offset, &value);
+    if (used < 0){ return -1; }
+    offset += used;
+    *dropped = (uint32_t)value;
+
+    uint32_t fields[M3LS_TELEMETRY_FIELDS] = {0};
+    for (int sample = 0; sample < count; sample++){
+        for (int field = 0; field < M3LS_TELEMETRY_FIELDS; field++){
+            used = getVarint(in + offset, length - offset, &value);
+            if (used < 0){ return -1; }
+            offset += used;
+            fields[field] += (uint32_t)value;
+        }
+        unpackTelemetry(fields, &samples[sample]);
+    }
+    return offset == length ? count : -1;
+}
+
+// Lays a sample out as the sequence of fields that is delta encoded
+void M3LSProtocol::packTelemetry(const M3LSTelemetrySample& sample,
+    uint32_t *fields){
+    int field = 0;
+    fields[field++] = sample.time;
+    fields[field++] = sample.mode;
+    fields[field++] = (uint32_t)sample.radius;
+    for (int axis = 0; axis < 3; axis++){
+        fields[field++] = sample.joystick[axis];
+    }
+    fields[field++] = sample.buttons;
+    for (int axis = 0; axis < M3LS_PROTOCOL_AXES; axis++){
+        fields[field++] = (uint32_t)sample.position[axis];
+        fields[field++] = (uint32_t)sample.error[axis];
+        fields[field++] = (uint32_t)sample.status[axis];
+    }
+}
+
+// Rebuilds a sample from its fields
+void M3LSProtocol::unpackTelemetry(const uint32_t *fields,
+    M3LSTelemetrySample *sample){
+    int field = 0;
+    sample->time = fields[field++];
+    sample->mode = (uint8_t)fields[field++];
+    sample->radius = (int32_t)fields[field++];
+    for (int axis = 0; axis < 3; axis++){
+        sample->joystick[axis] = (uint8_t)fields[field++];
+    }
+    sample->buttons = (uint16_t)fields[field++];
+    for (int axis = 0; axis < M3LS_PROTOCOL_AXES; axis++){
+        sample->position[axis] = (int32_t)fields[field++];
+        sample->error[axis] = (int32_t)fields[field++];
+        sample->status[axis] = (int32_t)fields[field++];
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Frame decoder
+M3LSFrameDecoder::M3LSFrameDecoder(){
+    errors = 0;
+    reset();
+}
+
+// Feeds one byte, returns true when a valid frame has been completed
+bool M3LSFrameDecoder::push(uint8_t byte){
+    switch(state){
+        case waitStart   :  if (byte == M3LS_FRAME_START){
+                                state = waitLength;
+                                crc = 0xFFFF;
+                            }
+                            return false;
+        case waitLength  :  if (byte > M3LS_MAX_PAYLOAD){
+                                errors++;
+                                state = waitStart;
+                                return false;
+                            }
+                            frame.length = byte;
+                            state = waitSeq;
+                            break;
+        case waitSeq     :  frame.seq = byte;
+                            state = waitType;
+                            break;
+        case waitType    :  frame.type = byte;
+                            received = 0;
+                            state = frame.length ? waitPayload : waitCrcLow;
+                            break;
+        case waitPayload :  frame.payload[received++] = byte;
+                            if (received == frame.length){
+                                state = waitCrcLow;
+                            }
+                            break;
+        case waitCrcLow  :  state = (byte == (crc & 0xFF)) ? waitCrcHigh
+                                : waitStart;
+                            if (state == waitStart){ errors++; }
+                            return false;
+        case waitCrcHigh :  state = waitStart;
+                            if (byte != (crc >> 8)){
+                                errors++;
+                                return false;
+                            }
+                            return true;
+    }
+    crc = M3LSProtocol::crc16(&byte, 1, crc);
+    return false;
+}
+
+// Returns the most recently completed frame
+const M3LSFrame& M3LSFrameDecoder::getFrame(){
+    return frame;
+}
+
+// Returns the number of frames dropped for a bad length or checksum
+unsigned long M3LSFrameDecoder::getErrorCount(){
+    return errors;
+}
+
+// Discards any partially received frame
+void M3LSFrameDecoder::reset(){
+    state = waitStart;
+    received = 0;
+    crc = 0xFFFF;
+}
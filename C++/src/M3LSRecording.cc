@@ -0,0 +1,166 @@
+/*
+M3LSRecording.cc - Records the joystick input of a session so that it can be
+                   exported and replayed through run() later
+Copyright info?
+*/
+
+#include "M3LSRecording.h"
+#include "M3LSProtocol.h"
+#include <string.h>
+
+// Size of the header and checksum around exported data
+#define M3LS_RECORDING_OVERHEAD 10
+
+// Lays a state out as the fields that are delta encoded
+static void packState(const M3LSInputState& state, uint32_t *fields){
+    fields[0] = state.time;
+    fields[1] = state.x;
+    fields[2] = state.y;
+    fields[3] = state.z;
+    fields[4] = state.buttons;
+}
+
+M3LSRecording::M3LSRecording(){
+    clear();
+}
+
+// Empties the recording
+void M3LSRecording::clear(){
+    size = 0;
+    full = false;
+    memset(lastFields, 0, sizeof(lastFields));
+    rewind();
+}
+
+// Appends a state unless its inputs match the last one appended. Returns
+// false once the recording is full.
+bool M3LSRecording::append(const M3LSInputState& state){
+    uint32_t fields[5];
+    packState(state, fields);
+    if (size > 0 && memcmp(fields + 1, lastFields + 1,
+        4 * sizeof(uint32_t)) == 0){
+        return !full;
+    }
+    if (full || size + 5 * M3LS_MAX_VARINT > M3LS_RECORDING_SIZE){
+        full = true;
+        return false;
+    }
+    for (int field = 0; field < 5; field++){
+        size += M3LSProtocol::putVarint(
+            (int32_t)(fields[field] - lastFields[field]), data + size);
+        lastFields[field] = fields[field];
+    }
+    return true;
+}
+
+// Makes next() start again from the first state
+void M3LSRecording::rewind(){
+    readOffset = 0;
+    memset(readFields, 0, sizeof(readFields));
+}
+
+// Reads the next state, returns false at the end of the recording
+bool M3LSRecording::next(M3LSInputState *state){
+    for (int field = 0; field < 5; field++){
+        int32_t delta;
+        int used = M3LSProtocol::getVarint(data + readOffset,
+            size - readOffset, &delta);
+        if (used < 0){ return false; }
+        readOffset += used;
+        readFields[field] += (uint32_t)delta;
+    }
+    state->time = readFields[0];
+    state->x = (uint8_t)readFields[1];
+    state->y = (uint8_t)readFields[2];
+    state->z = (uint8_t)readFields[3];
+    state->buttons = (uint16_t)readFields[4];
+    return true;
+}
+
+// Returns the number of bytes recorded
+int M3LSRecording::getSize(){
+    return size;
+}
+
+// Returns the recorded bytes, without the export header
+const uint8_t *M3LSRecording::getData(){
+    return data;
+}
+
+// Returns true once a state had to be left out for lack of space
+bool M3LSRecording::isFull(){
+    return full;
+}
+
+// Replaces the recording with an exported one. Returns false, leaving the
+// recording empty, if the export is damaged or too large.
+bool M3LSRecording::load(const uint8_t *exported, int exportedSize){
+    clear();
+    if (exportedSize < M3LS_RECORDING_OVERHEAD){ return false; }
+    uint32_t magic = (uint32_t)M3LSProtocol::getI32(exported);
+    uint32_t length = (uint32_t)M3LSProtocol::getI32(exported + 4);
+    if (magic != M3LS_RECORDING_MAGIC || length > M3LS_RECORDING_SIZE ||
+        (int)length != exportedSize - M3LS_RECORDING_OVERHEAD){
+        return false;
+    }
+    if (M3LSProtocol::getU16(exported + 8 + length) !=
+        M3LSProtocol::crc16(exported + 8, length)){
+        return false;
+    }
+    memcpy(data, exported + 8, length);
+    size = length;
+
+    // Appending carries on from the last state
+    M3LSInputState state;
+    while (next(&state)){}
+    memcpy(lastFields, readFields, sizeof(lastFields));
+    rewind();
+    return true;
+}
+
+// Exports the recording, header and checksum included
+void M3LSRecording::write(Stream& out){
+    uint8_t header[8];
+    uint8_t trailer[2];
+    seal(header, trailer);
+    out.write(header, 8);
+    out.write(data, size);
+    out.write(trailer, 2);
+}
+
+// Builds the header and checksum that go around exported data
+void M3LSRecording::seal(uint8_t *header, uint8_t *trailer){
+    M3LSProtocol::putI32((int32_t)M3LS_RECORDING_MAGIC, header);
+    M3LSProtocol::putI32(size, header + 4);
+    M3LSProtocol::putU16(M3LSProtocol::crc16(data, size), trailer);
+}
+
+// ---------------------------------------------------------------------------
+// Files on the host
+#if defined(MOCK)
+#include <stdio.h>
+
+// Exports the recording to a file
+bool M3LSRecording::saveFile(const char *path){
+    uint8_t header[8];
+    uint8_t trailer[2];
+    seal(header, trailer);
+    FILE *file = fopen(path, "wb");
+    if (file == NULL){ return false; }
+    bool ok = fwrite(header, 1, 8, file) == 8 &&
+        fwrite(data, 1, size, file) == (size_t)size &&
+        fwrite(trailer, 1, 2, file) == 2;
+    return fclose(file) == 0 && ok;
+}
+
+// Loads a recording exported to a file, or captured from a serial port
+bool M3LSRecording::loadFile(const char *path){
+    static uint8_t exported[M3LS_RECORDING_SIZE + M3LS_RECORDING_OVERHEAD];
+    clear();
+    FILE *file = fopen(path, "rb");
+    if (file == NULL){ return false; }
+    size_t length = fread(exported, 1, sizeof(exported), file);
+    fclose(file);
+    return load(exported, length);
+}
+#endif
@@ -0,0 +1,88 @@
+/*
+M3LSSensitivity.cc - Sensitivity curve from the joystick's throttle to the
+                     bounds the joystick sweeps, and the zones of its axes
+                     in velocity mode, both kept as lookup tables
+Copyright info?
+*/
+
+#include "M3LSSensitivity.h"
+
+M3LSSensitivity::M3LSSensitivity(){
+    rebuilds = 0;
+    reset();
+}
+
+// Restores the default curve and zones
+void M3LSSensitivity::reset(){
+    static const M3LSCurvePoint standard[] = {
+        {0, 10}, {64, 50}, {128, 500}, {192, 2250}, {255, 5500}};
+    setCurve(standard, sizeof(standard) / sizeof(standard[0]));
+    setZones(M3LS_ZONES);
+}
+
+// Compiles a curve into the radius table. Returns false, keeping the old
+// curve, unless the points start at input 0, end at input 255, rise in input
+// and never fall in radius.
+bool M3LSSensitivity::setCurve(const M3LSCurvePoint *points, int count){
+    if (count < 2 || count > M3LS_CURVE_POINTS){ return false; }
+    if (points[0].input != 0 || points[count - 1].input != 255){
+        return false;
+    }
+    for (int point = 1; point < count; point++){
+        if (points[point].input <= points[point - 1].input ||
+            points[point].radius < points[point - 1].radius){
+            return false;
+        }
+    }
+
+    // Same integer arithmetic as map(), so the default curve gives exactly
+    // the radii the piecewise setBounds() did
+    int segment = 0;
+    for (int input = 0; input < 256; input++){
+        while (segment < count - 2 && input >= points[segment + 1].input){
+            segment++;
+        }
+        const M3LSCurvePoint& low = points[segment];
+        const M3LSCurvePoint& high = points[segment + 1];
+        radii[input] = (uint16_t)((long)(input - low.input) *
+            (high.radius - low.radius) / (high.input - low.input) + low.radius);
+    }
+    for (int point = 0; point < count; point++){
+        curve[point] = points[point];
+    }
+    curvePoints = count;
+    rebuilds++;
+    return true;
+}
+
+// Copies the control points of the curve into `points`, which has room for
+// M3LS_CURVE_POINTS, and returns how many there are
+int M3LSSensitivity::getCurve(M3LSCurvePoint *points){
+    for (int point = 0; point < curvePoints; point++){
+        points[point] = curve[point];
+    }
+    return curvePoints;
+}
+
+// Splits each axis into an odd number of zones, the middle one dead. Returns
+// false, keeping the old zones, for an even number or one out of range.
+bool M3LSSensitivity::setZones(int newNumZones){
+    if (newNumZones < 3 || newNumZones > M3LS_ZONES_MAX ||
+        newNumZones % 2 == 0){
+        return false;
+    }
+    numZones = newNumZones;
+    buildZones();
+    rebuilds++;
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Private Functions
+// Rounds each input to the nearest of numZones evenly spaced levels
+void M3LSSensitivity::buildZones(){
+    int steps = numZones - 1;
+    for (int input = 0; input < 256; input++){
+        zones[input] = (int8_t)((2 * input * steps + 255) / 510 - steps / 2);
+    }
+}
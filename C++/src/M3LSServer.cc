@@ -0,0 +1,320 @@
+/*
+M3LSServer.cc - Dispatches frames of the M3LS binary protocol received on a
+                serial port onto an M3LS instance
+Copyright info?
+*/
+
+#include "M3LSServer.h"
+
+// Constructor
+template <class Manipulator>
+BasicM3LSServer<Manipulator>::BasicM3LSServer(Manipulator& manipulator, Stream& serialPort)
+    : m3(manipulator), port(serialPort)
+{
+    expectedSeq = 0;
+    waypointHead = 0;
+    waypointCount = 0;
+    playing = false;
+    interval = 0;
+    lastMillis = 0;
+    telemetryHead = 0;
+    telemetryCount = 0;
+    telemetryDropped = 0;
+    totalDropped = 0;
+    telemetryInterval = 0;
+    lastTelemetry = 0;
+    telemetrySeq = 0;
+}
+
+// Reads every pending byte, answers complete frames, takes a telemetry
+// sample when one is due and plays back the next waypoint once the playback
+// interval has elapsed
+template <class Manipulator>
+void BasicM3LSServer<Manipulator>::poll(){
+    while (port.available() > 0){
+        int c = port.read();
+        if (c < 0){ break; }
+        if (decoder.push((uint8_t)c)){
+            dispatch(decoder.getFrame());
+        }
+    }
+
+    if (telemetryInterval){
+        // Keep to the sample rate, unless a slow pass put us a whole
+        // interval behind
+        unsigned long now = Manipulator::Clock::micros();
+        if (now - lastTelemetry >= telemetryInterval){
+            lastTelemetry += telemetryInterval;
+            if (now - lastTelemetry >= telemetryInterval){
+                lastTelemetry = now;
+            }
+            sampleTelemetry(now);
+        }
+        if (telemetryCount >= M3LS_TELEMETRY_BATCH){ sendTelemetry(); }
+    }
+
+    if (!playing || waypointCount == 0){ return; }
+    unsigned long curMillis = Manipulator::Clock::millis();
+    if (curMillis - lastMillis < interval){ return; }
+    lastMillis = curMillis;
+
+    moveTo(waypoints[waypointHead]);
+    waypointHead = (waypointHead + 1) % M3LS_WAYPOINT_CAPACITY;
+    waypointCount--;
+}
+
+// Returns true while queued waypoints are being played back
+template <class Manipulator>
+bool BasicM3LSServer<Manipulator>::isPlaying(){
+    return playing;
+}
+
+// Returns the number of waypoints waiting to be played back
+template <class Manipulator>
+int BasicM3LSServer<Manipulator>::getQueuedWaypoints(){
+    return waypointCount;
+}
+
+// Returns the number of corrupted frames that were dropped
+template <class Manipulator>
+unsigned long BasicM3LSServer<Manipulator>::getErrorCount(){
+    return decoder.getErrorCount();
+}
+
+// Samples the stages every `microseconds`, or stops sampling for 0. Samples
+// still waiting are sent before it stops.
+template <class Manipulator>
+void BasicM3LSServer<Manipulator>::setTelemetryInterval(
+    unsigned long microseconds){
+    if (microseconds == 0){
+        while (telemetryCount > 0){ sendTelemetry(); }
+    }
+    telemetryInterval = microseconds;
+    lastTelemetry = Manipulator::Clock::micros() - microseconds;
+}
+
+// Returns the number of telemetry samples dropped because the port fell behind
+template <class Manipulator>
+unsigned long BasicM3LSServer<Manipulator>::getTelemetryDropped(){
+    return totalDropped;
+}
+
+// ---------------------------------------------------------------------------
+// Private Functions
+// Enforces sequence order, then executes and answers a frame
+template <class Manipulator>
+void BasicM3LSServer<Manipulator>::dispatch(const M3LSFrame& frame){
+    // A sync frame restarts the window at its own sequence number
+    if (frame.type == M3LSProtocol::Sync){
+        expectedSeq = frame.seq + 1;
+        sendAck(frame.seq, M3LSProtocol::statusOk);
+        return;
+    }
+
+    int8_t offset = (int8_t)(frame.seq - expectedSeq);
+    if (offset < 0){
+        // Retransmission of a frame that was already executed
+        if (frame.type == M3LSProtocol::GetStatus){
+            sendStatus(frame.seq, M3LSProtocol::statusDuplicate);
+        } else {
+            sendAck(frame.seq, M3LSProtocol::statusDuplicate);
+        }
+        return;
+    }
+    if (offset > 0){
+        // An earlier frame was lost, the host has to go back to it
+        sendAck(frame.seq, M3LSProtocol::statusOutOfOrder);
+        return;
+    }
+
+    uint8_t status = execute(frame);
+    // A frame refused for lack of space will be sent again
+    if (status != M3LSProtocol::statusFull){
+        expectedSeq++;
+    }
+    if (frame.type == M3LSProtocol::GetStatus){
+        sendStatus(frame.seq, status);
+    } else {
+        sendAck(frame.seq, status);
+    }
+}
+
+// Maps a request onto the manipulator
+template <class Manipulator>
+uint8_t BasicM3LSServer<Manipulator>::execute(const M3LSFrame& frame){
+    int32_t targets[M3LS_PROTOCOL_AXES];
+
+    switch(frame.type){
+        case M3LSProtocol::SetMode   :  if (frame.length != 1 ||
+                                            frame.payload[0] > M3LS::velocity){
+                                            return M3LSProtocol::statusBadRequest;
+                                        }
+                                        m3.setControlMode(
+                                            (M3LS::ControlMode)frame.payload[0]);
+                                        return M3LSProtocol::statusOk;
+        case M3LSProtocol::GetStatus :  return M3LSProtocol::statusOk;
+        case M3LSProtocol::Waypoints :  return queueWaypoints(frame);
+        case M3LSProtocol::Start     :  if (frame.length != 2){
+                                            return M3LSProtocol::statusBadRequest;
+                                        }
+                                        interval = M3LSProtocol::getU16(
+                                            frame.payload);
+                                        playing = true;
+                                        return M3LSProtocol::statusOk;
+        case M3LSProtocol::Stop      :  playing = false;
+                                        waypointHead = 0;
+                                        waypointCount = 0;
+                                        return M3LSProtocol::statusOk;
+        case M3LSProtocol::StreamTelemetry :
+                                        if (frame.length != 4){
+                                            return M3LSProtocol::statusBadRequest;
+                                        }
+                                        setTelemetryInterval((uint32_t)
+                                            M3LSProtocol::getI32(frame.payload));
+                                        return M3LSProtocol::statusOk;
+        case M3LSProtocol::Move      :  if (frame.length !=
+                                            4 * M3LS_PROTOCOL_AXES){
+                                            return M3LSProtocol::statusBadRequest;
+                                        }
+                                        for (int axis = 0;
+                                            axis < M3LS_PROTOCOL_AXES; axis++){
+                                            targets[axis] = M3LSProtocol::getI32(
+                                                frame.payload + 4 * axis);
+                                        }
+                                        moveTo(targets);
+                                        return M3LSProtocol::statusOk;
+        default                      :  return M3LSProtocol::statusBadRequest;
+    }
+}
+
+// Appends a batch of waypoints if the whole batch fits
+template <class Manipulator>
+uint8_t BasicM3LSServer<Manipulator>::queueWaypoints(const M3LSFrame& frame){
+    int room = M3LS_WAYPOINT_CAPACITY - waypointCount;
+    if (frame.length < 1){ return M3LSProtocol::statusBadRequest; }
+    if (frame.payload[0] > room){ return M3LSProtocol::statusFull; }
+
+    int32_t batch[255][M3LS_PROTOCOL_AXES];
+    int count = M3LSProtocol::decodeWaypoints(frame.payload, frame.length,
+        M3LS_PROTOCOL_AXES, batch, 255);
+    if (count < 0){ return M3LSProtocol::statusBadRequest; }
+
+    for (int point = 0; point < count; point++){
+        int slot = (waypointHead + waypointCount) % M3LS_WAYPOINT_CAPACITY;
+        memcpy(waypoints[slot], batch[point], sizeof(batch[point]));
+        waypointCount++;
+    }
+    return M3LSProtocol::statusOk;
+}
+
+// Moves every available axis to its target in a single batch
+template <class Manipulator>
+void BasicM3LSServer<Manipulator>::moveTo(const int32_t *targets){
+    int positions[M3LS_PROTOCOL_AXES];
+    for (int axis = 0; axis < M3LS_PROTOCOL_AXES; axis++){
+        positions[axis] = targets[axis];
+    }
+    m3.moveAxes(M3LSBase::axisMask(M3LSBase::XYZ), positions);
+}
+
+// Fills in the acknowledgement fields shared by every reply
+template <class Manipulator>
+int BasicM3LSServer<Manipulator>::buildAck(uint8_t status, uint8_t *payload){
+    payload[0] = status;
+    payload[1] = expectedSeq;
+    M3LSProtocol::putU16(M3LS_WAYPOINT_CAPACITY - waypointCount, payload + 2);
+    return 4;
+}
+
+// Acknowledges a frame
+template <class Manipulator>
+void BasicM3LSServer<Manipulator>::sendAck(uint8_t seq, uint8_t status){
+    uint8_t payload[4];
+    int length = buildAck(status, payload);
+    length = M3LSProtocol::encodeFrame(seq, M3LSProtocol::Ack, payload, length,
+        replyChars);
+    port.write(replyChars, length);
+}
+
+// Acknowledges a frame with the manipulator's current state
+template <class Manipulator>
+void BasicM3LSServer<Manipulator>::sendStatus(uint8_t seq, uint8_t status){
+    uint8_t payload[M3LS_MAX_PAYLOAD];
+    int length = buildAck(status, payload);
+    payload[length++] = m3.currentControlMode;
+    payload[length++] = m3.getNumAxes();
+    M3LSProtocol::putU16(waypointCount, payload + length);
+    length += 2;
+    payload[length++] = playing;
+
+    m3.getCurrentPosition();
+    for (int axis = 0; axis < M3LS_PROTOCOL_AXES; axis++){
+        int32_t position = axis < m3.getNumAxes() ? m3.currentPosition[axis] : 0;
+        M3LSProtocol::putI32(position, payload + length);
+        length += 4;
+    }
+    length = M3LSProtocol::encodeFrame(seq, M3LSProtocol::Status, payload,
+        length, replyChars);
+    port.write(replyChars, length);
+}
+
+// Copies the state of the manipulator and each stage into the ring, dropping
+// the oldest sample if it is full. Nothing is sent to the stages: positions
+// come from the estimators, and the status and error from the last status
+// read the manipulator made itself.
+template <class Manipulator>
+void BasicM3LSServer<Manipulator>::sampleTelemetry(unsigned long now){
+    if (telemetryCount == M3LS_TELEMETRY_CAPACITY){
+        telemetryHead = (telemetryHead + 1) % M3LS_TELEMETRY_CAPACITY;
+        telemetryCount--;
+        telemetryDropped++;
+        totalDropped++;
+    }
+    M3LSTelemetrySample& sample = telemetry[
+        (telemetryHead + telemetryCount) % M3LS_TELEMETRY_CAPACITY];
+    sample.time = now;
+    sample.mode = m3.currentControlMode;
+    sample.radius = m3.radius;
+    sample.joystick[0] = m3.input.getX();
+    sample.joystick[1] = m3.input.getY();
+    sample.joystick[2] = m3.input.getZ();
+    sample.buttons = m3.input.getButtons();
+    for (int axis = 0; axis < M3LS_PROTOCOL_AXES; axis++){
+        int position = 0;
+        int error = 0;
+        int status = -1;
+        if (axis < m3.getNumAxes()){
+            position = m3.getEstimatedPosition(axis);
+            error = m3.lastError[axis];
+            status = m3.lastStatus[axis];
+        }
+        sample.position[axis] = position;
+        sample.error[axis] = error;
+        sample.status[axis] = status;
+    }
+    telemetryCount++;
+}
+
+// Sends the oldest waiting samples in one frame. A frame only covers samples
+// that are contiguous in the ring; the rest go in the next one.
+template <class Manipulator>
+void BasicM3LSServer<Manipulator>::sendTelemetry(){
+    uint8_t payload[M3LS_MAX_PAYLOAD];
+    int contiguous = M3LS_TELEMETRY_CAPACITY - telemetryHead;
+    int encoded;
+    int length = M3LSProtocol::encodeTelemetry(telemetry + telemetryHead,
+        telemetryCount < contiguous ? telemetryCount : contiguous,
+        telemetryDropped, payload, M3LS_MAX_PAYLOAD, &encoded);
+    length = M3LSProtocol::encodeFrame(telemetrySeq++,
+        M3LSProtocol::Telemetry, payload, length, replyChars);
+    port.write(replyChars, length);
+    telemetryHead = (telemetryHead + encoded) % M3LS_TELEMETRY_CAPACITY;
+    telemetryCount -= encoded;
+    telemetryDropped = 0;
+}
+
+// Explicit instantiations for every axis count
+template class BasicM3LSServer<BasicM3LS<M3LS_DYNAMIC_AXES> >;
+template class BasicM3LSServer<BasicM3LS<1> >;
+template class BasicM3LSServer<BasicM3LS<2> >;
+template class BasicM3LSServer<BasicM3LS<3> >;
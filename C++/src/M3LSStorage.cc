@@ -0,0 +1,259 @@
+/*
+M3LSStorage.cc - Non-volatile storage for the calibration and user settings
+                 of an M3LS, so that begin() can skip recalibrating after a
+                 reset
+Copyright info?
+*/
+
+#include "M3LSStorage.h"
+#include "M3LSProtocol.h"
+
+// ---------------------------------------------------------------------------
+// Record helpers
+// Stamps a section and checksums it together with its data
+void M3LSStorage::seal(M3LSSection *section, const void *data, int size,
+    uint32_t stamp){
+    section->stamp = stamp;
+    section->valid = 1;
+    section->checksum = M3LSProtocol::crc16((const uint8_t *)&section->stamp,
+        sizeof(section->stamp));
+    section->checksum = M3LSProtocol::crc16((const uint8_t *)data, size,
+        section->checksum);
+}
+
+// Returns true if a section was sealed and its data is intact
+bool M3LSStorage::check(const M3LSSection& section, const void *data,
+    int size){
+    uint16_t checksum = M3LSProtocol::crc16(
+        (const uint8_t *)&section.stamp, sizeof(section.stamp));
+    checksum = M3LSProtocol::crc16((const uint8_t *)data, size, checksum);
+    return section.valid == 1 && section.checksum == checksum;
+}
+
+// Fills in the identifying fields of a record and checksums them
+void M3LSStorage::sealHeader(M3LSRecord *record){
+    record->magic = M3LS_STORAGE_MAGIC;
+    record->version = M3LS_STORAGE_VERSION;
+    record->reserved = 0;
+    record->checksum = M3LSProtocol::crc16((const uint8_t *)record,
+        offsetof(M3LSRecord, checksum));
+}
+
+// Returns true if a record was written by this library for a manipulator with
+// the same number of axes
+bool M3LSStorage::checkHeader(const M3LSRecord& record, int numAxes){
+    return record.magic == M3LS_STORAGE_MAGIC &&
+        record.version == M3LS_STORAGE_VERSION &&
+        record.numAxes == numAxes &&
+        record.checksum == M3LSProtocol::crc16((const uint8_t *)&record,
+            offsetof(M3LSRecord, checksum));
+}
+
+// ---------------------------------------------------------------------------
+// SAM3X flash backend
+#if defined(ARDUINO_ARCH_SAM) && !defined(MOCK)
+#include <string.h>
+
+// Number of pages reserved at the end of flash bank 1
+#define M3LS_FLASH_PAGES ((sizeof(M3LSRecord) + IFLASH1_PAGE_SIZE - 1) / \
+    IFLASH1_PAGE_SIZE)
+#define M3LS_FLASH_FIRST_PAGE (IFLASH1_SIZE / IFLASH1_PAGE_SIZE - \
+    M3LS_FLASH_PAGES)
+#define M3LS_FLASH_ADDR (IFLASH1_ADDR + M3LS_FLASH_FIRST_PAGE * \
+    IFLASH1_PAGE_SIZE)
+
+// Boot counter page: a base count, then one bit per boot since it was set
+#define M3LS_FLASH_BOOTS_PAGE (M3LS_FLASH_FIRST_PAGE - 1)
+#define M3LS_FLASH_BOOTS_ADDR (IFLASH1_ADDR + M3LS_FLASH_BOOTS_PAGE * \
+    IFLASH1_PAGE_SIZE)
+#define M3LS_FLASH_BOOTS_WORDS (IFLASH1_PAGE_SIZE / 4 - 1)
+
+// Programs the boot counter page from `words`. Without the erase, bits that
+// are already 0 stay 0 and the 1 bits leave the page as it is, which is how
+// the bitmap counts a boot.
+static bool writeBootsPage(const uint32_t *words, bool erase){
+    volatile uint32_t *latch = (volatile uint32_t *)M3LS_FLASH_BOOTS_ADDR;
+    noInterrupts();
+    for (unsigned int i = 0; i < IFLASH1_PAGE_SIZE / 4; i++){
+        latch[i] = words[i];
+    }
+    uint32_t status = efc_perform_command(EFC1,
+        erase ? EFC_FCMD_EWP : EFC_FCMD_WP, M3LS_FLASH_BOOTS_PAGE);
+    interrupts();
+    return status == 0;
+}
+
+// Flash is memory mapped, so reading is a copy
+bool DueFlashStorage::read(void *data, int size){
+    if (size > (int)(M3LS_FLASH_PAGES * IFLASH1_PAGE_SIZE)){ return false; }
+    memcpy(data, (const void *)M3LS_FLASH_ADDR, size);
+    return true;
+}
+
+// Fills each page's latch buffer a word at a time, then erases and writes it
+// with libsam's efc_perform_command(). That issues the command from a RAM
+// function, so the core keeps running while the controller is busy
+bool DueFlashStorage::write(const void *data, int size){
+    if (size > (int)(M3LS_FLASH_PAGES * IFLASH1_PAGE_SIZE)){ return false; }
+    const uint8_t *bytes = (const uint8_t *)data;
+    for (unsigned int page = 0; page < M3LS_FLASH_PAGES; page++){
+        uint32_t words[IFLASH1_PAGE_SIZE / 4];
+        int offset = page * IFLASH1_PAGE_SIZE;
+        int count = size - offset;
+        if (count <= 0){ break; }
+        if (count > IFLASH1_PAGE_SIZE){ count = IFLASH1_PAGE_SIZE; }
+        memset(words, 0xFF, sizeof(words));
+        memcpy(words, bytes + offset, count);
+
+        volatile uint32_t *latch = (volatile uint32_t *)(M3LS_FLASH_ADDR +
+            offset);
+        noInterrupts();
+        for (unsigned int i = 0; i < IFLASH1_PAGE_SIZE / 4; i++){
+            latch[i] = words[i];
+        }
+        uint32_t status = efc_perform_command(EFC1, EFC_FCMD_EWP,
+            M3LS_FLASH_FIRST_PAGE + page);
+        interrupts();
+        if (status != 0){ return false; }
+    }
+    return true;
+}
+
+// Counts the cleared bits of the bitmap on top of the base; an erased page
+// reads 0
+bool DueFlashStorage::readBoots(uint32_t *boots){
+    const uint32_t *page = (const uint32_t *)M3LS_FLASH_BOOTS_ADDR;
+    *boots = page[0] == 0xFFFFFFFF ? 0 : page[0];
+    for (unsigned int i = 1; i <= M3LS_FLASH_BOOTS_WORDS; i++){
+        for (uint32_t bits = ~page[i]; bits; bits &= bits - 1){
+            (*boots)++;
+        }
+    }
+    return true;
+}
+
+// Counts one more boot by clearing the next bit of the bitmap. Any other
+// count, or a full bitmap, erases the page and starts again from a new base.
+bool DueFlashStorage::writeBoots(uint32_t boots){
+    uint32_t current;
+    readBoots(&current);
+    if (boots == current){ return true; }
+
+    const uint32_t *page = (const uint32_t *)M3LS_FLASH_BOOTS_ADDR;
+    uint32_t words[IFLASH1_PAGE_SIZE / 4];
+    memcpy(words, page, sizeof(words));
+    uint32_t base = page[0] == 0xFFFFFFFF ? 0 : page[0];
+    uint32_t used = current - base;
+    if (boots == current + 1 && used < M3LS_FLASH_BOOTS_WORDS * 32){
+        words[1 + used / 32] &= ~(1UL << (used % 32));
+        return writeBootsPage(words, false);
+    }
+    memset(words, 0xFF, sizeof(words));
+    words[0] = boots;
+    return writeBootsPage(words, true);
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// AVR EEPROM backend
+#if defined(ARDUINO_ARCH_AVR) && !defined(MOCK)
+#include <EEPROM.h>
+
+bool EEPROMStorage::read(void *data, int size){
+    if (size > (int)EEPROM.length()){ return false; }
+    uint8_t *bytes = (uint8_t *)data;
+    for (int i = 0; i < size; i++){
+        bytes[i] = EEPROM.read(i);
+    }
+    return true;
+}
+
+bool EEPROMStorage::write(const void *data, int size){
+    if (size > (int)EEPROM.length()){ return false; }
+    const uint8_t *bytes = (const uint8_t *)data;
+    for (int i = 0; i < size; i++){
+        EEPROM.update(i, bytes[i]);
+    }
+    return true;
+}
+
+// The count is the largest in any slot; erased slots read all ones
+bool EEPROMStorage::readBoots(uint32_t *boots){
+    *boots = 0;
+    for (int slot = 0; slot < M3LS_BOOT_SLOTS; slot++){
+        uint32_t value;
+        EEPROM.get(sizeof(M3LSRecord) + slot * sizeof(value), value);
+        if (value != 0xFFFFFFFF && value > *boots){ *boots = value; }
+    }
+    return true;
+}
+
+// Each count goes to the next slot in turn, clearing any larger count left
+// by an earlier run so the largest is always the latest
+bool EEPROMStorage::writeBoots(uint32_t boots){
+    if (sizeof(M3LSRecord) + M3LS_BOOT_SLOTS * sizeof(boots) >
+        EEPROM.length()){
+        return false;
+    }
+    for (int slot = 0; slot < M3LS_BOOT_SLOTS; slot++){
+        uint32_t value;
+        int address = sizeof(M3LSRecord) + slot * sizeof(value);
+        EEPROM.get(address, value);
+        if (slot == (int)(boots % M3LS_BOOT_SLOTS)){
+            EEPROM.put(address, boots);
+        } else if (value != 0xFFFFFFFF && value > boots){
+            EEPROM.put(address, (uint32_t)0xFFFFFFFF);
+        }
+    }
+    return true;
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// File backend
+#if defined(MOCK)
+#include <stdio.h>
+
+FileStorage::FileStorage(const char *path){
+    this->path = path;
+}
+
+bool FileStorage::read(void *data, int size){
+    FILE *file = fopen(path, "rb");
+    if (file == NULL){ return false; }
+    bool ok = fread(data, 1, size, file) == (size_t)size;
+    fclose(file);
+    return ok;
+}
+
+// Rewrites the start of the file, keeping the boot counter after the record
+bool FileStorage::write(const void *data, int size){
+    FILE *file = fopen(path, "r+b");
+    if (file == NULL){ file = fopen(path, "w+b"); }
+    if (file == NULL){ return false; }
+    bool ok = fwrite(data, 1, size, file) == (size_t)size;
+    return fclose(file) == 0 && ok;
+}
+
+// A missing file, or one holding only a record, has counted no boots
+bool FileStorage::readBoots(uint32_t *boots){
+    *boots = 0;
+    FILE *file = fopen(path, "rb");
+    if (file == NULL){ return true; }
+    if (fseek(file, sizeof(M3LSRecord), SEEK_SET) != 0 ||
+        fread(boots, 1, sizeof(*boots), file) != sizeof(*boots)){
+        *boots = 0;
+    }
+    fclose(file);
+    return true;
+}
+
+bool FileStorage::writeBoots(uint32_t boots){
+    FILE *file = fopen(path, "r+b");
+    if (file == NULL){ file = fopen(path, "w+b"); }
+    if (file == NULL){ return false; }
+    bool ok = fseek(file, sizeof(M3LSRecord), SEEK_SET) == 0 &&
+        fwrite(&boots, 1, sizeof(boots), file) == sizeof(boots);
+    return fclose(file) == 0 && ok;
+}
+#endif
@@ -0,0 +1,65 @@
+/*
+M3LSTransform.cc - Fixed point mapping from the frame the operator steers in,
+                   such as one aligned with an angled needle, to stage axes
+Copyright info?
+*/
+
+#include "M3LSTransform.h"
+#include <string.h>
+
+M3LSTransform::M3LSTransform(){
+    reset();
+}
+
+// Makes the frame the stage axes themselves
+void M3LSTransform::reset(){
+    memset(matrix, 0, sizeof(matrix));
+    matrix[0] = matrix[4] = matrix[8] = (int32_t)1 << M3LS_TRANSFORM_SHIFT;
+    memset(offset, 0, sizeof(offset));
+    identity = true;
+}
+
+// Sets the matrix, row major, and the stage position of the frame's origin.
+// This is the only place floats are used; elements are rounded to the
+// nearest 1/65536.
+void M3LSTransform::configure(const float *newMatrix, const int *newOffset){
+    const float scale = (float)((int32_t)1 << M3LS_TRANSFORM_SHIFT);
+    for (int element = 0; element < 9; element++){
+        float value = newMatrix[element] * scale;
+        matrix[element] = (int32_t)(value < 0 ? value - 0.5f : value + 0.5f);
+    }
+    memcpy(offset, newOffset, sizeof(offset));
+
+    M3LSTransform unit;
+    identity = memcmp(matrix, unit.matrix, sizeof(matrix)) == 0 &&
+        offset[0] == 0 && offset[1] == 0 && offset[2] == 0;
+}
+
+// Returns true while frame and stage coordinates are the same
+bool M3LSTransform::isIdentity(){
+    return identity;
+}
+
+// Maps a point of the frame to stage counts
+void M3LSTransform::apply(const int *frame, int *stage){
+    rotate(frame, stage);
+    for (int axis = 0; axis < 3; axis++){ stage[axis] += offset[axis]; }
+}
+
+// Maps a displacement in the frame to one in stage counts, which leaves out
+// the offset. Results are rounded to the nearest count.
+void M3LSTransform::rotate(const int *displacement, int *stage){
+    const int64_t half = (int64_t)1 << (M3LS_TRANSFORM_SHIFT - 1);
+    for (int axis = 0; axis < 3; axis++){
+        const int32_t *row = matrix + 3 * axis;
+        int64_t sum = (int64_t)row[0] * displacement[0] +
+            (int64_t)row[1] * displacement[1] +
+            (int64_t)row[2] * displacement[2];
+        stage[axis] = (int)((sum + half) >> M3LS_TRANSFORM_SHIFT);
+    }
+}
+
+// Returns the fixed point matrix, row major
+const int32_t *M3LSTransform::getMatrix(){
+    return matrix;
+}
@@ -0,0 +1,672 @@
+/*
+M3LSTransport.cc - SPI transport backends used by the M3LS library to move
+                   command frames to the M3-LS stages and read their replies
+Copyright info?
+*/
+
+#include "M3LSTransport.h"
+
+// ---------------------------------------------------------------------------
+// Timing levels
+// Each level roughly halves either the clock period or the gap of the one
+// after it. The gap dominates a frame, so level 0 moves a frame about ten
+// times faster than the original timing.
+const M3LSTiming M3LSTimingTable::levels[M3LS_TIMING_LEVELS] = {
+    {8000000, 5},
+    {8000000, 10},
+    {4000000, 15},
+    {4000000, 30},
+    {2000000, 45},
+    {2000000, M3LS_BYTE_DELAY_US}
+};
+
+M3LSTimingTable::M3LSTimingTable(){
+    for (int i = 0; i < M3LS_TIMING_SLOTS; i++){
+        pins[i] = -1;
+    }
+}
+
+// Returns the clock and gap to drive the stage on a pin with
+const M3LSTiming& M3LSTimingTable::get(int pin){
+    return levels[getLevel(pin)];
+}
+
+// Returns the timing level of a pin; pins never set run at the slowest
+int M3LSTimingTable::getLevel(int pin){
+    int slot = getSlot(pin);
+    return slot < 0 ? M3LS_TIMING_SLOWEST : level[slot];
+}
+
+// Selects the timing level of a pin and forgets its recent errors
+void M3LSTimingTable::setLevel(int pin, int newLevel){
+    int slot = getSlot(pin);
+    if (slot < 0){ return; }
+    if (newLevel < 0){ newLevel = 0; }
+    if (newLevel > M3LS_TIMING_SLOWEST){ newLevel = M3LS_TIMING_SLOWEST; }
+    level[slot] = newLevel;
+    errors[slot] = 0;
+}
+
+// Counts consecutive frames whose reply does not echo their command, and
+// moves the pin one level slower once there are too many
+void M3LSTimingTable::record(int pin, const char *send, const char *recv,
+    int received){
+    int slot = getSlot(pin);
+    if (slot < 0){ return; }
+    if (echoes(send, recv, received)){
+        errors[slot] = 0;
+        return;
+    }
+    if (++errors[slot] < M3LS_TIMING_FALLBACK_ERRORS){ return; }
+    errors[slot] = 0;
+    if (level[slot] < M3LS_TIMING_SLOWEST){ level[slot]++; }
+}
+
+// Returns true if a reply is a complete frame carrying the command's opcode
+bool M3LSTimingTable::echoes(const char *send, const char *recv,
+    int received){
+    return received >= 4 && recv[0] == '<' && recv[1] == send[1] &&
+        recv[2] == send[2] && recv[received - 1] == '\r';
+}
+
+// Finds the slot of a pin, taking a free one on first use
+int M3LSTimingTable::getSlot(int pin){
+    for (int i = 0; i < M3LS_TIMING_SLOTS; i++){
+        if (pins[i] == pin){ return i; }
+    }
+    for (int i = 0; i < M3LS_TIMING_SLOTS; i++){
+        if (pins[i] == -1){
+            pins[i] = pin;
+            level[i] = M3LS_TIMING_SLOWEST;
+            errors[i] = 0;
+            return i;
+        }
+    }
+    return -1;
+}
+
+// ---------------------------------------------------------------------------
+// Blocking backend
+void BlockingSPITransport::begin(){
+}
+
+// Sends a command over the SPI bus and writes the response to the buffer
+int BlockingSPITransport::transfer(int pin, const char *send, int length,
+    char *recv, int recvSize){
+    // Prepare the appropriate settings
+    SPI.beginTransaction(SPISettings(timing.get(pin).clock, MSBFIRST,
+        SPI_MODE1));
+    int received = exchange(pin, send, length, recv, recvSize);
+    SPI.endTransaction();
+    return received;
+}
+
+// Sends several commands within as few bus transactions as the stages'
+// clocks allow, one while consecutive frames share a clock
+int BlockingSPITransport::transferBatch(const M3LSCommandFrame *frames,
+    int count, char *recv, int recvSize){
+    int sent = 0;
+    uint32_t clock = 0;
+    while (sent < count){
+        uint32_t frameClock = timing.get(frames[sent].pin).clock;
+        if (frameClock != clock){
+            if (clock != 0){ SPI.endTransaction(); }
+            SPI.beginTransaction(SPISettings(frameClock, MSBFIRST, SPI_MODE1));
+            clock = frameClock;
+        }
+        int received = exchange(frames[sent].pin, frames[sent].data,
+            frames[sent].length, recv, recvSize);
+        if (!M3LSTimingTable::echoes(frames[sent].data, recv, received)){
+            break;
+        }
+        sent++;
+    }
+    if (clock != 0){ SPI.endTransaction(); }
+    return sent;
+}
+
+// Selects the timing level of a stage
+void BlockingSPITransport::setTimingLevel(int pin, int level){
+    timing.setLevel(pin, level);
+}
+
+// Returns the timing level of a stage
+int BlockingSPITransport::getTimingLevel(int pin){
+    return timing.getLevel(pin);
+}
+
+// Runs one command and its reply on an open transaction
+int BlockingSPITransport::exchange(int pin, const char *send, int length,
+    char *recv, int recvSize){
+    int byteDelay = timing.get(pin).byteDelay;
+    digitalWrite(pin, LOW);
+    delayMicroseconds(byteDelay);
+
+    // Transfer the given command over SPI, one byte at a time
+    for(int i = 0; i < length; i++){
+        SPI.transfer(send[i]);
+        // Minimum delay time between SPI transfers
+        delayMicroseconds(byteDelay);
+    }
+
+    // Wait until the stage is ready to respond
+    int j = 0;
+    int counter = 0;
+    // char DONE '\r';
+    // char IN_PROGRESS 0x01;
+    while('<' != (recv[j] = SPI.transfer(0x01))){
+        delayMicroseconds(byteDelay);
+        if (counter++ == M3LS_REPLY_POLLS) break;
+    }
+    delayMicroseconds(byteDelay);
+
+    // Read in and store the response
+    while('\r' != (recv[++j] = SPI.transfer(0x01))){
+        delayMicroseconds(byteDelay);
+        if(j >= recvSize - 1){
+            digitalWrite(pin, HIGH);
+            timing.record(pin, send, recv, -1);
+            return -1;
+        }
+    }
+    digitalWrite(pin, HIGH);
+    timing.record(pin, send, recv, j + 1);
+    return j + 1;
+}
+
+// ---------------------------------------------------------------------------
+// DMA backend
+#if defined(M3LS_TRANSPORT_DMA)
+#if !defined(ARDUINO_ARCH_SAM)
+    #error "M3LS_TRANSPORT_DMA requires the SAM3X DMA controller (Arduino Due)"
+#endif
+
+/*
+The SAM3X serves SPI0 with the DMAC rather than a PDC channel. Channel 0 feeds
+SPI_TDR and channel 1 drains SPI_RDR; both use hardware handshaking so the
+peripheral paces the transfer. The frames are sent on chip select register 0
+with CSAAT set, while the stage itself is selected through its GPIO pin.
+*/
+#define M3LS_DMA_TX_CH      0
+#define M3LS_DMA_RX_CH      1
+#define M3LS_DMA_TX_PER     1
+#define M3LS_DMA_RX_PER     2
+#define M3LS_DMA_WINDOW     8
+
+// SCBR divider for a clock, DLYBCT for a gap (32 MCK periods per unit)
+#define M3LS_DMA_SCBR(clock)    (VARIANT_MCK / (clock))
+#define M3LS_DMA_DLYBCT(us)     ((VARIANT_MCK / 1000000 * (us) + 31) / 32)
+
+enum DmaPhase {dmaIdle, dmaCommand, dmaReply};
+
+// Frame state shared with the interrupt handler
+static volatile DmaPhase dmaPhase = dmaIdle;
+static volatile int dmaResult = 0;
+static int dmaPin;
+static char *dmaRecv;
+static int dmaRecvSize;
+static int dmaReceived;
+static int dmaPolls;
+static uint8_t dmaWindow[M3LS_DMA_WINDOW];
+static const uint8_t dmaFiller = 0x01;
+static const M3LSCommandFrame *dmaBatch;
+static int dmaBatchCount = 0;
+static int dmaBatchDone;
+static const char *dmaSend;
+static M3LSTimingTable dmaTiming;
+
+// Program one DMAC channel for a single buffer transfer
+static void dmaChannel(uint32_t ch, uint32_t src, uint32_t dst, int count,
+    uint32_t ctrlb, uint32_t cfg){
+    DMAC->DMAC_CHDR = DMAC_CHDR_DIS0 << ch;
+    DMAC->DMAC_CH_NUM[ch].DMAC_SADDR = src;
+    DMAC->DMAC_CH_NUM[ch].DMAC_DADDR = dst;
+    DMAC->DMAC_CH_NUM[ch].DMAC_DSCR = 0;
+    DMAC->DMAC_CH_NUM[ch].DMAC_CTRLA = count |
+        DMAC_CTRLA_SRC_WIDTH_BYTE | DMAC_CTRLA_DST_WIDTH_BYTE;
+    DMAC->DMAC_CH_NUM[ch].DMAC_CTRLB = DMAC_CTRLB_SRC_DSCR |
+        DMAC_CTRLB_DST_DSCR | ctrlb;
+    DMAC->DMAC_CH_NUM[ch].DMAC_CFG = cfg | DMAC_CFG_SOD |
+        DMAC_CFG_FIFOCFG_ASAP_CFG;
+}
+
+// Clock `count` bytes out of `src` (or filler bytes) into `dst`
+static void dmaStart(const uint8_t *src, uint8_t *dst, int count){
+    // Receive channel drains SPI_RDR into the destination buffer
+    dmaChannel(M3LS_DMA_RX_CH, (uint32_t)&SPI0->SPI_RDR, (uint32_t)dst, count,
+        DMAC_CTRLB_FC_PER2MEM_DMA_FC | DMAC_CTRLB_SRC_INCR_FIXED |
+        DMAC_CTRLB_DST_INCR_INCREMENTING,
+        DMAC_CFG_SRC_PER(M3LS_DMA_RX_PER) | DMAC_CFG_SRC_H2SEL);
+    // Transmit channel feeds SPI_TDR, repeating the filler when src is NULL
+    dmaChannel(M3LS_DMA_TX_CH, (uint32_t)(src ? src : &dmaFiller),
+        (uint32_t)&SPI0->SPI_TDR, count,
+        DMAC_CTRLB_FC_MEM2PER_DMA_FC | DMAC_CTRLB_DST_INCR_FIXED |
+        (src ? DMAC_CTRLB_SRC_INCR_INCREMENTING : DMAC_CTRLB_SRC_INCR_FIXED),
+        DMAC_CFG_DST_PER(M3LS_DMA_TX_PER) | DMAC_CFG_DST_H2SEL);
+    DMAC->DMAC_CHER = (DMAC_CHER_ENA0 << M3LS_DMA_RX_CH) |
+        (DMAC_CHER_ENA0 << M3LS_DMA_TX_CH);
+}
+
+// Selects a stage at its timing level and hands its command frame to the DMA
+// controller
+static void dmaSelect(int pin, const char *send, int length){
+    dmaPin = pin;
+    dmaSend = send;
+    dmaReceived = 0;
+    dmaPolls = 0;
+    dmaPhase = dmaCommand;
+
+    // Mode 1, 8 bit, chip select held by GPIO
+    const M3LSTiming& timing = dmaTiming.get(pin);
+    SPI0->SPI_CSR[0] = SPI_CSR_SCBR(M3LS_DMA_SCBR(timing.clock)) |
+        SPI_CSR_DLYBCT(M3LS_DMA_DLYBCT(timing.byteDelay)) | SPI_CSR_CSAAT |
+        SPI_CSR_BITS_8_BIT | SPI_MODE1;
+
+    digitalWrite(pin, LOW);
+    delayMicroseconds(timing.byteDelay);
+
+    // The command echo is not needed, let it land in the reply buffer
+    dmaStart((const uint8_t *)send, (uint8_t *)dmaRecv,
+        length < dmaRecvSize ? length : dmaRecvSize);
+}
+
+// Release the stage, then chain the next frame of a batch or publish the
+// result
+static void dmaFinish(int result){
+    digitalWrite(dmaPin, HIGH);
+    dmaTiming.record(dmaPin, dmaSend, dmaRecv, result);
+    if (dmaBatchCount > 0){
+        if (M3LSTimingTable::echoes(dmaSend, dmaRecv, result) &&
+            ++dmaBatchDone < dmaBatchCount){
+            const M3LSCommandFrame& next = dmaBatch[dmaBatchDone];
+            dmaSelect(next.pin, next.data, next.length);
+            return;
+        }
+        result = dmaBatchDone;
+        dmaBatchCount = 0;
+    }
+    dmaResult = result;
+    dmaPhase = dmaIdle;
+}
+
+// Scan a window of reply bytes, then either finish or request another window
+static void dmaReplyWindow(){
+    for (int i = 0; i < M3LS_DMA_WINDOW; i++){
+        char c = dmaWindow[i];
+        if (dmaReceived == 0){
+            // Still waiting for the stage to start its reply
+            if (c != '<'){
+                if (dmaPolls++ == M3LS_REPLY_POLLS){
+                    dmaFinish(-1);
+                    return;
+                }
+                continue;
+            }
+        }
+        if (dmaReceived >= dmaRecvSize - 1){
+            dmaFinish(-1);
+            return;
+        }
+        dmaRecv[dmaReceived++] = c;
+        if (c == '\r'){
+            dmaFinish(dmaReceived);
+            return;
+        }
+    }
+    dmaStart(NULL, dmaWindow, M3LS_DMA_WINDOW);
+}
+
+// Runs when the receive channel has collected a full buffer
+void DMAC_Handler(){
+    uint32_t status = DMAC->DMAC_EBCISR;
+    if (!(status & (DMAC_EBCISR_BTC0 << M3LS_DMA_RX_CH))){ return; }
+
+    switch(dmaPhase){
+        case dmaCommand :   // Command is out, start polling for the reply
+                            dmaPhase = dmaReply;
+                            dmaStart(NULL, dmaWindow, M3LS_DMA_WINDOW);
+                            break;
+        case dmaReply   :   dmaReplyWindow();
+                            break;
+        default         :   break;
+    }
+}
+
+// Enable the DMA controller and its completion interrupt
+void DmaSPITransport::begin(){
+    pmc_enable_periph_clk(ID_DMAC);
+    DMAC->DMAC_EN &= ~DMAC_EN_ENABLE;
+    DMAC->DMAC_GCFG = DMAC_GCFG_ARB_CFG_FIXED;
+    DMAC->DMAC_EN = DMAC_EN_ENABLE;
+    DMAC->DMAC_EBCIER = DMAC_EBCIER_BTC0 << M3LS_DMA_RX_CH;
+    NVIC_EnableIRQ(DMAC_IRQn);
+}
+
+// Sends a frame and waits for its reply
+int DmaSPITransport::transfer(int pin, const char *send, int length,
+    char *recv, int recvSize){
+    start(pin, send, length, recv, recvSize);
+    while (isBusy()){ yield(); }
+    return result();
+}
+
+// Sends a batch of frames and waits for the last reply
+int DmaSPITransport::transferBatch(const M3LSCommandFrame *frames, int count,
+    char *recv, int recvSize){
+    if (count <= 0){ return 0; }
+    startBatch(frames, count, recv, recvSize);
+    while (isBusy()){ yield(); }
+    return result();
+}
+
+// Selects the stage and hands the command frame to the DMA controller
+void DmaSPITransport::start(int pin, const char *send, int length,
+    char *recv, int recvSize){
+    dmaRecv = recv;
+    dmaRecvSize = recvSize;
+    dmaBatchCount = 0;
+    dmaSelect(pin, send, length);
+}
+
+// Starts the first frame of a batch; the interrupt handler chains the rest
+// without returning to the caller in between
+void DmaSPITransport::startBatch(const M3LSCommandFrame *frames, int count,
+    char *recv, int recvSize){
+    dmaRecv = recv;
+    dmaRecvSize = recvSize;
+    dmaBatch = frames;
+    dmaBatchDone = 0;
+    dmaBatchCount = count;
+    dmaSelect(frames[0].pin, frames[0].data, frames[0].length);
+}
+
+// Returns true while a frame is still on the wire
+bool DmaSPITransport::isBusy(){
+    return dmaPhase != dmaIdle;
+}
+
+// Returns the reply length of the last frame, or -1 if it failed
+int DmaSPITransport::result(){
+    return dmaResult;
+}
+
+// Selects the timing level of a stage; takes effect from its next frame
+void DmaSPITransport::setTimingLevel(int pin, int level){
+    dmaTiming.setLevel(pin, level);
+}
+
+// Returns the timing level of a stage
+int DmaSPITransport::getTimingLevel(int pin){
+    return dmaTiming.getLevel(pin);
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// Loopback backend
+#if defined(MOCK) || defined(M3LS_TRANSPORT_LOOPBACK)
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+LoopbackTransport::LoopbackTransport(){
+    for (int i = 0; i < M3LS_LOOPBACK_STAGES; i++){
+        stages[i].pin = -1;
+    }
+}
+
+// Stages keep their state across begin(), just like the real hardware
+void LoopbackTransport::begin(){
+}
+
+// Answers a frame from the stage model or the scripted reply
+int LoopbackTransport::transfer(int pin, const char *send, int length,
+    char *recv, int recvSize){
+    Stage *stage = getStage(pin);
+    if (stage == NULL){ return -1; }
+
+    // Record the frame for the tests
+    int stored = length < M3LS_REPLY_SIZE - 1 ? length : M3LS_REPLY_SIZE - 1;
+    memcpy(stage->lastFrame, send, stored);
+    stage->lastFrame[stored] = 0;
+    stage->frames++;
+
+    char reply[M3LS_REPLY_SIZE];
+    int replyLength;
+    if (stage->scripted[0]){
+        replyLength = strlen(stage->scripted);
+        memcpy(reply, stage->scripted, replyLength);
+        stage->scripted[0] = 0;
+    } else {
+        replyLength = respond(stage, send, length, reply);
+    }
+
+    // A frame clocked faster than the cabling carries loses a bit of the
+    // opcode echo
+    if (timing.getLevel(pin) < stage->timingLimit && replyLength > 2){
+        reply[1 + stage->frames % 2] ^= 0x40;
+    }
+
+    // Take as long as the frame and its reply would on the wire, with the
+    // gap of the stage's timing level after every byte
+    delayMicroseconds((length + replyLength + 1) *
+        timing.get(pin).byteDelay);
+
+    if (replyLength >= recvSize){
+        timing.record(pin, send, reply, -1);
+        if (recvSize > 0){ recv[0] = 0; }
+        return -1;
+    }
+    memcpy(recv, reply, replyLength);
+    timing.record(pin, send, recv, replyLength);
+    return replyLength;
+}
+
+// Answers each frame of a batch in turn, up to the first bad reply
+int LoopbackTransport::transferBatch(const M3LSCommandFrame *frames,
+    int count, char *recv, int recvSize){
+    int sent = 0;
+    while (sent < count){
+        int received = transfer(frames[sent].pin, frames[sent].data,
+            frames[sent].length, recv, recvSize);
+        if (!M3LSTimingTable::echoes(frames[sent].data, recv, received)){
+            break;
+        }
+        sent++;
+    }
+    return sent;
+}
+
+// Moves a simulated stage without sending it a command
+void LoopbackTransport::setPosition(int pin, int position){
+    Stage *stage = getStage(pin);
+    if (stage == NULL){ return; }
+    stage->position = position;
+    stage->target = position;
+}
+
+// Makes a stage approach its target by `countsPerPoll` counts per status
+// read instead of arriving at once; 0 restores instant moves
+void LoopbackTransport::setSpeed(int pin, int countsPerPoll){
+    Stage *stage = getStage(pin);
+    if (stage == NULL){ return; }
+    stage->speed = countsPerPoll;
+}
+
+// Keeps a stage running a frequency sweep for `polls` status reads
+void LoopbackTransport::setSweepLength(int pin, int polls){
+    Stage *stage = getStage(pin);
+    if (stage == NULL){ return; }
+    stage->sweepLength = polls;
+}
+
+// Gives a stage the resonant frequency of its last sweep, as if it had kept
+// its power while the controller restarted
+void LoopbackTransport::setFrequency(int pin, int frequency){
+    Stage *stage = getStage(pin);
+    if (stage == NULL){ return; }
+    stage->frequency = frequency;
+}
+
+// Makes frames sent to a stage faster than timing `level` come back corrupted
+void LoopbackTransport::setTimingLimit(int pin, int level){
+    Stage *stage = getStage(pin);
+    if (stage == NULL){ return; }
+    stage->timingLimit = level;
+}
+
+// Selects the timing level of a stage
+void LoopbackTransport::setTimingLevel(int pin, int level){
+    timing.setLevel(pin, level);
+}
+
+// Returns the timing level of a stage
+int LoopbackTransport::getTimingLevel(int pin){
+    return timing.getLevel(pin);
+}
+
+// Returns the closed loop speed a stage was last given, in counts per interval
+int LoopbackTransport::getDriveSpeed(int pin){
+    Stage *stage = getStage(pin);
+    return stage ? stage->driveSpeed : 0;
+}
+
+// Returns the simulated position of a stage
+int LoopbackTransport::getPosition(int pin){
+    Stage *stage = getStage(pin);
+    return stage ? stage->position : 0;
+}
+
+// Returns the last target a stage was given
+int LoopbackTransport::getTarget(int pin){
+    Stage *stage = getStage(pin);
+    return stage ? stage->target : 0;
+}
+
+// Returns true if the stage was put in closed loop mode
+bool LoopbackTransport::isClosedLoop(int pin){
+    Stage *stage = getStage(pin);
+    return stage ? stage->closedLoop : false;
+}
+
+// Replaces the model's answer to the next frame sent to a stage
+void LoopbackTransport::queueReply(int pin, const char *reply){
+    Stage *stage = getStage(pin);
+    if (stage == NULL){ return; }
+    strncpy(stage->scripted, reply, M3LS_REPLY_SIZE - 1);
+    stage->scripted[M3LS_REPLY_SIZE - 1] = 0;
+}
+
+// Returns the number of frames a stage has received
+unsigned long LoopbackTransport::getFrameCount(int pin){
+    Stage *stage = getStage(pin);
+    return stage ? stage->frames : 0;
+}
+
+// Returns the last frame a stage has received
+const char *LoopbackTransport::getLastFrame(int pin){
+    Stage *stage = getStage(pin);
+    return stage ? stage->lastFrame : "";
+}
+
+// Finds the stage on a chip select, powering one up on first use
+LoopbackTransport::Stage *LoopbackTransport::getStage(int pin){
+    for (int i = 0; i < M3LS_LOOPBACK_STAGES; i++){
+        if (stages[i].pin == pin){ return &stages[i]; }
+    }
+    for (int i = 0; i < M3LS_LOOPBACK_STAGES; i++){
+        if (stages[i].pin == -1){
+            Stage *stage = &stages[i];
+            stage->pin = pin;
+            stage->position = 6000;
+            stage->target = 6000;
+            stage->speed = 0;
+            stage->driveSpeed = 0;
+            stage->sweepLength = 0;
+            stage->sweeping = 0;
+            stage->frequency = 0;
+            stage->timingLimit = 0;
+            stage->sweepDirection = '0';
+            stage->closedLoop = false;
+            stage->frames = 0;
+            stage->lastFrame[0] = 0;
+            stage->scripted[0] = 0;
+            return stage;
+        }
+    }
+    return NULL;
+}
+
+// Parses a fixed width hex field of a command frame
+static int parseHex(const char *field, int digits){
+    char value[9];
+    memcpy(value, field, digits);
+    value[digits] = 0;
+    return (int)strtoul(value, NULL, 16);
+}
+
+// Applies a command to the stage model and builds its reply
+int LoopbackTransport::respond(Stage *stage, const char *send, int length,
+    char *reply){
+    if (length < 4 || send[0] != '<'){
+        return sprintf(reply, "<>\r");
+    }
+
+    int opcode = (send[1] - '0') * 10 + (send[2] - '0');
+    switch(opcode){
+        case 3  :   // <03> halt wherever the stage is
+                    stage->target = stage->position;
+                    return sprintf(reply, "<03>\r");
+        case 6  :   // <06 D SSSSSSSS> step in the given direction
+                    if (length >= 16){
+                        int steps = parseHex(send + 6, 8);
+                        stage->position += send[4] == '1' ? steps : -steps;
+                        stage->target = stage->position;
+                    }
+                    return sprintf(reply, "<06>\r");
+        case 8  :   // <08 TTTTTTTT> move to an absolute target
+                    if (length >= 14){
+                        stage->target = parseHex(send + 4, 8);
+                        if (stage->speed == 0){
+                            stage->position = stage->target;
+                        }
+                    }
+                    return sprintf(reply, "<08>\r");
+        case 10 :   // <10> report status, position and position error
+                    if (stage->speed > 0){
+                        int remaining = stage->target - stage->position;
+                        if (abs(remaining) <= stage->speed){
+                            stage->position = stage->target;
+                        } else {
+                            stage->position += remaining > 0 ?
+                                stage->speed : -stage->speed;
+                        }
+                    }
+                    if (stage->sweeping > 0){ stage->sweeping--; }
+                    return sprintf(reply, "<10 %06X %08X %08X>\r",
+                        stage->position != stage->target ||
+                            stage->sweeping > 0 ? M3LS_STATUS_RUNNING : 0,
+                        (unsigned int)stage->position,
+                        (unsigned int)(stage->target - stage->position));
+        case 20 :   // <20 X> select open or closed loop mode
+                    if (length >= 6 && send[4] != 'R'){
+                        stage->closedLoop = send[4] == '1';
+                    }
+                    return sprintf(reply, "<20 %d 0000>\r", stage->closedLoop);
+        case 40 :   // <40 SSSSSS CCCCCC AAAA IIII> set the closed loop speed
+                    if (length >= 29){
+                        stage->driveSpeed = parseHex(send + 4, 6);
+                    }
+                    return sprintf(reply, "<40>\r");
+        case 87 :   // <87 D> starts a frequency sweep, <87> reports the
+                    // result of the last one
+                    if (length >= 6 && send[3] == ' '){
+                        stage->sweepDirection = send[4];
+                        stage->sweeping = stage->sweepLength;
+                        stage->frequency = 0x0A00 + stage->pin;
+                    }
+                    return sprintf(reply, "<87 %c 00 %04X>\r",
+                        stage->sweepDirection, stage->frequency);
+        default :   return sprintf(reply, "<%c%c>\r", send[1], send[2]);
+    }
+}
+#endif
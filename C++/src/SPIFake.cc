@@ -0,0 +1,146 @@
+#include "Arduino.h"
+#include "SPI.h"
+#include <string.h>
+
+static SPIFake* p_SPIFake = NULL;
+SPIFake* SPIFakeInstance() {
+  if (!p_SPIFake) {
+    p_SPIFake = new SPIFake();
+  }
+  return p_SPIFake;
+}
+
+void releaseSPIFake() {
+  if (p_SPIFake) {
+    delete p_SPIFake;
+    p_SPIFake = NULL;
+  }
+}
+
+SPIFake::SPIFake() {
+  reset();
+}
+
+// Drops the script and responder, and zeroes the counters
+void SPIFake::reset() {
+  scriptHead = 0;
+  scriptLength = 0;
+  responder = NULL;
+  context = NULL;
+  idle = 0;
+  begins = 0;
+  transactions = 0;
+  openTransactions = 0;
+  bytes = 0;
+  settings = SPISettings();
+}
+
+// Appends bytes for transfer() to answer with. Returns false, queueing none
+// of them, if they do not fit.
+bool SPIFake::queueResponse(const uint8_t *response, size_t length) {
+  if (scriptLength + length > SPI_FAKE_SCRIPT) {
+    return false;
+  }
+  for (size_t i = 0; i < length; i++) {
+    script[(scriptHead + scriptLength + i) % SPI_FAKE_SCRIPT] = response[i];
+  }
+  scriptLength += length;
+  return true;
+}
+
+// Returns the number of scripted bytes not yet answered with
+size_t SPIFake::getScripted() {
+  return scriptLength;
+}
+
+// Answers every byte once the script runs out, e.g. with a model of a device
+void SPIFake::setResponder(Responder newResponder, void *newContext) {
+  responder = newResponder;
+  context = newContext;
+}
+
+// Sets the byte answered with when there is neither script nor responder
+void SPIFake::setIdleByte(uint8_t newIdle) {
+  idle = newIdle;
+}
+
+// Clocks one byte
+uint8_t SPIFake::exchange(uint8_t sent) {
+  bytes++;
+  if (scriptLength > 0) {
+    uint8_t answer = script[scriptHead];
+    scriptHead = (scriptHead + 1) % SPI_FAKE_SCRIPT;
+    scriptLength--;
+    return answer;
+  }
+  return responder != NULL ? responder(sent, context) : idle;
+}
+
+static SPIFake* fakeBus() {
+  return SPIFakeInstance();
+}
+
+void SPI_::begin() {
+  fakeBus()->begins++;
+}
+
+void SPI_::usingInterrupt(uint8_t a) {
+  UNUSED(a);
+}
+
+void SPI_::notUsingInterrupt(uint8_t a) {
+  UNUSED(a);
+}
+
+void SPI_::beginTransaction(SPISettings a) {
+  SPIFake* bus = fakeBus();
+  bus->transactions++;
+  bus->openTransactions++;
+  bus->settings = a;
+}
+
+uint8_t SPI_::transfer(uint8_t a) {
+  return fakeBus()->exchange(a);
+}
+
+uint16_t SPI_::transfer16(uint16_t a) {
+  SPIFake* bus = fakeBus();
+  uint16_t high = bus->exchange(a >> 8);
+  return (uint16_t)((high << 8) | bus->exchange(a & 0xFF));
+}
+
+void SPI_::transfer(void * a, size_t b) {
+  SPIFake* bus = fakeBus();
+  uint8_t *buffer = (uint8_t *)a;
+  for (size_t i = 0; i < b; i++) {
+    buffer[i] = bus->exchange(buffer[i]);
+  }
+}
+
+void SPI_::endTransaction(void) {
+  SPIFake* bus = fakeBus();
+  if (bus->openTransactions > 0) {
+    bus->openTransactions--;
+  }
+}
+
+void SPI_::end(void) {}
+
+void SPI_::setBitOrder(uint8_t a) {
+  UNUSED(a);
+}
+
+void SPI_::setDataMode(uint8_t a) {
+  UNUSED(a);
+}
+
+void SPI_::setClockDivider(uint8_t a) {
+  UNUSED(a);
+}
+
+void SPI_::attachInterrupt() {}
+
+void SPI_::detachInterrupt() {}
+
+// Preinstantiate Objects
+SPI_ SPI;
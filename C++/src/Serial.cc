@@ -0,0 +1,134 @@
+#include "Serial.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+size_t Stream::write(const uint8_t *buffer, size_t size) {
+  size_t n = 0;
+  while (size--) {
+    n += write(*buffer++);
+  }
+  return n;
+}
+
+size_t Stream::print(const char *s) {
+  return write((const uint8_t *)s, strlen(s));
+}
+
+size_t Stream::print(char c) {
+  return write((uint8_t)c);
+}
+
+size_t Stream::print(int n) {
+  return print((long)n);
+}
+
+size_t Stream::print(unsigned int n) {
+  return print((unsigned long)n);
+}
+
+size_t Stream::print(long n) {
+  char buf[24];
+  snprintf(buf, sizeof(buf), "%ld", n);
+  return print(buf);
+}
+
+size_t Stream::print(unsigned long n) {
+  char buf[24];
+  snprintf(buf, sizeof(buf), "%lu", n);
+  return print(buf);
+}
+
+size_t Stream::println(void) {
+  return print("\r\n");
+}
+
+size_t Stream::println(const char *s) {
+  return print(s) + println();
+}
+
+size_t Stream::println(char c) {
+  return print(c) + println();
+}
+
+size_t Stream::println(int n) {
+  return print(n) + println();
+}
+
+size_t Stream::println(unsigned int n) {
+  return print(n) + println();
+}
+
+size_t Stream::println(long n) {
+  return print(n) + println();
+}
+
+size_t Stream::println(unsigned long n) {
+  return print(n) + println();
+}
+
+Serial_::Serial_() : fd(-1), peeked(-1) {}
+
+void Serial_::begin(unsigned long baud) {
+  (void)baud;
+}
+
+void Serial_::end() {}
+
+int Serial_::available() {
+  int pending = 0;
+  if (fd >= 0 && ioctl(fd, FIONREAD, &pending) < 0) {
+    pending = 0;
+  }
+  return pending + (peeked >= 0);
+}
+
+int Serial_::read() {
+  if (peeked >= 0) {
+    int c = peeked;
+    peeked = -1;
+    return c;
+  }
+  uint8_t c;
+  if (available() <= 0 || ::read(fd, &c, 1) != 1) {
+    return -1;
+  }
+  return c;
+}
+
+int Serial_::peek() {
+  if (peeked < 0) {
+    peeked = read();
+  }
+  return peeked;
+}
+
+void Serial_::flush() {}
+
+size_t Serial_::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t Serial_::write(const uint8_t *buffer, size_t size) {
+  if (fd < 0) {
+    return size;
+  }
+  size_t sent = 0;
+  while (sent < size) {
+    ssize_t n = ::write(fd, buffer + sent, size - sent);
+    if (n <= 0) {
+      break;
+    }
+    sent += n;
+  }
+  return sent;
+}
+
+void Serial_::attach(int descriptor) {
+  fd = descriptor;
+  peeked = -1;
+}
+
+// Preinstantiate Objects
+Serial_ Serial;
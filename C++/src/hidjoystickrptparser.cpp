@@ -3,7 +3,8 @@
 JoystickReportParser::JoystickReportParser(JoystickEvents *evt) :
 joyEvents(evt),
 oldHat(0xDE),
-oldButtons(0) {
+oldButtons(0),
+sequence(0) {
         for (uint8_t i = 0; i < RPT_GEMEPAD_LEN; i++)
                 oldPad[i] = 0xD;
 }
@@ -41,6 +42,18 @@ void JoystickReportParser::Parse(USBHID *hid, bool is_rpt_id, uint8_t len, uint8
             oldPad[1] = 2;
         }
     }
+
+    // Publishing a copy means the control loop never reads a report that
+    // is halfway through being replaced
+    if (!match && joyEvents) {
+            M3LSJoystickSnapshot snapshot;
+            snapshot.sequence = sequence++;
+            snapshot.x = getX();
+            snapshot.y = getY();
+            snapshot.z = getZ();
+            snapshot.buttons = getButtons();
+            reports.push(snapshot);
+    }
 }
 
 uint16_t JoystickReportParser::getButtons(void){
@@ -84,3 +97,7 @@ uint8_t JoystickReportParser::getZ(void){
     }
     return oldPad[2];
 }
+
+M3LSJoystickRing& JoystickReportParser::getReports(void){
+    return reports;
+}
@@ -1,5 +1,6 @@
 #include "gtest/gtest.h"
 #include "M3LS.h"
+using ::testing::AnyNumber;
 using ::testing::Return;
 
 TEST(Constructor, SingleAxis){
@@ -13,6 +14,7 @@ TEST(Constructor, SingleAxis){
 
     // Set up expected calls for constructor
     EXPECT_CALL(*arduinoMock, delay(50));
+    EXPECT_CALL(*arduinoMock, millis()).Times(AnyNumber());
     EXPECT_CALL(*spiMock, begin());
     for (int pin = 0; pin < numAxes; pin++){
         EXPECT_CALL(*arduinoMock, pinMode(pins[pin], OUTPUT));
@@ -20,8 +22,7 @@ TEST(Constructor, SingleAxis){
     }
     M3LS m3 = M3LS(pins[0]);
 
-    // Set up expected calls for begin
-    EXPECT_CALL(*arduinoMock, delay(250)).Times(4);
+    // Start up and calibrate the stages
     m3.begin();
 
     // Cleanup mock
@@ -40,6 +41,7 @@ TEST(Constructor, DoubleAxis){
 
     // Set up expected calls for constructor
     EXPECT_CALL(*arduinoMock, delay(50));
+    EXPECT_CALL(*arduinoMock, millis()).Times(AnyNumber());
     EXPECT_CALL(*spiMock, begin());
     for (int pin = 0; pin < numAxes; pin++){
         EXPECT_CALL(*arduinoMock, pinMode(pins[pin], OUTPUT));
@@ -47,8 +49,7 @@ TEST(Constructor, DoubleAxis){
     }
     M3LS m3 = M3LS(pins[0], pins[1]);
 
-    // Set up expected calls for begin
-    EXPECT_CALL(*arduinoMock, delay(250)).Times(4);
+    // Start up and calibrate the stages
     m3.begin();
 
     // Cleanup mock
@@ -67,6 +68,7 @@ TEST(Constructor, TripleAxis){
 
     // Set up expected calls for constructor
     EXPECT_CALL(*arduinoMock, delay(50));
+    EXPECT_CALL(*arduinoMock, millis()).Times(AnyNumber());
     EXPECT_CALL(*spiMock, begin());
     for (int pin = 0; pin < numAxes; pin++){
         EXPECT_CALL(*arduinoMock, pinMode(pins[pin], OUTPUT));
@@ -74,8 +76,7 @@ TEST(Constructor, TripleAxis){
     }
     M3LS m3 = M3LS(pins[0], pins[1], pins[2]);
 
-    // Set up expected calls for begin
-    EXPECT_CALL(*arduinoMock, delay(250)).Times(4);
+    // Start up and calibrate the stages
     m3.begin();
 
     // Cleanup mock
@@ -94,6 +95,7 @@ TEST(Toggle, Hold){
 
     // Set up expected calls for constructor
     EXPECT_CALL(*arduinoMock, delay(50));
+    EXPECT_CALL(*arduinoMock, millis()).Times(AnyNumber());
     EXPECT_CALL(*spiMock, begin());
     for (int pin = 0; pin < numAxes; pin++){
         EXPECT_CALL(*arduinoMock, pinMode(pins[pin], OUTPUT));
@@ -101,8 +103,7 @@ TEST(Toggle, Hold){
     }
     M3LS m3 = M3LS(pins[0], pins[1], pins[2]);
 
-    // Set up expected calls for begin
-    EXPECT_CALL(*arduinoMock, delay(250)).Times(4);
+    // Start up and calibrate the stages
     m3.begin();
 
     // Set up expected calls for setting the control mode
@@ -126,6 +127,7 @@ TEST(Toggle, Velocity){
 
     // Set up expected calls for constructor
     EXPECT_CALL(*arduinoMock, delay(50));
+    EXPECT_CALL(*arduinoMock, millis()).Times(AnyNumber());
     EXPECT_CALL(*spiMock, begin());
     for (int pin = 0; pin < numAxes; pin++){
         EXPECT_CALL(*arduinoMock, pinMode(pins[pin], OUTPUT));
@@ -133,8 +135,7 @@ TEST(Toggle, Velocity){
     }
     M3LS m3 = M3LS(pins[0], pins[1], pins[2]);
 
-    // Set up expected calls for begin
-    EXPECT_CALL(*arduinoMock, delay(250)).Times(4);
+    // Start up and calibrate the stages
     m3.begin();
 
     // Set up expected calls for setting the control mode
@@ -158,6 +159,7 @@ TEST(Home, SetHome){
 
     // Set up expected calls for constructor
     EXPECT_CALL(*arduinoMock, delay(50));
+    EXPECT_CALL(*arduinoMock, millis()).Times(AnyNumber());
     EXPECT_CALL(*spiMock, begin());
     for (int pin = 0; pin < numAxes; pin++){
         EXPECT_CALL(*arduinoMock, pinMode(pins[pin], OUTPUT));
@@ -165,8 +167,7 @@ TEST(Home, SetHome){
     }
     M3LS m3 = M3LS(pins[0], pins[1], pins[2]);
 
-    // Set up expected calls for begin
-    EXPECT_CALL(*arduinoMock, delay(250)).Times(4);
+    // Start up and calibrate the stages
     m3.begin();
 
     // Set up expected calls for setting the control mode
@@ -188,6 +189,7 @@ TEST(Home, ReturnHome){
 
     // Set up expected calls for constructor
     EXPECT_CALL(*arduinoMock, delay(50));
+    EXPECT_CALL(*arduinoMock, millis()).Times(AnyNumber());
     EXPECT_CALL(*spiMock, begin());
     for (int pin = 0; pin < numAxes; pin++){
         EXPECT_CALL(*arduinoMock, pinMode(pins[pin], OUTPUT));
@@ -195,8 +197,7 @@ TEST(Home, ReturnHome){
     }
     M3LS m3 = M3LS(pins[0], pins[1], pins[2]);
 
-    // Set up expected calls for begin
-    EXPECT_CALL(*arduinoMock, delay(250)).Times(4);
+    // Start up and calibrate the stages
     m3.begin();
 
     // Set up expected calls for setting the control mode
@@ -218,6 +219,7 @@ TEST(Invert, X){
 
     // Set up expected calls for constructor
     EXPECT_CALL(*arduinoMock, delay(50));
+    EXPECT_CALL(*arduinoMock, millis()).Times(AnyNumber());
     EXPECT_CALL(*spiMock, begin());
     for (int pin = 0; pin < numAxes; pin++){
         EXPECT_CALL(*arduinoMock, pinMode(pins[pin], OUTPUT));
@@ -225,8 +227,7 @@ TEST(Invert, X){
     }
     M3LS m3 = M3LS(pins[0], pins[1], pins[2]);
 
-    // Set up expected calls for begin
-    EXPECT_CALL(*arduinoMock, delay(250)).Times(4);
+    // Start up and calibrate the stages
     m3.begin();
 
     // Set up expected calls for setting the control mode
@@ -248,6 +249,7 @@ TEST(Invert, Y){
 
     // Set up expected calls for constructor
     EXPECT_CALL(*arduinoMock, delay(50));
+    EXPECT_CALL(*arduinoMock, millis()).Times(AnyNumber());
     EXPECT_CALL(*spiMock, begin());
     for (int pin = 0; pin < numAxes; pin++){
         EXPECT_CALL(*arduinoMock, pinMode(pins[pin], OUTPUT));
@@ -255,8 +257,7 @@ TEST(Invert, Y){
     }
     M3LS m3 = M3LS(pins[0], pins[1], pins[2]);
 
-    // Set up expected calls for begin
-    EXPECT_CALL(*arduinoMock, delay(250)).Times(4);
+    // Start up and calibrate the stages
     m3.begin();
 
     // Set up expected calls for setting the control mode
@@ -278,6 +279,7 @@ TEST(Invert, Z){
 
     // Set up expected calls for constructor
     EXPECT_CALL(*arduinoMock, delay(50));
+    EXPECT_CALL(*arduinoMock, millis()).Times(AnyNumber());
     EXPECT_CALL(*spiMock, begin());
     for (int pin = 0; pin < numAxes; pin++){
         EXPECT_CALL(*arduinoMock, pinMode(pins[pin], OUTPUT));
@@ -285,8 +287,7 @@ TEST(Invert, Z){
     }
     M3LS m3 = M3LS(pins[0], pins[1], pins[2]);
 
-    // Set up expected calls for begin
-    EXPECT_CALL(*arduinoMock, delay(250)).Times(4);
+    // Start up and calibrate the stages
     m3.begin();
 
     // Set up expected calls for setting the control mode
@@ -308,6 +309,7 @@ TEST(Invert, S){
 
     // Set up expected calls for constructor
     EXPECT_CALL(*arduinoMock, delay(50));
+    EXPECT_CALL(*arduinoMock, millis()).Times(AnyNumber());
     EXPECT_CALL(*spiMock, begin());
     for (int pin = 0; pin < numAxes; pin++){
         EXPECT_CALL(*arduinoMock, pinMode(pins[pin], OUTPUT));
@@ -315,8 +317,7 @@ TEST(Invert, S){
     }
     M3LS m3 = M3LS(pins[0], pins[1], pins[2]);
 
-    // Set up expected calls for begin
-    EXPECT_CALL(*arduinoMock, delay(250)).Times(4);
+    // Start up and calibrate the stages
     m3.begin();
 
     // Set up expected calls for setting the control mode
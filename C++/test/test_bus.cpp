@@ -0,0 +1,199 @@
+#include "gtest/gtest.h"
+#include "M3LSImpl.h"
+#include "M3LSBus.h"
+#include <stdio.h>
+using ::testing::_;
+using ::testing::AnyNumber;
+using ::testing::Invoke;
+
+// Two manipulators sharing one bus
+typedef BasicM3LS<3, M3LSSharedConfig> SharedM3LS;
+
+// Builds a move of the stage on `pin` to `target`
+static M3LSCommandFrame moveFrame(int pin, int target){
+    M3LSCommandFrame frame;
+    frame.pin = pin;
+    frame.length = 14;
+    sprintf(frame.data, "<08 %08X>\r", target);
+    return frame;
+}
+
+TEST(Bus, Scheduling){
+    // Initialize mock
+    ArduinoMock* arduinoMock = arduinoMockInstance();
+    SPIMockInstance();
+    EXPECT_CALL(*arduinoMock, millis()).Times(AnyNumber());
+    M3LSBus bus;
+    int low = bus.attach(0);
+    int high = bus.attach(1);
+    bus.begin();
+    bus.begin();
+
+    // Posted frames wait for flush(), which sends them all
+    M3LSCommandFrame first = moveFrame(1, 1000);
+    M3LSCommandFrame second = moveFrame(1, 2000);
+    bus.post(low, &first, 1);
+    bus.post(high, &second, 1);
+    EXPECT_EQ(2, bus.getPending());
+    EXPECT_NE(1000, bus.getBackend().getTarget(1));
+    bus.flush();
+    EXPECT_EQ(0, bus.getPending());
+    EXPECT_EQ(2ul, bus.getBackend().getFrameCount(1));
+
+    // Fair batches start from a different client each time, so the client
+    // whose move lands last alternates
+    bus.post(low, &first, 1);
+    bus.post(high, &second, 1);
+    bus.flush();
+    EXPECT_EQ(1000, bus.getBackend().getTarget(1));
+    bus.post(low, &first, 1);
+    bus.post(high, &second, 1);
+    bus.flush();
+    EXPECT_EQ(2000, bus.getBackend().getTarget(1));
+
+    // Priority batches always send the higher priority client first
+    bus.setPolicy(M3LSBus::priority);
+    for (int batch = 0; batch < 2; batch++){
+        bus.post(low, &first, 1);
+        bus.post(high, &second, 1);
+        bus.flush();
+        EXPECT_EQ(1000, bus.getBackend().getTarget(1));
+    }
+
+    // A full queue flushes itself
+    for (int frame = 0; frame <= M3LS_BUS_QUEUE; frame++){
+        bus.post(low, &second, 1);
+    }
+    EXPECT_EQ(1, bus.getPending());
+
+    // A stop goes out at once and drops the moves waiting for its stage
+    M3LSCommandFrame stop = {1, 5, "<03>\r"};
+    bus.getBackend().setPosition(1, 500);
+    bus.post(low, &stop, 1);
+    EXPECT_EQ(0, bus.getPending());
+    EXPECT_EQ(500, bus.getBackend().getTarget(1));
+    bus.flush();
+    EXPECT_EQ(500, bus.getBackend().getTarget(1));
+
+    // Every frame is charged to the client that sent it
+    EXPECT_EQ(6ul + M3LS_BUS_QUEUE, bus.getUsage(low).frames);
+    EXPECT_EQ(5ul, bus.getUsage(high).frames);
+    EXPECT_EQ(0ul, bus.getUsage(low).failed);
+    EXPECT_GT(bus.getUsage(low).busyMicros, bus.getUsage(high).busyMicros);
+    EXPECT_GT(bus.getUtilization(low), 0);
+    EXPECT_LE(bus.getUtilization(low) + bus.getUtilization(high), 100);
+    bus.resetUsage();
+    EXPECT_EQ(0ul, bus.getUsage(low).frames);
+
+    // Only so many clients fit
+    bus.attach(0);
+    bus.attach(0);
+    EXPECT_EQ(-1, bus.attach(0));
+
+    // Cleanup mock
+    releaseArduinoMock();
+    releaseSPIMock();
+}
+
+TEST(Bus, Desync){
+    // Initialize mock
+    ArduinoMock* arduinoMock = arduinoMockInstance();
+    SPIMockInstance();
+    EXPECT_CALL(*arduinoMock, millis()).Times(AnyNumber());
+    M3LSBus bus;
+    int first = bus.attach(0);
+    int second = bus.attach(0);
+    bus.begin();
+    LoopbackTransport& backend = bus.getBackend();
+
+    // A stage that never echoes its opcode is resent a few times, then
+    // dropped, while the other client's frames behind it still arrive
+    backend.setTimingLimit(1, M3LS_TIMING_LEVELS);
+    M3LSCommandFrame bad = moveFrame(1, 1000);
+    M3LSCommandFrame good[] = {moveFrame(4, 2000), moveFrame(5, 3000)};
+    bus.post(first, &bad, 1);
+    bus.post(second, good, 2);
+    bus.flush();
+    EXPECT_EQ(1ul + M3LS_BUS_RETRIES, backend.getFrameCount(1));
+    EXPECT_EQ(2000, backend.getTarget(4));
+    EXPECT_EQ(3000, backend.getTarget(5));
+    EXPECT_EQ(1ul, bus.getUsage(first).failed);
+    EXPECT_EQ(1ul + M3LS_BUS_RETRIES, bus.getUsage(first).frames);
+    EXPECT_EQ(0ul, bus.getUsage(second).failed);
+    EXPECT_EQ(2ul, bus.getUsage(second).frames);
+
+    // A stop reports where it stopped, for the client to resend the rest
+    M3LSCommandFrame stops[] = {{1, 5, "<03>\r"}, {4, 5, "<03>\r"}};
+    EXPECT_EQ(0, bus.post(first, stops, 2));
+    EXPECT_EQ(1, bus.post(first, stops + 1, 1));
+
+    // Clients that were never attached get nothing
+    char recv[M3LS_REPLY_SIZE];
+    EXPECT_EQ(-1, bus.transfer(2, 4, "<10>\r", 5, recv, sizeof(recv)));
+    EXPECT_EQ(0, bus.post(-1, good, 1));
+    EXPECT_EQ(0ul, bus.getUsage(2).frames);
+    EXPECT_EQ(0, bus.getUtilization(-1));
+
+    // Cleanup mock
+    releaseArduinoMock();
+    releaseSPIMock();
+}
+
+TEST(Bus, SharedManipulators){
+    // Initialize test parameters
+    int pinsA[] = {1, 2, 3};
+    int pinsB[] = {4, 5, 6};
+    int targetsA[] = {1000, 2000, 3000};
+    int targetsB[] = {4000, 5000, 6000};
+
+    // Initialize mock
+    ArduinoMock* arduinoMock = arduinoMockInstance();
+    SPIMock* spiMock = SPIMockInstance();
+    EXPECT_CALL(*arduinoMock, millis()).Times(AnyNumber());
+    EXPECT_CALL(*arduinoMock, delay(_)).WillRepeatedly(Invoke(
+        [arduinoMock](int ms){ arduinoMock->addMillisRaw(ms); }));
+    EXPECT_CALL(*spiMock, begin()).Times(2);
+    EXPECT_CALL(*arduinoMock, pinMode(_, OUTPUT)).Times(6);
+    EXPECT_CALL(*arduinoMock, digitalWrite(_, HIGH)).Times(6);
+
+    // Both manipulators attach to the bus before they begin
+    M3LSBus bus;
+    SharedM3LS a(pinsA[0], pinsA[1], pinsA[2]);
+    SharedM3LS b(pinsB[0], pinsB[1], pinsB[2]);
+    a.getTransport().attach(bus);
+    b.getTransport().attach(bus);
+    EXPECT_EQ(0, a.getTransport().getClient());
+    EXPECT_EQ(1, b.getTransport().getClient());
+    a.begin();
+    b.begin();
+    EXPECT_GT(bus.getUsage(0).frames, 0ul);
+
+    // Their moves reach the stages together at flush()
+    a.moveAxes(7, targetsA);
+    b.moveAxes(7, targetsB);
+    EXPECT_GE(bus.getPending(), 6);
+    EXPECT_NE(targetsA[0], bus.getBackend().getTarget(pinsA[0]));
+    bus.flush();
+    for (int axis = 0; axis < 3; axis++){
+        EXPECT_EQ(targetsA[axis], bus.getBackend().getTarget(pinsA[axis]));
+        EXPECT_EQ(targetsB[axis], bus.getBackend().getTarget(pinsB[axis]));
+    }
+
+    // A read that needs its reply sends whatever is waiting first
+    targetsA[0] = 1500;
+    a.moveAxes(1, targetsA);
+    b.getCurrentPosition();
+    EXPECT_EQ(0, bus.getPending());
+    EXPECT_EQ(1500, bus.getBackend().getTarget(pinsA[0]));
+
+    // A halt does not wait for flush()
+    bus.getBackend().setPosition(pinsB[0], 4200);
+    b.halt();
+    EXPECT_EQ(4200, bus.getBackend().getTarget(pinsB[0]));
+    EXPECT_GT(bus.getUsage(0).frames, 0ul);
+    EXPECT_GT(bus.getUsage(1).frames, 0ul);
+
+    // Cleanup mock
+    releaseArduinoMock();
+    releaseSPIMock();
+}
@@ -0,0 +1,244 @@
+#include "gtest/gtest.h"
+#include "M3LS.h"
+#include "M3LSServer.h"
+#include "M3LSClient.h"
+#include <atomic>
+#include <chrono>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+using ::testing::AnyNumber;
+
+// Runs a server for a three axis M3LS on the slave end of a pty, polling it
+// from its own thread the way loop() would on the device
+class ClientTest : public ::testing::Test {
+  protected:
+    int pins[3];
+    int master;
+    int slave;
+    M3LS *m3;
+    M3LSServer *server;
+    std::atomic<bool> running;
+    std::thread device;
+
+    void SetUp(){
+        pins[0] = 1; pins[1] = 2; pins[2] = 3;
+        struct termios tio;
+        master = posix_openpt(O_RDWR | O_NOCTTY);
+        grantpt(master);
+        unlockpt(master);
+        slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+        tcgetattr(slave, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(slave, TCSANOW, &tio);
+        Serial.attach(slave);
+
+        // Initialize mock Arduino and SPI
+        ArduinoMock* arduinoMock = arduinoMockInstance();
+        SPIMock* spiMock = SPIMockInstance();
+        EXPECT_CALL(*arduinoMock, millis()).Times(AnyNumber());
+        EXPECT_CALL(*arduinoMock, delay(50));
+        EXPECT_CALL(*spiMock, begin());
+        for (int pin = 0; pin < 3; pin++){
+            EXPECT_CALL(*arduinoMock, pinMode(pins[pin], OUTPUT));
+            EXPECT_CALL(*arduinoMock, digitalWrite(pins[pin], HIGH));
+        }
+        m3 = new M3LS(pins[0], pins[1], pins[2]);
+        m3->begin();
+        server = new M3LSServer(*m3, Serial);
+
+        // Each pass takes some time on the device, whether or not the
+        // server talked to the stages
+        running = true;
+        device = std::thread([this, arduinoMock](){
+            while (running){
+                arduinoMock->addMicrosRaw(100);
+                server->poll();
+            }
+        });
+    }
+
+    void TearDown(){
+        running = false;
+        device.join();
+        delete server;
+        delete m3;
+        Serial.attach(-1);
+        close(slave);
+        close(master);
+        releaseArduinoMock();
+        releaseSPIMock();
+    }
+};
+
+TEST_F(ClientTest, Commands){
+    M3LSClient client;
+    client.attach(master);
+    ASSERT_TRUE(client.sync());
+
+    // Mode change and move round trip
+    ASSERT_TRUE(client.setMode(M3LS::hold));
+    ASSERT_TRUE(client.move(7000, 5000, 6500));
+    M3LSStatus status;
+    ASSERT_TRUE(client.getStatus(&status));
+    EXPECT_EQ(M3LS::hold, status.mode);
+    EXPECT_EQ(3, status.numAxes);
+    EXPECT_EQ(7000, status.position[0]);
+    EXPECT_EQ(5000, status.position[1]);
+    EXPECT_EQ(6500, status.position[2]);
+
+    // Invalid modes are refused
+    EXPECT_FALSE(client.setMode(9));
+}
+
+TEST_F(ClientTest, PipelinedStatus){
+    M3LSClient client;
+    client.attach(master);
+    client.setWindow(4);
+    ASSERT_TRUE(client.sync());
+
+    // Samples stream back in order with several requests in flight
+    int samples = 0;
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    ASSERT_TRUE(client.streamStatus(500, [&samples](const M3LSStatus& s){
+        EXPECT_EQ(3, s.numAxes);
+        samples++;
+    }));
+    double elapsed = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    EXPECT_EQ(500, samples);
+    EXPECT_GT(samples / elapsed, 1000.0);
+    EXPECT_EQ(0, client.getInFlight());
+}
+
+TEST_F(ClientTest, Trajectory){
+    // Initialize test parameters
+    const int numPoints = 2000;
+    static int32_t points[numPoints][M3LS_PROTOCOL_AXES];
+    for (int i = 0; i < numPoints; i++){
+        points[i][0] = 6000 + (i % 300);
+        points[i][1] = 6000 - (i % 150);
+        points[i][2] = 4000 + i;
+    }
+    M3LSClient client;
+    client.attach(master);
+    ASSERT_TRUE(client.sync());
+
+    // The upload outpaces playback and has to wait for space on the device
+    ASSERT_TRUE(client.start(0));
+    ASSERT_TRUE(client.uploadTrajectory(points, numPoints));
+    M3LSStatus status;
+    do {
+        ASSERT_TRUE(client.getStatus(&status));
+    } while (status.queued > 0);
+    EXPECT_EQ(points[numPoints - 1][0], status.position[0]);
+    EXPECT_EQ(points[numPoints - 1][1], status.position[1]);
+    EXPECT_EQ(points[numPoints - 1][2], status.position[2]);
+    EXPECT_TRUE(client.stop());
+}
+
+TEST_F(ClientTest, Telemetry){
+    M3LSClient client;
+    client.attach(master);
+    ASSERT_TRUE(client.sync());
+    ASSERT_TRUE(client.move(7000, 5000, 6500));
+    unsigned long frames = m3->getTransport().getFrameCount(pins[0]);
+
+    // Telemetry reports the estimated positions, which reach the targets
+    // once the move has had time to finish
+    arduinoMockInstance()->addMillisRaw(1000);
+
+    // Samples arrive at the requested interval until the stream is stopped
+    std::vector<M3LSTelemetrySample> samples;
+    ASSERT_TRUE(client.streamTelemetry(2000,
+        [&samples](const M3LSTelemetrySample& sample){
+            samples.push_back(sample);
+        }));
+    while (samples.size() < 50){ ASSERT_TRUE(client.pump(100)); }
+    ASSERT_TRUE(client.streamTelemetry(0, M3LSClient::TelemetryHandler()));
+    size_t received = samples.size();
+    for (int i = 0; i < 5; i++){ ASSERT_TRUE(client.pump(10)); }
+    EXPECT_EQ(received, samples.size());
+    EXPECT_EQ(0u, client.getTelemetryLostFrames());
+
+    // Sampling sends nothing to the stages
+    EXPECT_EQ(frames, m3->getTransport().getFrameCount(pins[0]));
+
+    // Each sample holds the state of the manipulator and its stages
+    for (size_t i = 0; i < samples.size(); i++){
+        EXPECT_EQ(M3LS::position, samples[i].mode);
+        EXPECT_EQ(127, samples[i].joystick[0]);
+        EXPECT_EQ(7000, samples[i].position[0]);
+        EXPECT_EQ(5000, samples[i].position[1]);
+        EXPECT_EQ(6500, samples[i].position[2]);
+        EXPECT_NE(-1, samples[i].status[2]);
+        if (i > 0){
+            EXPECT_GE(samples[i].time - samples[i - 1].time, 2000u);
+        }
+    }
+}
+
+TEST_F(ClientTest, LostFrame){
+    M3LSClient client;
+    client.attach(master);
+    client.setTimeout(20);
+    ASSERT_TRUE(client.sync());
+
+    // A frame that never reaches the device is sent again
+    uint8_t payload[4 * M3LS_PROTOCOL_AXES] = {0};
+    uint8_t frame[M3LS_MAX_FRAME];
+    M3LSProtocol::encodeFrame(0xEE, M3LSProtocol::Move, payload, 3, frame);
+    ASSERT_EQ(3, write(master, frame, 3));
+    ASSERT_TRUE(client.move(6100, 6200, 6300));
+    M3LSStatus status;
+    ASSERT_TRUE(client.getStatus(&status));
+    EXPECT_EQ(6100, status.position[0]);
+    EXPECT_GT(client.getRetransmitCount(), 0u);
+}
+
+TEST_F(ClientTest, FullBackoff){
+    // Initialize test parameters
+    static int32_t points[M3LS_WAYPOINT_CAPACITY + 1][M3LS_PROTOCOL_AXES];
+    for (int i = 0; i <= M3LS_WAYPOINT_CAPACITY; i++){
+        points[i][0] = 6000 + i;
+        points[i][1] = 6000;
+        points[i][2] = 6000;
+    }
+    M3LSClient client;
+    client.attach(master);
+    ASSERT_TRUE(client.sync());
+
+    // Fill the device while playback waits on the frozen clock
+    ASSERT_TRUE(client.start(1));
+    ASSERT_TRUE(client.uploadTrajectory(points, M3LS_WAYPOINT_CAPACITY));
+    unsigned long retransmits = client.getRetransmitCount();
+
+    // A refused batch is sent again after a growing backoff, not as soon as
+    // each refusal comes back
+    uint8_t payload[M3LS_MAX_PAYLOAD];
+    int encoded;
+    int length = M3LSProtocol::encodeWaypoints(points + M3LS_WAYPOINT_CAPACITY,
+        1, M3LS_PROTOCOL_AXES, payload, M3LS_MAX_PAYLOAD, &encoded);
+    uint8_t result = 0xFF;
+    ASSERT_TRUE(client.submit(M3LSProtocol::Waypoints, payload, length,
+        [&result](uint8_t status, const M3LSFrame&){ result = status; }));
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - start <
+        std::chrono::milliseconds(150)){
+        ASSERT_TRUE(client.pump(10));
+    }
+    EXPECT_EQ(0xFF, result);
+    EXPECT_GT(client.getRetransmitCount(), retransmits);
+    EXPECT_LE(client.getRetransmitCount(), retransmits + 8);
+
+    // Once playback frees a slot the batch goes through
+    arduinoMockInstance()->addMillisRaw(10);
+    ASSERT_TRUE(client.flush());
+    EXPECT_EQ(M3LSProtocol::statusOk, result);
+    EXPECT_TRUE(client.stop());
+}
@@ -0,0 +1,116 @@
+#include "gtest/gtest.h"
+#include "M3LSImpl.h"
+#include "test_helpers.h"
+
+// A joystick the test moves
+struct EnvelopedConfig : M3LSDefaultConfig {
+    typedef M3LSScriptedInput Input;
+};
+
+typedef BasicM3LS<3, EnvelopedConfig> EnvelopedM3LS;
+
+// The dish: its footprint in X and Y, below a floor at Z = 5000
+static const int dishLow[3] = {4000, 4000, M3LS_TRAVEL_MIN};
+static const int dishHigh[3] = {8000, 8000, 5000};
+
+TEST(Envelope, Clamp){
+    // Initialize test parameters
+    M3LSEnvelope envelope;
+
+    // Starts as the whole travel
+    EXPECT_EQ(M3LS_TRAVEL_MIN, envelope.clamp(0, -50));
+    EXPECT_EQ(M3LS_TRAVEL_MAX, envelope.clamp(1, M3LS_TRAVEL_MAX + 1));
+    EXPECT_EQ(6000, envelope.clamp(2, 6000));
+    EXPECT_EQ(1u, envelope.getHits(0));
+    EXPECT_EQ(1u, envelope.getHits(1));
+    EXPECT_EQ(0u, envelope.getHits(2));
+
+    // Limits must lie within the travel, low first
+    EXPECT_FALSE(envelope.setLimits(0, 3000, 2000));
+    EXPECT_FALSE(envelope.setLimits(0, -1, 2000));
+    EXPECT_FALSE(envelope.setLimits(M3LS_ENVELOPE_AXES, 0, 2000));
+    EXPECT_TRUE(envelope.setLimits(0, 2000, 10000));
+    EXPECT_EQ(2000, envelope.clamp(0, 1999));
+    EXPECT_EQ(2000, envelope.clamp(0, 2000));
+    EXPECT_EQ(10000, envelope.clamp(0, 10000));
+    EXPECT_EQ(10000, envelope.clamp(0, 10001));
+    EXPECT_EQ(3u, envelope.getHits(0));
+
+    // Points inside the keep-out region leave it along Z, upward
+    EXPECT_TRUE(envelope.setKeepOut(dishLow, dishHigh, 2, true));
+    int inside[3] = {6000, 6000, 3000};
+    envelope.clampPoint(inside, 3);
+    EXPECT_EQ(6000, inside[0]);
+    EXPECT_EQ(6000, inside[1]);
+    EXPECT_EQ(5001, inside[2]);
+    int beside[3] = {9000, 6000, 3000};
+    envelope.clampPoint(beside, 3);
+    EXPECT_EQ(3000, beside[2]);
+    int edge[3] = {8000, 4000, 5000};
+    envelope.clampPoint(edge, 3);
+    EXPECT_EQ(5001, edge[2]);
+    EXPECT_EQ(2u, envelope.getKeepOutHits());
+
+    // A region whose exit face lies outside the travel is refused
+    int top[3] = {0, 0, M3LS_TRAVEL_MAX};
+    EXPECT_FALSE(envelope.setKeepOut(dishLow, top, 2, true));
+    EXPECT_FALSE(envelope.setKeepOut(dishHigh, dishLow, 2, true));
+
+    // Clearing the region and resetting
+    envelope.clearKeepOut();
+    int loose[3] = {6000, 6000, 3000};
+    envelope.clampPoint(loose, 3);
+    EXPECT_EQ(3000, loose[2]);
+    envelope.reset();
+    EXPECT_EQ(M3LS_TRAVEL_MIN, envelope.getLow(0));
+    EXPECT_EQ(0u, envelope.getHits(0));
+    EXPECT_EQ(0u, envelope.getKeepOutHits());
+}
+
+TEST(Envelope, Manipulator){
+    // Initialize test parameters
+    int pins[] = {1, 2, 3};
+    EnvelopedM3LS *m3 = beginVirtualTime<EnvelopedM3LS>(pins);
+    ArduinoMock* arduinoMock = arduinoMockInstance();
+    LoopbackTransport& stages = m3->getTransport();
+    M3LSEnvelope& envelope = m3->getEnvelope();
+
+    // Targets past the soft limits stop at them
+    EXPECT_TRUE(m3->setSoftLimits(0, 2000, 10000));
+    int far[3] = {11000, 6000, 6000};
+    m3->moveAxes(M3LS::axisMask(M3LS::X), far);
+    EXPECT_EQ(10000, stages.getTarget(pins[0]));
+    EXPECT_EQ(1u, envelope.getHits(0));
+
+    // Z may go below the floor beside the dish...
+    EXPECT_TRUE(m3->setKeepOut(dishLow, dishHigh, 2, true));
+    int beside[3] = {0, 0, 3000};
+    m3->moveAxes(M3LS::axisMask(M3LS::Z), beside);
+    EXPECT_EQ(3000, stages.getTarget(pins[2]));
+
+    // ...but moving over the dish lifts it over the floor in the same batch
+    int over[3] = {6000, 6000, 0};
+    m3->moveAxes(M3LS::axisMask(M3LS::XY), over);
+    EXPECT_EQ(6000, stages.getTarget(pins[0]));
+    EXPECT_EQ(6000, stages.getTarget(pins[1]));
+    EXPECT_EQ(5001, stages.getTarget(pins[2]));
+    EXPECT_EQ(1u, envelope.getKeepOutHits());
+
+    // Driving Z down over the dish heads for the floor, not the end of travel
+    m3->bindButton(1, M3LS::ZDown);
+    m3->getInput().setButtons(1);
+    m3->setControlMode(M3LS::velocity);
+    arduinoMock->addMillisRaw(20);
+    m3->run();
+    EXPECT_EQ(5001, stages.getTarget(pins[2]));
+
+    // A keep-out region must leave along an axis the manipulator has
+    BasicM3LS<2, EnvelopedConfig> flat(pins[0], pins[1]);
+    EXPECT_FALSE(flat.setKeepOut(dishLow, dishHigh, 2, true));
+    EXPECT_TRUE(flat.setKeepOut(dishLow, dishHigh, 1, true));
+
+    // Cleanup mock
+    delete m3;
+    releaseArduinoMock();
+    releaseSPIMock();
+}
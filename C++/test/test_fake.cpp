@@ -0,0 +1,160 @@
+#include "gtest/gtest.h"
+#include "M3LSImpl.h"
+
+// Chip select of the stage the tests talk to
+static const int stagePin = 10;
+
+// Byte-level model of a stage on the fake bus: it takes in a command up to
+// its \r, then answers the filler bytes that follow with the reply, echoing
+// the opcode
+struct StageModel {
+    char command[32];
+    int received;
+    char reply[40];
+    int replyLength;
+    int replied;
+};
+
+static uint8_t respond(uint8_t sent, void *context){
+    StageModel *stage = (StageModel *)context;
+    if (stage->replied < stage->replyLength){
+        return stage->reply[stage->replied++];
+    }
+    if (sent == 0x01){ return 0x01; }
+    if (stage->received < 32){ stage->command[stage->received++] = sent; }
+    if (sent == '\r'){
+        if (memcmp(stage->command, "<10>", 4) == 0){
+            stage->replyLength = sprintf(stage->reply,
+                "<10 000000 00001770 00000000>\r");
+        } else {
+            stage->replyLength = sprintf(stage->reply, "<%c%c>\r",
+                stage->command[1], stage->command[2]);
+        }
+        stage->replied = 0;
+        stage->received = 0;
+    }
+    return 0x00;
+}
+
+// The default configuration with its stages on the SPI bus rather than the
+// loopback model
+struct FakeBusConfig : M3LSDefaultConfig {
+    typedef BlockingSPITransport Transport;
+};
+
+TEST(Fake, Throughput){
+    // Initialize test parameters
+    const unsigned long transfers = 1000000;
+    ArduinoFake* board = arduinoFakeInstance();
+    SPIFake* bus = SPIFakeInstance();
+    StageModel stage = {};
+    bus->setResponder(respond, &stage);
+    BlockingSPITransport transport;
+    char recv[M3LS_REPLY_SIZE];
+
+    // A million frames through the real byte-level transport
+    for (unsigned long frame = 0; frame < transfers; frame++){
+        ASSERT_EQ(5, transport.transfer(stagePin, "<08>\r", 5, recv,
+            M3LS_REPLY_SIZE));
+    }
+    EXPECT_EQ(0, memcmp(recv, "<08>\r", 5));
+    EXPECT_EQ(transfers, bus->transactions);
+    EXPECT_EQ(0ul, bus->openTransactions);
+    EXPECT_EQ(transfers * 10, bus->bytes);
+    EXPECT_EQ(transfers * 2, board->digitalWrites);
+    EXPECT_EQ(HIGH, board->level[stagePin]);
+    EXPECT_GT(board->getMicros(), transfers * 10);
+
+    // Cleanup fake
+    releaseArduinoFake();
+    releaseSPIFake();
+}
+
+TEST(Fake, Script){
+    // Scripted bytes answer first, the command's own bytes included, then
+    // the idle byte
+    SPIFake* bus = SPIFakeInstance();
+    const uint8_t reply[] = {0, 0, 0, 0, 0, '<', '0', '3', '>', '\r'};
+    ASSERT_TRUE(bus->queueResponse(reply, sizeof(reply)));
+    EXPECT_EQ(10u, bus->getScripted());
+    BlockingSPITransport transport;
+    char recv[M3LS_REPLY_SIZE];
+    EXPECT_EQ(5, transport.transfer(stagePin, "<03>\r", 5, recv,
+        M3LS_REPLY_SIZE));
+    EXPECT_EQ(0u, bus->getScripted());
+    bus->setIdleByte(0x55);
+    EXPECT_EQ(0x55, SPI.transfer(0x01));
+
+    // A script that does not fit is refused whole
+    static uint8_t large[SPI_FAKE_SCRIPT + 1];
+    EXPECT_FALSE(bus->queueResponse(large, sizeof(large)));
+    EXPECT_EQ(0u, bus->getScripted());
+
+    // Cleanup fake
+    releaseArduinoFake();
+    releaseSPIFake();
+}
+
+TEST(Fake, FuzzReplies){
+    // Initialize test parameters
+    const int recvSize = 16;
+    const int guard = 8;
+    uint32_t state = 12345;
+    SPIFake* bus = SPIFakeInstance();
+    ArduinoFake* board = arduinoFakeInstance();
+    bus->setResponder([](uint8_t, void *context) -> uint8_t {
+        // Mostly noise, with frame delimiters common enough to matter
+        uint32_t *random = (uint32_t *)context;
+        *random ^= *random << 13;
+        *random ^= *random >> 17;
+        *random ^= *random << 5;
+        switch (*random % 8){
+            case 0  :   return '<';
+            case 1  :   return '\r';
+            default :   return (uint8_t)(*random >> 8);
+        }
+    }, &state);
+    BlockingSPITransport transport;
+
+    // Whatever the stage answers, a reply stays within the buffer, ends in
+    // \r when accepted, and the stage is deselected afterwards
+    char recv[recvSize + guard];
+    for (int frame = 0; frame < 100000; frame++){
+        memset(recv, 0x7E, sizeof(recv));
+        int received = transport.transfer(stagePin, "<10>\r", 5, recv,
+            recvSize);
+        ASSERT_TRUE(received == -1 || (received > 0 && received <= recvSize));
+        if (received > 0){ ASSERT_EQ('\r', recv[received - 1]); }
+        for (int byte = recvSize; byte < recvSize + guard; byte++){
+            ASSERT_EQ(0x7E, recv[byte]);
+        }
+        ASSERT_EQ(HIGH, board->level[stagePin]);
+    }
+    EXPECT_EQ(0ul, bus->openTransactions);
+
+    // Cleanup fake
+    releaseArduinoFake();
+    releaseSPIFake();
+}
+
+TEST(Fake, Manipulator){
+    // The whole library runs on the fake board without any expectations
+    ArduinoFake* board = arduinoFakeInstance();
+    SPIFake* bus = SPIFakeInstance();
+    StageModel stage = {};
+    bus->setResponder(respond, &stage);
+    BasicM3LS<1, FakeBusConfig> m3(stagePin);
+    m3.begin();
+    EXPECT_EQ(OUTPUT, board->mode[stagePin]);
+    EXPECT_EQ(1ul, bus->begins);
+    int target = 7000;
+    unsigned long before = bus->transactions;
+    m3.moveAxes(1, &target);
+    EXPECT_GT(bus->transactions, before);
+    m3.getCurrentPosition();
+    EXPECT_EQ(6000, m3.getEstimatedPosition(0));
+
+    // Cleanup fake
+    releaseArduinoFake();
+    releaseSPIFake();
+}
@@ -0,0 +1,43 @@
+/*
+test_helpers.h - Fixture shared by the tests that run a whole manipulator on
+                 loopback stages in virtual time
+Copyright info?
+*/
+
+#ifndef test_helpers_h
+#define test_helpers_h
+
+#include "gtest/gtest.h"
+#include "M3LS.h"
+
+// Builds a three axis manipulator whose delay() advances the mock clock, so
+// code that waits on millis() runs in virtual time. `setup` gets the
+// manipulator before begin(), to bind buttons, attach storage or preset the
+// loopback stages. The caller deletes it, then releases the mocks.
+template <class Manipulator = M3LS, class Setup>
+Manipulator *beginVirtualTime(const int *pins, Setup setup){
+    ArduinoMock* arduinoMock = arduinoMockInstance();
+    SPIMock* spiMock = SPIMockInstance();
+    EXPECT_CALL(*arduinoMock, millis()).Times(::testing::AnyNumber());
+    EXPECT_CALL(*arduinoMock, delay(::testing::_)).WillRepeatedly(
+        ::testing::Invoke([arduinoMock](int ms){
+            arduinoMock->addMillisRaw(ms);
+        }));
+    EXPECT_CALL(*spiMock, begin());
+    for (int pin = 0; pin < 3; pin++){
+        EXPECT_CALL(*arduinoMock, pinMode(pins[pin], OUTPUT));
+        EXPECT_CALL(*arduinoMock, digitalWrite(pins[pin], HIGH));
+    }
+    Manipulator *m3 = new Manipulator(pins[0], pins[1], pins[2]);
+    setup(*m3);
+    m3->begin();
+    return m3;
+}
+
+// The same without any setup
+template <class Manipulator = M3LS>
+Manipulator *beginVirtualTime(const int *pins){
+    return beginVirtualTime<Manipulator>(pins, [](Manipulator&){});
+}
+
+#endif
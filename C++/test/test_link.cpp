@@ -0,0 +1,156 @@
+#include "gtest/gtest.h"
+#include "M3LS.h"
+#include "test_helpers.h"
+
+TEST(Link, Recovery){
+    // Initialize test parameters
+    int pins[] = {1, 2, 3};
+    M3LS *m3 = beginVirtualTime(pins);
+    LoopbackTransport& loopback = m3->getTransport();
+    loopback.setPosition(pins[0], 6400);
+    const M3LSLinkErrors& errors = m3->getLinkErrors(0);
+    EXPECT_EQ(0u, errors.stale + errors.malformed + errors.noReply);
+
+    // A reply left over from an earlier command costs one resend
+    unsigned long frames = loopback.getFrameCount(pins[0]);
+    loopback.queueReply(pins[0], "<20 1 0000>\r");
+    m3->getCurrentPosition();
+    EXPECT_EQ(frames + 2, loopback.getFrameCount(pins[0]));
+    EXPECT_EQ(6400, m3->getEstimatedPosition(0));
+    EXPECT_EQ(1u, errors.stale);
+    EXPECT_EQ(1u, errors.retries);
+    EXPECT_EQ(0u, errors.failures);
+
+    // So does a garbled status reply, whose position is never used
+    loopback.queueReply(pins[0], "<10 000000 0000G964 00000000>\r");
+    m3->getCurrentPosition();
+    EXPECT_EQ(frames + 4, loopback.getFrameCount(pins[0]));
+    EXPECT_EQ(6400, m3->getEstimatedPosition(0));
+    EXPECT_EQ(1u, errors.malformed);
+    EXPECT_EQ(2u, errors.retries);
+
+    // The other stages saw no errors, and there are none past the last axis
+    EXPECT_EQ(0u, m3->getLinkErrors(1).retries);
+    EXPECT_EQ(0u, m3->getLinkErrors(2).retries);
+    EXPECT_EQ(0u, m3->getLinkErrors(3).retries);
+    EXPECT_EQ(0u, m3->getLinkErrors(-1).stale);
+
+    m3->resetLinkErrors();
+    EXPECT_EQ(0u, errors.stale + errors.malformed + errors.retries);
+
+    // Cleanup mock
+    delete m3;
+    releaseArduinoMock();
+    releaseSPIMock();
+}
+
+TEST(Link, Failure){
+    // Initialize test parameters
+    int pins[] = {1, 2, 3};
+    M3LS *m3 = beginVirtualTime(pins);
+    LoopbackTransport& loopback = m3->getTransport();
+    int targets[] = {6500, 6000, 6000};
+    m3->moveAxes(M3LS::axisMask(M3LS::X), targets);
+    arduinoMockInstance()->addMillisRaw(200);
+
+    // Every reply from the stage comes back corrupted, while it has been
+    // moved without the library knowing
+    loopback.setTimingLimit(pins[0], M3LS_TIMING_LEVELS);
+    loopback.setPosition(pins[0], 7000);
+    unsigned long frames = loopback.getFrameCount(pins[0]);
+    unsigned long start = micros();
+    m3->getCurrentPosition();
+
+    // Bounded retries with backoff, then the estimate stands in
+    const M3LSLinkErrors& errors = m3->getLinkErrors(0);
+    EXPECT_EQ(frames + 1 + M3LS_LINK_RETRIES,
+        loopback.getFrameCount(pins[0]));
+    EXPECT_EQ(1u + M3LS_LINK_RETRIES, errors.malformed);
+    EXPECT_EQ((unsigned long)M3LS_LINK_RETRIES, errors.retries);
+    EXPECT_EQ(1u, errors.failures);
+    EXPECT_GE(micros() - start, (unsigned long)M3LS_LINK_BACKOFF_US * 3);
+    EXPECT_EQ(6500, m3->getEstimatedPosition(0));
+
+    // Once the link is clean again the stage is read as it is
+    loopback.setTimingLimit(pins[0], 0);
+    m3->getCurrentPosition();
+    EXPECT_EQ(7000, m3->getEstimatedPosition(0));
+
+    // Cleanup mock
+    delete m3;
+    releaseArduinoMock();
+    releaseSPIMock();
+}
+
+TEST(Link, Batch){
+    // Initialize test parameters
+    int pins[] = {1, 2, 3};
+    M3LS *m3 = beginVirtualTime(pins);
+    LoopbackTransport& loopback = m3->getTransport();
+    const M3LSLinkErrors& x = m3->getLinkErrors(M3LS::X);
+    const M3LSLinkErrors& y = m3->getLinkErrors(M3LS::Y);
+    int targets[] = {6500, 5500, 6000};
+    unsigned long frames = loopback.getFrameCount(pins[0]);
+    m3->moveAxes(M3LS::axisMask(M3LS::XY), targets);
+    unsigned long perMove = loopback.getFrameCount(pins[0]) - frames;
+
+    // A stale reply in the middle of a batch stops it there, and the batch
+    // is resent from that frame
+    targets[M3LS::X] = 7000;
+    targets[M3LS::Y] = 5000;
+    frames = loopback.getFrameCount(pins[0]);
+    loopback.queueReply(pins[0], "<20 1 0000>\r");
+    m3->moveAxes(M3LS::axisMask(M3LS::XY), targets);
+    EXPECT_EQ(frames + perMove + 1, loopback.getFrameCount(pins[0]));
+    EXPECT_EQ(1u, x.stale);
+    EXPECT_EQ(1u, x.retries);
+    EXPECT_EQ(7000, loopback.getTarget(pins[0]));
+    EXPECT_EQ(5000, loopback.getTarget(pins[1]));
+
+    // A stage whose every echo is corrupted is given up on after the
+    // retries, without charging the other stage
+    loopback.setTimingLimit(pins[1], M3LS_TIMING_LEVELS);
+    targets[M3LS::Y] = 5500;
+    m3->moveAxes(M3LS::axisMask(M3LS::XY), targets);
+    EXPECT_EQ(1u + M3LS_LINK_RETRIES, y.malformed);
+    EXPECT_EQ((unsigned long)M3LS_LINK_RETRIES, y.retries);
+    EXPECT_EQ(1u, y.failures);
+    EXPECT_EQ(0u, y.noReply);
+    EXPECT_EQ(1u, x.retries);
+    EXPECT_EQ(0u, x.failures);
+
+    // Cleanup mock
+    delete m3;
+    releaseArduinoMock();
+    releaseSPIMock();
+}
+
+TEST(Link, HaltPastDesync){
+    // Initialize test parameters
+    int pins[] = {1, 2, 3};
+    M3LS *m3 = beginVirtualTime(pins);
+    LoopbackTransport& loopback = m3->getTransport();
+    for (int pin = 0; pin < 3; pin++){
+        loopback.setSpeed(pins[pin], 10);
+    }
+    int targets[] = {7000, 7000, 7000};
+    m3->moveAxes(M3LS::axisMask(M3LS::XYZ), targets);
+    m3->getCurrentPosition();
+
+    // The first stage of the halt batch stops answering; the stop still
+    // reaches the others
+    loopback.setTimingLimit(pins[0], M3LS_TIMING_LEVELS);
+    m3->halt();
+    EXPECT_LE(1u, m3->getLinkErrors(M3LS::X).failures);
+    for (int pin = 1; pin < 3; pin++){
+        EXPECT_GT(7000, loopback.getTarget(pins[pin])) << "stage " << pin;
+        EXPECT_EQ(loopback.getPosition(pins[pin]),
+            loopback.getTarget(pins[pin])) << "stage " << pin;
+        EXPECT_EQ(0u, m3->getLinkErrors(pin).failures) << "stage " << pin;
+    }
+
+    // Cleanup mock
+    delete m3;
+    releaseArduinoMock();
+    releaseSPIMock();
+}
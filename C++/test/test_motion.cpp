@@ -0,0 +1,397 @@
+#include "gtest/gtest.h"
+#include "M3LS.h"
+#include "test_helpers.h"
+
+TEST(Settle, Query){
+    // Initialize test parameters
+    int pins[] = {1, 2, 3};
+    M3LS *m3 = beginVirtualTime(pins);
+    LoopbackTransport& loopback = m3->getTransport();
+    loopback.setSpeed(pins[0], 100);
+
+    // A stage is unsettled while it is running toward its target
+    int targets[] = {6500, 6000, 6000};
+    m3->moveAxes(M3LS::axisMask(M3LS::X), targets);
+    EXPECT_FALSE(m3->isSettled(M3LS::axisMask(M3LS::X), 5));
+    EXPECT_TRUE(m3->isSettled(M3LS::axisMask(M3LS::YZ), 5));
+
+    // A stopped stage is settled once its position error is within tolerance
+    loopback.queueReply(pins[0], "<10 000000 00001964 00000008>\r");
+    EXPECT_FALSE(m3->isSettled(M3LS::axisMask(M3LS::X), 5));
+    loopback.queueReply(pins[0], "<10 000000 00001964 FFFFFFFD>\r");
+    EXPECT_TRUE(m3->isSettled(M3LS::axisMask(M3LS::X), 5));
+
+    // A stage that does not answer is never settled
+    loopback.queueReply(pins[0], "<>\r");
+    EXPECT_FALSE(m3->isSettled(M3LS::axisMask(M3LS::X), 5));
+
+    // Cleanup mock
+    delete m3;
+    releaseArduinoMock();
+    releaseSPIMock();
+}
+
+TEST(Settle, Wait){
+    // Initialize test parameters
+    int pins[] = {1, 2, 3};
+    M3LS *m3 = beginVirtualTime(pins);
+    ArduinoMock* arduinoMock = arduinoMockInstance();
+    LoopbackTransport& loopback = m3->getTransport();
+    for (int pin = 0; pin < 3; pin++){
+        loopback.setSpeed(pins[pin], 50);
+    }
+
+    // Short moves return after a few fast polls instead of a fixed sleep
+    int targets[] = {6100, 5900, 6000};
+    m3->moveAxes(M3LS::axisMask(M3LS::XY), targets);
+    unsigned long start = arduinoMock->getMillis();
+    EXPECT_TRUE(m3->waitForSettle(M3LS::axisMask(M3LS::XY), 0, 1000));
+    EXPECT_LT(arduinoMock->getMillis() - start, 10u);
+    EXPECT_EQ(6100, loopback.getPosition(pins[0]));
+    EXPECT_EQ(5900, loopback.getPosition(pins[1]));
+
+    // Long moves back off to the slowest poll interval
+    targets[0] = 11000;
+    m3->moveAxes(M3LS::axisMask(M3LS::X), targets);
+    unsigned long frames = loopback.getFrameCount(pins[0]);
+    EXPECT_TRUE(m3->waitForSettle(M3LS::axisMask(M3LS::X), 0, 10000));
+    EXPECT_EQ(11000, loopback.getPosition(pins[0]));
+    EXPECT_EQ(frames + (11000 - 6100) / 50, loopback.getFrameCount(pins[0]));
+
+    // A stage that never arrives times out on schedule
+    loopback.setSpeed(pins[2], 1);
+    targets[2] = 12000;
+    m3->moveAxes(M3LS::axisMask(M3LS::Z), targets);
+    start = arduinoMock->getMillis();
+    EXPECT_FALSE(m3->waitForSettle(M3LS::axisMask(M3LS::Z), 5, 200));
+    EXPECT_EQ(200u, arduinoMock->getMillis() - start);
+
+    // Cleanup mock
+    delete m3;
+    releaseArduinoMock();
+    releaseSPIMock();
+}
+
+TEST(Calibration, Concurrent){
+    // Initialize test parameters
+    int pins[] = {1, 2, 3};
+    M3LS *m3 = beginVirtualTime(pins);
+    ArduinoMock* arduinoMock = arduinoMockInstance();
+    LoopbackTransport& loopback = m3->getTransport();
+
+    // Begin found each stage's frequency without sleeping beyond the SPI
+    // power up delay
+    EXPECT_EQ(50u, arduinoMock->getMillis());
+    for (int axis = 0; axis < 3; axis++){
+        EXPECT_EQ(0x0A00 + pins[axis], m3->getSweepFrequency(axis));
+    }
+    EXPECT_EQ(0, m3->getSweepFrequency(3));
+
+    // Sweeps run side by side, so the slowest stage sets the pace
+    loopback.setSweepLength(pins[0], 4);
+    loopback.setSweepLength(pins[1], 10);
+    loopback.setSweepLength(pins[2], 2);
+    unsigned long start = arduinoMock->getMillis();
+    EXPECT_TRUE(m3->calibrate(M3LS_CALIBRATION_TIMEOUT_MS));
+    EXPECT_EQ(2u * 9 * M3LS_CALIBRATION_POLL_MS,
+        arduinoMock->getMillis() - start);
+    EXPECT_STREQ("<87>\r", loopback.getLastFrame(pins[1]));
+
+    // A stage that never finishes gives up at the timeout
+    loopback.setSweepLength(pins[2], 1000);
+    EXPECT_FALSE(m3->calibrate(100));
+
+    // Cleanup mock
+    delete m3;
+    releaseArduinoMock();
+    releaseSPIMock();
+}
+
+TEST(Velocity, NativeSpeed){
+    // Initialize test parameters
+    int pins[] = {1, 2, 3};
+    M3LS *m3 = beginVirtualTime(pins);
+    LoopbackTransport& loopback = m3->getTransport();
+    m3->setControlMode(M3LS::velocity);
+    unsigned long frames = loopback.getFrameCount(pins[0]);
+
+    // Leaving the dead zone programs a speed, then one move to the far end
+    m3->updatePosition(255, 127, 127);
+    EXPECT_EQ(frames + 2, loopback.getFrameCount(pins[0]));
+    EXPECT_STREQ("<08 00002EE0>\r", loopback.getLastFrame(pins[0]));
+    int fullSpeed = loopback.getDriveSpeed(pins[0]);
+    EXPECT_EQ(3 * (5500 / 70 + 1) * 50 / 10, fullSpeed);
+    EXPECT_EQ(0u, loopback.getFrameCount(pins[1]) - frames);
+
+    // Holding the stick in a zone sends nothing at all
+    for (int tick = 0; tick < 10; tick++){
+        m3->updatePosition(255, 127, 127);
+    }
+    EXPECT_EQ(frames + 2, loopback.getFrameCount(pins[0]));
+
+    // A slower zone in the same direction only changes the speed
+    m3->updatePosition(170, 127, 127);
+    EXPECT_EQ(frames + 3, loopback.getFrameCount(pins[0]));
+    EXPECT_EQ(fullSpeed / 3, loopback.getDriveSpeed(pins[0]));
+
+    // Reversing heads for the other end
+    m3->updatePosition(0, 127, 127);
+    EXPECT_STREQ("<08 00000000>\r", loopback.getLastFrame(pins[0]));
+
+    // The dead zone stops the stage where it is with <03>, never a move to a
+    // position read while it was still going, and restores the move speed
+    loopback.setPosition(pins[0], 4321);
+    frames = loopback.getFrameCount(pins[0]);
+    m3->updatePosition(127, 127, 127);
+    EXPECT_EQ(4321, loopback.getTarget(pins[0]));
+    EXPECT_EQ(M3LS_POSITION_SPEED / 10, loopback.getDriveSpeed(pins[0]));
+    EXPECT_EQ(frames + 3, loopback.getFrameCount(pins[0]));
+    EXPECT_STREQ("<10>\r", loopback.getLastFrame(pins[0]));
+    EXPECT_EQ(4321, m3->getEstimatedPosition(0));
+
+    // Leaving velocity mode stops a driven axis
+    m3->updatePosition(127, 0, 127);
+    m3->setControlMode(M3LS::position);
+    EXPECT_EQ(M3LS_POSITION_SPEED / 10, loopback.getDriveSpeed(pins[1]));
+
+    // Cleanup mock
+    delete m3;
+    releaseArduinoMock();
+    releaseSPIMock();
+}
+
+TEST(Estimator, DeadReckoning){
+    // Initialize test parameters
+    int pins[] = {1, 2, 3};
+    M3LS *m3 = beginVirtualTime(pins);
+    ArduinoMock* arduinoMock = arduinoMockInstance();
+    LoopbackTransport& loopback = m3->getTransport();
+    unsigned long frames = loopback.getFrameCount(pins[0]);
+
+    // Halfway through a move the estimate is halfway there, and its bound
+    // covers the unmodelled acceleration
+    int targets[] = {7000, 6000, 6000};
+    m3->moveAxes(M3LS::axisMask(M3LS::X), targets);
+    arduinoMock->addMillisRaw(50);
+    EXPECT_EQ(6500, m3->getEstimatedPosition(M3LS::X));
+    EXPECT_EQ(M3LS_ESTIMATE_BASE_ERROR + 500 * M3LS_ESTIMATE_SPEED_ERROR / 100,
+        m3->getEstimateError(M3LS::X));
+    EXPECT_EQ(M3LS_ESTIMATE_BASE_ERROR, m3->getEstimateError(M3LS::Y));
+    EXPECT_EQ(frames + 1, loopback.getFrameCount(pins[0]));
+
+    // The background refresh reads only the uncertain axis
+    unsigned long others = loopback.getFrameCount(pins[1]);
+    m3->refreshEstimates();
+    EXPECT_EQ(frames + 2, loopback.getFrameCount(pins[0]));
+    EXPECT_EQ(others, loopback.getFrameCount(pins[1]));
+    EXPECT_EQ(7000, m3->getEstimatedPosition(M3LS::X));
+    EXPECT_EQ(M3LS_ESTIMATE_BASE_ERROR, m3->getEstimateError(M3LS::X));
+
+    // Once every estimate is certain nothing more is read
+    arduinoMock->addMillisRaw(M3LS_ESTIMATE_SAMPLE_MS);
+    m3->refreshEstimates();
+    EXPECT_EQ(frames + 2, loopback.getFrameCount(pins[0]));
+
+    // A move that has had time to finish is predicted on its target
+    targets[M3LS::X] = 6000;
+    m3->moveAxes(M3LS::axisMask(M3LS::X), targets);
+    arduinoMock->addMillisRaw(100 + M3LS_ESTIMATE_SETTLE_MS);
+    EXPECT_EQ(6000, m3->getEstimatedPosition(M3LS::X));
+    EXPECT_EQ(M3LS_ESTIMATE_BASE_ERROR, m3->getEstimateError(M3LS::X));
+
+    // Cleanup mock
+    delete m3;
+    releaseArduinoMock();
+    releaseSPIMock();
+}
+
+TEST(Queue, PreemptiveStop){
+    // Initialize test parameters
+    int pins[] = {1, 2, 3};
+    M3LS *m3 = beginVirtualTime(pins);
+    LoopbackTransport& loopback = m3->getTransport();
+    int targets[] = {7000, 5000, 6000};
+    m3->moveAxes(M3LS::axisMask(M3LS::XY), targets);
+
+    // Returning home sends the Z lift at once and queues the rest
+    m3->returnHome();
+    EXPECT_EQ(6000 + M3LS_HOME_CLEARANCE * 3 / 2 + M3LS_HOME_LIFT_MARGIN,
+        loopback.getTarget(pins[2]));
+    EXPECT_TRUE(m3->isHoming());
+    int queued = m3->getQueuedCommands();
+    EXPECT_LT(0, queued);
+
+    // A move made meanwhile waits behind the sequence
+    targets[M3LS::X] = 6500;
+    m3->moveAxes(M3LS::axisMask(M3LS::X), targets);
+    EXPECT_EQ(queued + 1, m3->getQueuedCommands());
+    EXPECT_EQ(7000, loopback.getTarget(pins[0]));
+
+    // A stop drops everything queued and reaches every stage within one
+    // batch of <03> frames
+    m3->halt();
+    EXPECT_EQ(0, m3->getQueuedCommands());
+    EXPECT_FALSE(m3->isHoming());
+    EXPECT_EQ(7000, loopback.getTarget(pins[0]));
+    EXPECT_EQ(5000, loopback.getTarget(pins[1]));
+    EXPECT_EQ(3u * (5 + 5 + 1) * M3LS_BYTE_DELAY_US, m3->getStopLatency());
+
+    // Otherwise the sequence finishes in the background, then the move
+    // queued behind it is sent
+    m3->returnHome();
+    m3->moveAxes(M3LS::axisMask(M3LS::X), targets);
+    EXPECT_TRUE(m3->flushCommands(1000));
+    EXPECT_FALSE(m3->isHoming());
+    EXPECT_EQ(6500, loopback.getTarget(pins[0]));
+    EXPECT_FALSE(m3->serviceCommands());
+
+    // Cleanup mock
+    delete m3;
+    releaseArduinoMock();
+    releaseSPIMock();
+}
+
+TEST(Queue, HaltWhileMoving){
+    // Initialize test parameters
+    int pins[] = {1, 2, 3};
+    M3LS *m3 = beginVirtualTime(pins);
+    ArduinoMock* arduinoMock = arduinoMockInstance();
+    LoopbackTransport& loopback = m3->getTransport();
+    loopback.setSpeed(pins[0], 10);
+    int targets[] = {9000, 6000, 6000};
+    m3->moveAxes(M3LS::axisMask(M3LS::X), targets);
+    for (int poll = 0; poll < 3; poll++){ m3->getCurrentPosition(); }
+
+    // A stage halted on its way is predicted to hold where it stopped
+    m3->halt();
+    int stopped = loopback.getPosition(pins[0]);
+    EXPECT_GT(9000, stopped);
+    EXPECT_EQ(stopped, m3->getEstimatedPosition(M3LS::X));
+    arduinoMock->addMillisRaw(300);
+    EXPECT_EQ(stopped, m3->getEstimatedPosition(M3LS::X));
+    EXPECT_EQ(M3LS_ESTIMATE_BASE_ERROR, m3->getEstimateError(M3LS::X));
+
+    // Moves relative to the last targets start from there, not from the
+    // cancelled target
+    m3->moveAlongNeedle(100);
+    EXPECT_EQ(stopped, loopback.getTarget(pins[0]));
+    EXPECT_EQ(6100, loopback.getTarget(pins[2]));
+
+    // Cleanup mock
+    delete m3;
+    releaseArduinoMock();
+    releaseSPIMock();
+}
+
+TEST(Home, Refused){
+    // Initialize test parameters
+    int pins[] = {1, 2, 3};
+    M3LS *m3 = beginVirtualTime(pins);
+    LoopbackTransport& loopback = m3->getTransport();
+    int targets[] = {8000, 5000, 6000};
+    m3->moveAxes(M3LS::axisMask(M3LS::XY), targets);
+    m3->setHomeClearance(100);
+
+    // A ceiling below the clearance height would let X and Y sweep across
+    // with the needle down, so the return is refused
+    m3->getEnvelope().setLimits(M3LS::Z, M3LS_TRAVEL_MIN, 6050);
+    m3->returnHome();
+    EXPECT_FALSE(m3->isHoming());
+    EXPECT_EQ(0, m3->getQueuedCommands());
+    EXPECT_EQ(6000, loopback.getTarget(pins[2]));
+    EXPECT_EQ(8000, loopback.getTarget(pins[0]));
+
+    // With room to clear it goes ahead, the lift stopping at the ceiling
+    m3->getEnvelope().setLimits(M3LS::Z, M3LS_TRAVEL_MIN, 6120);
+    m3->returnHome();
+    EXPECT_TRUE(m3->isHoming());
+    EXPECT_EQ(6120, loopback.getTarget(pins[2]));
+
+    // Cleanup mock
+    delete m3;
+    releaseArduinoMock();
+    releaseSPIMock();
+}
+
+TEST(Home, WaitTimeout){
+    // Initialize test parameters
+    int pins[] = {1, 2, 3};
+    M3LS *m3 = beginVirtualTime(pins);
+    ArduinoMock* arduinoMock = arduinoMockInstance();
+    LoopbackTransport& loopback = m3->getTransport();
+    int targets[] = {8000, 5000, 6000};
+    m3->moveAxes(M3LS::axisMask(M3LS::XY), targets);
+    arduinoMock->addMillisRaw(500);
+
+    // X can no longer be read once its move home is sent, so it never
+    // settles; the sequence gives up and halts instead of blocking the queue
+    loopback.setSpeed(pins[1], 1);
+    m3->returnHome();
+    arduinoMock->addMillisRaw(100);
+    while (m3->serviceCommands()){}
+    EXPECT_EQ(6000, loopback.getTarget(pins[1]));
+    loopback.setTimingLimit(pins[0], M3LS_TIMING_LEVELS);
+    arduinoMock->addMillisRaw(M3LS_WAIT_TIMEOUT_MS / 2);
+    EXPECT_FALSE(m3->serviceCommands());
+    EXPECT_TRUE(m3->isHoming());
+    arduinoMock->addMillisRaw(M3LS_WAIT_TIMEOUT_MS / 2);
+    EXPECT_TRUE(m3->serviceCommands());
+    EXPECT_FALSE(m3->isHoming());
+    EXPECT_EQ(0, m3->getQueuedCommands());
+    EXPECT_EQ(loopback.getPosition(pins[1]), loopback.getTarget(pins[1]));
+    EXPECT_LT(5000, loopback.getTarget(pins[1]));
+
+    // Cleanup mock
+    delete m3;
+    releaseArduinoMock();
+    releaseSPIMock();
+}
+
+TEST(Home, PlannedReturn){
+    // Initialize test parameters
+    int pins[] = {1, 2, 3};
+    M3LS *m3 = beginVirtualTime(pins);
+    ArduinoMock* arduinoMock = arduinoMockInstance();
+    LoopbackTransport& loopback = m3->getTransport();
+    int targets[] = {8000, 5000, 6000};
+    m3->moveAxes(M3LS::axisMask(M3LS::XY), targets);
+    arduinoMock->addMillisRaw(500);
+    m3->setHomeClearance(100);
+
+    // Z lifts first and X and Y wait for it to clear the clearance height
+    m3->returnHome();
+    EXPECT_EQ(6000 + 150 + M3LS_HOME_LIFT_MARGIN, loopback.getTarget(pins[2]));
+    arduinoMock->addMillisRaw(13);
+    while (m3->serviceCommands()){}
+    EXPECT_EQ(8000, loopback.getTarget(pins[0]));
+
+    // They start while Z is still moving, on speeds that make them arrive
+    // together
+    arduinoMock->addMillisRaw(1);
+    while (m3->serviceCommands()){}
+    EXPECT_EQ(6000, loopback.getTarget(pins[0]));
+    EXPECT_EQ(6000, loopback.getTarget(pins[1]));
+    EXPECT_EQ(M3LS_POSITION_SPEED / 10, loopback.getDriveSpeed(pins[0]));
+    EXPECT_EQ(M3LS_POSITION_SPEED / 20, loopback.getDriveSpeed(pins[1]));
+
+    // Z only comes down once X and Y have settled
+    unsigned long frames = loopback.getFrameCount(pins[0]);
+    arduinoMock->addMillisRaw(100);
+    while (m3->serviceCommands()){}
+    EXPECT_EQ(frames, loopback.getFrameCount(pins[0]));
+    EXPECT_TRUE(m3->isHoming());
+    arduinoMock->addMillisRaw(100 + M3LS_ESTIMATE_SETTLE_MS);
+    while (m3->serviceCommands()){}
+    EXPECT_EQ(6000, loopback.getTarget(pins[2]));
+    EXPECT_EQ(M3LS_POSITION_SPEED / 10, loopback.getDriveSpeed(pins[1]));
+
+    // The move completes once Z has settled too
+    EXPECT_TRUE(m3->isHoming());
+    EXPECT_TRUE(m3->flushCommands(1000));
+    EXPECT_FALSE(m3->isHoming());
+
+    // Cleanup mock
+    delete m3;
+    releaseArduinoMock();
+    releaseSPIMock();
+}
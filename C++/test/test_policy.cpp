@@ -0,0 +1,73 @@
+#include "gtest/gtest.h"
+#include "M3LSImpl.h"
+#include "test_helpers.h"
+#include <string>
+
+// Logger that keeps everything logged to it
+struct StringLogger {
+    static std::string text;
+    static void begin(){ text.clear(); }
+    static void print(const char *value){ text += value; }
+    static void print(int value){ text += std::to_string(value); }
+    static void println(){ text += "\n"; }
+    template <class T> static void println(const T& value){
+        print(value);
+        println();
+    }
+};
+std::string StringLogger::text;
+
+// The default configuration with a joystick the test moves and a log it
+// can read
+struct ScriptedConfig : M3LSDefaultConfig {
+    typedef M3LSScriptedInput Input;
+    typedef StringLogger Logger;
+};
+
+typedef BasicM3LS<3, ScriptedConfig> ScriptedM3LS;
+
+TEST(Policy, ScriptedRun){
+    // Initialize test parameters
+    int pins[] = {1, 2, 3};
+    ScriptedM3LS *m3 = beginVirtualTime<ScriptedM3LS>(pins,
+        [](ScriptedM3LS& m3){
+            m3.bindButton(3, M3LS::ToggleHold);
+            m3.bindButton(4, M3LS::SetHome);
+        });
+    ArduinoMock* arduinoMock = arduinoMockInstance();
+    LoopbackTransport& loopback = m3->getTransport();
+    M3LSScriptedInput& joystick = m3->getInput();
+
+    // A refresh tick maps the joystick onto the bounds around the center
+    joystick.set(255, 0, 255);
+    arduinoMock->addMillisRaw(100);
+    m3->run();
+    EXPECT_EQ(6000 + 5500, loopback.getTarget(pins[0]));
+    EXPECT_EQ(6000 - 5500, loopback.getTarget(pins[1]));
+
+    // Calls between ticks leave the stages alone
+    joystick.set(127, 127, 255);
+    m3->run();
+    EXPECT_EQ(6000 + 5500, loopback.getTarget(pins[0]));
+
+    // Holding stops the stages from following the joystick
+    joystick.setButtons(1 << 2);
+    arduinoMock->addMillisRaw(100);
+    m3->run();
+    joystick.setButtons(0);
+    joystick.set(0, 0, 255);
+    arduinoMock->addMillisRaw(100);
+    m3->run();
+    EXPECT_EQ(6000 + 5500, loopback.getTarget(pins[0]));
+
+    // Buttons log through the configured logger
+    joystick.setButtons(1 << 3);
+    arduinoMock->addMillisRaw(100);
+    m3->run();
+    EXPECT_NE(std::string::npos, StringLogger::text.find("Setting home to"));
+
+    // Cleanup mock
+    delete m3;
+    releaseArduinoMock();
+    releaseSPIMock();
+}
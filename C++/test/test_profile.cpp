@@ -0,0 +1,83 @@
+#include "gtest/gtest.h"
+#include "M3LS.h"
+#include "test_helpers.h"
+#include <string>
+
+// Stream that keeps everything printed to it
+class StringStream : public Stream {
+    public:
+        std::string text;
+        int available(){ return 0; }
+        int read(){ return -1; }
+        int peek(){ return -1; }
+        void flush(){}
+        size_t write(uint8_t c){ text += (char)c; return 1; }
+};
+
+TEST(Profile, Table){
+    // Initialize test parameters
+    ArduinoMock* arduinoMock = arduinoMockInstance();
+    M3LSProfiler::begin();
+
+    // Each timing adds to the count and total of its phase
+    {
+        M3LSProfileScope scope(M3LSProfiler::Bounds);
+        delayMicroseconds(30);
+    }
+    {
+        M3LSProfileScope scope(M3LSProfiler::Bounds);
+        delayMicroseconds(90);
+    }
+    arduinoMock->addMillisRaw(2);
+    {
+        M3LSProfileScope scope(M3LSProfiler::Spi);
+        arduinoMock->addMillisRaw(1);
+    }
+    const M3LSProfileEntry& bounds = M3LSProfiler::get(M3LSProfiler::Bounds);
+    EXPECT_EQ(2u, bounds.count);
+    EXPECT_EQ(120u, bounds.total);
+    EXPECT_EQ(90u, bounds.max);
+    EXPECT_EQ(1000u, M3LSProfiler::get(M3LSProfiler::Spi).total);
+
+    // Only phases that ran are printed
+    StringStream out;
+    M3LSProfiler::dump(out);
+    EXPECT_EQ("phase\tcount\ttotal_us\tmean_us\tmax_us\r\n"
+        "bounds\t2\t120\t60\t90\r\n"
+        "spi\t1\t1000\t1000\t1000\r\n", out.text);
+
+    // A reset empties the table
+    M3LSProfiler::reset();
+    EXPECT_EQ(0u, M3LSProfiler::get(M3LSProfiler::Bounds).count);
+
+    // Cleanup mock
+    releaseArduinoMock();
+}
+
+#ifdef M3LS_PROFILE
+TEST(Profile, Run){
+    // Initialize test parameters
+    int pins[] = {1, 2, 3};
+    M3LS *m3 = beginVirtualTime(pins);
+    ArduinoMock* arduinoMock = arduinoMockInstance();
+
+    // Start up talks to the stages before any refresh tick
+    EXPECT_LT(0u, M3LSProfiler::get(M3LSProfiler::Spi).count);
+    EXPECT_EQ(0u, M3LSProfiler::get(M3LSProfiler::Run).count);
+
+    // Every call checks the queue, but only a refresh tick does the rest
+    arduinoMock->addMillisRaw(100);
+    m3->run();
+    m3->run();
+    EXPECT_EQ(2u, M3LSProfiler::get(M3LSProfiler::Commands).count);
+    EXPECT_EQ(1u, M3LSProfiler::get(M3LSProfiler::Run).count);
+    EXPECT_EQ(1u, M3LSProfiler::get(M3LSProfiler::Estimates).count);
+    EXPECT_LE(M3LSProfiler::get(M3LSProfiler::Estimates).total,
+        M3LSProfiler::get(M3LSProfiler::Run).total);
+
+    // Cleanup mock
+    delete m3;
+    releaseArduinoMock();
+    releaseSPIMock();
+}
+#endif
@@ -0,0 +1,342 @@
+#include "gtest/gtest.h"
+#include "M3LS.h"
+#include "M3LSServer.h"
+#include <chrono>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+using ::testing::AnyNumber;
+
+// Opens a raw pty pair; the master end stands in for the host
+static void openPty(int *master, int *slave){
+    struct termios tio;
+    *master = posix_openpt(O_RDWR | O_NOCTTY);
+    ASSERT_GE(*master, 0);
+    ASSERT_EQ(0, grantpt(*master));
+    ASSERT_EQ(0, unlockpt(*master));
+    *slave = open(ptsname(*master), O_RDWR | O_NOCTTY);
+    ASSERT_GE(*slave, 0);
+    tcgetattr(*slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(*slave, TCSANOW, &tio);
+    fcntl(*master, F_SETFL, fcntl(*master, F_GETFL) | O_NONBLOCK);
+}
+
+// Writes one frame to the device end of the pty
+static void sendFrame(int fd, uint8_t seq, uint8_t type, const uint8_t *payload,
+    int length){
+    uint8_t frame[M3LS_MAX_FRAME];
+    int size = M3LSProtocol::encodeFrame(seq, type, payload, length, frame);
+    ASSERT_EQ(size, write(fd, frame, size));
+}
+
+// Polls the server until the host has received a reply frame, giving the pty
+// up to a second to deliver it
+static bool awaitReply(int fd, M3LSServer& server, M3LSFrameDecoder& decoder){
+    uint8_t c;
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while (std::chrono::steady_clock::now() < deadline){
+        server.poll();
+        while (read(fd, &c, 1) == 1){
+            if (decoder.push(c)){ return true; }
+        }
+    }
+    return false;
+}
+
+TEST(Protocol, Checksum){
+    // CRC-16/CCITT check value
+    const uint8_t check[] = "123456789";
+    EXPECT_EQ(0x29B1, M3LSProtocol::crc16(check, 9));
+}
+
+TEST(Protocol, Varint){
+    // Initialize test parameters
+    int32_t values[] = {0, 1, -1, 63, -64, 64, 12000, -12000, 2147483647,
+        -2147483647 - 1};
+    uint8_t buf[M3LS_MAX_VARINT];
+
+    for (int i = 0; i < 10; i++){
+        int32_t decoded;
+        int length = M3LSProtocol::putVarint(values[i], buf);
+        EXPECT_EQ(length, M3LSProtocol::getVarint(buf, length, &decoded));
+        EXPECT_EQ(values[i], decoded);
+    }
+
+    // Small deltas take a single byte
+    EXPECT_EQ(1, M3LSProtocol::putVarint(-64, buf));
+    EXPECT_EQ(-1, M3LSProtocol::getVarint(buf, 0, values));
+}
+
+TEST(Protocol, Waypoints){
+    // Initialize test parameters
+    int32_t points[300][M3LS_PROTOCOL_AXES];
+    int32_t decoded[255][M3LS_PROTOCOL_AXES];
+    uint8_t payload[M3LS_MAX_PAYLOAD];
+    for (int i = 0; i < 300; i++){
+        points[i][0] = 6000 + i;
+        points[i][1] = 6000 - 2 * i;
+        points[i][2] = 100 * (i % 7);
+    }
+
+    // A batch is cut at the payload size and decodes on its own
+    int encoded;
+    int length = M3LSProtocol::encodeWaypoints(points + 10, 290,
+        M3LS_PROTOCOL_AXES, payload, M3LS_MAX_PAYLOAD, &encoded);
+    EXPECT_LE(length, M3LS_MAX_PAYLOAD);
+    EXPECT_GT(encoded, 50);
+    EXPECT_EQ(encoded, M3LSProtocol::decodeWaypoints(payload, length,
+        M3LS_PROTOCOL_AXES, decoded, 255));
+    for (int i = 0; i < encoded; i++){
+        for (int axis = 0; axis < M3LS_PROTOCOL_AXES; axis++){
+            EXPECT_EQ(points[10 + i][axis], decoded[i][axis]);
+        }
+    }
+
+    // Truncated payloads are rejected
+    EXPECT_EQ(-1, M3LSProtocol::decodeWaypoints(payload, length - 1,
+        M3LS_PROTOCOL_AXES, decoded, 255));
+}
+
+TEST(Protocol, Telemetry){
+    // Initialize test parameters: a steady trace that crosses the wrap of
+    // the microsecond clock
+    M3LSTelemetrySample samples[40];
+    M3LSTelemetrySample decoded[255];
+    uint8_t payload[M3LS_MAX_PAYLOAD];
+    memset(samples, 0, sizeof(samples));
+    for (int i = 0; i < 40; i++){
+        samples[i].time = 0xFFFFF000u + 1000 * i;
+        samples[i].mode = i < 20 ? 2 : 3;
+        samples[i].radius = 5500;
+        samples[i].joystick[0] = 127 + i;
+        samples[i].joystick[1] = 127;
+        samples[i].joystick[2] = 255 - i;
+        samples[i].buttons = i == 30 ? 0x8000 : 0;
+        for (int axis = 0; axis < M3LS_PROTOCOL_AXES; axis++){
+            samples[i].position[axis] = 6000 + 3 * i * (axis - 1);
+            samples[i].error[axis] = (i % 5) - 2;
+            samples[i].status[axis] = axis == 2 ? -1 : 0x000100;
+        }
+    }
+
+    // Every field survives the round trip, and steady samples stay small
+    int encoded;
+    uint32_t dropped;
+    int length = M3LSProtocol::encodeTelemetry(samples, 40, 7, payload,
+        M3LS_MAX_PAYLOAD, &encoded);
+    EXPECT_LE(length, M3LS_MAX_PAYLOAD);
+    EXPECT_GE(encoded, 10);
+    EXPECT_EQ(encoded, M3LSProtocol::decodeTelemetry(payload, length, decoded,
+        255, &dropped));
+    EXPECT_EQ(7u, dropped);
+    for (int i = 0; i < encoded; i++){
+        uint32_t expected[M3LS_TELEMETRY_FIELDS];
+        uint32_t actual[M3LS_TELEMETRY_FIELDS];
+        M3LSProtocol::packTelemetry(samples[i], expected);
+        M3LSProtocol::packTelemetry(decoded[i], actual);
+        for (int field = 0; field < M3LS_TELEMETRY_FIELDS; field++){
+            EXPECT_EQ(expected[field], actual[field])
+                << "sample " << i << " field " << field;
+        }
+    }
+
+    // Truncated payloads are rejected
+    EXPECT_EQ(-1, M3LSProtocol::decodeTelemetry(payload, length - 1, decoded,
+        255, &dropped));
+}
+
+TEST(Protocol, DecoderResync){
+    // Initialize test parameters
+    M3LSFrameDecoder decoder;
+    uint8_t payload[] = {1, 2, 3};
+    uint8_t frame[M3LS_MAX_FRAME];
+    int length = M3LSProtocol::encodeFrame(7, M3LSProtocol::Move, payload, 3,
+        frame);
+
+    // Noise and a corrupted frame are skipped
+    uint8_t noise[] = {0x00, 0xA5, 0xFF, 0x13};
+    for (int i = 0; i < 4; i++){ EXPECT_FALSE(decoder.push(noise[i])); }
+    frame[5] ^= 0x40;
+    for (int i = 0; i < length; i++){ EXPECT_FALSE(decoder.push(frame[i])); }
+    frame[5] ^= 0x40;
+
+    // The next intact frame is delivered
+    bool complete = false;
+    for (int i = 0; i < length; i++){ complete = decoder.push(frame[i]); }
+    EXPECT_TRUE(complete);
+    EXPECT_EQ(7, decoder.getFrame().seq);
+    EXPECT_EQ(M3LSProtocol::Move, decoder.getFrame().type);
+    EXPECT_EQ(3, decoder.getFrame().length);
+    EXPECT_EQ(0, memcmp(payload, decoder.getFrame().payload, 3));
+    EXPECT_EQ(2u, decoder.getErrorCount());
+}
+
+TEST(Server, ModeAndStatus){
+    // Initialize test parameters
+    int pins[] = {1, 2, 3};
+    int master, slave;
+    openPty(&master, &slave);
+    Serial.attach(slave);
+
+    // Initialize mock Arduino and SPI
+    ArduinoMock* arduinoMock = arduinoMockInstance();
+    SPIMock* spiMock = SPIMockInstance();
+    EXPECT_CALL(*arduinoMock, millis()).Times(AnyNumber());
+    EXPECT_CALL(*arduinoMock, delay(50));
+    EXPECT_CALL(*spiMock, begin());
+    for (int pin = 0; pin < 3; pin++){
+        EXPECT_CALL(*arduinoMock, pinMode(pins[pin], OUTPUT));
+        EXPECT_CALL(*arduinoMock, digitalWrite(pins[pin], HIGH));
+    }
+    M3LS m3 = M3LS(pins[0], pins[1], pins[2]);
+    m3.begin();
+    M3LSServer server(m3, Serial);
+    M3LSFrameDecoder host;
+
+    // Open the window
+    sendFrame(master, 40, M3LSProtocol::Sync, NULL, 0);
+    ASSERT_TRUE(awaitReply(master, server, host));
+    EXPECT_EQ(M3LSProtocol::Ack, host.getFrame().type);
+    EXPECT_EQ(M3LSProtocol::statusOk, host.getFrame().payload[0]);
+    EXPECT_EQ(41, host.getFrame().payload[1]);
+
+    // Switch to velocity mode
+    uint8_t mode = M3LS::velocity;
+    sendFrame(master, 41, M3LSProtocol::SetMode, &mode, 1);
+    ASSERT_TRUE(awaitReply(master, server, host));
+    EXPECT_EQ(M3LSProtocol::statusOk, host.getFrame().payload[0]);
+
+    // A retransmission is not executed twice
+    sendFrame(master, 41, M3LSProtocol::SetMode, &mode, 1);
+    ASSERT_TRUE(awaitReply(master, server, host));
+    EXPECT_EQ(M3LSProtocol::statusDuplicate, host.getFrame().payload[0]);
+
+    // A frame past a gap is refused
+    sendFrame(master, 43, M3LSProtocol::GetStatus, NULL, 0);
+    ASSERT_TRUE(awaitReply(master, server, host));
+    EXPECT_EQ(M3LSProtocol::statusOutOfOrder, host.getFrame().payload[0]);
+    EXPECT_EQ(42, host.getFrame().payload[1]);
+
+    // Move, then read the status back
+    uint8_t targets[4 * M3LS_PROTOCOL_AXES];
+    M3LSProtocol::putI32(1000, targets);
+    M3LSProtocol::putI32(2000, targets + 4);
+    M3LSProtocol::putI32(3000, targets + 8);
+    sendFrame(master, 42, M3LSProtocol::Move, targets, sizeof(targets));
+    ASSERT_TRUE(awaitReply(master, server, host));
+    sendFrame(master, 43, M3LSProtocol::GetStatus, NULL, 0);
+    ASSERT_TRUE(awaitReply(master, server, host));
+    const M3LSFrame& status = host.getFrame();
+    EXPECT_EQ(M3LSProtocol::Status, status.type);
+    EXPECT_EQ(43, status.seq);
+    EXPECT_EQ(M3LS::velocity, status.payload[4]);
+    EXPECT_EQ(3, status.payload[5]);
+    EXPECT_EQ(1000, M3LSProtocol::getI32(status.payload + 9));
+    EXPECT_EQ(2000, M3LSProtocol::getI32(status.payload + 13));
+    EXPECT_EQ(3000, M3LSProtocol::getI32(status.payload + 17));
+
+    // Cleanup mock
+    Serial.attach(-1);
+    close(slave);
+    close(master);
+    releaseArduinoMock();
+    releaseSPIMock();
+}
+
+TEST(Server, TrajectoryUpload){
+    // Initialize test parameters
+    int pins[] = {1, 2, 3};
+    const int numPoints = 1000;
+    static int32_t points[numPoints][M3LS_PROTOCOL_AXES];
+    for (int i = 0; i < numPoints; i++){
+        points[i][0] = 6000 + (i % 200) * 10;
+        points[i][1] = 6000 - (i % 100) * 20;
+        points[i][2] = 6000 + i;
+    }
+    int master, slave;
+    openPty(&master, &slave);
+    Serial.attach(slave);
+
+    // Initialize mock Arduino and SPI
+    ArduinoMock* arduinoMock = arduinoMockInstance();
+    SPIMock* spiMock = SPIMockInstance();
+    EXPECT_CALL(*arduinoMock, millis()).Times(AnyNumber());
+    EXPECT_CALL(*arduinoMock, delay(50));
+    EXPECT_CALL(*spiMock, begin());
+    for (int pin = 0; pin < 3; pin++){
+        EXPECT_CALL(*arduinoMock, pinMode(pins[pin], OUTPUT));
+        EXPECT_CALL(*arduinoMock, digitalWrite(pins[pin], HIGH));
+    }
+    M3LS m3 = M3LS(pins[0], pins[1], pins[2]);
+    m3.begin();
+    M3LSServer server(m3, Serial);
+    M3LSFrameDecoder host;
+
+    // Open the window and start playback at full rate
+    sendFrame(master, 0, M3LSProtocol::Sync, NULL, 0);
+    ASSERT_TRUE(awaitReply(master, server, host));
+    uint8_t interval[2] = {0, 0};
+    sendFrame(master, 1, M3LSProtocol::Start, interval, 2);
+    ASSERT_TRUE(awaitReply(master, server, host));
+
+    // Stream the trajectory with a window of frames in flight, going back to
+    // the oldest unacknowledged frame whenever the device refuses one
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    int firstPoint[256];
+    uint8_t nextSeq = 2;
+    uint8_t oldestSeq = 2;
+    int sent = 0;
+    int acked = 0;
+    int refused = 0;
+    while (acked < numPoints){
+        while (sent < numPoints &&
+            (uint8_t)(nextSeq - oldestSeq) < M3LS_PROTOCOL_WINDOW){
+            uint8_t payload[M3LS_MAX_PAYLOAD];
+            int encoded;
+            int length = M3LSProtocol::encodeWaypoints(points + sent,
+                numPoints - sent, M3LS_PROTOCOL_AXES, payload,
+                M3LS_MAX_PAYLOAD, &encoded);
+            firstPoint[nextSeq] = sent;
+            sendFrame(master, nextSeq++, M3LSProtocol::Waypoints, payload,
+                length);
+            sent += encoded;
+        }
+        ASSERT_TRUE(awaitReply(master, server, host));
+        const M3LSFrame& ack = host.getFrame();
+        if (ack.seq != oldestSeq){ continue; }
+        if (ack.payload[0] == M3LSProtocol::statusOk){
+            oldestSeq++;
+            acked = oldestSeq == nextSeq ? sent : firstPoint[oldestSeq];
+        } else {
+            // Go back to the refused frame
+            refused++;
+            nextSeq = oldestSeq;
+            sent = firstPoint[oldestSeq];
+        }
+    }
+    double elapsed = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+
+    // The upload needed flow control and still finished in milliseconds
+    EXPECT_GT(refused, 0);
+    EXPECT_LT(elapsed, 1000.0);
+
+    // Play back the rest and check the final target
+    while (server.getQueuedWaypoints() > 0){ server.poll(); }
+    LoopbackTransport& loopback = m3.getTransport();
+    for (int axis = 0; axis < 3; axis++){
+        EXPECT_EQ(points[numPoints - 1][axis], loopback.getTarget(pins[axis]));
+    }
+    EXPECT_EQ(0u, server.getErrorCount());
+
+    // Cleanup mock
+    Serial.attach(-1);
+    close(slave);
+    close(master);
+    releaseArduinoMock();
+    releaseSPIMock();
+}
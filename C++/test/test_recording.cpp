@@ -0,0 +1,134 @@
+#include "gtest/gtest.h"
+#include "M3LSImpl.h"
+#include "M3LSRecording.h"
+#include "test_helpers.h"
+#include <unistd.h>
+#include <vector>
+
+// Path of the file a recording is exported to
+static const char *recordingPath = "m3ls_recording_test.bin";
+
+// Stream that keeps every byte written to it
+class ByteStream : public Stream {
+    public:
+        std::vector<uint8_t> bytes;
+        int available(){ return 0; }
+        int read(){ return -1; }
+        int peek(){ return -1; }
+        void flush(){}
+        size_t write(uint8_t c){ bytes.push_back(c); return 1; }
+};
+
+// Records the scripted joystick of the default configuration
+struct RecordConfig : M3LSDefaultConfig {
+    typedef M3LSRecordingInput<M3LSScriptedInput> Input;
+};
+
+// Plays a recording back in place of the joystick
+struct ReplayConfig : M3LSDefaultConfig {
+    typedef M3LSReplayInput<> Input;
+};
+
+// Binds the button that toggles hold in the recorded session
+template <class Manipulator>
+static void bindHold(Manipulator& m3){
+    m3.bindButton(3, M3LS::ToggleHold);
+}
+
+TEST(Recording, Buffer){
+    // Initialize test parameters
+    M3LSRecording recording;
+    M3LSInputState state = {0, 127, 127, 127, 0};
+
+    // Only changes are kept
+    for (uint32_t tick = 0; tick < 100; tick++){
+        state.time = 20 * tick;
+        state.x = tick < 50 ? 127 + tick : 177;
+        state.buttons = tick == 70 ? 4 : 0;
+        EXPECT_TRUE(recording.append(state));
+    }
+    EXPECT_LE(recording.getSize(), 53 * 6);
+    M3LSInputState read;
+    int states = 0;
+    while (recording.next(&read)){ states++; }
+    EXPECT_EQ(53, states);
+    EXPECT_EQ(71u * 20, read.time);
+    EXPECT_EQ(177, read.x);
+    EXPECT_EQ(0, read.buttons);
+
+    // An export loads back intact, and a damaged one does not load
+    ByteStream out;
+    recording.write(out);
+    M3LSRecording copy;
+    ASSERT_TRUE(copy.load(&out.bytes[0], out.bytes.size()));
+    EXPECT_EQ(recording.getSize(), copy.getSize());
+    EXPECT_EQ(0, memcmp(recording.getData(), copy.getData(),
+        recording.getSize()));
+    out.bytes[20] ^= 1;
+    EXPECT_FALSE(copy.load(&out.bytes[0], out.bytes.size()));
+    EXPECT_EQ(0, copy.getSize());
+
+    // So does a file
+    ASSERT_TRUE(recording.saveFile(recordingPath));
+    ASSERT_TRUE(copy.loadFile(recordingPath));
+    EXPECT_EQ(recording.getSize(), copy.getSize());
+    unlink(recordingPath);
+
+    // A full recording says so
+    M3LSRecording full;
+    for (uint32_t tick = 0; full.append(state); tick++){
+        state.time = 20 * tick;
+        state.x = tick % 200;
+    }
+    EXPECT_TRUE(full.isFull());
+    EXPECT_LE(full.getSize(), M3LS_RECORDING_SIZE);
+}
+
+TEST(Recording, Replay){
+    // Initialize test parameters
+    int pins[] = {1, 2, 3};
+    const int ticks = 200;
+    std::vector<int> recorded;
+    std::vector<int> replayed;
+    M3LSRecording recording;
+
+    // Record a session: a sweep on X and Y with hold toggled part way
+    typedef BasicM3LS<3, RecordConfig> RecordingM3LS;
+    RecordingM3LS *m3 = beginVirtualTime<RecordingM3LS>(pins,
+        bindHold<RecordingM3LS>);
+    ArduinoMock* arduinoMock = arduinoMockInstance();
+    m3->getInput().record(&recording);
+    for (int tick = 0; tick < ticks; tick++){
+        m3->getInput().set(127 + (tick % 100), 200 - tick / 2, 255);
+        m3->getInput().setButtons(tick == 120 || tick == 160 ? 1 << 2 : 0);
+        arduinoMock->addMillisRaw(20);
+        m3->run();
+        recorded.push_back(m3->getTransport().getTarget(pins[0]));
+        recorded.push_back(m3->getTransport().getTarget(pins[1]));
+    }
+    EXPECT_NE(recorded[0], recorded[2 * 99]);
+    EXPECT_NE(recorded[1], recorded[2 * 99 + 1]);
+    delete m3;
+    releaseArduinoMock();
+    releaseSPIMock();
+
+    // Replaying it moves the stages exactly as the operator did
+    typedef BasicM3LS<3, ReplayConfig> ReplayM3LS;
+    ReplayM3LS *replay = beginVirtualTime<ReplayM3LS>(pins,
+        bindHold<ReplayM3LS>);
+    arduinoMock = arduinoMockInstance();
+    replay->getInput().play(&recording);
+    for (int tick = 0; tick < ticks; tick++){
+        arduinoMock->addMillisRaw(20);
+        replay->run();
+        replayed.push_back(replay->getTransport().getTarget(pins[0]));
+        replayed.push_back(replay->getTransport().getTarget(pins[1]));
+    }
+    EXPECT_FALSE(replay->getInput().isPlaying());
+    EXPECT_EQ(recorded, replayed);
+
+    // Cleanup mock
+    delete replay;
+    releaseArduinoMock();
+    releaseSPIMock();
+}
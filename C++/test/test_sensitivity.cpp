@@ -0,0 +1,123 @@
+#include "gtest/gtest.h"
+#include "M3LSImpl.h"
+#include "test_helpers.h"
+#include <math.h>
+
+// A joystick the test moves
+struct ThrottledConfig : M3LSDefaultConfig {
+    typedef M3LSScriptedInput Input;
+};
+
+typedef BasicM3LS<3, ThrottledConfig> ThrottledM3LS;
+
+TEST(Sensitivity, DefaultCurve){
+    // Initialize test parameters
+    M3LSSensitivity sensitivity;
+
+    // The tables reproduce the piecewise bounds and the seven zones the
+    // library computed every tick before
+    for (int input = 0; input < 256; input++){
+        long radius;
+        if (input < 64){
+            radius = map(input, 0, 64, 10, 50);
+        } else if (input < 128){
+            radius = map(input, 64, 128, 50, 500);
+        } else if (input < 192){
+            radius = map(input, 128, 192, 500, 2250);
+        } else {
+            radius = map(input, 192, 255, 2250, 5500);
+        }
+        EXPECT_EQ(radius, sensitivity.getRadius(input)) << "input " << input;
+        EXPECT_EQ(round(input * 6 / 255.0) - 3, sensitivity.getZone(input))
+            << "input " << input;
+    }
+    EXPECT_EQ(M3LS_ZONES, sensitivity.getZones());
+
+    // Inputs out of range are clamped
+    EXPECT_EQ(10, sensitivity.getRadius(-5));
+    EXPECT_EQ(5500, sensitivity.getRadius(300));
+}
+
+TEST(Sensitivity, CustomCurve){
+    // Initialize test parameters
+    M3LSSensitivity sensitivity;
+    unsigned long rebuilds = sensitivity.getRebuilds();
+
+    // Linear from 100 to 1100 counts
+    M3LSCurvePoint linear[] = {{0, 100}, {255, 1100}};
+    EXPECT_TRUE(sensitivity.setCurve(linear, 2));
+    EXPECT_EQ(100, sensitivity.getRadius(0));
+    EXPECT_EQ(100 + 1000 * 51 / 255, sensitivity.getRadius(51));
+    EXPECT_EQ(1100, sensitivity.getRadius(255));
+    EXPECT_EQ(rebuilds + 1, sensitivity.getRebuilds());
+
+    // Curves that do not cover every input, or that fall, are refused and
+    // leave the table as it was
+    M3LSCurvePoint partial[] = {{10, 100}, {255, 1100}};
+    M3LSCurvePoint falling[] = {{0, 100}, {128, 50}, {255, 1100}};
+    M3LSCurvePoint repeated[] = {{0, 100}, {128, 500}, {128, 600},
+        {255, 1100}};
+    EXPECT_FALSE(sensitivity.setCurve(partial, 2));
+    EXPECT_FALSE(sensitivity.setCurve(falling, 3));
+    EXPECT_FALSE(sensitivity.setCurve(repeated, 4));
+    EXPECT_FALSE(sensitivity.setCurve(linear, 1));
+    EXPECT_EQ(100 + 1000 * 51 / 255, sensitivity.getRadius(51));
+    EXPECT_EQ(rebuilds + 1, sensitivity.getRebuilds());
+
+    // Zones: an odd number, the middle one dead
+    EXPECT_FALSE(sensitivity.setZones(4));
+    EXPECT_FALSE(sensitivity.setZones(1));
+    EXPECT_FALSE(sensitivity.setZones(M3LS_ZONES_MAX + 2));
+    EXPECT_TRUE(sensitivity.setZones(3));
+    EXPECT_EQ(-1, sensitivity.getZone(0));
+    EXPECT_EQ(0, sensitivity.getZone(127));
+    EXPECT_EQ(1, sensitivity.getZone(255));
+    EXPECT_TRUE(sensitivity.setZones(M3LS_ZONES_MAX));
+    EXPECT_EQ(-7, sensitivity.getZone(0));
+    EXPECT_EQ(7, sensitivity.getZone(255));
+
+    // Back to the default
+    sensitivity.reset();
+    EXPECT_EQ(5500, sensitivity.getRadius(255));
+    EXPECT_EQ(M3LS_ZONES, sensitivity.getZones());
+}
+
+TEST(Sensitivity, Manipulator){
+    // Initialize test parameters
+    int pins[] = {1, 2, 3};
+    ThrottledM3LS *m3 = beginVirtualTime<ThrottledM3LS>(pins);
+    ArduinoMock* arduinoMock = arduinoMockInstance();
+    m3->setControlMode(M3LS::position);
+    LoopbackTransport& stages = m3->getTransport();
+    M3LSScriptedInput& joystick = m3->getInput();
+
+    // A flat curve keeps the bounds the same at any throttle; the bounds of
+    // a tick come from the throttle of the one before
+    M3LSCurvePoint flat[] = {{0, 1000}, {255, 1000}};
+    EXPECT_TRUE(m3->setSensitivityCurve(flat, 2));
+    joystick.set(255, 0, 0);
+    for (int tick = 0; tick < 2; tick++){
+        arduinoMock->addMillisRaw(20);
+        m3->run();
+    }
+    EXPECT_EQ(6000 + 1000, stages.getTarget(pins[0]));
+    EXPECT_EQ(6000 - 1000, stages.getTarget(pins[1]));
+
+    // Holding Z up drives it at one zone step of the bounds per tick: with
+    // three zones a thirtieth of the radius, plus one
+    M3LSCurvePoint invalid[] = {{0, 1000}, {255, 10}};
+    EXPECT_FALSE(m3->setSensitivityCurve(invalid, 2));
+    EXPECT_TRUE(m3->setZones(3));
+    EXPECT_FALSE(m3->setZones(6));
+    m3->bindButton(1, M3LS::ZUp);
+    joystick.setButtons(1);
+    arduinoMock->addMillisRaw(20);
+    m3->run();
+    int step = 1000 / 30 + 1;
+    EXPECT_EQ(step * 1000 / 20 / 10, stages.getDriveSpeed(pins[2]));
+
+    // Cleanup mock
+    delete m3;
+    releaseArduinoMock();
+    releaseSPIMock();
+}
@@ -0,0 +1,73 @@
+#include "gtest/gtest.h"
+#include "M3LSSimulation.h"
+
+TEST(Simulation, Parallel){
+    // Initialize test parameters
+    M3LSSimOptions options;
+    options.pairs = 24;
+    options.ticks = 500;
+    options.seed = 7;
+    options.checkInterval = 5;
+    options.recording = NULL;
+    M3LSSimulation::expectHardware();
+
+    // Every pair runs every tick and keeps to the invariants
+    M3LSSimulation simulation(options);
+    M3LSSimReport single = simulation.run(1);
+    EXPECT_EQ(24ul * 500, single.ticks);
+    EXPECT_EQ(0ul, single.violations);
+    EXPECT_GT(single.ticksPerSecond, 0);
+    std::vector<uint32_t> checksums;
+    for (int pair = 0; pair < options.pairs; pair++){
+        EXPECT_EQ(100ul, simulation.getResult(pair).checks);
+        checksums.push_back(simulation.getResult(pair).checksum);
+    }
+
+    // Different seeds walk differently
+    EXPECT_NE(checksums[0], checksums[1]);
+
+    // A pair does the same thing whichever thread runs it
+    M3LSSimReport parallel = simulation.run(4);
+    EXPECT_EQ(4, parallel.threads);
+    EXPECT_EQ(single.ticks, parallel.ticks);
+    EXPECT_EQ(0ul, parallel.violations);
+    for (int pair = 0; pair < options.pairs; pair++){
+        EXPECT_EQ(checksums[pair], simulation.getResult(pair).checksum);
+    }
+
+    // Cleanup mock
+    releaseArduinoMock();
+    releaseSPIMock();
+}
+
+TEST(Simulation, Replay){
+    // Initialize test parameters
+    M3LSRecording recording;
+    M3LSInputState state = {0, 127, 127, 200, 0};
+    for (uint32_t step = 0; step < 100; step++){
+        state.time = 40 * step;
+        state.x = 127 + step;
+        state.y = 127 - step;
+        recording.append(state);
+    }
+    M3LSSimOptions options;
+    options.pairs = 6;
+    options.ticks = 300;
+    options.seed = 1;
+    options.checkInterval = 10;
+    options.recording = &recording;
+    M3LSSimulation::expectHardware();
+
+    // Every pair replaying the same session ends up in the same place
+    M3LSSimulation simulation(options);
+    M3LSSimReport report = simulation.run(3);
+    EXPECT_EQ(0ul, report.violations);
+    for (int pair = 1; pair < options.pairs; pair++){
+        EXPECT_EQ(simulation.getResult(0).checksum,
+            simulation.getResult(pair).checksum);
+    }
+
+    // Cleanup mock
+    releaseArduinoMock();
+    releaseSPIMock();
+}
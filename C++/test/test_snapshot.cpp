@@ -0,0 +1,123 @@
+#include "gtest/gtest.h"
+#include "M3LSSnapshotRing.h"
+#include <thread>
+
+// Reports published by the stress tests
+static const uint32_t reports = 200000;
+
+// Builds a report whose fields all derive from its number, so a torn read
+// shows up as fields that disagree
+static M3LSJoystickSnapshot makeReport(uint32_t sequence){
+    M3LSJoystickSnapshot report;
+    report.sequence = sequence;
+    report.x = (uint8_t)sequence;
+    report.y = (uint8_t)~sequence;
+    report.z = (uint8_t)(sequence >> 8);
+    report.buttons = (uint16_t)(sequence * 7);
+    return report;
+}
+
+// Returns true if a report is one makeReport() built
+static bool isWhole(const M3LSJoystickSnapshot& report){
+    M3LSJoystickSnapshot expected = makeReport(report.sequence);
+    return report.x == expected.x && report.y == expected.y &&
+        report.z == expected.z && report.buttons == expected.buttons;
+}
+
+TEST(Snapshot, Ring){
+    // Initialize test parameters
+    M3LSSnapshotRing<M3LSJoystickSnapshot, 4> ring;
+    M3LSJoystickSnapshot report;
+
+    // Snapshots come out in order
+    EXPECT_FALSE(ring.pop(&report));
+    EXPECT_FALSE(ring.takeNewest(&report));
+    for (uint32_t sequence = 0; sequence < 3; sequence++){
+        EXPECT_TRUE(ring.push(makeReport(sequence)));
+    }
+    EXPECT_EQ(3u, ring.getCount());
+    ASSERT_TRUE(ring.pop(&report));
+    EXPECT_EQ(0u, report.sequence);
+
+    // A full ring refuses more without touching what it holds
+    EXPECT_TRUE(ring.push(makeReport(3)));
+    EXPECT_TRUE(ring.push(makeReport(4)));
+    EXPECT_FALSE(ring.push(makeReport(5)));
+    EXPECT_EQ(1ul, ring.getDropped());
+    M3LSJoystickSnapshot drained[8];
+    ASSERT_EQ(4, ring.drain(drained, 8));
+    for (int index = 0; index < 4; index++){
+        EXPECT_EQ(index + 1u, drained[index].sequence);
+    }
+
+    // Taking the newest discards the rest, across the wrap of the slots
+    for (uint32_t sequence = 6; sequence < 9; sequence++){
+        ring.push(makeReport(sequence));
+    }
+    ASSERT_TRUE(ring.takeNewest(&report));
+    EXPECT_EQ(8u, report.sequence);
+    EXPECT_TRUE(isWhole(report));
+    EXPECT_EQ(0u, ring.getCount());
+}
+
+TEST(Snapshot, DrainStress){
+    // Every report crosses from one thread to the other whole and in order
+    M3LSJoystickRing ring;
+    std::thread producer([&ring](){
+        for (uint32_t sequence = 0; sequence < reports; sequence++){
+            while (!ring.push(makeReport(sequence))){
+                std::this_thread::yield();
+            }
+        }
+    });
+    uint32_t expected = 0;
+    int torn = 0;
+    M3LSJoystickSnapshot batch[M3LS_JOYSTICK_REPORTS];
+    while (expected < reports){
+        int taken = ring.drain(batch, M3LS_JOYSTICK_REPORTS);
+        if (taken == 0){ std::this_thread::yield(); }
+        for (int index = 0; index < taken; index++){
+            ASSERT_EQ(expected, batch[index].sequence);
+            torn += !isWhole(batch[index]);
+            expected++;
+        }
+    }
+    producer.join();
+    EXPECT_EQ(0, torn);
+    EXPECT_EQ(0u, ring.getCount());
+}
+
+TEST(Snapshot, NewestStress){
+    // A consumer that only wants the latest report always gets a whole one,
+    // never an older one than before, and ends on the last published
+    M3LSJoystickRing ring;
+    volatile bool done = false;
+    std::thread producer([&ring, &done](){
+        for (uint32_t sequence = 0; sequence < reports; sequence++){
+            while (!ring.push(makeReport(sequence))){
+                std::this_thread::yield();
+            }
+        }
+        __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+    });
+    M3LSJoystickSnapshot report;
+    uint32_t last = 0;
+    int taken = 0;
+    int torn = 0;
+    int backwards = 0;
+    while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE) || ring.getCount() > 0){
+        if (!ring.takeNewest(&report)){
+            std::this_thread::yield();
+            continue;
+        }
+        torn += !isWhole(report);
+        backwards += taken > 0 && report.sequence <= last;
+        last = report.sequence;
+        taken++;
+    }
+    producer.join();
+    EXPECT_EQ(0, torn);
+    EXPECT_EQ(0, backwards);
+    EXPECT_EQ(reports - 1, last);
+    EXPECT_GT(taken, 0);
+}
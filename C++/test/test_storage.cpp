@@ -0,0 +1,183 @@
+#include "gtest/gtest.h"
+#include "M3LS.h"
+#include "test_helpers.h"
+#include <stdio.h>
+#include <unistd.h>
+using ::testing::_;
+using ::testing::AnyNumber;
+
+// Path of the file standing in for flash
+static const char *storagePath = "m3ls_storage_test.bin";
+
+// Starts up a three axis M3LS that keeps its settings in `storage`. Unless
+// `powerCycled`, its stages kept the calibration of an earlier boot.
+static M3LS *beginWithStorage(int *pins, M3LSStorage *storage,
+    bool powerCycled = false){
+    return beginVirtualTime(pins, [&](M3LS& m3){
+        for (int pin = 0; pin < 3 && !powerCycled; pin++){
+            m3.getTransport().setFrequency(pins[pin], 0x0A00 + pins[pin]);
+        }
+        m3.setStorage(storage);
+    });
+}
+
+// Frames begin() sends each stage: a full calibration is two sweeps that are
+// each started, polled and read back; a warm start checks the stage's
+// frequency and changes modes. Both end by reading the position the
+// estimates start from.
+static const unsigned long coldFrames = 9;
+static const unsigned long warmFrames = 4;
+
+TEST(Storage, WarmStart){
+    // Initialize test parameters
+    int pins[] = {1, 2, 3};
+    unlink(storagePath);
+    FileStorage storage(storagePath);
+
+    // The first boot calibrates and records the result
+    M3LS *m3 = beginWithStorage(pins, &storage);
+    EXPECT_EQ(coldFrames, m3->getTransport().getFrameCount(pins[0]));
+    int targets[] = {7000, 5000, 6500};
+    m3->moveAxes(M3LS::axisMask(M3LS::XYZ), targets);
+    m3->setHome();
+    m3->bindButton(4, M3LS::ReturnHome);
+    m3->invertYAxis(true);
+    M3LSCurvePoint curve[] = {{0, 20}, {100, 300}, {255, 4000}};
+    EXPECT_TRUE(m3->setSensitivityCurve(curve, 3));
+    EXPECT_TRUE(m3->setZones(5));
+    EXPECT_TRUE(m3->saveSettings());
+    delete m3;
+    releaseArduinoMock();
+    releaseSPIMock();
+
+    // The next boot reuses the calibration, home position and bindings
+    m3 = beginWithStorage(pins, &storage);
+    LoopbackTransport& loopback = m3->getTransport();
+    EXPECT_EQ(warmFrames, loopback.getFrameCount(pins[0]));
+    EXPECT_EQ(0x0A00 + pins[1], m3->getSweepFrequency(1));
+    m3->returnHome();
+    EXPECT_TRUE(m3->flushCommands(1000));
+    EXPECT_EQ(7000, loopback.getTarget(pins[0]));
+    EXPECT_EQ(5000, loopback.getTarget(pins[1]));
+    M3LSSensitivity& sensitivity = m3->getSensitivity();
+    EXPECT_EQ(5, sensitivity.getZones());
+    EXPECT_EQ(300, sensitivity.getRadius(100));
+    EXPECT_EQ(4000, sensitivity.getRadius(255));
+    delete m3;
+    releaseArduinoMock();
+    releaseSPIMock();
+
+    // Stages that lost their power lost their calibration too, so it is run
+    // again
+    m3 = beginWithStorage(pins, &storage, true);
+    EXPECT_EQ(coldFrames + 1, m3->getTransport().getFrameCount(pins[0]));
+    EXPECT_EQ(0x0A00 + pins[2], m3->getSweepFrequency(2));
+
+    // Cleanup mock
+    delete m3;
+    releaseArduinoMock();
+    releaseSPIMock();
+    unlink(storagePath);
+}
+
+// Counts the writes that reach the file
+class CountingStorage : public FileStorage {
+    public:
+        CountingStorage(const char *path) : FileStorage(path), writes(0) {}
+        bool write(const void *data, int size){
+            writes++;
+            return FileStorage::write(data, size);
+        }
+        int writes;
+};
+
+TEST(Storage, QuietBoot){
+    // Initialize test parameters
+    int pins[] = {1, 2, 3};
+    unlink(storagePath);
+    CountingStorage storage(storagePath);
+
+    // The first boot records its calibration
+    M3LS *m3 = beginWithStorage(pins, &storage);
+    EXPECT_EQ(1, storage.writes);
+    delete m3;
+    releaseArduinoMock();
+    releaseSPIMock();
+
+    // A boot that changes nothing leaves the record alone and only counts
+    // itself
+    m3 = beginWithStorage(pins, &storage);
+    EXPECT_EQ(warmFrames, m3->getTransport().getFrameCount(pins[0]));
+    EXPECT_EQ(1, storage.writes);
+    uint32_t boots;
+    ASSERT_TRUE(storage.readBoots(&boots));
+    EXPECT_EQ(2u, boots);
+
+    // A changed binding is written, along with the boot count
+    m3->bindButton(2, M3LS::Stop);
+    EXPECT_TRUE(m3->saveSettings());
+    EXPECT_EQ(2, storage.writes);
+    EXPECT_TRUE(m3->saveSettings());
+    EXPECT_EQ(2, storage.writes);
+    M3LSRecord record;
+    ASSERT_TRUE(storage.read(&record, sizeof(record)));
+    EXPECT_EQ(2u, record.boots);
+    EXPECT_EQ(M3LS::Stop, record.buttonMap[2]);
+    EXPECT_EQ(0, record.buttonMap[3]);
+
+    // Cleanup mock
+    delete m3;
+    releaseArduinoMock();
+    releaseSPIMock();
+    unlink(storagePath);
+}
+
+TEST(Storage, StaleOrCorrupt){
+    // Initialize test parameters
+    int pins[] = {1, 2, 3};
+    unlink(storagePath);
+    FileStorage storage(storagePath);
+    M3LS *m3;
+
+    // A calibration is reused for a limited number of boots, even on a rig
+    // where nothing else changes
+    for (int boot = 0; boot <= M3LS_WARM_START_BOOTS + 1; boot++){
+        m3 = beginWithStorage(pins, &storage);
+        unsigned long expected = boot == 0 ||
+            boot == M3LS_WARM_START_BOOTS + 1 ? coldFrames : warmFrames;
+        EXPECT_EQ(expected, m3->getTransport().getFrameCount(pins[0]))
+            << "boot " << boot;
+        delete m3;
+        releaseArduinoMock();
+        releaseSPIMock();
+    }
+
+    // A damaged calibration section is not trusted
+    M3LSRecord record;
+    ASSERT_TRUE(storage.read(&record, sizeof(record)));
+    record.sweepFrequency[0] ^= 1;
+    ASSERT_TRUE(storage.write(&record, sizeof(record)));
+    m3 = beginWithStorage(pins, &storage);
+    EXPECT_EQ(coldFrames, m3->getTransport().getFrameCount(pins[0]));
+    delete m3;
+    releaseArduinoMock();
+    releaseSPIMock();
+
+    // Neither is a record for a different number of axes
+    ArduinoMock* arduinoMock = arduinoMockInstance();
+    SPIMock* spiMock = SPIMockInstance();
+    EXPECT_CALL(*arduinoMock, millis()).Times(AnyNumber());
+    EXPECT_CALL(*arduinoMock, delay(_)).Times(AnyNumber());
+    EXPECT_CALL(*spiMock, begin());
+    EXPECT_CALL(*arduinoMock, pinMode(_, OUTPUT)).Times(2);
+    EXPECT_CALL(*arduinoMock, digitalWrite(_, HIGH)).Times(2);
+    M3LS twoAxes(pins[0], pins[1]);
+    twoAxes.setStorage(&storage);
+    twoAxes.begin();
+    EXPECT_EQ(coldFrames, twoAxes.getTransport().getFrameCount(pins[0]));
+
+    // Cleanup mock
+    releaseArduinoMock();
+    releaseSPIMock();
+    unlink(storagePath);
+}
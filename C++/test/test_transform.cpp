@@ -0,0 +1,120 @@
+#include "gtest/gtest.h"
+#include "M3LSImpl.h"
+#include "test_helpers.h"
+#include <math.h>
+
+// A joystick the test moves
+struct SteeredConfig : M3LSDefaultConfig {
+    typedef M3LSScriptedInput Input;
+};
+
+typedef BasicM3LS<3, SteeredConfig> SteeredM3LS;
+
+// Frame tilted 30 degrees about stage X: the needle axis points down and
+// along stage Y
+static const float tilt = 30 * M_PI / 180;
+static const float tilted[9] = {
+    1, 0, 0,
+    0, cosf(tilt), sinf(tilt),
+    0, -sinf(tilt), cosf(tilt)};
+
+TEST(Transform, FixedPoint){
+    // Initialize test parameters
+    M3LSTransform transform;
+    int point[3] = {1000, -2000, 3000};
+    int stage[3];
+
+    // Starts as the identity
+    EXPECT_TRUE(transform.isIdentity());
+    transform.apply(point, stage);
+    EXPECT_EQ(1000, stage[0]);
+    EXPECT_EQ(-2000, stage[1]);
+    EXPECT_EQ(3000, stage[2]);
+
+    // Matches the float product to the nearest count
+    int offset[3] = {6000, 6000, 6000};
+    transform.configure(tilted, offset);
+    EXPECT_FALSE(transform.isIdentity());
+    transform.apply(point, stage);
+    for (int axis = 0; axis < 3; axis++){
+        float exact = offset[axis];
+        for (int column = 0; column < 3; column++){
+            exact += tilted[3 * axis + column] * point[column];
+        }
+        EXPECT_NEAR(exact, stage[axis], 1) << "axis " << axis;
+    }
+
+    // Displacements leave out the offset, and negatives round symmetrically
+    int along[3] = {0, 0, -1000};
+    transform.rotate(along, stage);
+    EXPECT_EQ(0, stage[0]);
+    EXPECT_EQ(-500, stage[1]);
+    EXPECT_EQ(-866, stage[2]);
+
+    // Resetting restores the identity
+    transform.reset();
+    EXPECT_TRUE(transform.isIdentity());
+}
+
+TEST(Transform, Steering){
+    // Initialize test parameters
+    int pins[] = {1, 2, 3};
+    int origin[3] = {6000, 6000, 6000};
+    SteeredM3LS *m3 = beginVirtualTime<SteeredM3LS>(pins);
+    ArduinoMock* arduinoMock = arduinoMockInstance();
+    m3->setControlMode(M3LS::position);
+    LoopbackTransport& stages = m3->getTransport();
+    M3LSScriptedInput& joystick = m3->getInput();
+    m3->setTransform(tilted, origin);
+
+    // Full joystick Y sweeps the tilted plane, moving stage Z as well as Y;
+    // joystick Z keeps the bounds at their widest
+    joystick.set(127, 255, 255);
+    arduinoMock->addMillisRaw(20);
+    m3->run();
+    EXPECT_NEAR(6000, stages.getTarget(pins[0]), 25);
+    EXPECT_NEAR(6000 + 5500 * cosf(tilt), stages.getTarget(pins[1]), 25);
+    EXPECT_NEAR(6000 - 5500 * sinf(tilt), stages.getTarget(pins[2]), 25);
+
+    // Holding Z up advances the needle along its axis, tick by tick
+    m3->bindButton(1, M3LS::ZUp);
+    joystick.set(127, 127, 255);
+    joystick.setButtons(1);
+    arduinoMock->addMillisRaw(20);
+    m3->run();
+    int first[3];
+    for (int axis = 0; axis < 3; axis++){
+        first[axis] = stages.getTarget(pins[axis]);
+    }
+    arduinoMock->addMillisRaw(20);
+    m3->run();
+    int stepY = stages.getTarget(pins[1]) - first[1];
+    int stepZ = stages.getTarget(pins[2]) - first[2];
+    EXPECT_EQ(first[0], stages.getTarget(pins[0]));
+    EXPECT_GT(stepY, 0);
+    EXPECT_GT(stepZ, 0);
+    EXPECT_NEAR(tanf(tilt), (float)stepY / stepZ, 0.05);
+
+    // Moves in the frame, and along the needle from the last targets
+    int frameTarget[3] = {0, 0, 2000};
+    m3->moveInFrame(frameTarget);
+    EXPECT_EQ(6000, stages.getTarget(pins[0]));
+    EXPECT_EQ(6000 + 1000, stages.getTarget(pins[1]));
+    EXPECT_EQ(6000 + 1732, stages.getTarget(pins[2]));
+    m3->moveAlongNeedle(-2000);
+    EXPECT_EQ(6000, stages.getTarget(pins[1]));
+    EXPECT_EQ(6000, stages.getTarget(pins[2]));
+
+    // Without a transform the joystick steers the stage axes again
+    m3->clearTransform();
+    joystick.setButtons(0);
+    joystick.set(127, 255, 255);
+    arduinoMock->addMillisRaw(20);
+    m3->run();
+    EXPECT_EQ(6000 + 5500, stages.getTarget(pins[1]));
+
+    // Cleanup mock
+    delete m3;
+    releaseArduinoMock();
+    releaseSPIMock();
+}
@@ -0,0 +1,290 @@
+#include "gtest/gtest.h"
+#include "M3LS.h"
+using ::testing::_;
+using ::testing::AnyNumber;
+using ::testing::InSequence;
+using ::testing::Return;
+
+TEST(Loopback, TargetRoundTrip){
+    // Initialize test parameters
+    LoopbackTransport loopback;
+    char recv[M3LS_REPLY_SIZE];
+    int pin = 1;
+
+    // Move the stage to 8000 counts
+    int length = loopback.transfer(pin, "<08 00001F40>\r", 14, recv,
+        M3LS_REPLY_SIZE);
+    EXPECT_EQ(5, length);
+    EXPECT_EQ(0, memcmp(recv, "<08>\r", 5));
+    EXPECT_EQ(8000, loopback.getTarget(pin));
+
+    // Read the position back
+    length = loopback.transfer(pin, "<10>\r", 5, recv, M3LS_REPLY_SIZE);
+    EXPECT_EQ(30, length);
+    EXPECT_EQ(0, memcmp(recv, "<10 000000 00001F40 00000000>\r", 30));
+    EXPECT_EQ(2u, loopback.getFrameCount(pin));
+    EXPECT_STREQ("<10>\r", loopback.getLastFrame(pin));
+}
+
+TEST(Loopback, Step){
+    // Initialize test parameters
+    LoopbackTransport loopback;
+    char recv[M3LS_REPLY_SIZE];
+    int pin = 2;
+    loopback.setPosition(pin, 100);
+
+    // Step forwards then backwards
+    loopback.transfer(pin, "<06 1 00000010>\r", 16, recv, M3LS_REPLY_SIZE);
+    EXPECT_EQ(116, loopback.getPosition(pin));
+    loopback.transfer(pin, "<06 0 00000020>\r", 16, recv, M3LS_REPLY_SIZE);
+    EXPECT_EQ(84, loopback.getPosition(pin));
+}
+
+TEST(Loopback, ScriptedReply){
+    // Initialize test parameters
+    LoopbackTransport loopback;
+    char recv[M3LS_REPLY_SIZE];
+    int pin = 3;
+
+    // A scripted reply replaces the model's answer once
+    loopback.queueReply(pin, "<10 garbage>\r");
+    EXPECT_EQ(13, loopback.transfer(pin, "<10>\r", 5, recv, M3LS_REPLY_SIZE));
+    EXPECT_EQ(0, memcmp(recv, "<10 garbage>\r", 13));
+    EXPECT_EQ(30, loopback.transfer(pin, "<10>\r", 5, recv, M3LS_REPLY_SIZE));
+
+    // Replies that do not fit the buffer are rejected
+    EXPECT_EQ(-1, loopback.transfer(pin, "<10>\r", 5, recv, 10));
+}
+
+TEST(Loopback, LibraryFrames){
+    // Initialize test parameters
+    int pins[] = {1, 2, 3};
+    int numAxes = 3;
+
+    // Initialize mock Arduino and SPI
+    ArduinoMock* arduinoMock = arduinoMockInstance();
+    SPIMock* spiMock = SPIMockInstance();
+
+    // Set up expected calls for begin
+    EXPECT_CALL(*arduinoMock, delay(50));
+    EXPECT_CALL(*arduinoMock, millis()).Times(AnyNumber());
+    EXPECT_CALL(*spiMock, begin());
+    for (int pin = 0; pin < numAxes; pin++){
+        EXPECT_CALL(*arduinoMock, pinMode(pins[pin], OUTPUT));
+        EXPECT_CALL(*arduinoMock, digitalWrite(pins[pin], HIGH));
+    }
+    M3LS m3 = M3LS(pins[0], pins[1], pins[2]);
+    m3.begin();
+
+    // Calibration and the switch to closed loop reach every stage: two
+    // sweeps, each polled once and read back, then the two mode changes and
+    // a position read
+    LoopbackTransport& loopback = m3.getTransport();
+    for (int pin = 0; pin < numAxes; pin++){
+        EXPECT_EQ(9u, loopback.getFrameCount(pins[pin]));
+        EXPECT_STREQ("<10>\r", loopback.getLastFrame(pins[pin]));
+        EXPECT_TRUE(loopback.isClosedLoop(pins[pin]));
+    }
+
+    // Full deflection maps onto the edges of the default bounds
+    m3.updatePosition(255, 0, 127, M3LS::XY);
+    EXPECT_EQ(6000 + 5500, loopback.getTarget(pins[0]));
+    EXPECT_EQ(6000 - 5500, loopback.getTarget(pins[1]));
+
+    // Cleanup mock
+    releaseArduinoMock();
+    releaseSPIMock();
+}
+
+TEST(Loopback, FixedAxisCount){
+    // Initialize test parameters
+    int pins[] = {1, 2};
+    int numAxes = 2;
+
+    // Initialize mock Arduino and SPI
+    ArduinoMock* arduinoMock = arduinoMockInstance();
+    SPIMock* spiMock = SPIMockInstance();
+
+    // Set up expected calls for begin
+    EXPECT_CALL(*arduinoMock, delay(50));
+    EXPECT_CALL(*arduinoMock, millis()).Times(AnyNumber());
+    EXPECT_CALL(*spiMock, begin());
+    for (int pin = 0; pin < numAxes; pin++){
+        EXPECT_CALL(*arduinoMock, pinMode(pins[pin], OUTPUT));
+        EXPECT_CALL(*arduinoMock, digitalWrite(pins[pin], HIGH));
+    }
+    BasicM3LS<2> m3(pins[0], pins[1]);
+    m3.begin();
+    EXPECT_EQ(numAxes, m3.getNumAxes());
+    EXPECT_LT(sizeof(BasicM3LS<2>), sizeof(M3LS));
+
+    // Axis selections are checked against the axis count at compile time
+    LoopbackTransport& loopback = m3.getTransport();
+    m3.updatePosition<M3LS::XY>(255, 0, 127);
+    EXPECT_EQ(6000 + 5500, loopback.getTarget(pins[0]));
+    EXPECT_EQ(6000 - 5500, loopback.getTarget(pins[1]));
+
+    // Nothing is sent to a third stage the manipulator does not have
+    EXPECT_EQ(0u, loopback.getFrameCount(3));
+
+    // Cleanup mock
+    releaseArduinoMock();
+    releaseSPIMock();
+}
+
+TEST(Loopback, BatchMove){
+    // Initialize test parameters
+    int pins[] = {1, 2, 3};
+    int numAxes = 3;
+
+    // Initialize mock Arduino and SPI
+    ArduinoMock* arduinoMock = arduinoMockInstance();
+    SPIMock* spiMock = SPIMockInstance();
+
+    // Set up expected calls for begin
+    EXPECT_CALL(*arduinoMock, delay(50));
+    EXPECT_CALL(*arduinoMock, millis()).Times(AnyNumber());
+    EXPECT_CALL(*spiMock, begin());
+    for (int pin = 0; pin < numAxes; pin++){
+        EXPECT_CALL(*arduinoMock, pinMode(pins[pin], OUTPUT));
+        EXPECT_CALL(*arduinoMock, digitalWrite(pins[pin], HIGH));
+    }
+    M3LS m3 = M3LS(pins[0], pins[1], pins[2]);
+    m3.begin();
+    LoopbackTransport& loopback = m3.getTransport();
+
+    // Only the selected axes receive a frame
+    int targets[] = {7000, 5000, 6500};
+    m3.moveAxes(M3LS::axisMask(M3LS::XZ), targets);
+    EXPECT_STREQ("<08 00001B58>\r", loopback.getLastFrame(pins[0]));
+    EXPECT_STREQ("<10>\r", loopback.getLastFrame(pins[1]));
+    EXPECT_STREQ("<08 00001964>\r", loopback.getLastFrame(pins[2]));
+    EXPECT_EQ(6000, loopback.getTarget(pins[1]));
+
+    // Position mode moves X and Y without sending Z to zero
+    m3.setControlMode(M3LS::position);
+    m3.updatePosition(255, 0, 127);
+    EXPECT_EQ(6000 + 5500, loopback.getTarget(pins[0]));
+    EXPECT_EQ(6000 - 5500, loopback.getTarget(pins[1]));
+    EXPECT_EQ(6500, loopback.getTarget(pins[2]));
+
+    // A batch reports how many frames were answered
+    M3LSCommandFrame frames[2];
+    char recv[M3LS_REPLY_SIZE];
+    for (int i = 0; i < 2; i++){
+        frames[i].pin = pins[i];
+        frames[i].length = 5;
+        memcpy(frames[i].data, "<10>\r", 5);
+    }
+    EXPECT_EQ(2, loopback.transferBatch(frames, 2, recv, M3LS_REPLY_SIZE));
+    loopback.queueReply(pins[1], "<10 000000 00001770 00000000 overflow>\r");
+    EXPECT_EQ(1, loopback.transferBatch(frames, 2, recv, 32));
+
+    // Cleanup mock
+    releaseArduinoMock();
+    releaseSPIMock();
+}
+
+TEST(Loopback, TimingProbe){
+    // Initialize test parameters
+    int pins[] = {1, 2, 3};
+    int numAxes = 3;
+    char recv[M3LS_REPLY_SIZE];
+
+    // Initialize mock Arduino and SPI
+    ArduinoMock* arduinoMock = arduinoMockInstance();
+    SPIMock* spiMock = SPIMockInstance();
+
+    // Set up expected calls for begin
+    EXPECT_CALL(*arduinoMock, delay(_)).Times(AnyNumber());
+    EXPECT_CALL(*arduinoMock, millis()).Times(AnyNumber());
+    EXPECT_CALL(*spiMock, begin());
+    for (int pin = 0; pin < numAxes; pin++){
+        EXPECT_CALL(*arduinoMock, pinMode(pins[pin], OUTPUT));
+        EXPECT_CALL(*arduinoMock, digitalWrite(pins[pin], HIGH));
+    }
+    M3LS m3 = M3LS(pins[0], pins[1], pins[2]);
+    LoopbackTransport& loopback = m3.getTransport();
+    EXPECT_EQ(M3LS_TIMING_SLOWEST, loopback.getTimingLevel(pins[0]));
+
+    // Each stage settles one level slower than the fastest it answers at
+    loopback.setTimingLimit(pins[0], 2);
+    m3.setTimingProbe(true);
+    m3.begin();
+    EXPECT_EQ(2 + M3LS_TIMING_MARGIN, loopback.getTimingLevel(pins[0]));
+    EXPECT_EQ(M3LS_TIMING_MARGIN, loopback.getTimingLevel(pins[1]));
+
+    // Consecutive garbled replies step a stage back one level at a time
+    loopback.setTimingLimit(pins[1], 3);
+    for (int read = 0; read < 2 * M3LS_TIMING_FALLBACK_ERRORS; read++){
+        loopback.transfer(pins[1], "<10>\r", 5, recv, M3LS_REPLY_SIZE);
+    }
+    EXPECT_EQ(3, loopback.getTimingLevel(pins[1]));
+    loopback.transfer(pins[1], "<10>\r", 5, recv, M3LS_REPLY_SIZE);
+    EXPECT_EQ(0, memcmp(recv, "<10 ", 4));
+    EXPECT_EQ(3, loopback.getTimingLevel(pins[1]));
+
+    // A lone bad reply is not enough
+    loopback.queueReply(pins[2], "<>\r");
+    loopback.transfer(pins[2], "<10>\r", 5, recv, M3LS_REPLY_SIZE);
+    loopback.transfer(pins[2], "<10>\r", 5, recv, M3LS_REPLY_SIZE);
+    EXPECT_EQ(M3LS_TIMING_MARGIN, loopback.getTimingLevel(pins[2]));
+
+    // A stage that passes no level is left at the slowest one and reported,
+    // and the margin never runs past the end of the table
+    loopback.setTimingLimit(pins[1], M3LS_TIMING_SLOWEST);
+    loopback.setTimingLimit(pins[2], M3LS_TIMING_LEVELS);
+    EXPECT_FALSE(m3.negotiateTiming());
+    EXPECT_EQ(2 + M3LS_TIMING_MARGIN, loopback.getTimingLevel(pins[0]));
+    EXPECT_EQ(M3LS_TIMING_SLOWEST, loopback.getTimingLevel(pins[1]));
+    EXPECT_EQ(M3LS_TIMING_SLOWEST, loopback.getTimingLevel(pins[2]));
+    EXPECT_EQ(0ul, m3.getLinkErrors(1).failures);
+    EXPECT_EQ(1ul, m3.getLinkErrors(2).failures);
+    loopback.setTimingLimit(pins[2], 0);
+    EXPECT_TRUE(m3.negotiateTiming());
+
+    // Cleanup mock
+    releaseArduinoMock();
+    releaseSPIMock();
+}
+
+TEST(Blocking, Transfer){
+    // Initialize test parameters
+    BlockingSPITransport blocking;
+    char recv[M3LS_REPLY_SIZE];
+    const char *command = "<08>\r";
+    const char *reply = "<08>\r";
+    int pin = 4;
+
+    // Initialize mock Arduino and SPI
+    ArduinoMock* arduinoMock = arduinoMockInstance();
+    SPIMock* spiMock = SPIMockInstance();
+
+    // The frame goes out a byte at a time, then filler bytes are clocked
+    // until the stage answers
+    {
+        InSequence frame;
+        EXPECT_CALL(*spiMock,
+            beginTransaction(SPISettings(2000000, MSBFIRST, SPI_MODE1)));
+        EXPECT_CALL(*arduinoMock, digitalWrite(pin, LOW));
+        for (int i = 0; i < 5; i++){
+            EXPECT_CALL(*spiMock, transfer(command[i])).WillOnce(Return(0));
+        }
+        EXPECT_CALL(*spiMock, transfer(0x01))
+            .WillOnce(Return(0x01))
+            .WillOnce(Return(0x01))
+            .WillOnce(Return(reply[0]))
+            .WillOnce(Return(reply[1]))
+            .WillOnce(Return(reply[2]))
+            .WillOnce(Return(reply[3]))
+            .WillOnce(Return(reply[4]));
+        EXPECT_CALL(*arduinoMock, digitalWrite(pin, HIGH));
+        EXPECT_CALL(*spiMock, endTransaction());
+    }
+    EXPECT_EQ(5, blocking.transfer(pin, command, 5, recv, M3LS_REPLY_SIZE));
+    EXPECT_EQ(0, memcmp(recv, reply, 5));
+
+    // Cleanup mock
+    releaseArduinoMock();
+    releaseSPIMock();
+}
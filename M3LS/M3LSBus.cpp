@@ -0,0 +1 @@
+../C++/src/M3LSBus.cc
\ No newline at end of file
@@ -0,0 +1 @@
+../C++/include/M3LSBus.h
\ No newline at end of file
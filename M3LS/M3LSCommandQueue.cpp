@@ -0,0 +1 @@
+../C++/src/M3LSCommandQueue.cc
\ No newline at end of file
@@ -0,0 +1 @@
+../C++/include/M3LSCommandQueue.h
\ No newline at end of file
@@ -0,0 +1 @@
+../C++/src/M3LSEnvelope.cc
\ No newline at end of file
@@ -0,0 +1 @@
+../C++/include/M3LSEnvelope.h
\ No newline at end of file
@@ -0,0 +1 @@
+../C++/src/M3LSEstimator.cc
\ No newline at end of file
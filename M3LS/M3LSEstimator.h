@@ -0,0 +1 @@
+../C++/include/M3LSEstimator.h
\ No newline at end of file
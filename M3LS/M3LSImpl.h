@@ -0,0 +1 @@
+../C++/include/M3LSImpl.h
\ No newline at end of file
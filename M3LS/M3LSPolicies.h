@@ -0,0 +1 @@
+../C++/include/M3LSPolicies.h
\ No newline at end of file
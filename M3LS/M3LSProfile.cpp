@@ -0,0 +1 @@
+../C++/src/M3LSProfile.cc
\ No newline at end of file
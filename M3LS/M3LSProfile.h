@@ -0,0 +1 @@
+../C++/include/M3LSProfile.h
\ No newline at end of file
@@ -0,0 +1 @@
+../C++/src/M3LSProtocol.cc
\ No newline at end of file
@@ -0,0 +1 @@
+../C++/include/M3LSProtocol.h
\ No newline at end of file
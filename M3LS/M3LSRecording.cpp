@@ -0,0 +1 @@
+../C++/src/M3LSRecording.cc
\ No newline at end of file
@@ -0,0 +1 @@
+../C++/include/M3LSRecording.h
\ No newline at end of file
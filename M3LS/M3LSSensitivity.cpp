@@ -0,0 +1 @@
+../C++/src/M3LSSensitivity.cc
\ No newline at end of file
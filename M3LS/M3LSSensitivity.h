@@ -0,0 +1 @@
+../C++/include/M3LSSensitivity.h
\ No newline at end of file
@@ -0,0 +1 @@
+../C++/src/M3LSServer.cc
\ No newline at end of file
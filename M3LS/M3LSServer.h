@@ -0,0 +1 @@
+../C++/include/M3LSServer.h
\ No newline at end of file
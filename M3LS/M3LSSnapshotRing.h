@@ -0,0 +1 @@
+../C++/include/M3LSSnapshotRing.h
\ No newline at end of file
@@ -0,0 +1 @@
+../C++/src/M3LSStorage.cc
\ No newline at end of file
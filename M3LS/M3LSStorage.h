@@ -0,0 +1 @@
+../C++/include/M3LSStorage.h
\ No newline at end of file
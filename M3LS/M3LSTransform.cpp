@@ -0,0 +1 @@
+../C++/src/M3LSTransform.cc
\ No newline at end of file
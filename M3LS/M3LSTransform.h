@@ -0,0 +1 @@
+../C++/include/M3LSTransform.h
\ No newline at end of file
@@ -0,0 +1 @@
+../C++/src/M3LSTransport.cc
\ No newline at end of file
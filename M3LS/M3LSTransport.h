@@ -0,0 +1 @@
+../C++/include/M3LSTransport.h
\ No newline at end of file
@@ -0,0 +1 @@
+../C++/include/M3LSTravel.h
\ No newline at end of file
@@ -5,8 +5,36 @@ if [ ! -z "$1" ] ; then
     rm -r ./Release/*
     mkdir -p ./Release/M3LS_${1}
     cp ./C++/src/M3LS.cc ./Release/M3LS_${1}/M3LS.cpp
+    cp ./C++/src/M3LSTransport.cc ./Release/M3LS_${1}/M3LSTransport.cpp
+    cp ./C++/src/M3LSStorage.cc ./Release/M3LS_${1}/M3LSStorage.cpp
+    cp ./C++/src/M3LSEstimator.cc ./Release/M3LS_${1}/M3LSEstimator.cpp
+    cp ./C++/src/M3LSTransform.cc ./Release/M3LS_${1}/M3LSTransform.cpp
+    cp ./C++/src/M3LSSensitivity.cc ./Release/M3LS_${1}/M3LSSensitivity.cpp
+    cp ./C++/src/M3LSEnvelope.cc ./Release/M3LS_${1}/M3LSEnvelope.cpp
+    cp ./C++/src/M3LSCommandQueue.cc ./Release/M3LS_${1}/M3LSCommandQueue.cpp
+    cp ./C++/src/M3LSProfile.cc ./Release/M3LS_${1}/M3LSProfile.cpp
+    cp ./C++/src/M3LSRecording.cc ./Release/M3LS_${1}/M3LSRecording.cpp
+    cp ./C++/src/M3LSBus.cc ./Release/M3LS_${1}/M3LSBus.cpp
+    cp ./C++/src/M3LSProtocol.cc ./Release/M3LS_${1}/M3LSProtocol.cpp
+    cp ./C++/src/M3LSServer.cc ./Release/M3LS_${1}/M3LSServer.cpp
     cp ./C++/src/hidjoystickrptparser.cpp ./Release/M3LS_${1}/hidjoystickrptparser.cpp
     cp ./C++/include/M3LS.h ./Release/M3LS_${1}/M3LS.h
+    cp ./C++/include/M3LSImpl.h ./Release/M3LS_${1}/M3LSImpl.h
+    cp ./C++/include/M3LSPolicies.h ./Release/M3LS_${1}/M3LSPolicies.h
+    cp ./C++/include/M3LSTransport.h ./Release/M3LS_${1}/M3LSTransport.h
+    cp ./C++/include/M3LSStorage.h ./Release/M3LS_${1}/M3LSStorage.h
+    cp ./C++/include/M3LSEstimator.h ./Release/M3LS_${1}/M3LSEstimator.h
+    cp ./C++/include/M3LSTransform.h ./Release/M3LS_${1}/M3LSTransform.h
+    cp ./C++/include/M3LSSensitivity.h ./Release/M3LS_${1}/M3LSSensitivity.h
+    cp ./C++/include/M3LSEnvelope.h ./Release/M3LS_${1}/M3LSEnvelope.h
+    cp ./C++/include/M3LSTravel.h ./Release/M3LS_${1}/M3LSTravel.h
+    cp ./C++/include/M3LSCommandQueue.h ./Release/M3LS_${1}/M3LSCommandQueue.h
+    cp ./C++/include/M3LSProfile.h ./Release/M3LS_${1}/M3LSProfile.h
+    cp ./C++/include/M3LSRecording.h ./Release/M3LS_${1}/M3LSRecording.h
+    cp ./C++/include/M3LSBus.h ./Release/M3LS_${1}/M3LSBus.h
+    cp ./C++/include/M3LSSnapshotRing.h ./Release/M3LS_${1}/M3LSSnapshotRing.h
+    cp ./C++/include/M3LSProtocol.h ./Release/M3LS_${1}/M3LSProtocol.h
+    cp ./C++/include/M3LSServer.h ./Release/M3LS_${1}/M3LSServer.h
     cp ./C++/include/hidjoystickrptparser.h ./Release/M3LS_${1}/hidjoystickrptparser.h
     cp -r ./Arduino/examples ./Release/M3LS_${1}/
     cd Release